@@ -0,0 +1,117 @@
+// Logs screen page loads at depth: LIMIT/OFFSET against the (timestamp, id)
+// cursor of DatabaseHelper, for all readings, one status and alerts only.
+//
+//   flutter test benchmark/db_page_benchmark.dart
+//
+// Fills the app's database under the ffi databases directory with
+// [rowCount] readings (this takes a while) and empties it after.
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:sqflite_common_ffi/sqflite_ffi.dart';
+import 'package:client/database/database_helper.dart';
+import 'package:client/models/sensor_reading.dart';
+
+const int rowCount = 1000000;
+const int pageSize = 50;
+const List<int> depths = [0, 100, 1000, 10000]; // Pages skipped
+
+SensorReading _reading(int i) {
+  final start = DateTime(2025, 1, 1);
+  return SensorReading(
+    timestamp: start.add(Duration(milliseconds: 500 * i)),
+    distance: 40 + i % 60,
+    waterQuality: 300 + i % 50,
+    status: i % 7 == 0 ? 'OVERFLOW' : 'HALF_FULL',
+    alert: i % 11 == 0,
+    arduinoUptime: 100 + 500 * i,
+    deviceName: 'HC-05',
+    deviceAddress: '98:D3:31:F5:12:34',
+    percentage: (i % 101).toDouble(),
+    tankHeight: 120.0,
+  );
+}
+
+Future<double> _timeMs(Future<void> Function() body) async {
+  const rounds = 5;
+  final sw = Stopwatch()..start();
+  for (var i = 0; i < rounds; i++) {
+    await body();
+  }
+  return sw.elapsedMicroseconds / 1000 / rounds;
+}
+
+void main() {
+  sqfliteFfiInit();
+  databaseFactory = databaseFactoryFfi;
+  final helper = DatabaseHelper.instance;
+
+  test('page load by depth', () async {
+    await helper.deleteAllReadings();
+    for (var i = 0; i < rowCount; i++) {
+      helper.queueReading(_reading(i));
+    }
+    await helper.flushPendingReadings();
+    final db = await helper.database;
+
+    final filters = <String, (String?, List<Object?>)>{
+      'all': (null, const []),
+      'status': ('r.status = ?', ['OVERFLOW']),
+      'alerts': ('r.alert = ?', [1]),
+    };
+
+    // ignore: avoid_print
+    print('${'filter'.padRight(8)} ${'page'.padLeft(6)} '
+        '${'offset ms'.padLeft(10)} ${'cursor ms'.padLeft(10)}');
+    for (final entry in filters.entries) {
+      final (where, args) = entry.value;
+      final whereClause = where == null ? '' : 'WHERE $where';
+      for (final depth in depths) {
+        // The cursor of the page before, as the screen would hold it
+        ReadingCursor? after;
+        if (depth > 0) {
+          final before = await db.rawQuery(
+            'SELECT r.id, r.timestamp FROM sensor_readings r $whereClause '
+            'ORDER BY r.timestamp DESC, r.id DESC LIMIT 1 OFFSET ?',
+            [...args, depth * pageSize - 1],
+          );
+          if (before.isEmpty) continue;
+          after = ReadingCursor(
+            before.first['timestamp'] as int,
+            before.first['id'] as int,
+          );
+        }
+
+        final offsetMs = await _timeMs(() async {
+          await db.rawQuery(
+            'SELECT r.*, d.name AS deviceName, d.address AS deviceAddress '
+            'FROM sensor_readings r JOIN devices d ON d.id = r.deviceId '
+            '$whereClause ORDER BY r.timestamp DESC, r.id DESC '
+            'LIMIT ? OFFSET ?',
+            [...args, pageSize, depth * pageSize],
+          );
+        });
+        final cursorMs = await _timeMs(() async {
+          switch (entry.key) {
+            case 'all':
+              await helper.getReadingsPaginated(limit: pageSize, after: after);
+            case 'status':
+              await helper.getReadingsByStatus(
+                'OVERFLOW',
+                limit: pageSize,
+                after: after,
+              );
+            default:
+              await helper.getAlertReadings(limit: pageSize, after: after);
+          }
+        });
+        // ignore: avoid_print
+        print('${entry.key.padRight(8)} ${depth.toString().padLeft(6)} '
+            '${offsetMs.toStringAsFixed(2).padLeft(10)} '
+            '${cursorMs.toStringAsFixed(2).padLeft(10)}');
+      }
+    }
+
+    await helper.deleteAllReadings();
+    await helper.close();
+  }, timeout: const Timeout(Duration(minutes: 30)));
+}
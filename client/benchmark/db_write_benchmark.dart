@@ -0,0 +1,80 @@
+// Insert throughput of DatabaseHelper: one awaited insertReading() per
+// reading (the old per-packet path) against queueReading() with batched
+// transactional flushes.
+//
+// Runs on the host against SQLite through sqflite_common_ffi:
+//
+//   flutter test benchmark/db_write_benchmark.dart
+//
+// Uses the app's database file under the ffi databases directory, emptied
+// before and after each run.
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:sqflite_common_ffi/sqflite_ffi.dart';
+import 'package:client/database/database_helper.dart';
+import 'package:client/models/sensor_reading.dart';
+
+const int readingCount = 5000;
+
+SensorReading _reading(int i) {
+  final start = DateTime(2025, 1, 1);
+  return SensorReading(
+    timestamp: start.add(Duration(milliseconds: 500 * i)),
+    distance: 40 + i % 60,
+    waterQuality: 300 + i % 50,
+    status: i % 97 == 0 ? 'OVERFLOW' : 'HALF_FULL',
+    alert: i % 97 == 0,
+    arduinoUptime: 100 + 500 * i,
+    deviceName: 'HC-05',
+    deviceAddress: '98:D3:31:F5:12:34',
+    percentage: (i % 101).toDouble(),
+    tankHeight: 120.0,
+  );
+}
+
+void _report(String name, int count, Stopwatch sw) {
+  final perSecond = count * 1000000 / sw.elapsedMicroseconds;
+  // ignore: avoid_print
+  print(
+    '${name.padRight(28)} ${count.toString().padLeft(6)} readings '
+    '${(sw.elapsedMicroseconds / 1000).toStringAsFixed(0).padLeft(7)} ms '
+    '${perSecond.toStringAsFixed(0).padLeft(8)} inserts/s',
+  );
+}
+
+void main() {
+  sqfliteFfiInit();
+  databaseFactory = databaseFactoryFfi;
+  final db = DatabaseHelper.instance;
+
+  test('insert throughput', () async {
+    await db.deleteAllReadings();
+
+    // Before: one autocommit transaction per reading
+    var sw = Stopwatch()..start();
+    for (var i = 0; i < readingCount; i++) {
+      await db.insertReading(_reading(i));
+    }
+    sw.stop();
+    _report('insertReading (awaited)', readingCount, sw);
+    expect(await db.getTotalCount(), readingCount);
+    await db.deleteAllReadings();
+
+    // After: queued, flushed every writeBatchSize readings
+    sw = Stopwatch()..start();
+    for (var i = 0; i < readingCount; i++) {
+      db.queueReading(_reading(i));
+    }
+    await db.flushPendingReadings();
+    sw.stop();
+    _report(
+      'queueReading (batch ${DatabaseHelper.writeBatchSize})',
+      readingCount,
+      sw,
+    );
+    expect(await db.getTotalCount(), readingCount);
+
+    await db.deleteAllReadings();
+    await db.close();
+  });
+}
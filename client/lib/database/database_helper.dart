@@ -1,7 +1,23 @@
+import 'dart:async';
 import 'package:sqflite/sqflite.dart';
 import 'package:path/path.dart';
 import '../models/sensor_reading.dart';
 
+/// Position in a newest-first listing: the (timestamp, id) of the last row
+/// of the previous page. The next page starts strictly after it, so page
+/// loads cost the same however deep they are.
+class ReadingCursor {
+  final int timestamp; // Epoch ms
+  final int id;
+
+  const ReadingCursor(this.timestamp, this.id);
+
+  /// Cursor just past [reading], which must have come from the database
+  factory ReadingCursor.after(SensorReading reading) {
+    return ReadingCursor(reading.timestamp.millisecondsSinceEpoch, reading.id!);
+  }
+}
+
 /// Database helper class for managing SQLite operations
 class DatabaseHelper {
   // Singleton pattern
@@ -10,13 +26,77 @@ class DatabaseHelper {
 
   DatabaseHelper._init();
 
+  // Write-behind queue: readings arrive every 500 ms per tank, so they are
+  // collected here and written in one transaction when [writeBatchSize]
+  // have piled up or [writeBatchDelay] has passed since the first one.
+  static const int writeBatchSize = 64;
+  static const Duration writeBatchDelay = Duration(seconds: 5);
+
+  // While writes keep failing, queued readings are kept up to this many
+  // (about 3 hours of one tank); beyond it the oldest are dropped
+  static const int maxPendingReadings = 20000;
+
+  // Every queued row uses the same statement text, so the platform side
+  // compiles it once per batch and rebinds it for each row.
+  static const String _insertSql = '''
+    INSERT INTO sensor_readings (
+      timestamp, distance, waterQuality, status, alert, arduinoUptime,
+      deviceId, percentage, tankHeight, waterLevel
+    ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+  ''';
+
+  // Readings with their device's name and address, as SensorReading.fromMap
+  // expects them
+  static const String _selectSql = '''
+    SELECT r.*, d.name AS deviceName, d.address AS deviceAddress
+    FROM sensor_readings r JOIN devices d ON d.id = r.deviceId
+  ''';
+
+  // Version 4 copies rows from the old table in chunks of this many, newest
+  // first, pausing between chunks so queries and writes get their turn
+  static const int _migrateChunk = 2000;
+  static const Duration _migratePause = Duration(milliseconds: 20);
+
+  final List<SensorReading> _pending = [];
+  Timer? _flushTimer;
+
+  // devices.id by address
+  final Map<String, int> _deviceIds = {};
+  Future<void>? _migration;
+  bool _migrating = false;
+
+  /// Whether this isolate copies pre-version 4 rows. The sensor worker
+  /// isolate turns it off and leaves the migration to the UI isolate,
+  /// which opens the database first.
+  bool migrateLegacy = true;
+
+  /// Writes readings queued in another isolate (the sensor worker) before
+  /// queries here run, so they see everything received so far
+  Future<int> Function()? flushHook;
+
+  // reading_stats exists and its triggers are installed
+  bool _statsReady = false;
+  Future<int> _lastFlush = Future.value(0);
+
   /// Get the database instance
   Future<Database> get database async {
     if (_database != null) return _database!;
     _database = await _initDB('water_tank_logs.db');
+    if (_migrating) _migration ??= _migrateLegacyReadings(_database!);
     return _database!;
   }
 
+  /// True while readings from before version 4 are being copied
+  bool get isMigrating => _migrating;
+
+  /// Completes once readings from before version 4 have all been copied
+  /// into the current table. Until then queries only return the rows
+  /// copied so far, which are the newest.
+  Future<void> get migrationDone async {
+    await database;
+    await _migration;
+  }
+
   /// Initialize the database
   Future<Database> _initDB(String filePath) async {
     final dbPath = await getDatabasesPath();
@@ -24,42 +104,78 @@ class DatabaseHelper {
 
     return await openDatabase(
       path,
-      version: 2,
+      version: 4,
       onCreate: _createDB,
       onUpgrade: _upgradeDB,
+      onOpen: _openDB,
+    );
+  }
+
+  /// Note a pending version 4 migration before any caller gets the
+  /// database, so deletes issued right away also reach the old table
+  Future<void> _openDB(Database db) async {
+    if (!migrateLegacy) return;
+    final legacy = await db.rawQuery(
+      "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'sensor_readings_legacy'",
     );
+    _migrating = legacy.isNotEmpty;
   }
 
   /// Create database tables
   Future<void> _createDB(Database db, int version) async {
+    await _createTables(db);
+    print('Database created successfully with sensor_readings table');
+  }
+
+  /// Version 4 tables. Timestamps are epoch ms (UTC) and devices are stored
+  /// once and referenced by id, which keeps rows and indexes small and
+  /// makes time ranges integer comparisons.
+  Future<void> _createTables(DatabaseExecutor db) async {
     const idType = 'INTEGER PRIMARY KEY AUTOINCREMENT';
     const textType = 'TEXT NOT NULL';
     const intType = 'INTEGER NOT NULL';
     const realType = 'REAL';
 
+    await db.execute('''
+      CREATE TABLE devices (
+        id INTEGER PRIMARY KEY,
+        address $textType UNIQUE,
+        name $textType
+      )
+    ''');
+
     await db.execute('''
       CREATE TABLE sensor_readings (
         id $idType,
-        timestamp $textType,
+        timestamp $intType,
         distance $intType,
         waterQuality $intType,
         status $textType,
         alert $intType,
         arduinoUptime $intType,
-        deviceName $textType,
-        deviceAddress $textType,
+        deviceId $intType REFERENCES devices(id),
         percentage $realType,
         tankHeight $realType,
         waterLevel $realType
       )
     ''');
 
-    // Create index on timestamp for faster queries
-    await db.execute('''
-      CREATE INDEX idx_timestamp ON sensor_readings(timestamp DESC)
-    ''');
+    await _createIndexes(db);
+  }
 
-    print('Database created successfully with sensor_readings table');
+  /// Indexes for the newest-first listings. SQLite appends the rowid (id)
+  /// to every index, so each one also orders ties on timestamp by id and a
+  /// page is a single backwards range scan.
+  Future<void> _createIndexes(DatabaseExecutor db) async {
+    await db.execute(
+      'CREATE INDEX IF NOT EXISTS idx_timestamp ON sensor_readings(timestamp)',
+    );
+    await db.execute(
+      'CREATE INDEX IF NOT EXISTS idx_status_timestamp ON sensor_readings(status, timestamp)',
+    );
+    await db.execute(
+      'CREATE INDEX IF NOT EXISTS idx_alert_timestamp ON sensor_readings(alert, timestamp)',
+    );
   }
 
   /// Upgrade database schema between versions
@@ -84,36 +200,357 @@ class DatabaseHelper {
         );
       } catch (e) {}
     }
+
+    // Version 3 rebuilt the timestamp index and added the filter indexes;
+    // version 4 replaces the table, indexes included.
+
+    // Version 4: epoch-ms timestamps and a devices table. Only the schema
+    // changes here, so opening stays quick however many rows there are;
+    // the old rows are copied afterwards by _migrateLegacyReadings.
+    if (oldVersion < 4) {
+      await db.execute('DROP INDEX IF EXISTS idx_timestamp');
+      await db.execute('DROP INDEX IF EXISTS idx_status_timestamp');
+      await db.execute('DROP INDEX IF EXISTS idx_alert_timestamp');
+      await _dropStats(db);
+      await db.execute(
+        'ALTER TABLE sensor_readings RENAME TO sensor_readings_legacy',
+      );
+      await _createTables(db);
+
+      // New rows are numbered after the old ones, which keep their ids
+      await db.execute(
+        "DELETE FROM sqlite_sequence WHERE name = 'sensor_readings'",
+      );
+      await db.execute('''
+        INSERT INTO sqlite_sequence (name, seq)
+        SELECT 'sensor_readings', IFNULL(MAX(id), 0) FROM sensor_readings_legacy
+      ''');
+    }
+
+    // Migrations may rewrite rows; the summary is rebuilt on first use
+    await _dropStats(db);
+  }
+
+  /// Copy version 3 rows into the current table, newest first, one chunk
+  /// per transaction. Copied rows are deleted from the old table in the
+  /// same transaction, so an interrupted migration resumes where it stopped
+  /// the next time the database is opened. Runs once _openDB has found the
+  /// old table.
+  Future<void> _migrateLegacyReadings(Database db) async {
+    int copied = 0;
+    while (true) {
+      try {
+        final n = await db.transaction((txn) async {
+          final rows = await txn.rawQuery(
+            'SELECT * FROM sensor_readings_legacy ORDER BY id DESC LIMIT ?',
+            [_migrateChunk],
+          );
+          if (rows.isEmpty) {
+            await txn.execute('DROP TABLE sensor_readings_legacy');
+            _migrating = false;
+            return 0;
+          }
+
+          final batch = txn.batch();
+          for (final row in rows) {
+            final deviceId = await _deviceId(
+              txn,
+              row['deviceAddress'] as String,
+              row['deviceName'] as String,
+            );
+            batch.rawInsert('''
+              INSERT INTO sensor_readings (
+                id, timestamp, distance, waterQuality, status, alert,
+                arduinoUptime, deviceId, percentage, tankHeight, waterLevel
+              ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+            ''', [
+              row['id'],
+              DateTime.parse(row['timestamp'] as String).millisecondsSinceEpoch,
+              row['distance'],
+              row['waterQuality'],
+              row['status'],
+              row['alert'],
+              row['arduinoUptime'],
+              deviceId,
+              row['percentage'],
+              row['tankHeight'],
+              row['waterLevel'],
+            ]);
+          }
+          await batch.commit(noResult: true);
+          await txn.rawDelete(
+            'DELETE FROM sensor_readings_legacy WHERE id >= ?',
+            [rows.last['id']],
+          );
+          return rows.length;
+        });
+        if (n == 0) break;
+        copied += n;
+      } catch (e) {
+        _deviceIds.clear(); // May hold ids from the rolled back chunk
+        print('Reading migration stopped after $copied rows: $e');
+        return;
+      }
+      await Future.delayed(_migratePause);
+    }
+    print('Migrated $copied readings to schema version 4');
+  }
+
+  /// devices.id for [address], adding the device or updating its name
+  Future<int> _deviceId(
+    DatabaseExecutor txn,
+    String address,
+    String name,
+  ) async {
+    final cached = _deviceIds[address];
+    if (cached != null) return cached;
+
+    await txn.rawInsert(
+      'INSERT OR IGNORE INTO devices (address, name) VALUES (?, ?)',
+      [address, name],
+    );
+    if (name.isNotEmpty) {
+      await txn.rawUpdate(
+        'UPDATE devices SET name = ? WHERE address = ? AND name <> ?',
+        [name, address, name],
+      );
+    }
+    final result = await txn.rawQuery(
+      'SELECT id FROM devices WHERE address = ?',
+      [address],
+    );
+    final id = result.first['id'] as int;
+    _deviceIds[address] = id;
+    return id;
+  }
+
+  /// Arguments for [_insertSql]
+  static List<Object?> _insertArgs(SensorReading r, int deviceId) {
+    return [
+      r.timestamp.millisecondsSinceEpoch,
+      r.distance,
+      r.waterQuality,
+      r.status,
+      r.alert ? 1 : 0,
+      r.arduinoUptime,
+      deviceId,
+      r.percentage,
+      r.tankHeight,
+      r.waterLevel,
+    ];
+  }
+
+  // ==========================================================================
+  //                        STATISTICS SUMMARY
+  // ==========================================================================
+  //
+  // reading_stats holds one row per status with running counts and sums,
+  // kept current by triggers on sensor_readings, so statistics read at
+  // most four rows however large the table grows. It is built from a full
+  // scan the first time it is needed and dropped by schema migrations and
+  // deleteAllReadings() (which would otherwise fire the delete trigger for
+  // every row).
+
+  Future<void> _dropStats(DatabaseExecutor db) async {
+    await db.execute('DROP TRIGGER IF EXISTS reading_stats_insert');
+    await db.execute('DROP TRIGGER IF EXISTS reading_stats_delete');
+    await db.execute('DROP TRIGGER IF EXISTS reading_stats_update');
+    await db.execute('DROP TABLE IF EXISTS reading_stats');
+    _statsReady = false;
+  }
+
+  /// Create and fill reading_stats if it is missing
+  Future<void> _ensureStats(Database db) async {
+    if (_statsReady) return;
+    await db.transaction((txn) async {
+      final exists = await txn.rawQuery(
+        "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'reading_stats'",
+      );
+      if (exists.isNotEmpty) return;
+
+      await txn.execute('''
+        CREATE TABLE reading_stats (
+          status TEXT PRIMARY KEY,
+          count INTEGER NOT NULL DEFAULT 0,
+          alerts INTEGER NOT NULL DEFAULT 0,
+          sumDistance INTEGER NOT NULL DEFAULT 0,
+          sumWaterQuality INTEGER NOT NULL DEFAULT 0,
+          sumPercentage REAL NOT NULL DEFAULT 0,
+          countPercentage INTEGER NOT NULL DEFAULT 0
+        ) WITHOUT ROWID
+      ''');
+      await txn.execute('''
+        INSERT INTO reading_stats
+        SELECT status, COUNT(*), SUM(alert), SUM(distance), SUM(waterQuality),
+               TOTAL(percentage), COUNT(percentage)
+        FROM sensor_readings
+        GROUP BY status
+      ''');
+
+      // INSERT OR IGNORE + UPDATE rather than an upsert, which older
+      // Android SQLite versions don't have
+      const add = '''
+        INSERT OR IGNORE INTO reading_stats (status) VALUES (NEW.status);
+        UPDATE reading_stats SET
+          count = count + 1,
+          alerts = alerts + NEW.alert,
+          sumDistance = sumDistance + NEW.distance,
+          sumWaterQuality = sumWaterQuality + NEW.waterQuality,
+          sumPercentage = sumPercentage + IFNULL(NEW.percentage, 0),
+          countPercentage = countPercentage + (NEW.percentage IS NOT NULL)
+        WHERE status = NEW.status;
+      ''';
+      const remove = '''
+        UPDATE reading_stats SET
+          count = count - 1,
+          alerts = alerts - OLD.alert,
+          sumDistance = sumDistance - OLD.distance,
+          sumWaterQuality = sumWaterQuality - OLD.waterQuality,
+          sumPercentage = sumPercentage - IFNULL(OLD.percentage, 0),
+          countPercentage = countPercentage - (OLD.percentage IS NOT NULL)
+        WHERE status = OLD.status;
+      ''';
+      await txn.execute(
+        'CREATE TRIGGER reading_stats_insert AFTER INSERT ON sensor_readings BEGIN $add END',
+      );
+      await txn.execute(
+        'CREATE TRIGGER reading_stats_delete AFTER DELETE ON sensor_readings BEGIN $remove END',
+      );
+      await txn.execute(
+        'CREATE TRIGGER reading_stats_update AFTER UPDATE ON sensor_readings BEGIN $remove $add END',
+      );
+    });
+    _statsReady = true;
+  }
+
+  /// Per-status rows of reading_stats, built first if needed
+  Future<List<Map<String, Object?>>> _statsRows() async {
+    final db = await _flushedDatabase;
+    await _ensureStats(db);
+    return db.rawQuery('SELECT * FROM reading_stats WHERE count > 0');
   }
 
   /// Insert a sensor reading into the database
   Future<int> insertReading(SensorReading reading) async {
     final db = await instance.database;
-    final id = await db.insert('sensor_readings', reading.toMap());
+    final id = await db.transaction((txn) async {
+      final deviceId = await _deviceId(
+        txn,
+        reading.deviceAddress,
+        reading.deviceName,
+      );
+      return txn.rawInsert(_insertSql, _insertArgs(reading, deviceId));
+    });
     print('Inserted reading with ID: $id');
     return id;
   }
 
+  /// Queue a reading for the next batched write. Returns immediately; the
+  /// reading reaches the database within [writeBatchDelay], or sooner once
+  /// [writeBatchSize] readings are queued.
+  void queueReading(SensorReading reading) {
+    _pending.add(reading);
+    if (_pending.length >= writeBatchSize) {
+      flushPendingReadings();
+    } else {
+      _flushTimer ??= Timer(writeBatchDelay, flushPendingReadings);
+    }
+  }
+
+  /// Number of readings queued but not yet written
+  int get pendingCount => _pending.length;
+
+  /// Write all queued readings in a single transaction. Flushes run one
+  /// after another, so rows keep their arrival order. Returns the number
+  /// of readings written.
+  Future<int> flushPendingReadings() {
+    _flushTimer?.cancel();
+    _flushTimer = null;
+    if (_pending.isEmpty) return _lastFlush.then((_) => 0);
+
+    final rows = List<SensorReading>.of(_pending);
+    _pending.clear();
+    _lastFlush = _lastFlush.then((_) => _writeBatch(rows));
+    return _lastFlush;
+  }
+
+  Future<int> _writeBatch(List<SensorReading> rows) async {
+    try {
+      final db = await instance.database;
+      await db.transaction((txn) async {
+        final batch = txn.batch();
+        for (final r in rows) {
+          final deviceId = await _deviceId(txn, r.deviceAddress, r.deviceName);
+          batch.rawInsert(_insertSql, _insertArgs(r, deviceId));
+        }
+        await batch.commit(noResult: true);
+      });
+    } catch (e) {
+      // Put the rows back in front so the next flush retries them in order
+      print('Batch insert of ${rows.length} readings failed: $e');
+      _deviceIds.clear();
+      _pending.insertAll(0, rows);
+      final excess = _pending.length - maxPendingReadings;
+      if (excess > 0) {
+        _pending.removeRange(0, excess);
+        print('Dropped $excess queued readings, writes keep failing');
+      }
+      _flushTimer ??= Timer(writeBatchDelay, flushPendingReadings);
+      return 0;
+    }
+    return rows.length;
+  }
+
+  /// The database, after queued readings have been written, so queries
+  /// see everything received so far
+  Future<Database> get _flushedDatabase async {
+    await flushPendingReadings();
+    await flushHook?.call();
+    return instance.database;
+  }
+
   /// Get all sensor readings (newest first)
   Future<List<SensorReading>> getAllReadings() async {
-    final db = await instance.database;
-    const orderBy = 'timestamp DESC';
-    final result = await db.query('sensor_readings', orderBy: orderBy);
+    final db = await _flushedDatabase;
+    final result = await db.rawQuery(
+      '$_selectSql ORDER BY r.timestamp DESC, r.id DESC',
+    );
 
     return result.map((map) => SensorReading.fromMap(map)).toList();
   }
 
-  /// Get readings with pagination
+  /// Get a page of readings, newest first, starting after [after] (null =
+  /// the newest)
   Future<List<SensorReading>> getReadingsPaginated({
     required int limit,
-    required int offset,
-  }) async {
-    final db = await instance.database;
-    final result = await db.query(
-      'sensor_readings',
-      orderBy: 'timestamp DESC',
-      limit: limit,
-      offset: offset,
+    ReadingCursor? after,
+  }) {
+    return _queryPage(null, const [], limit, after);
+  }
+
+  /// Newest-first rows matching [where], limited to those after [after].
+  /// `timestamp <= ?` bounds the index range scan; the second term skips
+  /// the rows of the cursor's timestamp that were already shown. Devices
+  /// are joined by primary key, one lookup per row returned.
+  Future<List<SensorReading>> _queryPage(
+    String? where,
+    List<Object?> whereArgs,
+    int? limit,
+    ReadingCursor? after,
+  ) async {
+    final db = await _flushedDatabase;
+    final conditions = <String>[if (where != null) where];
+    final args = <Object?>[...whereArgs];
+    if (after != null) {
+      conditions.add('r.timestamp <= ? AND (r.timestamp < ? OR r.id < ?)');
+      args.addAll([after.timestamp, after.timestamp, after.id]);
+    }
+    final whereClause =
+        conditions.isEmpty ? '' : 'WHERE ${conditions.join(' AND ')}';
+    final limitClause = limit == null ? '' : 'LIMIT $limit';
+    final result = await db.rawQuery(
+      '$_selectSql $whereClause ORDER BY r.timestamp DESC, r.id DESC $limitClause',
+      args,
     );
 
     return result.map((map) => SensorReading.fromMap(map)).toList();
@@ -124,61 +561,47 @@ class DatabaseHelper {
     required DateTime startDate,
     required DateTime endDate,
   }) async {
-    final db = await instance.database;
-    final result = await db.query(
-      'sensor_readings',
-      where: 'timestamp BETWEEN ? AND ?',
-      whereArgs: [startDate.toIso8601String(), endDate.toIso8601String()],
-      orderBy: 'timestamp DESC',
+    final db = await _flushedDatabase;
+    final result = await db.rawQuery(
+      '$_selectSql WHERE r.timestamp BETWEEN ? AND ? '
+      'ORDER BY r.timestamp DESC, r.id DESC',
+      [startDate.millisecondsSinceEpoch, endDate.millisecondsSinceEpoch],
     );
 
     return result.map((map) => SensorReading.fromMap(map)).toList();
   }
 
-  /// Get readings by status
-  Future<List<SensorReading>> getReadingsByStatus(String status) async {
-    final db = await instance.database;
-    final result = await db.query(
-      'sensor_readings',
-      where: 'status = ?',
-      whereArgs: [status],
-      orderBy: 'timestamp DESC',
-    );
-
-    return result.map((map) => SensorReading.fromMap(map)).toList();
+  /// Get readings by status, newest first; a page of [limit] after
+  /// [after] when given
+  Future<List<SensorReading>> getReadingsByStatus(
+    String status, {
+    int? limit,
+    ReadingCursor? after,
+  }) {
+    return _queryPage('r.status = ?', [status], limit, after);
   }
 
-  /// Get readings with alerts only
-  Future<List<SensorReading>> getAlertReadings() async {
-    final db = await instance.database;
-    final result = await db.query(
-      'sensor_readings',
-      where: 'alert = ?',
-      whereArgs: [1],
-      orderBy: 'timestamp DESC',
-    );
-
-    return result.map((map) => SensorReading.fromMap(map)).toList();
+  /// Get readings with alerts only, newest first; a page of [limit] after
+  /// [after] when given
+  Future<List<SensorReading>> getAlertReadings({
+    int? limit,
+    ReadingCursor? after,
+  }) {
+    return _queryPage('r.alert = ?', [1], limit, after);
   }
 
   /// Get total count of readings
   Future<int> getTotalCount() async {
-    final db = await instance.database;
-    final result = await db.rawQuery('SELECT COUNT(*) FROM sensor_readings');
-    return Sqflite.firstIntValue(result) ?? 0;
+    final rows = await _statsRows();
+    return rows.fold<int>(0, (sum, row) => sum + (row['count'] as int));
   }
 
   /// Get count by status
   Future<Map<String, int>> getCountByStatus() async {
-    final db = await instance.database;
-    final result = await db.rawQuery('''
-      SELECT status, COUNT(*) as count 
-      FROM sensor_readings 
-      GROUP BY status
-    ''');
+    final rows = await _statsRows();
 
     Map<String, int> counts = {};
-    for (var row in result) {
+    for (var row in rows) {
       counts[row['status'] as String] = row['count'] as int;
     }
     return counts;
@@ -186,11 +609,9 @@ class DatabaseHelper {
 
   /// Get latest reading
   Future<SensorReading?> getLatestReading() async {
-    final db = await instance.database;
-    final result = await db.query(
-      'sensor_readings',
-      orderBy: 'timestamp DESC',
-      limit: 1,
+    final db = await _flushedDatabase;
+    final result = await db.rawQuery(
+      '$_selectSql ORDER BY r.timestamp DESC, r.id DESC LIMIT 1',
     );
 
     if (result.isNotEmpty) {
@@ -201,87 +622,85 @@ class DatabaseHelper {
 
   /// Delete a reading by ID
   Future<int> deleteReading(int id) async {
-    final db = await instance.database;
-    return await db.delete('sensor_readings', where: 'id = ?', whereArgs: [id]);
+    final db = await _flushedDatabase;
+    return await db.transaction((txn) async {
+      // Old rows keep their ids, so it may not have been migrated yet
+      final legacy = _migrating
+          ? await txn.delete(
+              'sensor_readings_legacy',
+              where: 'id = ?',
+              whereArgs: [id],
+            )
+          : 0;
+      return legacy +
+          await txn.delete('sensor_readings', where: 'id = ?', whereArgs: [id]);
+    });
   }
 
-  /// Delete all readings
+  /// Delete all readings. The statistics summary is dropped first so the
+  /// delete doesn't run its trigger per row; it is rebuilt (empty) on use.
   Future<int> deleteAllReadings() async {
-    final db = await instance.database;
-    return await db.delete('sensor_readings');
+    final db = await _flushedDatabase;
+    return await db.transaction((txn) async {
+      await _dropStats(txn);
+      final legacy =
+          _migrating ? await txn.delete('sensor_readings_legacy') : 0;
+      return legacy + await txn.delete('sensor_readings');
+    });
   }
 
   /// Delete readings older than specified days
   Future<int> deleteOldReadings(int days) async {
-    final db = await instance.database;
+    final db = await _flushedDatabase;
     final cutoffDate = DateTime.now().subtract(Duration(days: days));
 
-    return await db.delete(
-      'sensor_readings',
-      where: 'timestamp < ?',
-      whereArgs: [cutoffDate.toIso8601String()],
-    );
+    return await db.transaction((txn) async {
+      // Rows not migrated yet still have ISO 8601 timestamps
+      final legacy = _migrating
+          ? await txn.delete(
+              'sensor_readings_legacy',
+              where: 'timestamp < ?',
+              whereArgs: [cutoffDate.toIso8601String()],
+            )
+          : 0;
+      return legacy +
+          await txn.delete(
+            'sensor_readings',
+            where: 'timestamp < ?',
+            whereArgs: [cutoffDate.millisecondsSinceEpoch],
+          );
+    });
   }
 
-  /// Get database statistics
+  /// Get database statistics, from the reading_stats summary
   Future<Map<String, dynamic>> getStatistics() async {
-    final db = await instance.database;
-
-    // Total count
-    final totalResult = await db.rawQuery(
-      'SELECT COUNT(*) as total FROM sensor_readings',
-    );
-    final total = Sqflite.firstIntValue(totalResult) ?? 0;
-
-    // Average distance
-    final avgDistanceResult = await db.rawQuery(
-      'SELECT AVG(distance) as avg FROM sensor_readings',
-    );
-    final avgDistanceValue = avgDistanceResult.first['avg'] as num?;
-    final avgDistance = avgDistanceValue?.toDouble();
-
-    // Average water quality
-    final avgWaterResult = await db.rawQuery(
-      'SELECT AVG(waterQuality) as avg FROM sensor_readings',
-    );
-    final avgWaterValue = avgWaterResult.first['avg'] as num?;
-    final avgWater = avgWaterValue?.toDouble();
-
-    // Average percentage (new in DB v2)
-    double? avgPercentage;
-    try {
-      final avgPercResult = await db.rawQuery(
-        'SELECT AVG(percentage) as avg FROM sensor_readings',
-      );
-      final avgPercValue = avgPercResult.first['avg'] as num?;
-      avgPercentage = avgPercValue?.toDouble();
-    } catch (e) {
-      avgPercentage = null;
-    }
-
-    // Alert count
-    final alertResult = await db.rawQuery(
-      'SELECT COUNT(*) as count FROM sensor_readings WHERE alert = 1',
-    );
-    final alertCount = Sqflite.firstIntValue(alertResult) ?? 0;
-
-    // Status breakdown
-    final statusResult = await db.rawQuery('''
-      SELECT status, COUNT(*) as count 
-      FROM sensor_readings 
-      GROUP BY status
-    ''');
-
+    final rows = await _statsRows();
+
+    int total = 0;
+    int alertCount = 0;
+    int sumDistance = 0;
+    int sumWater = 0;
+    double sumPercentage = 0;
+    int countPercentage = 0;
     Map<String, int> statusBreakdown = {};
-    for (var row in statusResult) {
-      statusBreakdown[row['status'] as String] = row['count'] as int;
+    for (var row in rows) {
+      final count = row['count'] as int;
+      total += count;
+      alertCount += row['alerts'] as int;
+      sumDistance += row['sumDistance'] as int;
+      sumWater += row['sumWaterQuality'] as int;
+      sumPercentage += (row['sumPercentage'] as num).toDouble();
+      countPercentage += row['countPercentage'] as int;
+      statusBreakdown[row['status'] as String] = count;
     }
 
     return {
       'total': total,
-      'averageDistance': avgDistance ?? 0.0,
-      'averageWaterQuality': avgWater ?? 0.0,
-      'averagePercentage': avgPercentage ?? 0.0,
+      'averageDistance': total > 0 ? sumDistance / total : 0.0,
+      'averageWaterQuality': total > 0 ? sumWater / total : 0.0,
+      'averagePercentage': countPercentage > 0
+          ? sumPercentage / countPercentage
+          : 0.0,
       'alertCount': alertCount,
       'statusBreakdown': statusBreakdown,
     };
@@ -293,9 +712,15 @@ class DatabaseHelper {
     return readings.map((r) => r.toMap()).toList();
   }
 
-  /// Close the database
+  /// Close the database, writing any queued readings first
   Future<void> close() async {
-    final db = await instance.database;
+    final db = await _flushedDatabase;
     await db.close();
+    _database = null;
+    // A migration still running stops at its next chunk and resumes from
+    // the next open
+    _migration = null;
+    _migrating = false;
+    _deviceIds.clear();
   }
 }
@@ -34,7 +34,10 @@ class SensorReading {
   factory SensorReading.fromMap(Map<String, dynamic> map) {
     return SensorReading(
       id: map['id'] as int?,
-      timestamp: DateTime.parse(map['timestamp'] as String),
+      // Epoch ms from the database, ISO 8601 from exports
+      timestamp: map['timestamp'] is int
+          ? DateTime.fromMillisecondsSinceEpoch(map['timestamp'] as int)
+          : DateTime.parse(map['timestamp'] as String),
       distance: (map['distance'] is num) ? (map['distance'] as num).toInt() : 0,
       waterQuality: (map['waterQuality'] is num)
           ? (map['waterQuality'] as num).toInt()
@@ -45,10 +45,12 @@ class _LogsScreenState extends State<LogsScreen> {
   // Statistics
   Map<String, dynamic> _statistics = {};
 
-  // Pagination
+  // Pagination: _pageStarts[n] is the cursor page n was loaded after (null
+  // for the first), so Previous goes back without re-reading earlier pages
   static const int _itemsPerPage = 50;
   int _currentPage = 0;
   bool _hasMoreData = true;
+  final List<ReadingCursor?> _pageStarts = [null];
 
   @override
   void initState() {
@@ -68,18 +70,26 @@ class _LogsScreenState extends State<LogsScreen> {
 
     try {
       List<SensorReading> readings;
+      final after = _pageStarts[_currentPage];
 
       if (_showAlertsOnly) {
         // Load only alert readings
-        readings = await _dbHelper.getAlertReadings();
+        readings = await _dbHelper.getAlertReadings(
+          limit: _itemsPerPage,
+          after: after,
+        );
       } else if (_filterStatus != 'ALL') {
         // Load filtered by status
-        readings = await _dbHelper.getReadingsByStatus(_filterStatus);
+        readings = await _dbHelper.getReadingsByStatus(
+          _filterStatus,
+          limit: _itemsPerPage,
+          after: after,
+        );
       } else {
-        // Load all readings with pagination
+        // Load all readings
         readings = await _dbHelper.getReadingsPaginated(
           limit: _itemsPerPage,
-          offset: _currentPage * _itemsPerPage,
+          after: after,
         );
       }
 
@@ -108,8 +118,15 @@ class _LogsScreenState extends State<LogsScreen> {
     }
   }
 
-  Future<void> _refreshData() async {
+  void _resetPages() {
     _currentPage = 0;
+    _pageStarts
+      ..clear()
+      ..add(null);
+  }
+
+  Future<void> _refreshData() async {
+    _resetPages();
     await _loadData();
     await _loadStatistics();
   }
@@ -121,7 +138,7 @@ class _LogsScreenState extends State<LogsScreen> {
   void _applyFilter(String status) {
     setState(() {
       _filterStatus = status;
-      _currentPage = 0;
+      _resetPages();
     });
     _loadData();
   }
@@ -129,14 +146,16 @@ class _LogsScreenState extends State<LogsScreen> {
   void _toggleAlertsFilter() {
     setState(() {
       _showAlertsOnly = !_showAlertsOnly;
-      _currentPage = 0;
+      _resetPages();
     });
     _loadData();
   }
 
   void _nextPage() {
-    if (_hasMoreData && !_showAlertsOnly && _filterStatus == 'ALL') {
+    if (_hasMoreData && _readings.isNotEmpty) {
       setState(() {
+        _pageStarts.removeRange(_currentPage + 1, _pageStarts.length);
+        _pageStarts.add(ReadingCursor.after(_readings.last));
         _currentPage++;
       });
       _loadData();
@@ -409,10 +428,7 @@ class _LogsScreenState extends State<LogsScreen> {
           ),
 
           // Pagination Controls
-          if (!_isLoading &&
-              _readings.isNotEmpty &&
-              _filterStatus == 'ALL' &&
-              !_showAlertsOnly)
+          if (!_isLoading && _readings.isNotEmpty)
             _buildPaginationControls(),
         ],
       ),
@@ -2,11 +2,11 @@ import 'dart:async';
 import 'dart:convert';
 import 'dart:typed_data';
 import 'package:flutter/material.dart';
+import 'package:flutter/scheduler.dart';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'package:flutter_bluetooth_serial/flutter_bluetooth_serial.dart';
 import 'bluetooth_connection_screen.dart'; // Make sure this import is correct
-import '../database/database_helper.dart';
-import '../models/sensor_reading.dart';
+import '../services/sensor_worker.dart';
 
 class SensorDataScreen extends StatefulWidget {
   final BluetoothConnection connection;
@@ -25,7 +25,8 @@ class SensorDataScreen extends StatefulWidget {
   State<SensorDataScreen> createState() => _SensorDataScreenState();
 }
 
-class _SensorDataScreenState extends State<SensorDataScreen> {
+class _SensorDataScreenState extends State<SensorDataScreen>
+    with WidgetsBindingObserver {
   // ============================================================================
   //                        THEME COLORS
   // ============================================================================
@@ -50,8 +51,10 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
   String status = 'EMPTY'; // EMPTY, HALF_FULL, OVERFLOW, CONTAMINATED
   bool alert = false; // Alert flag (true/false)
 
-  // Data buffer for handling chunked data from HC-05
-  String dataBuffer = '';
+  // Framing, parsing and DB writes for the connection, off the UI isolate
+  late final SensorWorker _worker;
+  SensorUpdate? _latestUpdate;
+  bool _updateScheduled = false;
 
   // Last update time for connection monitoring
   DateTime? lastDataReceived;
@@ -71,6 +74,7 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
   @override
   void initState() {
     super.initState();
+    WidgetsBinding.instance.addObserver(this);
     _startListeningForData();
     _startConnectionMonitoring();
     _loadSavedTankHeight();
@@ -78,22 +82,43 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
 
   @override
   void dispose() {
+    WidgetsBinding.instance.removeObserver(this);
     connectionMonitor?.cancel();
+    _worker.close();
     _heightController.dispose();
     widget.connection.dispose();
     super.dispose();
   }
 
+  @override
+  void didChangeAppLifecycleState(AppLifecycleState state) {
+    // The OS may kill a backgrounded app without further notice, so write
+    // queued readings out now
+    if (state == AppLifecycleState.paused ||
+        state == AppLifecycleState.detached) {
+      _worker.flush();
+    }
+  }
+
   // ============================================================================
-  //                        DATA RECEPTION & PARSING
+  //                        DATA RECEPTION
   // ============================================================================
 
   void _startListeningForData() {
     debugPrint('Starting data listener...');
 
+    _worker = SensorWorker.start(
+      deviceName: widget.device.name ?? '',
+      deviceAddress: widget.device.address,
+      tankHeight: tankHeight,
+    );
+    _worker.updates.listen(_onSensorUpdate);
+    _worker.notices.listen(_onSensorNotice);
+
+    // Bytes go straight to the worker, which frames, parses and stores them
     widget.connection.input!.listen(
       (data) {
-        _handleIncomingData(data);
+        _worker.add(data);
       },
       onDone: () {
         debugPrint('Connection closed by remote device');
@@ -105,297 +130,42 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
     );
   }
 
-  void _handleIncomingData(List<int> data) {
-    try {
-      // Convert bytes to string
-      String chunk = String.fromCharCodes(data);
-      debugPrint('Received chunk (${data.length} bytes): $chunk');
-
-      // Add to buffer
-      dataBuffer += chunk;
-
-      // Process complete messages (ending with newline)
-      while (dataBuffer.contains('\n')) {
-        int newlineIndex = dataBuffer.indexOf('\n');
-        String msg = dataBuffer.substring(0, newlineIndex).trim();
-        dataBuffer = dataBuffer.substring(newlineIndex + 1);
-
-        debugPrint('Complete message: $msg');
-
-        if (msg.isEmpty) continue;
-
-        // If it's JSON (legacy or some confirmations), parse as JSON
-        if (msg.startsWith('{')) {
-          _parseJsonData(msg);
-        } else {
-          // Otherwise it's the MCU's ASCII protocol: T:...,P:...,W:...,S:...,A:... or H:<value>
-          _parsePlainPacket(msg);
-        }
-      }
-
-      // Prevent buffer overflow (keep last 300 characters)
-      if (dataBuffer.length > 300) {
-        debugPrint('Buffer overflow protection: truncating buffer');
-        dataBuffer = dataBuffer.substring(dataBuffer.length - 100);
-      }
-    } catch (e) {
-      debugPrint('Data handling error: $e');
-    }
-  }
-
-  Future<void> _parseJsonData(String jsonString) async {
-    try {
-      // Parse JSON
-      Map<String, dynamic> json = jsonDecode(jsonString);
-
-      debugPrint('Parsed JSON: $json');
-
-      // If MCU returns a dedicated 'height' key, treat it as confirmation
-      if (json.containsKey('height')) {
-        var h = json['height'];
-        if (h is num) {
-          final double confirmed = h.toDouble();
-          // Update UI and persist locally
-          setState(() {
-            tankHeight = confirmed;
-            _heightController.text = confirmed.toStringAsFixed(1);
-          });
-          await _saveTankHeightLocally(confirmed);
-          if (mounted) {
-            _showSnackBar(
-              'Tank height confirmed: ${confirmed.toStringAsFixed(1)} cm',
-              Colors.green,
-            );
-          }
-          // Continue to parse telemetry in the same message if present
-        }
-      }
-
-      // Distinguish telemetry messages from simple confirmations
-      // Telemetry messages include keys like 'percentage', 'water' or 'timestamp'.
-      // Simple confirmations from MCU (e.g. {"status":"..."}) may only include a 'status' field.
-      final bool looksLikeTelemetry =
-          json.containsKey('percentage') ||
-          json.containsKey('water') ||
-          json.containsKey('timestamp');
-
-      if (!looksLikeTelemetry && json.containsKey('status')) {
-        // This is likely a confirmation/notice from MCU. Show it to the user.
-        final String msg = json['status'].toString();
-        if (mounted) _showSnackBar(msg, Colors.green);
-        return;
-      }
-
-      // Update UI with telemetry data
+  /// Keep the newest update and apply it in the next frame, so bursts of
+  /// packets cost one rebuild
+  void _onSensorUpdate(SensorUpdate update) {
+    _latestUpdate = update;
+    if (_updateScheduled) return;
+    _updateScheduled = true;
+    SchedulerBinding.instance.scheduleFrameCallback((_) {
+      _updateScheduled = false;
+      final u = _latestUpdate;
+      if (u == null || !mounted) return;
+      _latestUpdate = null;
       setState(() {
-        // Update timestamp (milliseconds since Arduino startup)
-        timestamp = json['timestamp'] ?? 0;
-
-        // Update percentage (newer firmware sends percentage)
-        if (json.containsKey('percentage')) {
-          var p = json['percentage'];
-          if (p is num) {
-            percentage = p.toDouble();
-          } else if (p is String) {
-            percentage = double.tryParse(p) ?? percentage;
-          }
-        }
-
-        // Update distance: prefer explicit 'distance' field from MCU if present,
-        // otherwise compute from percentage and known tank height (if set).
-        if (json['distance'] != null) {
-          distance = (json['distance'] as num).toInt();
-        } else if (percentage > 0.0 && tankHeight != null) {
-          // Compute distance from top sensor to water surface in cm.
-          // If percentage is fill percent (0 = empty, 100 = full), then
-          // distance = tankHeight * (1 - percentage/100).
-          final double computed = tankHeight! * (1.0 - (percentage / 100.0));
-          distance = computed.round();
-        }
-
-        // Update water quality (0-1023 ADC value)
-        waterQuality = (json['water'] is num)
-            ? (json['water'] as num).toInt()
-            : (json['water'] ?? waterQuality);
-
-        // Update status string
-        status = json['status'] ?? status;
-
-        // Update alert flag
-        var alertValue = json['alert'];
-        if (alertValue is int) {
-          alert = alertValue == 1;
-        } else if (alertValue is bool) {
-          alert = alertValue;
-        }
-
-        // Update last received time
-        lastDataReceived = DateTime.now();
+        timestamp = u.uptime;
+        distance = u.distance;
+        waterQuality = u.waterQuality;
+        percentage = u.percentage;
+        status = u.status;
+        alert = u.alert;
+        lastDataReceived = DateTime.fromMillisecondsSinceEpoch(u.receivedAt);
       });
-
-      debugPrint(
-        'Updated sensor data: timestamp=$timestamp, distance=$distance cm, '
-        'water=$waterQuality, status=$status, alert=$alert',
-      );
-
-      // Persist the reading to the local SQLite database.
-      try {
-        final reading = SensorReading(
-          timestamp: DateTime.now(),
-          distance: distance,
-          waterQuality: waterQuality,
-          status: status,
-          alert: alert,
-          arduinoUptime: timestamp,
-          deviceName: widget.device.name ?? '',
-          deviceAddress: widget.device.address,
-          percentage: percentage,
-          tankHeight: tankHeight,
-        );
-
-        // Insert and log the assigned id (DatabaseHelper also prints on insert)
-        final id = await DatabaseHelper.instance.insertReading(reading);
-        debugPrint('Sensor reading persisted with id: $id');
-      } catch (dbError) {
-        debugPrint('Error inserting reading into DB: $dbError');
-      }
-    } catch (e) {
-      debugPrint('JSON parse error: $e');
-      debugPrint('Failed JSON string: $jsonString');
-    }
+    });
   }
 
-  /// Parse the MCU ASCII status packets and confirmations.
-  /// Expected formats:
-  /// - Telemetry: "T:12345,P:50,W:123,S:2,A:1" (keys separated by commas)
-  /// - Height confirmation: "H:100" (integer cm)
-  Future<void> _parsePlainPacket(String packet) async {
-    try {
-      final s = packet.trim();
-      if (s.isEmpty) return;
-
-      // Handle simple height confirmation: "H:100" or "H:100\r"
-      if (s.startsWith('H:')) {
-        final rest = s.substring(2).trim();
-        final int? h = int.tryParse(rest);
-        if (h != null) {
-          setState(() {
-            tankHeight = h.toDouble();
-            _heightController.text = tankHeight!.toStringAsFixed(1);
-          });
-          await _saveTankHeightLocally(tankHeight!);
-          if (mounted) {
-            _showSnackBar(
-              'Tank height confirmed: ${tankHeight!.toStringAsFixed(1)} cm',
-              Colors.green,
-            );
-          }
-        }
-        return;
-      }
-
-      // Otherwise parse key:value pairs separated by commas
-      final parts = s.split(',');
-      int? parsedTimestamp;
-      int? parsedP;
-      int? parsedW;
-      int? parsedS;
-      int? parsedA;
-
-      for (var part in parts) {
-        final token = part.trim();
-        if (!token.contains(':')) continue;
-        final kv = token.split(':');
-        if (kv.length < 2) continue;
-        final key = kv[0].trim();
-        final value = kv.sublist(1).join(':').trim();
-
-        switch (key) {
-          case 'T':
-            parsedTimestamp = int.tryParse(value);
-            break;
-          case 'P':
-            parsedP = int.tryParse(value);
-            break;
-          case 'W':
-            parsedW = int.tryParse(value);
-            break;
-          case 'S':
-            parsedS = int.tryParse(value);
-            break;
-          case 'A':
-            parsedA = int.tryParse(value);
-            break;
-          default:
-            break;
-        }
-      }
-
-      // If this looks like telemetry, update UI and persist
-      final bool hasTelemetry =
-          parsedTimestamp != null ||
-          parsedP != null ||
-          parsedW != null ||
-          parsedS != null ||
-          parsedA != null;
-      if (!hasTelemetry) return;
-
-      // Map status code to string (matches MCU enum)
-      String mapStatus(int code) {
-        switch (code) {
-          case 3:
-            return 'CONTAMINATED';
-          case 2:
-            return 'OVERFLOW';
-          case 1:
-            return 'HALF_FULL';
-          case 0:
-          default:
-            return 'EMPTY';
-        }
-      }
-
-      setState(() {
-        if (parsedTimestamp != null) timestamp = parsedTimestamp;
-        if (parsedP != null) percentage = parsedP.toDouble();
-
-        // Compute distance from percentage when tankHeight is known. If the MCU
-        // provided an explicit distance field in other packets use that (not
-        // available in the compact ASCII format), so here we compute.
-        if (parsedP != null && tankHeight != null) {
-          final double computed = tankHeight! * (1.0 - (percentage / 100.0));
-          distance = computed.round();
-        }
-
-        if (parsedW != null) waterQuality = parsedW;
-        if (parsedS != null) status = mapStatus(parsedS);
-        if (parsedA != null) alert = parsedA == 1;
-        lastDataReceived = DateTime.now();
-      });
-
-      // Persist reading to DB (distance unknown in this packet, keep previous)
-      try {
-        final reading = SensorReading(
-          timestamp: DateTime.now(),
-          distance: distance,
-          waterQuality: waterQuality,
-          status: status,
-          alert: alert,
-          arduinoUptime: timestamp,
-          deviceName: widget.device.name ?? '',
-          deviceAddress: widget.device.address,
-          percentage: percentage,
-          tankHeight: tankHeight,
-        );
-
-        final id = await DatabaseHelper.instance.insertReading(reading);
-        debugPrint('Persisted reading from plain packet with id: $id');
-      } catch (dbError) {
-        debugPrint('DB insert error for plain packet: $dbError');
+  Future<void> _onSensorNotice(SensorNotice notice) async {
+    final confirmed = notice.tankHeight;
+    if (confirmed != null) {
+      // Update UI and persist locally
+      if (mounted) {
+        setState(() {
+          tankHeight = confirmed;
+          _heightController.text = confirmed.toStringAsFixed(1);
+        });
       }
-    } catch (e) {
-      debugPrint('Plain packet parse error: $e');
+      await _saveTankHeightLocally(confirmed);
     }
+    if (mounted) _showSnackBar(notice.message, Colors.green);
   }
 
   // ============================================================================
@@ -436,6 +206,7 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
     });
 
     connectionMonitor?.cancel();
+    _worker.flush();
     // Notify parent if it provided a disconnect handler (preferred). The
     // parent (e.g. MainNavigationScreen) can update its state and show the
     // connection screen. If no handler is provided, fall back to navigating
@@ -471,6 +242,7 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
     try {
       connectionMonitor?.cancel();
       await widget.connection.close();
+      await _worker.flush();
 
       _showSnackBar('Disconnected', Colors.orange);
       debugPrint('Manually disconnected from device');
@@ -535,6 +307,7 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
             tankHeight = saved;
             _heightController.text = saved.toStringAsFixed(1);
           });
+          _worker.setTankHeight(saved);
         }
       }
     } catch (e) {
@@ -600,6 +373,7 @@ class _SensorDataScreenState extends State<SensorDataScreen> {
                   // Keep the controller in sync
                   _heightController.text = parsed.toStringAsFixed(1);
                 });
+                _worker.setTankHeight(parsed);
                 await _saveTankHeightLocally(parsed); // Save it
                 // --- END OF FIX 2 ---
 
@@ -0,0 +1,548 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:isolate';
+import 'dart:typed_data';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import '../database/database_helper.dart';
+import '../models/sensor_reading.dart';
+
+/// Latest sensor values, posted by the worker at most once per frame
+class SensorUpdate {
+  final int uptime; // Milliseconds since Arduino startup
+  final int distance; // cm
+  final int waterQuality; // ADC value (0-1023)
+  final double percentage; // 0.0 - 100.0
+  final String status;
+  final bool alert;
+  final int receivedAt; // Epoch ms of the newest packet
+
+  const SensorUpdate({
+    required this.uptime,
+    required this.distance,
+    required this.waterQuality,
+    required this.percentage,
+    required this.status,
+    required this.alert,
+    required this.receivedAt,
+  });
+}
+
+/// Something the MCU said that the user should see: a height confirmation
+/// (with [tankHeight] set) or a status notice
+class SensorNotice {
+  final String message;
+  final double? tankHeight;
+
+  const SensorNotice(this.message, {this.tankHeight});
+}
+
+/// Long-lived isolate that turns the bytes of a Bluetooth connection into
+/// readings: line framing, parsing and the batched database writer all run
+/// there, off the UI isolate. The connection itself stays on the UI
+/// isolate (its stream is a platform channel) and hands each chunk over
+/// with [add].
+///
+/// The worker coalesces telemetry and posts at most one [SensorUpdate] per
+/// [frameInterval] on [updates]; [notices] carries height confirmations and
+/// MCU messages as they arrive.
+class SensorWorker {
+  static const Duration frameInterval = Duration(milliseconds: 16);
+
+  final _updates = StreamController<SensorUpdate>.broadcast();
+  final _notices = StreamController<SensorNotice>.broadcast();
+  final ReceivePort _fromWorker = ReceivePort();
+  final ReceivePort _exit = ReceivePort();
+  final Map<int, Completer<int>> _replies = {};
+
+  // Messages sent before the worker's port arrived
+  final List<Object> _early = [];
+  SendPort? _toWorker;
+  int _nextReply = 0;
+  bool _closed = false;
+
+  Stream<SensorUpdate> get updates => _updates.stream;
+  Stream<SensorNotice> get notices => _notices.stream;
+
+  SensorWorker._();
+
+  /// Start a worker for readings from [deviceName] / [deviceAddress]. It
+  /// can be fed right away; chunks are held until the isolate is up.
+  static SensorWorker start({
+    required String deviceName,
+    required String deviceAddress,
+    double? tankHeight,
+  }) {
+    final worker = SensorWorker._();
+    worker._spawn(deviceName, deviceAddress, tankHeight);
+    return worker;
+  }
+
+  Future<void> _spawn(
+    String deviceName,
+    String deviceAddress,
+    double? tankHeight,
+  ) async {
+    _fromWorker.listen(_onMessage);
+    _exit.listen((_) => _onExit());
+    DatabaseHelper.instance.flushHook = flush;
+    try {
+      // Open (and if needed upgrade) the database here first, so the
+      // worker never races the UI isolate through a schema migration
+      await DatabaseHelper.instance.database;
+      await Isolate.spawn(
+        _workerMain,
+        _WorkerStart(
+          _fromWorker.sendPort,
+          RootIsolateToken.instance!,
+          deviceName,
+          deviceAddress,
+          tankHeight,
+        ),
+        onExit: _exit.sendPort,
+        onError: _exit.sendPort,
+        debugName: 'sensor-worker',
+      );
+    } catch (e) {
+      debugPrint('Sensor worker failed to start: $e');
+      _onExit();
+    }
+  }
+
+  /// Hand a chunk of bytes from the connection to the worker
+  void add(Uint8List chunk) => _send(chunk);
+
+  /// Tank height (cm) set by the user, used to derive distance
+  void setTankHeight(double? height) => _send(_TankHeight(height));
+
+  /// Write the worker's queued readings now. Returns how many were written.
+  Future<int> flush() {
+    if (_closed) return Future.value(0);
+    final id = _nextReply++;
+    final done = Completer<int>();
+    _replies[id] = done;
+    _send(_Flush(id));
+    return done.future;
+  }
+
+  /// Write out queued readings and stop the worker
+  Future<void> close() async {
+    if (_closed) return;
+    final id = _nextReply++;
+    final done = Completer<int>();
+    _replies[id] = done;
+    _send(_Close(id));
+    await done.future;
+  }
+
+  void _send(Object message) {
+    if (_closed) return;
+    final port = _toWorker;
+    if (port == null) {
+      _early.add(message);
+    } else {
+      port.send(message);
+    }
+  }
+
+  void _onMessage(dynamic message) {
+    if (message is SensorUpdate) {
+      _updates.add(message);
+    } else if (message is SensorNotice) {
+      _notices.add(message);
+    } else if (message is _Reply) {
+      _replies.remove(message.id)?.complete(message.count);
+    } else if (message is SendPort) {
+      _toWorker = message;
+      for (final m in _early) {
+        message.send(m);
+      }
+      _early.clear();
+    }
+  }
+
+  // Exit or uncaught error: nothing more will arrive
+  void _onExit() {
+    if (_closed) return;
+    _closed = true;
+    _early.clear();
+    for (final done in _replies.values) {
+      done.complete(0);
+    }
+    _replies.clear();
+    if (DatabaseHelper.instance.flushHook == flush) {
+      DatabaseHelper.instance.flushHook = null;
+    }
+    _fromWorker.close();
+    _exit.close();
+    _updates.close();
+    _notices.close();
+  }
+}
+
+// ============================================================================
+//                        MESSAGES
+// ============================================================================
+
+class _WorkerStart {
+  final SendPort toUi;
+  final RootIsolateToken token;
+  final String deviceName;
+  final String deviceAddress;
+  final double? tankHeight;
+
+  const _WorkerStart(
+    this.toUi,
+    this.token,
+    this.deviceName,
+    this.deviceAddress,
+    this.tankHeight,
+  );
+}
+
+class _TankHeight {
+  final double? height;
+  const _TankHeight(this.height);
+}
+
+class _Flush {
+  final int id;
+  const _Flush(this.id);
+}
+
+class _Close {
+  final int id;
+  const _Close(this.id);
+}
+
+class _Reply {
+  final int id;
+  final int count;
+  const _Reply(this.id, this.count);
+}
+
+// ============================================================================
+//                        WORKER ISOLATE
+// ============================================================================
+
+Future<void> _workerMain(_WorkerStart start) async {
+  // sqflite talks to its platform plugin from here too
+  BackgroundIsolateBinaryMessenger.ensureInitialized(start.token);
+  DatabaseHelper.instance.migrateLegacy = false;
+
+  final worker = _Worker(start);
+  final inbox = ReceivePort();
+  start.toUi.send(inbox.sendPort);
+
+  await for (final message in inbox) {
+    if (message is Uint8List) {
+      worker.handleIncomingData(message);
+    } else if (message is _TankHeight) {
+      worker.tankHeight = message.height;
+    } else if (message is _Flush) {
+      final n = await DatabaseHelper.instance.flushPendingReadings();
+      start.toUi.send(_Reply(message.id, n));
+    } else if (message is _Close) {
+      worker.postNow();
+      // The database stays open: sqflite shares the connection with the
+      // UI isolate, so closing it here would close it there too
+      final n = await DatabaseHelper.instance.flushPendingReadings();
+      inbox.close();
+      Isolate.exit(start.toUi, _Reply(message.id, n));
+    }
+  }
+}
+
+/// Parser and sensor state on the worker side
+class _Worker {
+  final SendPort toUi;
+  final String deviceName;
+  final String deviceAddress;
+  double? tankHeight;
+
+  // Current sensor readings (matches Arduino JSON format)
+  int timestamp = 0; // Milliseconds since Arduino startup
+  int distance = 0;
+  int waterQuality = 0;
+  double percentage = 0.0;
+  String status = 'EMPTY';
+  bool alert = false;
+  int receivedAt = 0;
+
+  // Bytes of the line being received
+  final BytesBuilder _line = BytesBuilder(copy: false);
+
+  // An update is posted on the first packet and then at most once per
+  // frame while packets keep coming
+  Timer? _frameTimer;
+  bool _dirty = false;
+
+  _Worker(_WorkerStart start)
+    : toUi = start.toUi,
+      deviceName = start.deviceName,
+      deviceAddress = start.deviceAddress,
+      tankHeight = start.tankHeight;
+
+  // ==========================================================================
+  //                        FRAMING
+  // ==========================================================================
+
+  // Longer partial lines have lost their newline and are dropped
+  static const int _maxLine = 300;
+
+  /// Split [data] into newline-terminated messages and parse each one
+  void handleIncomingData(Uint8List data) {
+    int start = 0;
+    for (int i = 0; i < data.length; i++) {
+      if (data[i] != 0x0A) continue;
+      _line.add(Uint8List.sublistView(data, start, i));
+      start = i + 1;
+      final msg = String.fromCharCodes(_line.takeBytes()).trim();
+      if (msg.isEmpty) continue;
+      try {
+        // If it's JSON (legacy or some confirmations), parse as JSON
+        if (msg.startsWith('{')) {
+          _parseJsonData(msg);
+        } else {
+          // Otherwise it's the MCU's ASCII protocol: T:...,P:...,W:...,S:...,A:... or H:<value>
+          _parsePlainPacket(msg);
+        }
+      } catch (e) {
+        debugPrint('Packet parse error: $e');
+        debugPrint('Failed packet: $msg');
+      }
+    }
+    if (start < data.length) {
+      _line.add(Uint8List.sublistView(data, start));
+    }
+
+    // Prevent buffer overflow
+    if (_line.length > _maxLine) {
+      debugPrint('Buffer overflow protection: dropping partial line');
+      _line.clear();
+    }
+  }
+
+  // ==========================================================================
+  //                        PARSING
+  // ==========================================================================
+
+  void _parseJsonData(String jsonString) {
+    Map<String, dynamic> json = jsonDecode(jsonString);
+
+    // If MCU returns a dedicated 'height' key, treat it as confirmation
+    if (json.containsKey('height')) {
+      var h = json['height'];
+      if (h is num) {
+        _confirmHeight(h.toDouble());
+        // Continue to parse telemetry in the same message if present
+      }
+    }
+
+    // Distinguish telemetry messages from simple confirmations
+    // Telemetry messages include keys like 'percentage', 'water' or 'timestamp'.
+    // Simple confirmations from MCU (e.g. {"status":"..."}) may only include a 'status' field.
+    final bool looksLikeTelemetry =
+        json.containsKey('percentage') ||
+        json.containsKey('water') ||
+        json.containsKey('timestamp');
+
+    if (!looksLikeTelemetry) {
+      if (json.containsKey('status')) {
+        toUi.send(SensorNotice(json['status'].toString()));
+      }
+      return;
+    }
+
+    // Update timestamp (milliseconds since Arduino startup)
+    timestamp = json['timestamp'] ?? 0;
+
+    // Update percentage (newer firmware sends percentage)
+    if (json.containsKey('percentage')) {
+      var p = json['percentage'];
+      if (p is num) {
+        percentage = p.toDouble();
+      } else if (p is String) {
+        percentage = double.tryParse(p) ?? percentage;
+      }
+    }
+
+    // Update distance: prefer explicit 'distance' field from MCU if present,
+    // otherwise compute from percentage and known tank height (if set).
+    if (json['distance'] != null) {
+      distance = (json['distance'] as num).toInt();
+    } else if (percentage > 0.0 && tankHeight != null) {
+      // distance = tankHeight * (1 - percentage/100) from the sensor at the
+      // top down to the water surface
+      distance = (tankHeight! * (1.0 - (percentage / 100.0))).round();
+    }
+
+    // Update water quality (0-1023 ADC value)
+    waterQuality = (json['water'] is num)
+        ? (json['water'] as num).toInt()
+        : (json['water'] ?? waterQuality);
+
+    status = json['status'] ?? status;
+
+    var alertValue = json['alert'];
+    if (alertValue is int) {
+      alert = alertValue == 1;
+    } else if (alertValue is bool) {
+      alert = alertValue;
+    }
+
+    _received();
+  }
+
+  /// Parse the MCU ASCII status packets and confirmations.
+  /// Expected formats:
+  /// - Telemetry: "T:12345,P:50,W:123,S:2,A:1" (keys separated by commas)
+  /// - Height confirmation: "H:100" (integer cm)
+  void _parsePlainPacket(String s) {
+    // Handle simple height confirmation: "H:100"
+    if (s.startsWith('H:')) {
+      final int? h = int.tryParse(s.substring(2).trim());
+      if (h != null) _confirmHeight(h.toDouble());
+      return;
+    }
+
+    // Otherwise parse key:value pairs separated by commas
+    int? parsedTimestamp;
+    int? parsedP;
+    int? parsedW;
+    int? parsedS;
+    int? parsedA;
+
+    for (var part in s.split(',')) {
+      final token = part.trim();
+      final colon = token.indexOf(':');
+      if (colon < 0) continue;
+      final key = token.substring(0, colon).trim();
+      final value = token.substring(colon + 1).trim();
+
+      switch (key) {
+        case 'T':
+          parsedTimestamp = int.tryParse(value);
+          break;
+        case 'P':
+          parsedP = int.tryParse(value);
+          break;
+        case 'W':
+          parsedW = int.tryParse(value);
+          break;
+        case 'S':
+          parsedS = int.tryParse(value);
+          break;
+        case 'A':
+          parsedA = int.tryParse(value);
+          break;
+        default:
+          break;
+      }
+    }
+
+    final bool hasTelemetry =
+        parsedTimestamp != null ||
+        parsedP != null ||
+        parsedW != null ||
+        parsedS != null ||
+        parsedA != null;
+    if (!hasTelemetry) return;
+
+    if (parsedTimestamp != null) timestamp = parsedTimestamp;
+    if (parsedP != null) percentage = parsedP.toDouble();
+
+    // The compact format has no distance field, so derive it when the
+    // tank height is known and keep the previous value otherwise
+    if (parsedP != null && tankHeight != null) {
+      distance = (tankHeight! * (1.0 - (percentage / 100.0))).round();
+    }
+
+    if (parsedW != null) waterQuality = parsedW;
+    if (parsedS != null) status = _mapStatus(parsedS);
+    if (parsedA != null) alert = parsedA == 1;
+
+    _received();
+  }
+
+  // Map status code to string (matches MCU enum)
+  static String _mapStatus(int code) {
+    switch (code) {
+      case 3:
+        return 'CONTAMINATED';
+      case 2:
+        return 'OVERFLOW';
+      case 1:
+        return 'HALF_FULL';
+      case 0:
+      default:
+        return 'EMPTY';
+    }
+  }
+
+  void _confirmHeight(double h) {
+    tankHeight = h;
+    toUi.send(
+      SensorNotice(
+        'Tank height confirmed: ${h.toStringAsFixed(1)} cm',
+        tankHeight: h,
+      ),
+    );
+  }
+
+  // ==========================================================================
+  //                        PERSISTENCE & UI UPDATES
+  // ==========================================================================
+
+  /// Queue the current values as a reading and schedule a UI update
+  void _received() {
+    final now = DateTime.now();
+    receivedAt = now.millisecondsSinceEpoch;
+
+    // Written with the next batch (DatabaseHelper.writeBatchSize/Delay)
+    DatabaseHelper.instance.queueReading(
+      SensorReading(
+        timestamp: now,
+        distance: distance,
+        waterQuality: waterQuality,
+        status: status,
+        alert: alert,
+        arduinoUptime: timestamp,
+        deviceName: deviceName,
+        deviceAddress: deviceAddress,
+        percentage: percentage,
+        tankHeight: tankHeight,
+      ),
+    );
+
+    _dirty = true;
+    if (_frameTimer == null) {
+      postNow();
+      _frameTimer = Timer.periodic(SensorWorker.frameInterval, (timer) {
+        if (_dirty) {
+          postNow();
+        } else {
+          // Quiet for a frame; the next packet posts straight away
+          timer.cancel();
+          _frameTimer = null;
+        }
+      });
+    }
+  }
+
+  void postNow() {
+    if (!_dirty) return;
+    _dirty = false;
+    toUi.send(
+      SensorUpdate(
+        uptime: timestamp,
+        distance: distance,
+        waterQuality: waterQuality,
+        percentage: percentage,
+        status: status,
+        alert: alert,
+        receivedAt: receivedAt,
+      ),
+    );
+  }
+}
@@ -0,0 +1,119 @@
+// Exporting a whole store: materialising every reading first (what a
+// getAllReadings()-style export does) against streaming from the mapped
+// blocks with RangeCursor, with and without dropping consumed pages. Each
+// variant runs in its own process so peak RSS is its own.
+//
+//   ./bin/bench_export [devices=1000] [readings_per_device=10000] [path=/tmp/bench_export.tsdb]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "column_store.h"
+#include "fleet_sim.h"
+#include "query.h"
+
+typedef enum {
+    EXPORT_MATERIALISE = 0,
+    EXPORT_STREAM,
+    EXPORT_STREAM_RELEASE
+} ExportMode_t;
+
+static void print_csv(FILE* out, const Reading_t& r){
+    fprintf(out, "%" PRIu64 ",%u,%" PRIu32 ",%u,%u,%u,%u\n", r.rx_time_us, (unsigned)r.device_id, r.device_time_ms,
+            (unsigned)r.percent, (unsigned)r.water_adc, (unsigned)r.status, (unsigned)r.alert);
+}
+
+static uint64_t run_export(const char* path, ExportMode_t mode){
+    static BlockFile file;
+    if(file.open(path) < 0) return 0;
+    FILE* out = fopen("/dev/null", "w");
+    if(!out) return 0;
+
+    uint64_t n = 0;
+    if(mode == EXPORT_MATERIALISE){
+        std::vector<Reading_t> all;
+        RangeCursor cur(file, QUERY_ALL_DEVICES, INT64_MIN, INT64_MAX);
+        Reading_t r;
+        while(cur.next(&r)) all.push_back(r);
+        for(const Reading_t& x : all) print_csv(out, x);
+        n = all.size();
+    } else {
+        RangeCursor cur(file, QUERY_ALL_DEVICES, INT64_MIN, INT64_MAX, mode == EXPORT_STREAM_RELEASE);
+        Reading_t r;
+        while(cur.next(&r)){
+            print_csv(out, r);
+            n++;
+        }
+    }
+    fclose(out);
+    return n;
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 10000;
+    std::string path = (argc > 3) ? argv[3] : "/tmp/bench_export.tsdb";
+    if(devices == 0 || devices > MAX_DEVICES) devices = MAX_DEVICES;
+
+    // Written by a child too, so the exporters don't inherit the writer's memory
+    printf("Writing %u devices x %u readings...\n", devices, per_device);
+    fflush(stdout);
+    unlink(path.c_str());
+    pid_t writer = fork();
+    if(writer == 0){
+        static ColumnStore store;
+        if(store.open(path.c_str()) < 0){
+            perror(path.c_str());
+            _exit(1);
+        }
+        std::vector<SimDevice_t> sims(devices);
+        for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+        for(uint32_t k = 0; k < per_device; k++){
+            for(uint32_t d = 0; d < devices; d++) store.on_reading(sim_next(&sims[d], (uint16_t)d));
+        }
+        store.close();
+        printf("%.1f MB file\n\n", store.file_bytes() / 1e6);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if(writer < 0 || waitpid(writer, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return 1;
+
+    const char* names[] = { "materialise, then write", "stream from mmap", "stream, release pages" };
+    printf("%-26s %12s %10s %12s %12s\n", "export (CSV to /dev/null)", "readings", "ms", "readings/s", "peak RSS MB");
+
+    for(int mode = EXPORT_MATERIALISE; mode <= EXPORT_STREAM_RELEASE; mode++){
+        int fds[2];
+        if(pipe(fds) < 0) return 1;
+
+        uint64_t t0 = now_us();
+        pid_t pid = fork();
+        if(pid == 0){
+            uint64_t n = run_export(path.c_str(), (ExportMode_t)mode);
+            if(write(fds[1], &n, sizeof(n)) != sizeof(n)) _exit(1);
+            _exit(0);
+        }
+        uint64_t n = 0;
+        if(read(fds[0], &n, sizeof(n)) != sizeof(n)) n = 0;
+        int status;
+        struct rusage ru;
+        wait4(pid, &status, 0, &ru);
+        double ms = (now_us() - t0) / 1000.0;
+        close(fds[0]);
+        close(fds[1]);
+
+        printf("%-26s %12" PRIu64 " %10.0f %12.0f %12.1f\n", names[mode], n, ms, n / (ms / 1000.0), ru.ru_maxrss / 1024.0);
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
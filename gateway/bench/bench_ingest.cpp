@@ -0,0 +1,146 @@
+// Fleet-scale ingest: N simulated tanks on socketpairs, each sending a
+// status packet at RATE Hz (staggered evenly), read by the epoll ingest
+// engine. Reports throughput and the send -> parsed (ingest) and
+// send -> dispatcher (queue) latency percentiles.
+//
+//   ./bin/bench_ingest [devices=10000] [rate_hz=2] [seconds=10] [loops=0]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "event_queue.h"
+#include "ingest.h"
+
+static void sleep_until_us(uint64_t t){
+    uint64_t now = now_us();
+    if(t <= now) return;
+    struct timespec ts = { (time_t)((t - now) / 1000000ULL), (long)((t - now) % 1000000ULL) * 1000L };
+    nanosleep(&ts, NULL);
+}
+
+static void print_percentiles(const char* name, std::vector<uint32_t>& v){
+    if(v.empty()) return;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    printf("  %-10s p50 %6.3f ms  p99 %6.3f ms  p99.9 %6.3f ms  max %7.3f ms\n", name,
+           v[n / 2] / 1000.0, v[n * 99 / 100] / 1000.0, v[n * 999 / 1000] / 1000.0, v[n - 1] / 1000.0);
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 10000;
+    uint32_t rate_hz = (argc > 2) ? (uint32_t)atoi(argv[2]) : 2;
+    uint32_t seconds = (argc > 3) ? (uint32_t)atoi(argv[3]) : 10;
+    uint16_t loops = (argc > 4) ? (uint16_t)atoi(argv[4]) : 0;
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+
+    // Two descriptors per simulated tank
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    EventQueue queue(65536);
+    IngestConfig_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.loops = loops;
+    cfg.high_water = 49152;
+    cfg.low_water = 16384;
+    IngestEngine engine(&queue, cfg);
+
+    std::vector<int> dev_fd;
+    for(uint32_t i = 0; i < devices; i++){
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0){
+            fprintf(stderr, "socketpair: %s, running with %u devices\n", strerror(errno), i);
+            break;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "sim%u", i);
+        if(!engine.add_socket(sv[1], name)){
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        dev_fd.push_back(sv[0]);
+    }
+    devices = (uint32_t)dev_fd.size();
+
+    uint32_t per_device = rate_hz * seconds;
+    uint64_t total = (uint64_t)devices * per_device;
+    std::vector<uint64_t> sent_at(total, 0);
+    std::vector<uint32_t> ingest_lat, queue_lat;
+    ingest_lat.reserve(total);
+    queue_lat.reserve(total);
+
+    if(engine.start() < 0){
+        fprintf(stderr, "engine start failed\n");
+        return 1;
+    }
+    printf("Devices: %u @ %u Hz for %us (%llu packets), %u ingest loops\n",
+           devices, rate_hz, seconds, (unsigned long long)total, (unsigned)engine.loop_count());
+
+    // --- Consumer: stands in for the sink dispatcher ---
+    std::atomic<bool> done(false);
+    std::thread consumer([&]{
+        static Event_t batch[256];
+        while(!done || queue.depth() > 0){
+            uint32_t n = queue.pop_batch(batch, 256, 50);
+            uint64_t t = now_us();
+            for(uint32_t i = 0; i < n; i++){
+                const Reading_t& r = batch[i].reading;
+                uint64_t idx = (uint64_t)r.device_id * per_device + r.device_time_ms;
+                if(batch[i].type != EVENT_READING || idx >= total || !sent_at[idx]) continue;
+                ingest_lat.push_back((uint32_t)(r.rx_time_us - sent_at[idx]));
+                queue_lat.push_back((uint32_t)(t - sent_at[idx]));
+            }
+        }
+    });
+
+    // --- Producer: packets staggered evenly across each period ---
+    // T carries the sequence number so the consumer can find the send time
+    uint64_t period_us = 1000000ULL / rate_hz;
+    uint64_t t0 = now_us() + 100000;
+    uint64_t late = 0;
+    char line[64];
+
+    for(uint32_t k = 0; k < per_device; k++){
+        for(uint32_t i = 0; i < devices; i++){
+            uint64_t due = t0 + k * period_us + (uint64_t)i * period_us / devices;
+            sleep_until_us(due);
+            if(now_us() > due + 1000) late++;
+
+            int n = snprintf(line, sizeof(line), "T:%u,P:%u,W:%u,S:%u,A:0\n", k, i % 101, (i * 7) % 1024, i % 3);
+            sent_at[(uint64_t)i * per_device + k] = now_us();
+            if(write(dev_fd[i], line, (size_t)n) != n) fprintf(stderr, "short write to sim%u\n", i);
+        }
+    }
+    double elapsed = (now_us() - t0) / 1e6;
+
+    // Let the pipeline drain
+    usleep(200000);
+    engine.stop();
+    done = true;
+    consumer.join();
+
+    printf("Received %zu / %llu packets (%.0f packets/s), dropped %llu, backpressure waits %llu, late sends %llu\n",
+           ingest_lat.size(), (unsigned long long)total, ingest_lat.size() / elapsed,
+           (unsigned long long)queue.dropped(), (unsigned long long)engine.backpressure_waits(),
+           (unsigned long long)late);
+    print_percentiles("ingest", ingest_lat);
+    print_percentiles("queue", queue_lat);
+
+    for(int fd : dev_fd) close(fd);
+    return 0;
+}
@@ -0,0 +1,276 @@
+// MQTT bridge: publish throughput and reading-to-PUBACK latency by in-flight
+// window, then a broker outage: messages spool to disk and must all arrive,
+// in order per device, once the broker is back.
+//
+// Runs against a minimal in-process broker (CONNACK, a PUBACK per QoS 1
+// PUBLISH, optionally delayed to stand in for a remote one) unless a real
+// broker is given.
+//
+//   ./bin/bench_mqtt [devices=10000] [readings_per_device=20] [broker_rtt_ms=1] [host:port]
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "fleet_sim.h"
+#include "mqtt.h"
+
+#define SPOOL_PATH      "/tmp/bench_mqtt.spool"
+#define FLUSH_EVERY     256     // Readings per dispatcher flush, as in the gateway
+
+//  FAKE BROKER
+// One client at a time; acks are held for rtt_ms, as a broker across a
+// network would return them
+struct FakeBroker {
+    int listen_fd = -1;
+    uint16_t port = 0;
+    uint32_t rtt_ms = 0;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> publishes{0};
+    std::atomic<uint64_t> duplicates{0};    // DUP flag set
+    std::atomic<uint64_t> out_of_order{0};  // Per-device T went backwards
+    std::vector<uint32_t> last_t;           // Per device
+    std::thread thread;
+
+    int start(uint16_t want_port){
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(want_port);
+        socklen_t len = sizeof(addr);
+        if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) return -errno;
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len);
+        port = ntohs(addr.sin_port);
+        last_t.assign(MAX_DEVICES, 0);
+        running = true;
+        thread = std::thread(&FakeBroker::run, this);
+        return 0;
+    }
+
+    void stop(){
+        running = false;
+        if(thread.joinable()) thread.join();
+        close(listen_fd);
+    }
+
+    void on_publish(const uint8_t* p, size_t len, size_t header, std::string* out){
+        publishes++;
+        if(p[0] & 0x08) duplicates++;
+        uint16_t tl = (uint16_t)((p[header] << 8) | p[header + 1]);
+        const char* topic = (const char*)p + header + 2;
+        size_t body = header + 2 + tl;
+        uint8_t qos = (p[0] >> 1) & 3;
+        if(qos){
+            mqtt_encode_simple(out, MQTT_PUBACK, (uint16_t)((p[body] << 8) | p[body + 1]));
+            body += 2;
+        }
+
+        // <prefix>/dev<N>/reading {"t":..,"T":<device ms>,...}
+        const char* dev = (const char*)memmem(topic, tl, "/dev", 4);
+        std::string payload((const char*)p + body, len - body);
+        size_t at = payload.find("\"T\":");
+        if(!dev || at == std::string::npos) return;
+        uint32_t id = (uint32_t)atoi(dev + 4);
+        uint32_t t = (uint32_t)atol(payload.c_str() + at + 4);
+        if(id < MAX_DEVICES){
+            if(t < last_t[id]) out_of_order++;
+            last_t[id] = t;
+        }
+    }
+
+    void serve(int fd){
+        std::string in, out;
+        std::deque<std::pair<uint64_t, std::string>> delayed;    // Acks with their release time
+        char buf[65536];
+        while(running){
+            uint64_t now = mono_ms();
+            while(!delayed.empty() && delayed.front().first <= now){
+                out += delayed.front().second;
+                delayed.pop_front();
+            }
+            if(!out.empty()){
+                if(send(fd, out.data(), out.size(), MSG_NOSIGNAL) < 0) return;
+                out.clear();
+            }
+
+            struct pollfd p = { fd, POLLIN, 0 };
+            if(poll(&p, 1, delayed.empty() ? 50 : 1) <= 0) continue;
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) return;
+            in.append(buf, (size_t)n);
+
+            std::string acks;
+            size_t off = 0, header;
+            int len;
+            while((len = mqtt_packet_length((const uint8_t*)in.data() + off, in.size() - off, &header)) > 0){
+                const uint8_t* pk = (const uint8_t*)in.data() + off;
+                switch(pk[0] >> 4){
+                    case MQTT_CONNECT:    mqtt_encode_simple(&out, MQTT_CONNACK, 0); break;
+                    case MQTT_PINGREQ:    mqtt_encode_simple(&out, MQTT_PINGRESP, 0); break;
+                    case MQTT_PUBLISH:    on_publish(pk, (size_t)len, header, &acks); break;
+                    case MQTT_DISCONNECT: return;
+                    default: break;
+                }
+                off += (size_t)len;
+            }
+            in.erase(0, off);
+            if(acks.empty()) continue;
+            if(rtt_ms) delayed.push_back(std::make_pair(mono_ms() + rtt_ms, acks));
+            else out += acks;
+        }
+    }
+
+    void run(){
+        while(running){
+            struct pollfd p = { listen_fd, POLLIN, 0 };
+            if(poll(&p, 1, 50) <= 0) continue;
+            int fd = accept(listen_fd, NULL, NULL);
+            if(fd < 0) continue;
+            serve(fd);
+            close(fd);
+        }
+    }
+};
+
+//  DRIVER
+static bool wait_for(MqttBridge* b, uint64_t target, uint32_t timeout_ms){
+    uint64_t deadline = mono_ms() + timeout_ms;
+    while(b->acked() + b->dropped() < target){
+        if(mono_ms() > deadline) return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+static void feed(MqttBridge* b, const std::vector<Reading_t>& readings){
+    for(size_t i = 0; i < readings.size(); i++){
+        b->on_reading(readings[i]);
+        if(i % FLUSH_EVERY == FLUSH_EVERY - 1) b->flush();
+    }
+    b->flush();
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 10000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 20;
+    uint32_t rtt_ms = (argc > 3) ? (uint32_t)atoi(argv[3]) : 1;
+    const char* external = (argc > 4) ? argv[4] : NULL;
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+    uint64_t total = (uint64_t)devices * per_device;
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Generating %u devices x %u readings...\n", devices, per_device);
+    std::vector<Reading_t> readings(total);
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+    for(uint32_t k = 0; k < per_device; k++){
+        for(uint32_t d = 0; d < devices; d++) readings[(uint64_t)k * devices + d] = sim_next(&sims[d], (uint16_t)d);
+    }
+
+    FakeBroker broker;
+    broker.rtt_ms = rtt_ms;
+    MqttConfig_t cfg = MQTT_DEFAULTS;
+    cfg.client_id = "bench_mqtt";
+    std::string host;
+    if(external){
+        const char* colon = strrchr(external, ':');
+        host.assign(external, colon ? (size_t)(colon - external) : strlen(external));
+        cfg.host = host.c_str();
+        cfg.port = colon ? (uint16_t)atoi(colon + 1) : MQTT_PORT;
+        printf("Broker %s:%u\n", cfg.host, (unsigned)cfg.port);
+    } else {
+        if(broker.start(0) < 0){
+            perror("broker");
+            return 1;
+        }
+        cfg.port = broker.port;
+        printf("In-process broker, %u ms ack delay\n", rtt_ms);
+    }
+
+    // --- Window sweep ---
+    printf("\n%5s %8s %12s %10s %10s %10s\n", "qos", "window", "msgs/s", "p50 ms", "p99 ms", "max ms");
+    static const uint32_t windows[] = { 1, 16, 256, 1024 };
+    for(uint32_t w = 0; w < 5; w++){
+        MqttConfig_t c = cfg;
+        c.qos = w < 4 ? 1 : 0;
+        c.inflight = w < 4 ? windows[w] : 0;
+        std::vector<Reading_t> sample(readings);
+        if(c.inflight == 1) sample.resize(std::min<size_t>(sample.size(), rtt_ms ? 2000 : 20000));   // Stop-and-wait is slow
+
+        MqttBridge* b = new MqttBridge();
+        b->start(c);
+        while(!b->connected()) usleep(1000);
+        uint64_t t0 = mono_us();
+        feed(b, sample);
+        bool ok = wait_for(b, sample.size(), 120000);
+        double s = (mono_us() - t0) / 1e6;
+        const LatencyHistogram& lat = b->publish_latency();
+        if(c.qos) printf("%5u %8u %12.0f %10.2f %10.2f %10.2f%s\n", c.qos, c.inflight, sample.size() / s,
+                         lat.percentile(50) / 1000.0, lat.percentile(99) / 1000.0, lat.max() / 1000.0, ok ? "" : "  (timed out)");
+        else printf("%5u %8s %12.0f %10s %10s %10s%s\n", c.qos, "-", sample.size() / s, "-", "-", "-", ok ? "" : "  (timed out)");
+        b->stop();
+        delete b;
+    }
+    if(external) return 0;
+
+    // --- Outage ---
+    // Half the fleet's readings arrive with the broker down, the rest after
+    // it comes back
+    printf("\nBroker outage, %" PRIu64 " messages, spool %s:\n", total, SPOOL_PATH);
+    broker.stop();
+    unlink(SPOOL_PATH);
+    broker.publishes = broker.duplicates = broker.out_of_order = 0;
+    MqttConfig_t c = cfg;
+    c.spool_path = SPOOL_PATH;
+    MqttBridge* b = new MqttBridge();
+    if(b->start(c) < 0){
+        perror(SPOOL_PATH);
+        return 1;
+    }
+    std::vector<Reading_t> first(readings.begin(), readings.begin() + total / 2);
+    std::vector<Reading_t> second(readings.begin() + total / 2, readings.end());
+    feed(b, first);
+    while(b->spooled() < first.size()) usleep(1000);
+    printf("  down:   %" PRIu64 " spooled, %.1f MB on disk\n", b->spooled(), b->spool_bytes() / 1e6);
+
+    uint16_t port = cfg.port;
+    FakeBroker back;
+    back.rtt_ms = rtt_ms;
+    if(back.start(port) < 0){
+        perror("broker restart");
+        return 1;
+    }
+    uint64_t t0 = mono_us();
+    feed(b, second);
+    bool ok = wait_for(b, total, 120000);
+    double s = (mono_us() - t0) / 1e6;
+    printf("  back:   %" PRIu64 " published in %.2f s (%.0f msgs/s), %" PRIu64 " dropped%s\n", b->acked(), s, b->acked() / s,
+           b->dropped(), ok ? "" : " (timed out)");
+    b->stop();
+    printf("  broker: %" PRIu64 " received, %" PRIu64 " duplicates, %" PRIu64 " out of order, spool %s\n",
+           back.publishes.load(), back.duplicates.load(), back.out_of_order.load(), b->spool_bytes() ? "not empty" : "empty");
+    delete b;
+    back.stop();
+    unlink(SPOOL_PATH);
+    return (ok && back.publishes >= total && !back.out_of_order) ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+// Ingest throughput of the telemetry parser: newline scanning (scalar vs
+// SSE2 vs AVX2) and full decoding (sscanf baseline, tlm_feed, tlm_feed_batch)
+// over a buffer of realistic status packets.
+//
+//   make bench            or   ./bin/bench_parser [MiB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+#define DEFAULT_MIB     64
+#define REPEAT          5
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Fill `buf` with status lines as send_status_packet() prints them, plus
+// the odd H: ack. Returns the number of bytes used (ends on a '\n').
+static size_t make_corpus(char* buf, size_t size){
+    size_t pos = 0;
+    uint32_t t = 0;
+    srand(42);
+
+    while(pos + 48 < size){
+        t += 500;
+        int n;
+        if(rand() % 64 == 0){
+            n = snprintf(buf + pos, size - pos, "H:%d\n", 1 + rand() % 499);
+        } else {
+            n = snprintf(buf + pos, size - pos, "T:%u,P:%d,W:%d,S:%d,A:%d\n",
+                         t, rand() % 101, rand() % 1024, rand() % 4, rand() % 2);
+        }
+        pos += (size_t)n;
+    }
+    return pos;
+}
+
+static void report(const char* name, size_t bytes, size_t lines, double secs){
+    printf("  %-22s %8.2f GB/s  %8.1f Mlines/s\n", name,
+           (double)bytes / secs / 1e9, (double)lines / secs / 1e6);
+}
+
+// --- Newline scanning ---
+static size_t bench_scan(TlmScanImpl_t impl, const uint8_t* data, size_t len){
+    uint32_t offsets[TLM_SCAN_BATCH];
+    size_t total = 0;
+    size_t pos = 0;
+
+    while(pos < len){
+        size_t n = tlm_scan_newlines_with(impl, data + pos, len - pos, offsets, TLM_SCAN_BATCH);
+        if(n == 0) break;
+        total += n;
+        pos += offsets[n - 1] + 1;
+    }
+    return total;
+}
+
+// --- Full decode ---
+static size_t bench_sscanf(const char* data, size_t len){
+    size_t lines = 0;
+    const char* p = data;
+    const char* end = data + len;
+    unsigned t, pc, w, s, a;
+    char line[64];
+
+    while(p < end){
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if(!nl) break;
+
+        // sscanf() strlen()s its input, so hand it one terminated line at a time
+        size_t n = (size_t)(nl - p);
+        if(n >= sizeof(line)) n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        if(sscanf(line, "T:%u,P:%u,W:%u,S:%u,A:%u", &t, &pc, &w, &s, &a) == 5 || sscanf(line, "H:%u", &t) == 1) lines++;
+        p = nl + 1;
+    }
+    return lines;
+}
+
+static size_t bench_feed(const uint8_t* data, size_t len){
+    TlmParser_t parser;
+    TlmLine_t line;
+    tlm_parser_init(&parser);
+
+    while(len > 0){
+        size_t n = tlm_feed(&parser, data, len, &line);
+        data += n;
+        len -= n;
+    }
+    return parser.status_lines + parser.ack_lines;
+}
+
+static size_t bench_feed_batch(const uint8_t* data, size_t len){
+    TlmParser_t parser;
+    TlmLine_t lines[64];
+    size_t n_lines;
+    uint64_t checksum = 0;
+    tlm_parser_init(&parser);
+
+    while(len > 0){
+        size_t n = tlm_feed_batch(&parser, data, len, lines, 64, &n_lines);
+        for(size_t i = 0; i < n_lines; i++) checksum += lines[i].status.percent;
+        data += n;
+        len -= n;
+    }
+    if(checksum == 1) puts(""); // Keep the decode from being optimised away
+    return parser.status_lines + parser.ack_lines;
+}
+
+int main(int argc, char** argv){
+    size_t mib = (argc > 1) ? (size_t)atoi(argv[1]) : DEFAULT_MIB;
+    size_t size = mib << 20;
+    char* buf = (char*)malloc(size);
+    if(!buf) return 1;
+
+    size_t len = make_corpus(buf, size);
+    const uint8_t* data = (const uint8_t*)buf;
+    size_t expected = bench_scan(TLM_SCAN_SCALAR, data, len);
+
+    static const char* impl_names[] = { "scalar", "sse2", "avx2" };
+    printf("Corpus: %zu bytes, %zu lines, best scanner: %s\n\n", len, expected, impl_names[tlm_scan_best()]);
+
+    printf("Newline scan (best of %d):\n", REPEAT);
+    for(int impl = TLM_SCAN_SCALAR; impl <= TLM_SCAN_AVX2; impl++){
+        if(impl > (int)tlm_scan_best()) break;
+        double best = 1e9;
+        for(int r = 0; r < REPEAT; r++){
+            double t0 = now_s();
+            size_t n = bench_scan((TlmScanImpl_t)impl, data, len);
+            double dt = now_s() - t0;
+            if(n != expected){ fprintf(stderr, "scan mismatch\n"); return 1; }
+            if(dt < best) best = dt;
+        }
+        report(impl_names[impl], len, expected, best);
+    }
+
+    printf("\nDecode (best of %d):\n", REPEAT);
+    struct { const char* name; size_t (*fn)(const uint8_t*, size_t); } decoders[] = {
+        { "tlm_feed",       bench_feed },
+        { "tlm_feed_batch", bench_feed_batch },
+    };
+
+    // sscanf is slow enough that one pass is representative
+    {
+        double t0 = now_s();
+        size_t n = bench_sscanf(buf, len);
+        report("sscanf (baseline)", len, n, now_s() - t0);
+    }
+    for(size_t d = 0; d < sizeof(decoders) / sizeof(decoders[0]); d++){
+        double best = 1e9;
+        size_t n = 0;
+        for(int r = 0; r < REPEAT; r++){
+            double t0 = now_s();
+            n = decoders[d].fn(data, len);
+            double dt = now_s() - t0;
+            if(dt < best) best = dt;
+        }
+        if(n != expected){ fprintf(stderr, "%s: decoded %zu of %zu lines\n", decoders[d].name, n, expected); return 1; }
+        report(decoders[d].name, len, n, best);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Range queries over the column store: answered from block headers (only
+// the edge blocks decoded) versus decoding every reading, on a synthetic
+// fleet. Both must agree.
+//
+//   ./bin/bench_query [devices=1000] [readings_per_device=20000] [file=/tmp/bench_query.tsdb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "clock.h"
+#include "column_store.h"
+#include "fleet_sim.h"
+#include "query.h"
+
+static bool same_stats(const RangeStats_t& a, const RangeStats_t& b){
+    if(a.count != b.count) return false;
+    if(a.count == 0) return true;
+    return a.t_first_ms == b.t_first_ms && a.t_last_ms == b.t_last_ms &&
+           a.percent_min == b.percent_min && a.percent_max == b.percent_max && a.percent_sum == b.percent_sum &&
+           a.water_min == b.water_min && a.water_max == b.water_max && a.water_sum == b.water_sum &&
+           !memcmp(a.status_count, b.status_count, sizeof(a.status_count)) && a.alert_count == b.alert_count;
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 20000;
+    const char* path = (argc > 3) ? argv[3] : "/tmp/bench_query.tsdb";
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+
+    // --- Build the store ---
+    printf("Writing %u devices x %u readings (%.1f h at 2 Hz)...\n", devices, per_device, per_device / 7200.0);
+    unlink(path);
+    {
+        static ColumnStore store;
+        if(store.open(path) < 0){
+            perror(path);
+            return 1;
+        }
+        std::vector<SimDevice_t> sims(devices);
+        for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+        for(uint32_t k = 0; k < per_device; k++){
+            for(uint32_t d = 0; d < devices; d++) store.on_reading(sim_next(&sims[d], (uint16_t)d));
+        }
+        store.close();
+    }
+
+    static BlockFile file;
+    if(file.open(path) < 0){
+        perror(path);
+        return 1;
+    }
+    RangeStats_t all;
+    query_range(file, QUERY_ALL_DEVICES, INT64_MIN, INT64_MAX, &all);
+    printf("%zu blocks, %llu readings\n\n", file.index().size(), (unsigned long long)all.count);
+
+    // Ranges end at a point inside the data so both edges cut blocks
+    int64_t end_ms = all.t_first_ms + (all.t_last_ms - all.t_first_ms) * 9 / 10;
+    struct { const char* name; int64_t span_ms; } ranges[] = {
+        { "1 min", 60000 }, { "10 min", 600000 }, { "1 h", 3600000 }, { "all", INT64_MAX / 2 },
+    };
+    uint16_t targets[] = { 7, QUERY_ALL_DEVICES };
+    bool ok = true;
+
+    printf("device  range    readings    index ms   decoded   scan ms  speedup\n");
+    for(uint16_t dev : targets){
+        for(auto& rg : ranges){
+            int64_t from = (rg.span_ms > end_ms) ? INT64_MIN : end_ms - rg.span_ms;
+            RangeStats_t fast, slow;
+
+            uint64_t t0 = now_us();
+            query_range(file, dev, from, end_ms, &fast);
+            uint64_t t1 = now_us();
+            query_range_scan(file, dev, from, end_ms, &slow);
+            uint64_t t2 = now_us();
+
+            bool match = same_stats(fast, slow);
+            ok = ok && match;
+            double fast_ms = (t1 - t0) / 1000.0, slow_ms = (t2 - t1) / 1000.0;
+            printf("%6s  %-7s %9llu  %10.3f  %8u  %8.1f  %6.0fx %s\n",
+                   dev == QUERY_ALL_DEVICES ? "all" : "7", rg.name, (unsigned long long)fast.count,
+                   fast_ms, fast.blocks_decoded, slow_ms, slow_ms / (fast_ms > 0.001 ? fast_ms : 0.001),
+                   match ? "" : "MISMATCH");
+        }
+    }
+    unlink(path);
+    return ok ? 0 : 1;
+}
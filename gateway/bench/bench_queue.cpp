@@ -0,0 +1,180 @@
+// Event queue contention: P producer threads push fixed-size events into one
+// queue drained by a single batch consumer. Compares the lock-free
+// EventQueue (per-event push and 32-event push_batch, as the ingest loops
+// use it) with the previous mutex + condvar ring.
+//
+//   ./bin/bench_queue [events_per_producer=2000000] [max_producers=8]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "event_queue.h"
+
+#define BENCH_CAPACITY      65536
+#define BENCH_BATCH         256
+#define BENCH_PUSH_BATCH    32      // Same as INGEST_EVENT_BATCH
+
+// Reference: the mutex-guarded ring EventQueue used before
+class MutexQueue {
+public:
+    explicit MutexQueue(uint32_t capacity) : slots_(new Event_t[capacity]), capacity_(capacity) {}
+    ~MutexQueue(){ delete[] slots_; }
+
+    bool push(const Event_t& ev){
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(count_ == capacity_){
+                dropped_++;
+                return false;
+            }
+            slots_[(head_ + count_) % capacity_] = ev;
+            count_++;
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    uint32_t pop_batch(Event_t* out, uint32_t max, uint32_t timeout_ms){
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(count_ == 0) not_empty_.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+
+        uint32_t n = 0;
+        while(n < max && count_ > 0){
+            out[n++] = slots_[head_];
+            head_ = (head_ + 1) % capacity_;
+            count_--;
+        }
+        return n;
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    Event_t* slots_;
+    uint32_t capacity_;
+    uint32_t head_ = 0;
+    uint32_t count_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+typedef struct {
+    double seconds;
+    uint64_t full;          // push() calls rejected (producers retried)
+    bool in_order;          // Per-producer FIFO order held
+} Result_t;
+
+template <class Q>
+static void produce(Q& queue, uint16_t id, uint64_t count){
+    Event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EVENT_READING;
+    ev.reading.device_id = id;
+
+    for(uint64_t i = 0; i < count; i++){
+        ev.reading.device_time_ms = (uint32_t)i;
+        while(!queue.push(ev)) std::this_thread::yield();
+    }
+}
+
+static void produce_batched(EventQueue& queue, uint16_t id, uint64_t count){
+    Event_t evs[BENCH_PUSH_BATCH];
+    memset(evs, 0, sizeof(evs));
+
+    for(uint64_t i = 0; i < count; i += BENCH_PUSH_BATCH){
+        uint32_t n = (count - i < BENCH_PUSH_BATCH) ? (uint32_t)(count - i) : BENCH_PUSH_BATCH;
+        for(uint32_t k = 0; k < n; k++){
+            evs[k].type = EVENT_READING;
+            evs[k].reading.device_id = id;
+            evs[k].reading.device_time_ms = (uint32_t)(i + k);
+        }
+        // A full ring queues only a prefix; resend the rest
+        uint32_t done = 0;
+        while(done < n){
+            done += queue.push_batch(evs + done, n - done);
+            if(done < n) std::this_thread::yield();
+        }
+    }
+}
+
+// Producers retry on full so every event is delivered and the run measures
+// sustained throughput; the rejected pushes show how often the ring filled
+template <class Q, bool BATCHED>
+static Result_t run(uint32_t producers, uint64_t per_producer){
+    Q queue(BENCH_CAPACITY);
+    std::atomic<uint32_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+
+    for(uint32_t p = 0; p < producers; p++){
+        threads.emplace_back([&, p]{
+            ready++;
+            while(!go) std::this_thread::yield();
+            if constexpr(BATCHED) produce_batched(queue, (uint16_t)p, per_producer);
+            else produce(queue, (uint16_t)p, per_producer);
+        });
+    }
+    while(ready < producers) std::this_thread::yield();
+
+    static Event_t batch[BENCH_BATCH];
+    std::vector<uint32_t> next(producers, 0);
+    uint64_t total = per_producer * producers;
+    uint64_t received = 0;
+    bool in_order = true;
+
+    uint64_t t0 = now_us();
+    go = true;
+    while(received < total){
+        uint32_t n = queue.pop_batch(batch, BENCH_BATCH, 10);
+        for(uint32_t i = 0; i < n; i++){
+            const Reading_t& r = batch[i].reading;
+            if(r.device_time_ms != next[r.device_id]) in_order = false;
+            next[r.device_id] = r.device_time_ms + 1;
+        }
+        received += n;
+    }
+    uint64_t t1 = now_us();
+    for(std::thread& t : threads) t.join();
+
+    Result_t res;
+    res.seconds = (t1 - t0) / 1e6;
+    res.full = queue.dropped();
+    res.in_order = in_order;
+    return res;
+}
+
+int main(int argc, char** argv){
+    uint64_t per_producer = (argc > 1) ? (uint64_t)atoll(argv[1]) : 2000000;
+    uint32_t max_producers = (argc > 2) ? (uint32_t)atoi(argv[2]) : 8;
+
+    printf("Event size %zu B, capacity %u, batch %u, %llu events per producer, %u CPUs\n\n",
+           sizeof(Event_t), BENCH_CAPACITY, BENCH_BATCH, (unsigned long long)per_producer,
+           std::thread::hardware_concurrency());
+    printf("producers  queue         Mevents/s   full pushes   order\n");
+
+    for(uint32_t p = 1; p <= max_producers; p *= 2){
+        Result_t res[3] = {
+            run<MutexQueue, false>(p, per_producer),
+            run<EventQueue, false>(p, per_producer),
+            run<EventQueue, true>(p, per_producer),
+        };
+        const char* names[3] = { "mutex", "lock-free", "lock-free x32" };
+        double total = (double)per_producer * p;
+
+        for(int i = 0; i < 3; i++){
+            printf("%9u  %-13s %9.2f  %12llu   %s\n", p, names[i], total / res[i].seconds / 1e6,
+                   (unsigned long long)res[i].full, res[i].in_order ? "ok" : "BROKEN");
+        }
+    }
+    return 0;
+}
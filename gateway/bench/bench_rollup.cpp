@@ -0,0 +1,121 @@
+// Rollups: ingest overhead of maintaining the 1m/1h/1d tiers, and hourly /
+// daily answers from rollup rows checked against a full decode of the raw
+// column store for the same buckets.
+//
+//   ./bin/bench_rollup [devices=1000] [readings_per_device=20000] [dir=/tmp/bench_rollup]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "column_store.h"
+#include "fleet_sim.h"
+#include "query.h"
+#include "rollup.h"
+
+static bool matches(const RangeStats_t& raw, const std::vector<RollupRow_t>& rows){
+    uint64_t count = 0, psum = 0, wsum = 0, alerts = 0;
+    uint32_t pmin = 0xFF, pmax = 0, wmin = 0xFFFF, wmax = 0;
+    for(const RollupRow_t& r : rows){
+        count += r.count;
+        psum += r.percent_sum;
+        wsum += r.water_sum;
+        alerts += r.alert_count;
+        if(!r.count) continue;
+        if(r.percent_min < pmin) pmin = r.percent_min;
+        if(r.percent_max > pmax) pmax = r.percent_max;
+        if(r.water_min < wmin) wmin = r.water_min;
+        if(r.water_max > wmax) wmax = r.water_max;
+    }
+    return count == raw.count && psum == raw.percent_sum && wsum == raw.water_sum && alerts == raw.alert_count &&
+           (count == 0 || (pmin == raw.percent_min && pmax == raw.percent_max &&
+                           wmin == raw.water_min && wmax == raw.water_max));
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 20000;
+    std::string dir = (argc > 3) ? argv[3] : "/tmp/bench_rollup";
+    std::string tsdb = dir + ".tsdb";
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+    uint64_t total = (uint64_t)devices * per_device;
+
+    printf("Generating %u devices x %u readings (%.1f h at 2 Hz)...\n", devices, per_device, per_device / 7200.0);
+    std::vector<Reading_t> readings(total);
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+    for(uint32_t k = 0; k < per_device; k++){
+        for(uint32_t d = 0; d < devices; d++) readings[(uint64_t)k * devices + d] = sim_next(&sims[d], (uint16_t)d);
+    }
+
+    if(system(("rm -rf " + dir + " " + tsdb).c_str()) != 0) return 1;
+
+    // --- Ingest: rollups alone, then raw store for the cross-check ---
+    static RollupStore rollups;
+    if(rollups.open(dir.c_str()) < 0){
+        perror(dir.c_str());
+        return 1;
+    }
+    uint64_t t0 = now_us();
+    for(uint64_t i = 0; i < total; i++){
+        rollups.on_reading(readings[i]);
+        if((i & 0xFFFF) == 0) rollups.flush();
+    }
+    rollups.close();
+    double s = (now_us() - t0) / 1e6;
+    printf("rollup ingest: %.2f M readings/s, rows written 1m %llu / 1h %llu / 1d %llu\n", total / s / 1e6,
+           (unsigned long long)rollups.rows_written(TIER_1M), (unsigned long long)rollups.rows_written(TIER_1H),
+           (unsigned long long)rollups.rows_written(TIER_1D));
+
+    {
+        static ColumnStore store;
+        if(store.open(tsdb.c_str()) < 0){
+            perror(tsdb.c_str());
+            return 1;
+        }
+        for(uint64_t i = 0; i < total; i++) store.on_reading(readings[i]);
+        store.close();
+    }
+    static BlockFile file;
+    file.open(tsdb.c_str());
+
+    // --- Whole-hour and whole-day windows: rollup rows vs raw decode ---
+    RangeStats_t all;
+    query_range(file, QUERY_ALL_DEVICES, INT64_MIN, INT64_MAX, &all);
+    int64_t hour = 3600000, day = 86400000;
+    int64_t h0 = (all.t_first_ms / hour + 1) * hour;
+    int64_t d0 = (all.t_first_ms / day) * day;
+
+    struct { const char* name; RollupTier_t tier; int64_t from, to; uint16_t dev; } cases[] = {
+        { "device 7, one hour, 1m rows", TIER_1M, h0, h0 + hour, 7 },
+        { "device 7, one hour, 1h rows", TIER_1H, h0, h0 + hour, 7 },
+        { "fleet, one hour, 1h rows",    TIER_1H, h0, h0 + hour, QUERY_ALL_DEVICES },
+        { "fleet, whole day, 1d rows",   TIER_1D, d0, d0 + day,  QUERY_ALL_DEVICES },
+    };
+    bool ok = true;
+
+    printf("\n%-30s %10s %8s %10s %10s\n", "query", "readings", "rows", "rollup ms", "raw ms");
+    for(auto& c : cases){
+        std::vector<RollupRow_t> rows;
+        RangeStats_t raw;
+
+        uint64_t a = now_us();
+        rollup_read(dir.c_str(), c.tier, c.dev, c.from, c.to, &rows);
+        uint64_t b = now_us();
+        query_range_scan(file, c.dev, c.from, c.to - 1, &raw);
+        uint64_t e = now_us();
+
+        bool match = matches(raw, rows);
+        ok = ok && match;
+        printf("%-30s %10llu %8zu %10.3f %10.1f %s\n", c.name, (unsigned long long)raw.count, rows.size(),
+               (b - a) / 1000.0, (e - b) / 1000.0, match ? "" : "MISMATCH");
+    }
+
+    if(system(("rm -rf " + dir + " " + tsdb).c_str()) != 0) return 1;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+// Alert rules: readings per second through the rule engine as the rule
+// count grows, with a realistic mix of thresholds, for-durations, windows
+// and group count() rules over 50-device farms. Firing rules go through the
+// alert tracker, as in the gateway, which folds them into incidents.
+//
+//   ./bin/bench_rules [devices=5000] [readings_per_device=200] [max_rules=1000]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "fleet_sim.h"
+#include "rules.h"
+
+#define FARM_SIZE   50
+
+// Rule k of a generated set; windows repeat every few rules, as they do in
+// real rule files
+static std::string make_rule(uint32_t k, uint32_t farms){
+    static const char* const windows[] = { "30s", "1m", "5m", "15m" };
+    char buf[160];
+    uint32_t farm = k % farms;
+    switch(k % 6){
+        case 0: snprintf(buf, sizeof(buf), "rule r%u: P > %u for 30s\n", k, 80 + k % 20); break;
+        case 1: snprintf(buf, sizeof(buf), "rule r%u: delta(W, %s) >= %u\n", k, windows[k % 4], 20 + k % 50); break;
+        case 2: snprintf(buf, sizeof(buf), "rule r%u in farm%u: avg(P, %s) < %u && S != EMPTY\n", k, farm, windows[k % 4], 5 + k % 10); break;
+        case 3: snprintf(buf, sizeof(buf), "rule r%u in farm%u: count(S == CONTAMINATED) >= %u\n", k, farm, 2 + k % 3); break;
+        case 4: snprintf(buf, sizeof(buf), "rule r%u: max(W, %s) - min(W, %s) > %u\n", k, windows[k % 4], windows[k % 4], 100 + k % 100); break;
+        default: snprintf(buf, sizeof(buf), "rule r%u in farm%u: W > %u or A == 1 for 5s\n", k, farm, 200 + k % 300); break;
+    }
+    return buf;
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 5000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 200;
+    uint32_t max_rules = (argc > 3) ? (uint32_t)atoi(argv[3]) : 1000;
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+    uint32_t farms = (devices + FARM_SIZE - 1) / FARM_SIZE;
+    uint64_t total = (uint64_t)devices * per_device;
+
+    printf("Generating %u devices x %u readings in %u farms...\n", devices, per_device, farms);
+    std::vector<Reading_t> readings(total);
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+    for(uint32_t k = 0; k < per_device; k++){
+        for(uint32_t d = 0; d < devices; d++) readings[(uint64_t)k * devices + d] = sim_next(&sims[d], (uint16_t)d);
+    }
+
+    std::string groups;
+    for(uint32_t f = 0; f < farms; f++){
+        uint32_t last = (f + 1) * FARM_SIZE - 1;
+        if(last >= devices) last = devices - 1;
+        groups += "group farm" + std::to_string(f) + " " + std::to_string(f * FARM_SIZE) + "-" + std::to_string(last) + "\n";
+    }
+
+    printf("\n%8s %8s %14s %16s %10s %12s %10s %10s\n", "rules", "windows", "readings/s", "rule evals/s", "ns/eval",
+           "transitions", "notified", "limited");
+    for(uint32_t n = 10; n <= max_rules; n *= 10){
+        std::string text = groups;
+        for(uint32_t k = 0; k < n; k++) text += make_rule(k, farms);
+
+        AlertTracker* alerts = new AlertTracker();
+        RuleEngine* engine = new RuleEngine(alerts);
+        std::string error;
+        if(engine->compile(text.c_str(), "generated", &error) < 0){
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+
+        uint64_t t0 = now_us();
+        for(uint64_t i = 0; i < total; i++){
+            engine->on_reading(readings[i]);
+            if((i & 0xFFF) == 0) alerts->tick((int64_t)(readings[i].rx_time_us / 1000));
+        }
+        double s = (now_us() - t0) / 1e6;
+
+        uint64_t notified = 0;
+        for(uint8_t t = 0; t < ALERT_EVENT_COUNT; t++) notified += alerts->events((AlertEventType_t)t);
+        printf("%8u %8zu %14.0f %16.0f %10.1f %12llu %10llu %10llu\n", n, engine->window_count(), total / s,
+               engine->evaluations() / s, s * 1e9 / engine->evaluations(), (unsigned long long)engine->transitions(),
+               (unsigned long long)notified, (unsigned long long)alerts->rate_limited());
+        delete engine;
+        delete alerts;
+    }
+    return 0;
+}
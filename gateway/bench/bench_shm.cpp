@@ -0,0 +1,221 @@
+// Shared-memory ring: publish cost on the dispatcher, reader throughput,
+// writer-to-reader delivery latency against a CSV line over a Unix socket,
+// and a reader too slow for a small ring, which must see only whole
+// records, in order, with everything else counted as lost.
+//
+// Readings carry a counter in every field so a torn or reordered copy shows
+// up. For the latency runs the writer stamps rx_time_us with monotonic
+// nanoseconds instead of the wall clock.
+//
+//   ./bin/bench_shm [records=10000000] [latency_samples=200000]
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "shm_ring.h"
+
+#define RING_NAME       "tankgw-bench"
+#define READ_BATCH      256
+#define GAP_US          20      // Between latency samples
+
+static inline uint64_t mono_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static Reading_t make(uint64_t i){
+    Reading_t r;
+    memset(&r, 0, sizeof(r));
+    r.rx_time_us = i;
+    r.device_time_ms = (uint32_t)i;
+    r.device_id = (uint16_t)(i % MAX_DEVICES);
+    r.percent = (uint16_t)(i % 101);
+    r.water_adc = (uint16_t)(i % 1024);
+    r.status = (uint8_t)(i % STATUS_COUNT);
+    r.alert = (uint8_t)(i & 1);
+    return r;
+}
+
+static bool intact(const Reading_t& r){
+    uint64_t i = r.device_time_ms;
+    return r.device_id == i % MAX_DEVICES && r.percent == i % 101 && r.water_adc == i % 1024 &&
+           r.status == i % STATUS_COUNT && r.alert == (i & 1);
+}
+
+static void print_latency(const char* name, std::vector<uint64_t>* ns){
+    if(ns->empty()) return;
+    std::sort(ns->begin(), ns->end());
+    size_t n = ns->size();
+    printf("%-22s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", name, (*ns)[n / 2], (*ns)[n * 99 / 100],
+           (*ns)[n * 999 / 1000], (*ns)[n - 1]);
+}
+
+// Writer and reader spin, yielding so they can share a core
+static void shm_latency(uint32_t samples){
+    ShmPublisher pub;
+    ShmReader reader;
+    pub.open(RING_NAME, SHM_SLOTS_DEFAULT);
+    reader.open(RING_NAME, false);
+    std::vector<uint64_t> ns;
+    ns.reserve(samples);
+
+    std::atomic<bool> done(false);
+    std::thread t([&]{
+        Reading_t batch[READ_BATCH];
+        while(ns.size() < samples){
+            uint32_t n = reader.read(batch, READ_BATCH);
+            uint64_t now = mono_ns();
+            for(uint32_t i = 0; i < n; i++) ns.push_back(now - batch[i].rx_time_us);
+            if(!n) sched_yield();
+        }
+        done = true;
+    });
+    for(uint64_t i = 0; !done; i++){
+        Reading_t r = make(i);
+        r.rx_time_us = mono_ns();
+        pub.on_reading(r);
+        uint64_t until = mono_us() + GAP_US;
+        while(mono_us() < until && !done) sched_yield();
+    }
+    t.join();
+    print_latency("shm ring", &ns);
+}
+
+static void socket_latency(uint32_t samples){
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0){
+        perror("socketpair");
+        return;
+    }
+    std::vector<uint64_t> ns;
+    ns.reserve(samples);
+    std::atomic<bool> done(false);
+    std::thread t([&]{
+        char buf[4096];
+        size_t have = 0;
+        while(ns.size() < samples){
+            ssize_t n = recv(sv[1], buf + have, sizeof(buf) - have, 0);
+            if(n <= 0) break;
+            have += (size_t)n;
+            uint64_t now = mono_ns();
+            char* line = buf;
+            char* nl;
+            while((nl = (char*)memchr(line, '\n', have - (size_t)(line - buf)))){
+                unsigned long long stamp;
+                unsigned dev, t_ms, p, w, s, a;
+                if(sscanf(line, "%llu,%u,%u,%u,%u,%u,%u", &stamp, &dev, &t_ms, &p, &w, &s, &a) == 7) ns.push_back(now - stamp);
+                line = nl + 1;
+            }
+            have -= (size_t)(line - buf);
+            memmove(buf, line, have);
+        }
+        done = true;
+    });
+    for(uint64_t i = 0; !done; i++){
+        Reading_t r = make(i);
+        char line[96];
+        int n = snprintf(line, sizeof(line), "%" PRIu64 ",%u,%" PRIu32 ",%u,%u,%u,%u\n", mono_ns(), (unsigned)r.device_id,
+                         r.device_time_ms, (unsigned)r.percent, (unsigned)r.water_adc, (unsigned)r.status, (unsigned)r.alert);
+        if(send(sv[0], line, (size_t)n, MSG_NOSIGNAL) < 0) break;
+        uint64_t until = mono_us() + GAP_US;
+        while(mono_us() < until && !done) sched_yield();
+    }
+    t.join();
+    close(sv[0]);
+    close(sv[1]);
+    print_latency("CSV over unix socket", &ns);
+}
+
+int main(int argc, char** argv){
+    uint64_t records = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    uint32_t samples = (argc > 2) ? (uint32_t)atoi(argv[2]) : 200000;
+    std::vector<Reading_t> readings(READ_BATCH);
+    bool ok = true;
+
+    // --- Publish and read cost, one thread ---
+    {
+        ShmPublisher pub;
+        if(pub.open(RING_NAME, SHM_SLOTS_DEFAULT) < 0){
+            perror("/dev/shm/" RING_NAME);
+            return 1;
+        }
+        ShmReader reader;
+        uint64_t t0 = mono_us();
+        for(uint64_t i = 0; i < records; i++) pub.on_reading(make(i));
+        double publish_ns = (mono_us() - t0) * 1000.0 / records;
+
+        // Read back in ring-sized rounds
+        reader.open(RING_NAME, false);
+        uint64_t got = 0, read_ns = 0, rounds = records / SHM_SLOTS_DEFAULT + 1;
+        for(uint64_t k = 0; k < rounds; k++){
+            for(uint32_t i = 0; i < SHM_SLOTS_DEFAULT / 2; i++) pub.on_reading(make(pub.published()));
+            uint64_t t1 = mono_us();
+            uint32_t n;
+            while((n = reader.read(&readings[0], READ_BATCH))){
+                for(uint32_t i = 0; i < n; i++) ok &= intact(readings[i]);
+                got += n;
+            }
+            read_ns += (mono_us() - t1) * 1000;
+        }
+        printf("publish: %.1f ns/reading (%.0f M/s)\n", publish_ns, 1000.0 / publish_ns);
+        printf("read:    %.1f ns/reading (%.0f M/s), %" PRIu64 " read, %" PRIu64 " lost\n\n", (double)read_ns / got,
+               got * 1000.0 / read_ns, got, reader.lost());
+    }
+
+    // --- Delivery latency ---
+    printf("%u samples, one every %u us (ns)\n", samples, GAP_US);
+    printf("%-22s %10s %10s %10s %10s\n", "", "p50", "p99", "p99.9", "max");
+    shm_latency(samples);
+    socket_latency(samples);
+
+    // --- Overrun ---
+    // A 4096-slot ring and a reader that naps every batch
+    {
+        ShmPublisher pub;
+        ShmReader reader;
+        pub.open(RING_NAME, 4096);
+        reader.open(RING_NAME, false);
+        std::atomic<bool> done(false);
+        uint64_t got = 0, torn = 0, backwards = 0;
+        std::thread t([&]{
+            uint64_t last = 0;
+            std::vector<Reading_t> batch(READ_BATCH);
+            while(true){
+                bool finished = done.load();
+                uint32_t n = reader.read(&batch[0], READ_BATCH);
+                for(uint32_t i = 0; i < n; i++){
+                    if(!intact(batch[i])) torn++;
+                    if(got && batch[i].rx_time_us <= last) backwards++;
+                    last = batch[i].rx_time_us;
+                    got++;
+                }
+                if(!n && finished) break;
+                usleep(100);
+            }
+        });
+        uint64_t total = records / 10;
+        for(uint64_t i = 0; i < total; i++){
+            pub.on_reading(make(i));
+            if(i % 1024 == 0) sched_yield();
+        }
+        done = true;
+        t.join();
+        printf("\noverrun: %" PRIu64 " published, %" PRIu64 " read + %" PRIu64 " lost, %" PRIu64 " torn, %" PRIu64
+               " out of order\n", total, got, reader.lost(), torn, backwards);
+        ok &= !torn && !backwards && got + reader.lost() == total;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+// Columnar store: append throughput, bytes per reading and a full decode
+// round trip over a synthetic fleet that behaves like the firmware (500 ms
+// cadence, slowly moving level, ADC noise of a few LSB, serial latency
+// jitter on the receive time).
+//
+//   ./bin/bench_store [devices=1000] [readings_per_device=10000] [file=/tmp/bench_store.tsdb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "block.h"
+#include "clock.h"
+#include "column_store.h"
+#include "fleet_sim.h"
+
+static bool same(const Reading_t& a, const Reading_t& b){
+    return a.rx_time_us / 1000 == b.rx_time_us / 1000 && a.device_time_ms == b.device_time_ms &&
+           a.device_id == b.device_id && a.percent == b.percent && a.water_adc == b.water_adc &&
+           a.status == b.status && a.alert == b.alert;
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    uint32_t per_device = (argc > 2) ? (uint32_t)atoi(argv[2]) : 10000;
+    const char* path = (argc > 3) ? argv[3] : "/tmp/bench_store.tsdb";
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+    uint64_t total = (uint64_t)devices * per_device;
+
+    // Pre-generate so the timing covers only the store
+    printf("Generating %u devices x %u readings...\n", devices, per_device);
+    std::vector<Reading_t> readings(total);
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+    for(uint32_t k = 0; k < per_device; k++){
+        for(uint32_t d = 0; d < devices; d++) readings[(uint64_t)k * devices + d] = sim_next(&sims[d], (uint16_t)d);
+    }
+
+    size_t csv_bytes = 0;
+    char line[80];
+    for(uint64_t i = 0; i < total; i += 97){
+        const Reading_t& r = readings[i];
+        csv_bytes += (size_t)snprintf(line, sizeof(line), "%llu,%u,%u,%u,%u,%u,%u\n",
+                                      (unsigned long long)r.rx_time_us, r.device_id, r.device_time_ms,
+                                      r.percent, r.water_adc, r.status, r.alert);
+    }
+    double csv_per_reading = (double)csv_bytes / (double)((total + 96) / 97);
+
+    // --- Encode only ---
+    {
+        std::vector<BlockBuilder*> builders;
+        for(uint32_t d = 0; d < devices; d++) builders.push_back(new BlockBuilder((uint16_t)d));
+        static uint8_t block[BLOCK_SIZE];
+        uint64_t sealed = 0;
+
+        uint64_t t0 = now_us();
+        for(uint64_t i = 0; i < total; i++){
+            BlockBuilder* b = builders[readings[i].device_id];
+            if(!b->append(readings[i])){
+                b->seal(block);
+                sealed++;
+                b->append(readings[i]);
+            }
+        }
+        double s = (now_us() - t0) / 1e6;
+        printf("encode:  %7.2f M readings/s (%llu blocks sealed)\n", total / s / 1e6, (unsigned long long)sealed);
+        for(BlockBuilder* b : builders) delete b;
+    }
+
+    // --- Store (encode + write) ---
+    unlink(path);
+    ColumnStore store;
+    if(store.open(path) < 0){
+        perror(path);
+        return 1;
+    }
+    uint64_t t0 = now_us();
+    for(uint64_t i = 0; i < total; i++) store.on_reading(readings[i]);
+    store.close();
+    double s = (now_us() - t0) / 1e6;
+
+    printf("append:  %7.2f M readings/s into %s\n", total / s / 1e6, path);
+    printf("size:    %.1f MB for %llu readings = %.3f bytes/reading (CSV: %.1f bytes/reading, %.0fx)\n",
+           store.file_bytes() / 1e6, (unsigned long long)total, (double)store.file_bytes() / total,
+           csv_per_reading, csv_per_reading / ((double)store.file_bytes() / total));
+
+    // --- Reopen, decode everything, compare ---
+    ColumnStore check;
+    if(check.open(path) < 0){
+        perror(path);
+        return 1;
+    }
+    FILE* f = fopen(path, "rb");
+    std::vector<uint32_t> next(devices, 0);
+    static uint8_t block[BLOCK_SIZE];
+    static Reading_t out[BLOCK_MAX_READINGS];
+    uint64_t decoded = 0, mismatched = 0;
+
+    t0 = now_us();
+    for(const BlockRef_t& ref : check.index()){
+        fseek(f, (long)ref.block_no * BLOCK_SIZE, SEEK_SET);
+        if(fread(block, 1, BLOCK_SIZE, f) != BLOCK_SIZE || !block_check(block)){
+            mismatched++;
+            continue;
+        }
+        uint32_t n = block_decode(block, out, BLOCK_MAX_READINGS);
+        for(uint32_t i = 0; i < n; i++){
+            uint32_t d = out[i].device_id;
+            if(!same(out[i], readings[(uint64_t)next[d]++ * devices + d])) mismatched++;
+        }
+        decoded += n;
+    }
+    s = (now_us() - t0) / 1e6;
+    fclose(f);
+
+    printf("decode:  %7.2f M readings/s, %llu/%llu readings, %llu mismatches\n",
+           decoded / s / 1e6, (unsigned long long)decoded, (unsigned long long)total, (unsigned long long)mismatched);
+    unlink(path);
+    return (decoded == total && mismatched == 0) ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+// Column store throughput against durability settings: no WAL, WAL left to
+// the page cache, fsync on a timer, and fsync on every group commit at
+// several commit sizes (the dispatcher commits once per drained batch).
+//
+//   ./bin/bench_wal [devices=1000] [readings=2000000] [path=/tmp/bench_wal.tsdb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "column_store.h"
+#include "fleet_sim.h"
+
+typedef struct {
+    const char* name;
+    bool wal;
+    int32_t sync_ms;
+    uint32_t batch;         // Readings per flush() / group commit
+} Setting_t;
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    uint64_t total = (argc > 2) ? (uint64_t)atoll(argv[2]) : 2000000;
+    std::string path = (argc > 3) ? argv[3] : "/tmp/bench_wal.tsdb";
+    std::string clean = "rm -rf " + path + " " + path + ".wal";
+    if(devices == 0 || devices > MAX_DEVICES) devices = MAX_DEVICES;
+
+    std::vector<Reading_t> readings(total);
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+    for(uint64_t i = 0; i < total; i++) readings[i] = sim_next(&sims[i % devices], (uint16_t)(i % devices));
+
+    const Setting_t settings[] = {
+        { "no WAL",                 false, 0,              256 },
+        { "WAL, never fsync",       true,  WAL_SYNC_NEVER, 256 },
+        { "WAL, fsync every 100ms", true,  100,            256 },
+        { "WAL, fsync every 10ms",  true,  10,             256 },
+        { "WAL, fsync per commit",  true,  0,              256 },
+        { "WAL, fsync per commit",  true,  0,              32 },
+        { "WAL, fsync per commit",  true,  0,              1 },
+    };
+
+    printf("%u devices, %llu readings per run (fewer for small commits)\n\n", devices, (unsigned long long)total);
+    printf("%-24s %6s %12s %10s %10s %10s\n", "setting", "batch", "readings/s", "commits", "fsyncs", "WAL MB");
+
+    for(const Setting_t& s : settings){
+        if(system(clean.c_str()) != 0) return 1;
+
+        // fsync per reading is slow enough that a slice says as much
+        uint64_t n = total;
+        if(s.sync_ms == 0 && (uint64_t)s.batch * 20000 < n) n = (uint64_t)s.batch * 20000;
+
+        static ColumnStore store;
+        WalConfig_t cfg = WAL_DEFAULTS;
+        cfg.sync_ms = s.sync_ms;
+        if(store.open(path.c_str(), s.wal ? &cfg : NULL) < 0){
+            perror(path.c_str());
+            return 1;
+        }
+
+        uint64_t wal_bytes = 0, commits = 0, syncs = 0;
+        uint64_t t0 = now_us();
+        for(uint64_t i = 0; i < n; i++){
+            store.on_reading(readings[i]);
+            if((i + 1) % s.batch == 0) store.flush();
+        }
+        store.flush();
+        double secs = (now_us() - t0) / 1e6;
+        if(store.wal()){
+            const WriteAheadLog* wal = store.wal();
+            commits = wal->commits();
+            syncs = wal->syncs();
+            wal_bytes = (uint64_t)(wal->segment() - 1) * cfg.segment_bytes + wal->bytes();
+        }
+        store.close();
+
+        printf("%-24s %6u %12.0f %10llu %10llu %10.1f\n", s.name, s.batch, n / secs,
+               (unsigned long long)commits, (unsigned long long)syncs, wal_bytes / 1e6);
+    }
+
+    if(system(clean.c_str()) != 0) return 1;
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Live stream fan-out: the fleet's readings at their real rate to N
+// WebSocket subscribers, unfiltered and filtered, then with a few stalled
+// subscribers whose drop policy must not hold back the others.
+//
+// Reports messages delivered per second, the dispatcher's cost per reading
+// and the server thread's CPU (process CPU less the feeding and reading
+// threads). The subscribers are read in-process by one thread, so on a
+// small machine the large unfiltered cases measure that thread as much as
+// the server; only the stalled-subscriber case decides the exit status.
+//
+//   ./bin/bench_ws [devices=10000] [seconds=5]
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "fleet_sim.h"
+#include "websocket.h"
+
+#define FLUSH_MS        10      // Dispatcher flush cadence under load
+#define DRAIN_MS        5000    // For subscribers to catch up at the end
+
+struct Subscriber {
+    int fd;
+    bool stalled;               // Never reads
+    uint32_t first, last;       // Device range, or all
+    uint64_t expected;
+    uint64_t frames;
+    std::string in;
+};
+
+static double thread_cpu_s(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double process_cpu_s(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+//  SUBSCRIBERS
+static int subscribe(uint16_t port, const char* query, Subscriber* s){
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -errno;
+    if(s->stalled){
+        int small = 4096;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -errno;
+    }
+
+    char req[512];
+    int n = snprintf(req, sizeof(req), "GET /live%s HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", query);
+    if(send(fd, req, (size_t)n, MSG_NOSIGNAL) != n){
+        close(fd);
+        return -EIO;
+    }
+
+    // Read the 101 reply; whatever follows it is frames
+    char buf[4096];
+    while(s->in.find("\r\n\r\n") == std::string::npos){
+        ssize_t r = recv(fd, buf, sizeof(buf), 0);
+        if(r <= 0){
+            close(fd);
+            return -EIO;
+        }
+        s->in.append(buf, (size_t)r);
+    }
+    if(s->in.compare(0, 12, "HTTP/1.1 101")){
+        close(fd);
+        return -EPROTO;
+    }
+    s->in.erase(0, s->in.find("\r\n\r\n") + 4);
+    s->fd = fd;
+    return 0;
+}
+
+// Count complete server frames (unmasked, short) in `s->in`
+static void parse(Subscriber* s){
+    size_t off = 0;
+    while(s->in.size() - off >= 2){
+        const uint8_t* p = (const uint8_t*)s->in.data() + off;
+        size_t len = p[1] & 0x7F, header = 2;
+        if(len == 126){
+            if(s->in.size() - off < 4) break;
+            len = (size_t)((p[2] << 8) | p[3]);
+            header = 4;
+        }
+        if(s->in.size() - off < header + len) break;
+        if((p[0] & 0x0F) == 0x1) s->frames++;
+        off += header + len;
+    }
+    s->in.erase(0, off);
+}
+
+static void read_all(std::vector<Subscriber>* subs, std::atomic<bool>* running, double* cpu){
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    for(size_t i = 0; i < subs->size(); i++){
+        if((*subs)[i].stalled) continue;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, (*subs)[i].fd, &ev);
+    }
+    struct epoll_event evs[256];
+    char buf[65536];
+    while(running->load()){
+        int n = epoll_wait(ep, evs, 256, 20);
+        for(int i = 0; i < n; i++){
+            Subscriber* s = &(*subs)[evs[i].data.u64];
+            ssize_t r = recv(s->fd, buf, sizeof(buf), 0);
+            if(r <= 0){
+                epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, NULL);
+                continue;
+            }
+            s->in.append(buf, (size_t)r);
+            parse(s);
+        }
+    }
+    close(ep);
+    *cpu = thread_cpu_s();
+}
+
+//  DRIVER
+static bool run_case(const char* name, uint32_t devices, uint32_t seconds, uint32_t normal, uint32_t stalled, bool filtered){
+    LiveStream* live = new LiveStream();
+    if(live->start(0, NULL) < 0){
+        perror("listen");
+        return false;
+    }
+
+    // Filtered subscribers watch ten devices each, spread over the fleet
+    std::vector<Subscriber> subs(normal + stalled);
+    for(uint32_t i = 0; i < subs.size(); i++){
+        Subscriber* s = &subs[i];
+        s->fd = -1;
+        s->stalled = i >= normal;
+        s->first = 0;
+        s->last = devices - 1;
+        s->expected = s->frames = 0;
+        char query[64] = "";
+        if(filtered){
+            s->first = (i * 10) % devices;
+            s->last = std::min(s->first + 9, devices - 1);
+            snprintf(query, sizeof(query), "?devices=%u-%u", s->first, s->last);
+        }
+        if(s->stalled) snprintf(query, sizeof(query), "?policy=drop-old&buffer=64");
+        int rc = subscribe(live->port(), query, s);
+        if(rc < 0){
+            fprintf(stderr, "subscriber %u: %s\n", i, strerror(-rc));
+            return false;
+        }
+    }
+    while(live->clients() < subs.size()) usleep(1000);
+
+    std::atomic<bool> running(true);
+    double reader_cpu = 0;
+    std::thread reader(read_all, &subs, &running, &reader_cpu);
+
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++) sim_init(&sims[d], d);
+
+    // The fleet reports every 500 ms; spread each round over its flushes
+    uint32_t per_flush = std::max<uint32_t>(1, devices * 2 * FLUSH_MS / 1000);
+    std::vector<uint64_t> per_device(devices, 0);
+    uint64_t fed = 0, dispatch_ns = 0;
+    uint32_t next_dev = 0;
+    double cpu0 = process_cpu_s(), main0 = thread_cpu_s();
+    uint64_t t0 = mono_us(), deadline = t0 + (uint64_t)seconds * 1000000;
+    for(uint64_t tick = mono_us(); tick < deadline; tick += FLUSH_MS * 1000){
+        uint64_t d0 = mono_us();
+        for(uint32_t i = 0; i < per_flush; i++){
+            live->on_reading(sim_next(&sims[next_dev], (uint16_t)next_dev));
+            per_device[next_dev]++;
+            next_dev = (next_dev + 1) % devices;
+        }
+        live->flush();
+        dispatch_ns += (mono_us() - d0) * 1000;
+        fed += per_flush;
+        uint64_t now = mono_us();
+        if(tick + FLUSH_MS * 1000 > now) usleep((useconds_t)(tick + FLUSH_MS * 1000 - now));
+    }
+    double main_cpu = thread_cpu_s() - main0;
+    for(size_t k = 0; k < subs.size(); k++){
+        for(uint32_t d = subs[k].first; d <= subs[k].last; d++) subs[k].expected += per_device[d];
+    }
+
+    // Let the normal subscribers drain
+    uint64_t drain_deadline = mono_ms() + DRAIN_MS;
+    bool complete = false;
+    while(!complete && mono_ms() < drain_deadline){
+        complete = true;
+        for(uint32_t i = 0; i < normal; i++) if(subs[i].frames < subs[i].expected) complete = false;
+        if(!complete) usleep(1000);
+    }
+    double s = (mono_us() - t0) / 1e6;
+    running = false;
+    reader.join();
+    double server_cpu = process_cpu_s() - cpu0 - main_cpu - reader_cpu;
+
+    uint64_t delivered = 0, short_subs = 0;
+    for(uint32_t i = 0; i < normal; i++){
+        delivered += subs[i].frames;
+        if(subs[i].frames < subs[i].expected) short_subs++;
+    }
+    printf("%-22s %6u %12.0f %10.0f %10" PRIu64 " %9.1f%% %10.0f%s\n", name, (unsigned)subs.size(), fed / (double)seconds,
+           delivered / s, live->dropped(), 100.0 * server_cpu / s, fed ? (double)dispatch_ns / fed : 0.0,
+           short_subs ? "  (some subscribers short)" : "");
+
+    for(size_t i = 0; i < subs.size(); i++) close(subs[i].fd);
+    live->stop();
+    delete live;
+    return !short_subs;
+}
+
+int main(int argc, char** argv){
+    uint32_t devices = (argc > 1) ? (uint32_t)atoi(argv[1]) : 10000;
+    uint32_t seconds = (argc > 2) ? (uint32_t)atoi(argv[2]) : 5;
+    if(devices > MAX_DEVICES) devices = MAX_DEVICES;
+    if(devices < 10) devices = 10;
+    signal(SIGPIPE, SIG_IGN);
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    printf("%u devices at 2 readings/s, %u s per case\n\n", devices, seconds);
+    printf("%-22s %6s %12s %10s %10s %10s %10s\n", "case", "subs", "readings/s", "msgs/s", "dropped", "server", "ns/reading");
+    static const uint32_t counts[] = { 1, 10, 100, 1000 };
+    for(uint32_t i = 0; i < 4; i++) run_case("all devices", devices, seconds, counts[i], 0, false);
+    run_case("10 devices each", devices, seconds, 1000, 0, true);
+    return run_case("100 + 10 stalled", devices, seconds, 100, 10, false) ? 0 : 1;
+}
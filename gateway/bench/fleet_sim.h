@@ -0,0 +1,63 @@
+#ifndef GATEWAY_BENCH_FLEET_SIM_H
+#define GATEWAY_BENCH_FLEET_SIM_H
+
+// Deterministic readings that behave like the firmware: 500 ms cadence,
+// slowly moving level, ADC noise of a few LSB, serial latency jitter on the
+// receive time and the odd contamination event. Shared by the store benches.
+
+#include <stdint.h>
+#include "reading.h"
+
+typedef struct {
+    uint64_t rng;
+    uint64_t boot_us;       // Wall clock at device T = 0
+    uint32_t t_ms;
+    int32_t  level;         // Percent
+    int32_t  water_base;
+} SimDevice_t;
+
+static inline uint32_t xorshift(uint64_t* s){
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return (uint32_t)(x >> 32);
+}
+
+static inline void sim_init(SimDevice_t* d, uint32_t id){
+    d->rng = 0x9E3779B97F4A7C15ULL * (id + 1);
+    d->boot_us = 1700000000000000ULL + (uint64_t)(xorshift(&d->rng) % 3600) * 1000000ULL;
+    d->t_ms = 100;
+    d->level = (int32_t)(xorshift(&d->rng) % 101);
+    d->water_base = 20 + (int32_t)(xorshift(&d->rng) % 60);
+}
+
+static inline Reading_t sim_next(SimDevice_t* d, uint16_t id){
+    Reading_t r;
+    uint32_t roll = xorshift(&d->rng);
+
+    d->t_ms += 500;
+    if(roll % 64 == 0) d->level += (roll & 64) ? 1 : -1;     // Slow fill / drain
+    if(d->level < 0) d->level = 0;
+    if(d->level > 100) d->level = 100;
+
+    int32_t noise = (int32_t)((roll >> 8) % 3) - 1;          // +-1 LSB
+    if(roll % 997 == 0) d->water_base += 150;                // Rare contamination event
+    if(d->water_base > 100 && roll % 41 == 0) d->water_base -= 150;
+
+    r.device_id = id;
+    r.device_time_ms = d->t_ms;
+    r.rx_time_us = d->boot_us + (uint64_t)d->t_ms * 1000ULL + 30000 + ((roll >> 16) % 900);
+    r.percent = (uint16_t)d->level;
+    r.water_adc = (uint16_t)(d->water_base + noise);
+
+    if(r.water_adc > 100) r.status = STATUS_CONTAMINATED;
+    else if(r.percent >= 80) r.status = STATUS_OVERFLOW;
+    else if(r.percent > 50) r.status = STATUS_HALF_FULL;
+    else r.status = STATUS_EMPTY;
+    r.alert = (r.status == STATUS_CONTAMINATED || r.status == STATUS_OVERFLOW);
+    return r;
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include "alerts.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "sinks.h"
+
+#define TABLE_MASK  (ALERT_TABLE_SIZE - 1)
+
+static inline uint32_t slot_of(uint64_t key){
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key & TABLE_MASK;
+}
+
+const char* alert_event_name(uint8_t type){
+    switch(type){
+        case ALERT_OPENED:     return "OPENED";
+        case ALERT_UPDATED:    return "UPDATED";
+        case ALERT_RESOLVED:   return "RESOLVED";
+        case ALERT_FLAPPING:   return "FLAPPING";
+        case ALERT_SUPPRESSED: return "SUPPRESSED";
+        default:               return "UNKNOWN";
+    }
+}
+
+void alert_print(FILE* out, const AlertEvent_t& ev){
+    if(ev.type == ALERT_SUPPRESSED){
+        fprintf(out, "alerts: %u notifications dropped by the rate limit\n", ev.suppressed);
+        return;
+    }
+
+    const Reading_t& r = ev.detail.reading;
+    if(ev.detail.group) fprintf(out, "group %s: ", ev.detail.group);
+    else fprintf(out, "dev%u: ", (unsigned)r.device_id);
+    fprintf(out, "%s %s #%u", ev.detail.name, alert_event_name(ev.type), ev.incident);
+
+    switch(ev.type){
+        case ALERT_OPENED:
+            break;
+        case ALERT_UPDATED:
+            fprintf(out, ", open %" PRId64 " s, %u repeats", (ev.at_ms - ev.opened_ms) / 1000, ev.repeats);
+            break;
+        case ALERT_RESOLVED:
+            fprintf(out, " after %" PRId64 " s%s\n", (ev.at_ms - ev.opened_ms) / 1000, ev.stale ? " (no data)" : "");
+            return;
+        case ALERT_FLAPPING:
+            fprintf(out, ", holding notifications until it settles");
+            break;
+        default:
+            break;
+    }
+    if(ev.detail.group) fprintf(out, " (last dev%u", (unsigned)r.device_id);
+    fprintf(out, "%sP:%u W:%u S:%s)\n", ev.detail.group ? " " : " (",
+            (unsigned)r.percent, (unsigned)r.water_adc, status_name(r.status));
+}
+
+//  TRACKER
+AlertTracker::AlertTracker(const AlertConfig_t& cfg)
+    : cfg_(cfg), table_(new Entry_t[ALERT_TABLE_SIZE]), used_(0), next_incident_(0), last_tick_ms_(0),
+      tokens_(cfg.burst), tokens_ms_(0), suppressed_(0), notify_(NULL), ctx_(NULL),
+      coalesced_(0), rate_limited_(0), overflow_(0) {
+    memset(table_, 0, sizeof(Entry_t) * ALERT_TABLE_SIZE);
+    memset(events_, 0, sizeof(events_));
+}
+
+AlertTracker::~AlertTracker(){
+    delete[] table_;
+}
+
+AlertTracker::Entry_t* AlertTracker::find(uint64_t key){
+    for(uint32_t i = slot_of(key); table_[i].key; i = (i + 1) & TABLE_MASK){
+        if(table_[i].key == key) return &table_[i];
+    }
+    return NULL;
+}
+
+AlertTracker::Entry_t* AlertTracker::insert(uint64_t key){
+    if(used_ >= ALERT_TABLE_MAX_LOAD) return NULL;
+    uint32_t i = slot_of(key);
+    while(table_[i].key) i = (i + 1) & TABLE_MASK;
+    memset(&table_[i], 0, sizeof(Entry_t));
+    table_[i].key = key;
+    used_++;
+    return &table_[i];
+}
+
+// Backward-shift deletion: later entries of the probe run move up, so
+// lookups never need tombstones
+void AlertTracker::erase(uint32_t slot){
+    uint32_t hole = slot;
+    for(uint32_t j = (hole + 1) & TABLE_MASK; table_[j].key; j = (j + 1) & TABLE_MASK){
+        uint32_t home = slot_of(table_[j].key);
+        bool stays = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if(stays) continue;
+        table_[hole] = table_[j];
+        hole = j;
+    }
+    table_[hole].key = 0;
+    used_--;
+}
+
+// Token bucket; updates give way first, at half the bucket
+bool AlertTracker::take_token(AlertEventType_t type, int64_t now_ms){
+    if(!tokens_ms_) tokens_ms_ = now_ms;
+    if(now_ms > tokens_ms_){
+        tokens_ += (now_ms - tokens_ms_) * cfg_.rate_per_s / 1000.0;
+        if(tokens_ > cfg_.burst) tokens_ = cfg_.burst;
+        tokens_ms_ = now_ms;
+    }
+    if(tokens_ < 1 || (type == ALERT_UPDATED && tokens_ < cfg_.burst / 2.0)) return false;
+    tokens_ -= 1;
+    return true;
+}
+
+void AlertTracker::emit(Entry_t* e, AlertEventType_t type, int64_t now_ms, uint8_t stale){
+    if(!take_token(type, now_ms)){
+        rate_limited_++;
+        suppressed_++;
+        e->last_event_ms = now_ms;  // An update retries after update_ms, not on every packet
+        return;
+    }
+
+    AlertEvent_t ev;
+    ev.type = type;
+    ev.key = e->key;
+    ev.incident = e->incident;
+    ev.detail = e->detail;
+    ev.opened_ms = e->opened_ms;
+    ev.at_ms = now_ms;
+    ev.repeats = e->repeats;
+    ev.suppressed = 0;
+    ev.stale = stale;
+    ev.active = e->state != ST_CLEAR;
+
+    e->notified = e->detail;
+    e->last_event_ms = now_ms;
+    e->repeats = 0;
+    events_[type]++;
+    if(notify_) notify_(ctx_, ev);
+}
+
+void AlertTracker::open_incident(Entry_t* e, int64_t now_ms){
+    if(now_ms - e->flap_start_ms > cfg_.flap_window_ms){
+        e->flap_start_ms = now_ms;
+        e->flap_count = 0;
+    }
+    e->flap_count++;
+    e->state = ST_OPEN;
+    e->opened_ms = now_ms;
+    e->last_change_ms = now_ms;
+    e->repeats = 0;
+    e->incident = ++next_incident_;
+
+    if(e->flapping) return;
+    if(e->flap_count >= cfg_.flap_opens){
+        e->flapping = 1;
+        emit(e, ALERT_FLAPPING, now_ms);
+        return;
+    }
+    emit(e, ALERT_OPENED, now_ms);
+}
+
+void AlertTracker::close_incident(Entry_t* e, int64_t now_ms, uint8_t stale){
+    e->state = ST_CLEAR;
+    e->last_change_ms = now_ms;
+    if(!e->flapping) emit(e, ALERT_RESOLVED, now_ms, stale);
+}
+
+void AlertTracker::observe(uint64_t key, bool active, int64_t now_ms, const AlertDetail_t& detail){
+    Entry_t* e = find(key);
+    if(!e){
+        if(!active) return;     // Nothing open, nothing to remember
+        e = insert(key);
+        if(!e){
+            overflow_++;
+            return;
+        }
+    }
+    e->last_seen_ms = now_ms;
+    e->detail = detail;
+
+    if(!active){
+        if(e->state == ST_OPEN){
+            e->state = ST_RESOLVING;
+            e->inactive_ms = now_ms;
+        }
+        return;
+    }
+
+    switch(e->state){
+        case ST_CLEAR:
+            open_incident(e, now_ms);
+            break;
+        case ST_RESOLVING:      // Back within resolve_ms: same incident
+            e->state = ST_OPEN;
+            e->repeats++;
+            coalesced_++;
+            break;
+        default:
+            e->repeats++;
+            coalesced_++;
+            if(!e->flapping && detail.reading.status != e->notified.reading.status &&
+               now_ms - e->last_event_ms >= cfg_.update_ms){
+                emit(e, ALERT_UPDATED, now_ms);
+            }
+            break;
+    }
+}
+
+void AlertTracker::tick(int64_t now_ms){
+    if(now_ms - last_tick_ms_ < ALERT_TICK_MS) return;
+    last_tick_ms_ = now_ms;
+
+    for(uint32_t i = 0; i < ALERT_TABLE_SIZE; ){
+        Entry_t* e = &table_[i];
+        if(!e->key){
+            i++;
+            continue;
+        }
+        if(e->state == ST_RESOLVING && now_ms - e->inactive_ms >= cfg_.resolve_ms) close_incident(e, now_ms, 0);
+        else if(e->state != ST_CLEAR && now_ms - e->last_seen_ms >= cfg_.stale_ms) close_incident(e, now_ms, 1);
+
+        // Settled: restate where the key ended up
+        if(e->flapping && now_ms - e->last_change_ms >= cfg_.flap_window_ms){
+            e->flapping = 0;
+            e->flap_count = 0;
+            emit(e, e->state == ST_CLEAR ? ALERT_RESOLVED : ALERT_UPDATED, now_ms);
+        }
+        if(e->state == ST_CLEAR && !e->flapping && now_ms - e->last_change_ms >= cfg_.flap_window_ms){
+            erase(i);           // The next entry may have moved into slot i
+            continue;
+        }
+        i++;
+    }
+
+    // Own budget check, so the summary itself never counts as dropped
+    if(suppressed_ && take_token(ALERT_UPDATED, now_ms)){
+        AlertEvent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = ALERT_SUPPRESSED;
+        ev.at_ms = now_ms;
+        ev.suppressed = suppressed_;
+        suppressed_ = 0;
+        events_[ALERT_SUPPRESSED]++;
+        if(notify_) notify_(ctx_, ev);
+    }
+}
+
+uint32_t AlertTracker::open() const {
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < ALERT_TABLE_SIZE; i++) n += (table_[i].key && table_[i].state != ST_CLEAR);
+    return n;
+}
@@ -0,0 +1,157 @@
+#ifndef GATEWAY_ALERTS_H
+#define GATEWAY_ALERTS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "reading.h"
+
+// ALERT LIFECYCLE
+//
+// Devices repeat A:1 in every packet while a condition holds, and rules
+// report each transition, including ones that flap. The tracker turns these
+// observations into incidents, one per key (the A flag of a device, or a
+// rule on a device or group), so notification sinks see:
+//
+//   OPENED      first activation
+//   UPDATED     still active, and the status changed; at most once per
+//               update_ms, with the number of observations coalesced
+//   RESOLVED    inactive for resolve_ms (re-activation within it continues
+//               the incident), or no observation for stale_ms
+//   FLAPPING    flap_opens incidents within flap_window_ms: further opens
+//               and resolves are held back until the key has been stable
+//               for flap_window_ms, then the current state is restated
+//   SUPPRESSED  the notification rate limit dropped events; sent when it
+//               recovers, with the count
+//
+// Incidents live in a fixed open-addressing table (ALERT_TABLE_SIZE slots,
+// allocated once); settled keys are forgotten after flap_window_ms, and new
+// keys beyond ALERT_TABLE_MAX_LOAD are counted but not tracked.
+#define ALERT_TABLE_SIZE        65536   // Power of two
+#define ALERT_TABLE_MAX_LOAD    49152   // 75%
+#define ALERT_TICK_MS           1000    // Timer scan period
+
+typedef struct {
+    int64_t  resolve_ms;        // Inactive this long before RESOLVED
+    int64_t  update_ms;         // Minimum spacing of UPDATED per incident
+    int64_t  stale_ms;          // Open with no observation this long: RESOLVED
+    uint32_t flap_opens;        // Incidents within flap_window_ms that count as flapping
+    int64_t  flap_window_ms;
+    uint32_t rate_per_s;        // Notification rate limit...
+    uint32_t burst;             // ...and bucket size
+} AlertConfig_t;
+
+static const AlertConfig_t ALERT_DEFAULTS = { 10000, 300000, 60000, 4, 600000, 20, 200 };
+
+typedef enum {
+    ALERT_OPENED = 0,
+    ALERT_UPDATED,
+    ALERT_RESOLVED,
+    ALERT_FLAPPING,
+    ALERT_SUPPRESSED,
+    ALERT_EVENT_COUNT
+} AlertEventType_t;
+
+// Key subjects: a device id, or ALERT_GROUP | group id
+#define ALERT_GROUP             0x10000u
+#define ALERT_SOURCE_FLAG       0       // The device's own A flag; rules are 1 + rule index
+
+static inline uint64_t alert_key(uint32_t source, uint32_t subject){
+    return (1ULL << 63) | ((uint64_t)source << 32) | subject;
+}
+
+// What an observation says about its key; strings must outlive the tracker
+typedef struct {
+    const char* name;           // "alert" for the A flag, else the rule name
+    const char* group;          // Group rules: the group name, else NULL
+    Reading_t   reading;        // The reading that caused the observation
+} AlertDetail_t;
+
+typedef struct {
+    AlertEventType_t type;
+    uint64_t key;
+    uint32_t incident;          // Sequence number, shared by an incident's events
+    AlertDetail_t detail;       // Latest observation
+    int64_t  opened_ms;         // Epoch ms, from reading receive times
+    int64_t  at_ms;
+    uint32_t repeats;           // Active observations since the previous event
+    uint32_t suppressed;        // ALERT_SUPPRESSED: events dropped
+    uint8_t  stale;             // ALERT_RESOLVED: no data rather than inactive
+    uint8_t  active;            // Restated state after flapping
+} AlertEvent_t;
+
+typedef void (*AlertNotifyFn)(void* ctx, const AlertEvent_t& ev);
+
+class AlertTracker {
+public:
+    AlertTracker(const AlertConfig_t& cfg = ALERT_DEFAULTS);
+    ~AlertTracker();
+
+    // Notifications go to `fn` (NULL = counted only)
+    void set_notify(AlertNotifyFn fn, void* ctx) { notify_ = fn; ctx_ = ctx; }
+
+    // `key` was observed active or inactive at `now_ms`
+    void observe(uint64_t key, bool active, int64_t now_ms, const AlertDetail_t& detail);
+
+    // Timers (resolve, stale, flap end, forgetting); scans at most every ALERT_TICK_MS
+    void tick(int64_t now_ms);
+
+    const AlertConfig_t& config() const { return cfg_; }
+    uint32_t tracked() const { return used_; }
+    uint32_t open() const;
+    uint64_t events(AlertEventType_t type) const { return events_[type]; }
+    uint64_t coalesced() const { return coalesced_; }       // Observations absorbed into open incidents
+    uint64_t rate_limited() const { return rate_limited_; }
+    uint64_t overflow() const { return overflow_; }         // Keys not tracked for lack of room
+
+private:
+    typedef enum { ST_CLEAR = 0, ST_OPEN, ST_RESOLVING } State_t;
+
+    typedef struct {
+        uint64_t key;               // 0 = empty slot
+        AlertDetail_t detail;
+        AlertDetail_t notified;     // As of the last event
+        int64_t  opened_ms;
+        int64_t  last_seen_ms;      // Last observation, active or not
+        int64_t  inactive_ms;       // ST_RESOLVING since
+        int64_t  last_event_ms;
+        int64_t  flap_start_ms;     // Current flap counting window
+        int64_t  last_change_ms;    // Last open or resolve, for flap end
+        uint32_t incident;
+        uint32_t repeats;
+        uint16_t flap_count;
+        uint8_t  state;
+        uint8_t  flapping;
+    } Entry_t;
+
+    Entry_t* find(uint64_t key);
+    Entry_t* insert(uint64_t key);
+    void erase(uint32_t slot);
+    void emit(Entry_t* e, AlertEventType_t type, int64_t now_ms, uint8_t stale = 0);
+    void open_incident(Entry_t* e, int64_t now_ms);
+    void close_incident(Entry_t* e, int64_t now_ms, uint8_t stale);
+    bool take_token(AlertEventType_t type, int64_t now_ms);
+
+    AlertConfig_t cfg_;
+    Entry_t* table_;                // [ALERT_TABLE_SIZE]
+    uint32_t used_;
+    uint32_t next_incident_;
+    int64_t  last_tick_ms_;
+    double   tokens_;
+    int64_t  tokens_ms_;
+    uint32_t suppressed_;           // Since the last SUPPRESSED event
+    AlertNotifyFn notify_;
+    void* ctx_;
+
+    uint64_t events_[ALERT_EVENT_COUNT];
+    uint64_t coalesced_;
+    uint64_t rate_limited_;
+    uint64_t overflow_;
+};
+
+const char* alert_event_name(uint8_t type);
+
+// One line per event, as the alert log prints them
+void alert_print(FILE* out, const AlertEvent_t& ev);
+
+#endif
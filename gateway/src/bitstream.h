@@ -0,0 +1,75 @@
+#ifndef GATEWAY_BITSTREAM_H
+#define GATEWAY_BITSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// MSB-first bit packing for the block codecs. Bits are gathered in a 64-bit
+// accumulator and spilled a byte at a time into an owned buffer that keeps
+// its capacity across reset().
+class BitWriter {
+public:
+    // Append the low `n` bits of `v` (n <= 57)
+    inline void put(uint64_t v, uint32_t n){
+        acc_ = (acc_ << n) | (v & ((1ULL << n) - 1));
+        fill_ += n;
+        while(fill_ >= 8){
+            fill_ -= 8;
+            bytes_.push_back((uint8_t)(acc_ >> fill_));
+        }
+    }
+
+    // Bits written so far, including the unflushed tail
+    size_t bits() const { return bytes_.size() * 8 + fill_; }
+
+    // Pad the last byte with zeros
+    void finish(){
+        if(fill_) bytes_.push_back((uint8_t)(acc_ << (8 - fill_)));
+        acc_ = 0;
+        fill_ = 0;
+    }
+
+    void reset(){
+        bytes_.clear();
+        acc_ = 0;
+        fill_ = 0;
+    }
+
+    const uint8_t* data() const { return bytes_.data(); }
+    size_t size() const { return bytes_.size(); }     // Whole bytes (call finish() first)
+    void reserve(size_t n){ bytes_.reserve(n); }
+
+private:
+    std::vector<uint8_t> bytes_;
+    uint64_t acc_ = 0;
+    uint32_t fill_ = 0;
+};
+
+// Reads back what BitWriter produced. Past the end it returns zero bits,
+// so a corrupt column can't read outside its block.
+class BitReader {
+public:
+    BitReader() : p_(NULL), end_(NULL) {}
+    BitReader(const uint8_t* data, size_t len) : p_(data), end_(data + len) {}
+
+    // Next `n` bits (n <= 57)
+    inline uint64_t get(uint32_t n){
+        while(fill_ < n){
+            acc_ = (acc_ << 8) | (p_ < end_ ? *p_++ : 0);
+            fill_ += 8;
+        }
+        fill_ -= n;
+        return (acc_ >> fill_) & ((1ULL << n) - 1);
+    }
+
+    inline uint32_t bit(){ return (uint32_t)get(1); }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    uint64_t acc_ = 0;
+    uint32_t fill_ = 0;
+};
+
+#endif
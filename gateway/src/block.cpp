@@ -0,0 +1,256 @@
+#include "block.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.h"
+
+// Worst case for one reading: two 68-bit escaped deltas, two 26-bit XOR
+// values and a 4-bit state symbol, plus per-column padding at seal time
+#define READING_MAX_BITS    (68 + 68 + 26 + 26 + 4)
+#define SEAL_SLACK_BITS     (COL_COUNT * 8)
+
+//  DELTA-OF-DELTA
+// '0'            same interval as last time
+// '10'   +  5    [-16, 15]       receive-time jitter
+// '110'  +  9    [-256, 255]
+// '1110' + 13    [-4096, 4095]
+// '1111' + 64    anything (clock steps, device reboots)
+static void dod_put(BitWriter* w, DodState_t* s, int64_t value){
+    int64_t delta = value - s->prev;
+    int64_t dod = delta - s->prev_delta;
+    s->prev = value;
+    s->prev_delta = delta;
+
+    if(dod == 0){
+        w->put(0, 1);
+    } else if(dod >= -16 && dod < 16){
+        w->put(0x2, 2);
+        w->put((uint64_t)dod, 5);
+    } else if(dod >= -256 && dod < 256){
+        w->put(0x6, 3);
+        w->put((uint64_t)dod, 9);
+    } else if(dod >= -4096 && dod < 4096){
+        w->put(0xE, 4);
+        w->put((uint64_t)dod, 13);
+    } else {
+        w->put(0xF, 4);
+        w->put((uint64_t)dod >> 32, 32);
+        w->put((uint64_t)dod, 32);
+    }
+}
+
+static inline int64_t sign_extend(uint64_t v, uint32_t bits){
+    uint64_t m = 1ULL << (bits - 1);
+    return (int64_t)((v ^ m) - m);
+}
+
+static int64_t dod_get(BitReader* r, DodState_t* s){
+    int64_t dod;
+    if(!r->bit()) dod = 0;
+    else if(!r->bit()) dod = sign_extend(r->get(5), 5);
+    else if(!r->bit()) dod = sign_extend(r->get(9), 9);
+    else if(!r->bit()) dod = sign_extend(r->get(13), 13);
+    else {
+        uint64_t hi = r->get(32);
+        dod = (int64_t)((hi << 32) | r->get(32));
+    }
+    s->prev_delta += dod;
+    s->prev += s->prev_delta;
+    return s->prev;
+}
+
+//  XOR (16-bit values)
+// '0'                          unchanged
+// '10' + window bits           changed bits fit the previous window
+// '11' + 4 lead + 4 (len-1) + len bits   new window
+static void xor_put(BitWriter* w, XorState_t* s, uint16_t value){
+    uint32_t x = (uint32_t)(value ^ s->prev);
+    s->prev = value;
+
+    if(x == 0){
+        w->put(0, 1);
+        return;
+    }
+    uint32_t lead = (uint32_t)__builtin_clz(x) - 16;
+    uint32_t trail = (uint32_t)__builtin_ctz(x);
+
+    if(s->lead != 0xFF && lead >= s->lead && trail >= s->trail){
+        w->put(0x2, 2);
+        w->put(x >> s->trail, 16 - s->lead - s->trail);
+    } else {
+        uint32_t len = 16 - lead - trail;
+        w->put(0x3, 2);
+        w->put(lead, 4);
+        w->put(len - 1, 4);
+        w->put(x >> trail, len);
+        s->lead = (uint8_t)lead;
+        s->trail = (uint8_t)trail;
+    }
+}
+
+static uint16_t xor_get(BitReader* r, XorState_t* s){
+    if(r->bit()){
+        if(!r->bit()){
+            if(s->lead == 0xFF) return s->prev; // Corrupt column: no window yet
+            uint32_t len = 16 - s->lead - s->trail;
+            s->prev ^= (uint16_t)(r->get(len) << s->trail);
+        } else {
+            uint32_t lead = (uint32_t)r->get(4);
+            uint32_t len = (uint32_t)r->get(4) + 1;
+            uint32_t trail = 16 - lead - len;
+            if(lead + len > 16) trail = 0; // Corrupt column; keep shifts defined
+            s->prev ^= (uint16_t)(r->get(len) << trail);
+            s->lead = (uint8_t)lead;
+            s->trail = (uint8_t)trail;
+        }
+    }
+    return s->prev;
+}
+
+//  BUILDER
+BlockBuilder::BlockBuilder(uint16_t device_id) : device_id_(device_id) {
+    for(uint8_t c = 0; c < COL_COUNT; c++) cols_[c].reserve(BLOCK_PAYLOAD / 2);
+    reset();
+}
+
+void BlockBuilder::reset(){
+    memset(&hdr_, 0, sizeof(hdr_));
+    hdr_.magic = BLOCK_MAGIC;
+    hdr_.device_id = device_id_;
+    hdr_.water_min = 0xFFFF;
+    hdr_.percent_min = 0xFF;
+
+    for(uint8_t c = 0; c < COL_COUNT; c++) cols_[c].reset();
+    memset(&time_, 0, sizeof(time_));
+    memset(&devtime_, 0, sizeof(devtime_));
+    percent_.prev = 0;
+    percent_.lead = 0xFF;
+    water_.prev = 0;
+    water_.lead = 0xFF;
+    state_ = 0xFF;
+}
+
+bool BlockBuilder::append(const Reading_t& r){
+    size_t bits = 0;
+    for(uint8_t c = 0; c < COL_COUNT; c++) bits += cols_[c].bits();
+    if(hdr_.count == BLOCK_MAX_READINGS || bits + READING_MAX_BITS + SEAL_SLACK_BITS > BLOCK_PAYLOAD * 8){
+        return false;
+    }
+    int64_t t_ms = (int64_t)(r.rx_time_us / 1000);
+    if(hdr_.count > 0 && t_ms < hdr_.t_last_ms) return false;
+
+    if(hdr_.count == 0){
+        // The first receive time lives in the header, T starts from zero
+        time_.prev = t_ms;
+        hdr_.t_first_ms = t_ms;
+    } else {
+        dod_put(&cols_[COL_TIME], &time_, t_ms);
+    }
+    dod_put(&cols_[COL_DEVTIME], &devtime_, (int64_t)r.device_time_ms);
+    xor_put(&cols_[COL_PERCENT], &percent_, r.percent);
+    xor_put(&cols_[COL_WATER], &water_, r.water_adc);
+
+    uint8_t state = (uint8_t)((r.status & 0x3) | ((r.alert & 1) << 2));
+    if(state == state_){
+        cols_[COL_STATE].put(0, 1);
+    } else {
+        cols_[COL_STATE].put(0x8 | state, 4);
+        state_ = state;
+    }
+
+    // --- Summary ---
+    hdr_.count++;
+    hdr_.t_last_ms = t_ms;
+    hdr_.percent_sum += r.percent;
+    hdr_.water_sum += r.water_adc;
+    if(r.percent < hdr_.percent_min) hdr_.percent_min = (uint8_t)r.percent;
+    if(r.percent > hdr_.percent_max) hdr_.percent_max = (uint8_t)r.percent;
+    if(r.water_adc < hdr_.water_min) hdr_.water_min = r.water_adc;
+    if(r.water_adc > hdr_.water_max) hdr_.water_max = r.water_adc;
+    hdr_.status_count[r.status & 0x3]++;
+    hdr_.alert_count += r.alert & 1;
+    return true;
+}
+
+void BlockBuilder::seal(uint8_t* out){
+    memset(out, 0, BLOCK_SIZE);
+
+    uint8_t* p = out + BLOCK_HEADER_SIZE;
+    for(uint8_t c = 0; c < COL_COUNT; c++){
+        cols_[c].finish();
+        hdr_.col_bytes[c] = (uint16_t)cols_[c].size();
+        memcpy(p, cols_[c].data(), cols_[c].size());
+        p += cols_[c].size();
+    }
+
+    hdr_.crc = 0;
+    memcpy(out, &hdr_, sizeof(hdr_));
+    uint32_t crc = crc32(out, BLOCK_SIZE);
+    memcpy(out + offsetof(BlockHeader_t, crc), &crc, sizeof(crc));
+
+    reset();
+}
+
+//  READING
+bool block_check(const uint8_t* block){
+    BlockHeader_t hdr;
+    memcpy(&hdr, block, sizeof(hdr));
+    if(hdr.magic != BLOCK_MAGIC || hdr.count == 0) return false;
+
+    uint32_t total = 0;
+    for(uint8_t c = 0; c < COL_COUNT; c++) total += hdr.col_bytes[c];
+    if(total > BLOCK_PAYLOAD) return false;
+
+    uint32_t zero = 0;
+    uint32_t crc = crc32_update(0, block, offsetof(BlockHeader_t, crc));
+    crc = crc32_update(crc, &zero, sizeof(zero));
+    crc = crc32_update(crc, block + offsetof(BlockHeader_t, crc) + 4, BLOCK_SIZE - offsetof(BlockHeader_t, crc) - 4);
+    return crc == hdr.crc;
+}
+
+void BlockCursor::start(const uint8_t* block){
+    hdr_ = (const BlockHeader_t*)block;
+    i_ = 0;
+    n_ = hdr_->count;
+
+    const uint8_t* p = block + BLOCK_HEADER_SIZE;
+    time_r_ = BitReader(p, hdr_->col_bytes[COL_TIME]);
+    p += hdr_->col_bytes[COL_TIME];
+    devtime_r_ = BitReader(p, hdr_->col_bytes[COL_DEVTIME]);
+    p += hdr_->col_bytes[COL_DEVTIME];
+    percent_r_ = BitReader(p, hdr_->col_bytes[COL_PERCENT]);
+    p += hdr_->col_bytes[COL_PERCENT];
+    water_r_ = BitReader(p, hdr_->col_bytes[COL_WATER]);
+    p += hdr_->col_bytes[COL_WATER];
+    state_r_ = BitReader(p, hdr_->col_bytes[COL_STATE]);
+
+    time_ = { hdr_->t_first_ms, 0 };
+    devtime_ = { 0, 0 };
+    percent_ = { 0, 0xFF, 0 };
+    water_ = { 0, 0xFF, 0 };
+    state_ = 0;
+}
+
+bool BlockCursor::next(Reading_t* out){
+    if(i_ >= n_) return false;
+
+    int64_t t_ms = (i_ == 0) ? hdr_->t_first_ms : dod_get(&time_r_, &time_);
+    out->rx_time_us = (uint64_t)t_ms * 1000ULL;
+    out->device_time_ms = (uint32_t)dod_get(&devtime_r_, &devtime_);
+    out->device_id = hdr_->device_id;
+    out->percent = xor_get(&percent_r_, &percent_);
+    out->water_adc = xor_get(&water_r_, &water_);
+    if(state_r_.bit()) state_ = (uint8_t)state_r_.get(3);
+    out->status = state_ & 0x3;
+    out->alert = (state_ >> 2) & 1;
+    i_++;
+    return true;
+}
+
+uint32_t block_decode(const uint8_t* block, Reading_t* out, uint32_t max){
+    BlockCursor cur(block);
+    uint32_t n = 0;
+    while(n < max && cur.next(&out[n])) n++;
+    return n;
+}
@@ -0,0 +1,153 @@
+#ifndef GATEWAY_BLOCK_H
+#define GATEWAY_BLOCK_H
+
+#include <stdint.h>
+#include "bitstream.h"
+#include "reading.h"
+
+// COLUMNAR BLOCK FORMAT
+//
+// Readings of one device are packed into fixed-size blocks: a 64-byte
+// summary header followed by five byte-aligned, bit-packed columns.
+//
+//   time     gateway receive time in ms, delta-of-delta
+//   devtime  T (device uptime ms), delta-of-delta
+//   percent  P, XOR with previous value (Gorilla-style windows)
+//   water    W, XOR with previous value
+//   state    S and A as one 3-bit symbol, 1 bit when unchanged
+//
+// At the firmware's 500 ms cadence a steady tank costs ~1.5 bytes per
+// reading. Receive times are kept at millisecond resolution.
+#define BLOCK_SIZE          4096
+#define BLOCK_HEADER_SIZE   64
+#define BLOCK_PAYLOAD       (BLOCK_SIZE - BLOCK_HEADER_SIZE)
+#define BLOCK_MAGIC         0x31425354u     // "TSB1"
+#define BLOCK_MAX_READINGS  0xFFFF
+
+typedef enum {
+    COL_TIME = 0,
+    COL_DEVTIME,
+    COL_PERCENT,
+    COL_WATER,
+    COL_STATE,
+    COL_COUNT
+} Column_t;
+
+// Summary header; lets range queries skip or answer whole blocks without
+// decoding them. Little-endian on disk.
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;                   // CRC-32 of the block with this field zeroed
+    uint16_t device_id;
+    uint16_t count;                 // Readings in the block
+    uint16_t alert_count;           // Readings with A = 1
+    uint16_t water_min;
+    int64_t  t_first_ms;            // Receive time of the first / last reading
+    int64_t  t_last_ms;
+    uint32_t percent_sum;
+    uint32_t water_sum;
+    uint16_t col_bytes[COL_COUNT];  // Column lengths, laid out in Column_t order
+    uint16_t water_max;
+    uint8_t  percent_min;
+    uint8_t  percent_max;
+    uint16_t _pad;
+    uint16_t status_count[STATUS_COUNT];
+} BlockHeader_t;
+
+static_assert(sizeof(BlockHeader_t) == BLOCK_HEADER_SIZE, "block header must be 64 bytes");
+
+// Per-column encoder state
+typedef struct {
+    int64_t  prev;
+    int64_t  prev_delta;
+} DodState_t;
+
+typedef struct {
+    uint16_t prev;
+    uint8_t  lead;      // Leading / trailing zeros of the current XOR window
+    uint8_t  trail;
+} XorState_t;
+
+// Accumulates one device's readings into an open block. Columns grow in
+// their own buffers and are laid out back to back by seal(); buffers keep
+// their capacity between blocks so steady-state appends don't allocate.
+class BlockBuilder {
+public:
+    explicit BlockBuilder(uint16_t device_id);
+    BlockBuilder(const BlockBuilder&) = delete;
+    BlockBuilder& operator=(const BlockBuilder&) = delete;
+
+    // False when the block is full, or when the receive time steps back
+    // (clock change) so t_first/t_last always bound a block's readings;
+    // seal() it and append again
+    bool append(const Reading_t& r);
+
+    uint16_t device_id() const { return device_id_; }
+    uint16_t count() const { return hdr_.count; }
+    bool empty() const { return hdr_.count == 0; }
+    const BlockHeader_t& header() const { return hdr_; }
+
+    // Write the block image (BLOCK_SIZE bytes) and start a new block
+    void seal(uint8_t* out);
+
+private:
+    void reset();
+
+    uint16_t device_id_;
+    BlockHeader_t hdr_;
+    BitWriter cols_[COL_COUNT];
+    DodState_t time_;
+    DodState_t devtime_;
+    XorState_t percent_;
+    XorState_t water_;
+    uint8_t state_;
+};
+
+// Decodes a sealed block's readings one at a time straight from the block
+// image, e.g. a mapped file: nothing is copied or buffered. The image must
+// stay valid while the cursor is in use.
+class BlockCursor {
+public:
+    BlockCursor() : hdr_(NULL), i_(0), n_(0) {}
+    explicit BlockCursor(const uint8_t* block) { start(block); }
+
+    void start(const uint8_t* block);
+
+    // Next reading; false once the block is exhausted. rx_time_us is
+    // restored at ms resolution.
+    bool next(Reading_t* out);
+
+    bool done() const { return i_ >= n_; }
+    const BlockHeader_t& header() const { return *hdr_; }
+
+private:
+    const BlockHeader_t* hdr_;
+    uint32_t i_;
+    uint32_t n_;
+    BitReader time_r_;
+    BitReader devtime_r_;
+    BitReader percent_r_;
+    BitReader water_r_;
+    BitReader state_r_;
+    DodState_t time_;
+    DodState_t devtime_;
+    XorState_t percent_;
+    XorState_t water_;
+    uint8_t state_;
+};
+
+// A sealed block's position in its file and a copy of its header, enough
+// to skip or summarise the block without reading it
+typedef struct {
+    uint32_t block_no;      // Offset in the file / BLOCK_SIZE
+    BlockHeader_t hdr;
+} BlockRef_t;
+
+// Validate magic, CRC and column lengths
+bool block_check(const uint8_t* block);
+
+// Decode up to `max` readings (all of them when max >= count). Returns the
+// number decoded. rx_time_us is restored at ms resolution.
+uint32_t block_decode(const uint8_t* block, Reading_t* out, uint32_t max);
+
+#endif
@@ -0,0 +1,164 @@
+#include "capture.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "clock.h"
+
+static size_t put_varint(uint8_t* p, uint64_t v){
+    size_t n = 0;
+    while(v >= 0x80){
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+CaptureWriter::CaptureWriter()
+    : file_(NULL), channels_(0), last_us_(0), records_(0), payload_(0), file_bytes_(0) {}
+
+CaptureWriter::~CaptureWriter(){
+    close();
+}
+
+int CaptureWriter::open(const char* path, const std::vector<std::string>& channels){
+    if(channels.empty() || channels.size() > UINT16_MAX) return -EINVAL;
+    close();
+    file_ = fopen(path, "wb");
+    if(!file_) return -errno;
+    setvbuf(file_, NULL, _IOFBF, 1 << 16);
+
+    CaptureHeader_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CAPTURE_MAGIC;
+    hdr.channels = (uint16_t)channels.size();
+    hdr.start_us = now_us();
+    fwrite(&hdr, sizeof(hdr), 1, file_);
+    file_bytes_ = sizeof(hdr);
+
+    for(const std::string& name : channels){
+        uint8_t len = (uint8_t)(name.size() > 255 ? 255 : name.size());
+        fputc(len, file_);
+        fwrite(name.data(), 1, len, file_);
+        file_bytes_ += 1 + len;
+    }
+    channels_ = hdr.channels;
+    last_us_ = mono_us();
+    records_ = payload_ = 0;
+    return ferror(file_) ? -EIO : 0;
+}
+
+int CaptureWriter::write(uint16_t channel, uint64_t mono_us, const uint8_t* data, size_t len){
+    if(!file_) return -EBADF;
+    if(channel >= channels_) return -EINVAL;
+
+    while(len > 0){
+        size_t n = len > CAPTURE_CHUNK_MAX ? CAPTURE_CHUNK_MAX : len;
+        uint8_t hdr[30];
+        size_t h = put_varint(hdr, mono_us > last_us_ ? mono_us - last_us_ : 0);
+        h += put_varint(hdr + h, channel);
+        h += put_varint(hdr + h, n);
+        if(mono_us > last_us_) last_us_ = mono_us;
+
+        if(fwrite(hdr, 1, h, file_) != h || fwrite(data, 1, n, file_) != n) return -EIO;
+        file_bytes_ += h + n;
+        payload_ += n;
+        records_++;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int CaptureWriter::flush(){
+    if(!file_) return -EBADF;
+    return fflush(file_) == 0 ? 0 : -errno;
+}
+
+void CaptureWriter::close(){
+    if(!file_) return;
+    fclose(file_);
+    file_ = NULL;
+}
+
+CaptureReader::CaptureReader()
+    : file_(NULL), start_us_(0), t_us_(0), truncated_(false) {}
+
+CaptureReader::~CaptureReader(){
+    close();
+}
+
+int CaptureReader::open(const char* path){
+    close();
+    file_ = fopen(path, "rb");
+    if(!file_) return -errno;
+    setvbuf(file_, NULL, _IOFBF, 1 << 16);
+
+    CaptureHeader_t hdr;
+    if(fread(&hdr, sizeof(hdr), 1, file_) != 1 || hdr.magic != CAPTURE_MAGIC || hdr.channels == 0){
+        close();
+        return -EINVAL;
+    }
+    names_.clear();
+    for(uint16_t i = 0; i < hdr.channels; i++){
+        int len = fgetc(file_);
+        char name[256];
+        if(len == EOF || fread(name, 1, (size_t)len, file_) != (size_t)len){
+            close();
+            return -EINVAL;
+        }
+        names_.push_back(std::string(name, (size_t)len));
+    }
+    start_us_ = hdr.start_us;
+    t_us_ = 0;
+    truncated_ = false;
+    return 0;
+}
+
+void CaptureReader::close(){
+    if(file_) fclose(file_);
+    file_ = NULL;
+}
+
+// 1 = value, 0 = clean end of file, -1 = cut off or malformed
+int CaptureReader::read_varint(uint64_t* v){
+    uint64_t x = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        int c = fgetc(file_);
+        if(c == EOF) return shift == 0 && !ferror(file_) ? 0 : -1;
+        x |= (uint64_t)(c & 0x7F) << shift;
+        if(!(c & 0x80)){
+            *v = x;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+bool CaptureReader::next(CaptureRecord_t* rec){
+    if(!file_) return false;
+
+    uint64_t dt, channel, len;
+    int rc = read_varint(&dt);
+    if(rc <= 0){
+        truncated_ = rc < 0;
+        return false;
+    }
+    if(read_varint(&channel) <= 0 || read_varint(&len) <= 0 || channel >= names_.size() || len > CAPTURE_CHUNK_MAX){
+        truncated_ = true;
+        return false;
+    }
+    buf_.resize(len);
+    if(len && fread(buf_.data(), 1, len, file_) != len){
+        truncated_ = true;
+        return false;
+    }
+
+    t_us_ += dt;
+    rec->t_us = t_us_;
+    rec->channel = (uint16_t)channel;
+    rec->len = (uint32_t)len;
+    rec->data = buf_.data();
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef GATEWAY_CAPTURE_H
+#define GATEWAY_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// SERIAL CAPTURE FILES
+//
+// Raw bytes as they arrived from one or more ports, with the monotonic
+// time of each read, so an incident can be replayed with its original
+// timing (tools/serial_capture.cpp, tools/serial_replay.cpp).
+//
+//   header   magic, channel count, wall clock at t = 0 (us)
+//   names    per channel: length byte + port path
+//   records  varint us since the previous record, varint channel,
+//            varint length, the bytes
+//
+// A record is one read(); the firmware's ~33-byte packets take ~37 bytes.
+// Records are only appended, so a capture cut short by a crash reads back
+// up to its last complete record.
+#define CAPTURE_MAGIC       0x31504143u     // "CAP1"
+#define CAPTURE_CHUNK_MAX   65536           // Bytes per record
+
+typedef struct {
+    uint32_t magic;
+    uint16_t channels;
+    uint16_t reserved;
+    uint64_t start_us;          // CLOCK_REALTIME when the capture began
+} CaptureHeader_t;
+
+static_assert(sizeof(CaptureHeader_t) == 16, "capture header is 16 bytes");
+
+typedef struct {
+    uint64_t t_us;              // Since the start of the capture
+    uint16_t channel;
+    uint32_t len;
+    const uint8_t* data;        // Valid until the next call to next()
+} CaptureRecord_t;
+
+class CaptureWriter {
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    // Create `path` with one channel per name; time 0 is now. Returns 0 or -errno.
+    int open(const char* path, const std::vector<std::string>& channels);
+
+    // Append bytes read on `channel` at monotonic time `mono_us`
+    int write(uint16_t channel, uint64_t mono_us, const uint8_t* data, size_t len);
+
+    int flush();
+    void close();
+
+    uint64_t records() const { return records_; }
+    uint64_t payload_bytes() const { return payload_; }
+    uint64_t file_bytes() const { return file_bytes_; }
+
+private:
+    FILE* file_;
+    uint16_t channels_;
+    uint64_t last_us_;
+    uint64_t records_;
+    uint64_t payload_;
+    uint64_t file_bytes_;
+};
+
+class CaptureReader {
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    // Returns 0, -errno, or -EINVAL if this isn't a capture file
+    int open(const char* path);
+    void close();
+
+    uint16_t channels() const { return (uint16_t)names_.size(); }
+    const char* channel_name(uint16_t channel) const { return names_[channel].c_str(); }
+    uint64_t start_us() const { return start_us_; }
+
+    // Next record in time order; false at the end. truncated() tells
+    // whether the file ended inside a record.
+    bool next(CaptureRecord_t* rec);
+    bool truncated() const { return truncated_; }
+
+private:
+    int read_varint(uint64_t* v);
+
+    FILE* file_;
+    std::vector<std::string> names_;
+    std::vector<uint8_t> buf_;
+    uint64_t start_us_;
+    uint64_t t_us_;
+    bool truncated_;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include "column_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ColumnStore::ColumnStore()
+    : fd_(-1), pending_(new uint8_t[STORE_WRITE_BLOCKS * BLOCK_SIZE]), pending_count_(0),
+      block_count_(0), corrupt_(0), readings_(0), wal_on_(false), synced_blocks_(0), replayed_(0) {
+    memset(open_, 0, sizeof(open_));
+    memset(seq_, 0, sizeof(seq_));
+    memset(first_segment_, 0, sizeof(first_segment_));
+}
+
+ColumnStore::~ColumnStore(){
+    close();
+    for(uint32_t i = 0; i < MAX_DEVICES; i++) delete open_[i];
+    delete[] pending_;
+}
+
+int ColumnStore::open(const char* path, const WalConfig_t* wal){
+    fd_ = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd_ < 0) return -errno;
+    readings_ = replayed_ = 0;
+    corrupt_ = 0;
+
+    int rc = scan();
+    if(rc == 0 && wal){
+        char dir[300];
+        snprintf(dir, sizeof(dir), "%s.wal", path);
+        rc = wal_.open(dir, *wal);
+        if(rc == 0) rc = replay_wal();
+        if(rc == 0) rc = wal_.start();
+        if(rc == 0) rc = write_mark();
+        wal_on_ = (rc == 0);
+
+        // Replayed readings pin their old segments; after a run of crashes
+        // don't wait for the new segment to fill before letting them go
+        if(wal_on_ && wal_.segment_count() > wal->keep_segments + 1) checkpoint(true);
+    }
+    if(rc < 0){
+        ::close(fd_);
+        fd_ = -1;
+    }
+    return rc;
+}
+
+// Index existing blocks. Damaged blocks in the middle are skipped; a run
+// of damaged blocks at the end (or a partial block) is a write that never
+// completed and is cut off so new blocks land on a clean boundary.
+int ColumnStore::scan(){
+    struct stat st;
+    if(fstat(fd_, &st) < 0) return -errno;
+
+    uint32_t blocks = (uint32_t)(st.st_size / BLOCK_SIZE);
+    uint32_t good_end = 0;
+    uint8_t* buf = pending_; // Not in use yet
+
+    index_.clear();
+    damaged_.clear();
+    for(uint32_t b = 0; b < blocks; b++){
+        if(pread(fd_, buf, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+        if(!block_check(buf)){
+            damaged_.push_back(b);
+            continue;
+        }
+        BlockRef_t ref;
+        ref.block_no = b;
+        memcpy(&ref.hdr, buf, sizeof(ref.hdr));
+        index_.push_back(ref);
+        readings_ += ref.hdr.count;
+        good_end = b + 1;
+    }
+    while(!damaged_.empty() && damaged_.back() >= good_end) damaged_.pop_back(); // Trailing damage is just a torn write
+    corrupt_ = (uint32_t)damaged_.size();
+
+    if((off_t)good_end * BLOCK_SIZE != st.st_size){
+        if(ftruncate(fd_, (off_t)good_end * BLOCK_SIZE) < 0) return -errno;
+    }
+    if(lseek(fd_, 0, SEEK_END) < 0) return -errno;
+    block_count_ = good_end;
+    return 0;
+}
+
+// Positions come from the blocks that survived; log entries below them
+// are already in the file
+int ColumnStore::replay_wal(){
+    int rc = cut_unsynced();
+    if(rc < 0) return rc;
+    if(fdatasync(fd_) < 0) return -errno;
+    synced_blocks_ = block_count_;
+
+    memset(seq_, 0, sizeof(seq_));
+    for(const BlockRef_t& ref : index_){
+        if(ref.hdr.device_id < MAX_DEVICES) seq_[ref.hdr.device_id] += ref.hdr.count;
+    }
+    int64_t n = wal_.replay(on_replay, this);
+    return n < 0 ? (int)n : 0;
+}
+
+// Drop everything from the first damaged block past the newest mark. A
+// log without marks predates them and leaves the file as it is.
+int ColumnStore::cut_unsynced(){
+    uint32_t mark = UINT32_MAX;
+    const std::vector<uint32_t>& segments = wal_.segments();
+    for(size_t i = segments.size(); i-- > 0;){
+        WalEntry_t e;
+        if(wal_.first_entry(segments[i], &e) && e.device_id == STORE_MARK_DEVICE){
+            mark = e.seq;
+            break;
+        }
+    }
+
+    uint32_t cut = block_count_;
+    uint32_t corrupt = 0;           // Damage below the mark is real corruption
+    for(uint32_t b : damaged_){
+        if(b >= mark){
+            cut = b;
+            break;
+        }
+        corrupt++;
+    }
+    damaged_.clear();
+    if(cut == block_count_) return 0;
+    corrupt_ = corrupt;
+
+    while(!index_.empty() && index_.back().block_no > cut){
+        readings_ -= index_.back().hdr.count;
+        index_.pop_back();
+    }
+    if(ftruncate(fd_, (off_t)cut * BLOCK_SIZE) < 0) return -errno;
+    if(lseek(fd_, 0, SEEK_END) < 0) return -errno;
+    block_count_ = cut;
+    return 0;
+}
+
+void ColumnStore::on_replay(void* ctx, uint32_t segment, const WalEntry_t& e){
+    ColumnStore* self = (ColumnStore*)ctx;
+    if(e.device_id >= MAX_DEVICES || e.seq < self->seq_[e.device_id]) return;
+
+    // A gap means blocks went missing (damaged mid-file); keep what the
+    // log has rather than discarding the rest of the device's history
+    self->seq_[e.device_id] = e.seq;
+
+    Reading_t r;
+    r.rx_time_us = e.rx_time_us;
+    r.device_time_ms = e.device_time_ms;
+    r.device_id = e.device_id;
+    r.percent = e.percent;
+    r.water_adc = e.water_adc;
+    r.status = e.status;
+    r.alert = e.alert;
+    self->append(r, segment);
+    self->replayed_++;
+}
+
+void ColumnStore::seal(BlockBuilder* b){
+    if(pending_count_ == STORE_WRITE_BLOCKS) write_blocks();
+
+    uint8_t* block = pending_ + (size_t)pending_count_ * BLOCK_SIZE;
+    b->seal(block);
+
+    BlockRef_t ref;
+    ref.block_no = block_count_;
+    memcpy(&ref.hdr, block, sizeof(ref.hdr));
+    index_.push_back(ref);
+    pending_count_++;
+    block_count_++;
+}
+
+void ColumnStore::append(const Reading_t& r, uint32_t wal_segment){
+    BlockBuilder* b = open_[r.device_id];
+    if(!b) b = open_[r.device_id] = new BlockBuilder(r.device_id);
+
+    if(!b->append(r)){
+        seal(b);
+        b->append(r);
+    }
+    if(b->count() == 1) first_segment_[r.device_id] = wal_segment;
+    seq_[r.device_id]++;
+    readings_++;
+}
+
+void ColumnStore::on_reading(const Reading_t& r){
+    if(fd_ < 0 || r.device_id >= MAX_DEVICES) return;
+
+    if(wal_on_){
+        WalEntry_t e;
+        e.rx_time_us = r.rx_time_us;
+        e.device_time_ms = r.device_time_ms;
+        e.seq = seq_[r.device_id];
+        e.device_id = r.device_id;
+        e.percent = r.percent;
+        e.water_adc = r.water_adc;
+        e.status = r.status;
+        e.alert = r.alert;
+        wal_.append(e);
+    }
+    append(r, wal_.segment());
+}
+
+void ColumnStore::flush(){
+    if(fd_ < 0) return;
+
+    if(wal_on_){
+        int rc = wal_.commit();
+        if(rc < 0) fprintf(stderr, "column store: wal: %s\n", strerror(-rc));
+    }
+    bool written = write_blocks();
+    if(wal_on_ && wal_.rotate_due()) checkpoint(written);
+}
+
+// Returns false if blocks had to be dropped
+bool ColumnStore::write_blocks(){
+    if(pending_count_ == 0) return true;
+
+    size_t total = (size_t)pending_count_ * BLOCK_SIZE;
+    size_t done = 0;
+    while(done < total){
+        ssize_t n = write(fd_, pending_ + done, total - done);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            fprintf(stderr, "column store: write: %s\n", strerror(errno));
+
+            // Disk full or I/O error: drop the unwritten blocks and cut the
+            // file back to a block boundary so later appends stay aligned
+            uint32_t lost = pending_count_ - (uint32_t)(done / BLOCK_SIZE);
+            block_count_ -= lost;
+            index_.resize(index_.size() - lost);
+            if(ftruncate(fd_, (off_t)block_count_ * BLOCK_SIZE) == 0) lseek(fd_, 0, SEEK_END);
+            pending_count_ = 0;
+            return false;
+        }
+        done += (size_t)n;
+    }
+    pending_count_ = 0;
+    return true;
+}
+
+// Seal blocks that would pin old segments, make the file durable, start a
+// new segment and delete the ones every open block has moved past. If
+// blocks were dropped the log is the only copy, so nothing is deleted.
+void ColumnStore::checkpoint(bool written){
+    uint32_t current = wal_.segment();
+    uint32_t keep = wal_.config().keep_segments;
+    for(uint32_t i = 0; i < MAX_DEVICES; i++){
+        if(open_[i] && !open_[i]->empty() && first_segment_[i] + keep <= current) seal(open_[i]);
+    }
+    written = write_blocks() && written;
+
+    if(fdatasync(fd_) < 0){
+        fprintf(stderr, "column store: fdatasync: %s\n", strerror(errno));
+        return;
+    }
+    synced_blocks_ = block_count_;
+
+    int rc = wal_.rotate();
+    if(rc == 0) rc = write_mark();
+    if(rc < 0){
+        fprintf(stderr, "column store: wal: %s\n", strerror(-rc));
+        return;
+    }
+    if(!written) return;
+
+    uint32_t oldest = wal_.segment();
+    for(uint32_t i = 0; i < MAX_DEVICES; i++){
+        if(open_[i] && !open_[i]->empty() && first_segment_[i] < oldest) oldest = first_segment_[i];
+    }
+    wal_.remove_before(oldest);
+}
+
+// Start the current segment with the number of durable blocks, synced
+// before any older segment (and its mark) can be deleted
+int ColumnStore::write_mark(){
+    WalEntry_t e;
+    memset(&e, 0, sizeof(e));
+    e.seq = synced_blocks_;
+    e.device_id = STORE_MARK_DEVICE;
+    wal_.append(e);
+    int rc = wal_.commit();
+    return rc < 0 ? rc : wal_.sync();
+}
+
+void ColumnStore::close(){
+    if(fd_ < 0) return;
+
+    for(uint32_t i = 0; i < MAX_DEVICES; i++){
+        if(open_[i] && !open_[i]->empty()) seal(open_[i]);
+    }
+    bool written = write_blocks();
+
+    // Everything is in sealed blocks now; the log is only needed if they
+    // didn't make it to disk
+    if(wal_on_){
+        bool durable = written && fdatasync(fd_) == 0;
+        wal_.close();
+        if(durable) wal_.remove_before(UINT32_MAX);
+        wal_on_ = false;
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
@@ -0,0 +1,85 @@
+#ifndef GATEWAY_COLUMN_STORE_H
+#define GATEWAY_COLUMN_STORE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "block.h"
+#include "sinks.h"
+#include "wal.h"
+
+#define STORE_WRITE_BLOCKS  16      // Sealed blocks gathered per write()
+#define STORE_MARK_DEVICE   0xFFFF  // WAL entry whose seq is the count of durable blocks
+
+// STORAGE: append-only file of fixed-size columnar blocks (see block.h).
+// Each device fills its own open block in memory; full blocks are sealed
+// and appended, so the file interleaves devices but every block holds a
+// single device's readings in time order. Readings still in open blocks
+// are only written by close(), so without a WAL a crash loses them.
+//
+// With a WAL (PATH.wal/) every reading is logged first and each flush()
+// is a group commit. A checkpoint, when a WAL segment fills up, syncs the
+// file and deletes the segments no open block still needs. open() replays
+// the log on top of the last durable blocks: each entry carries its
+// per-device position, so readings already in the file are skipped.
+//
+// Every segment starts with a mark entry holding the number of blocks
+// synced so far. Blocks past the mark may reach the disk in any order, so
+// on open everything from the first damaged block past the mark is cut
+// off: later blocks can't be placed in their device's sequence, and the
+// log still holds all of their readings.
+class ColumnStore : public Sink {
+public:
+    ColumnStore();
+    ~ColumnStore();
+
+    // Open or create `path`. Existing blocks are indexed; a torn tail from
+    // an interrupted write is truncated. With `wal`, readings logged but
+    // not yet in sealed blocks are replayed. Returns 0 or -errno.
+    int open(const char* path, const WalConfig_t* wal = NULL);
+
+    // Seal every open block, write everything out and close the file
+    void close();
+
+    void on_reading(const Reading_t& r) override;
+    void flush() override;      // Write sealed blocks and commit the WAL (open blocks stay in memory)
+
+    const std::vector<BlockRef_t>& index() const { return index_; }
+    uint64_t readings() const { return readings_; }
+    uint64_t file_bytes() const { return (uint64_t)block_count_ * BLOCK_SIZE; }
+    uint32_t corrupt_blocks() const { return corrupt_; }
+    uint64_t replayed() const { return replayed_; }     // Readings recovered from the WAL by open()
+    uint32_t device_readings(uint16_t id) const { return seq_[id]; }
+    uint64_t synced_bytes() const { return synced_blocks_ * (uint64_t)BLOCK_SIZE; }
+    const WriteAheadLog* wal() const { return wal_on_ ? &wal_ : NULL; }
+
+private:
+    void seal(BlockBuilder* b);
+    void append(const Reading_t& r, uint32_t wal_segment);
+    int scan();
+    int replay_wal();
+    int cut_unsynced();
+    int write_mark();
+    bool write_blocks();
+    void checkpoint(bool written);
+    static void on_replay(void* ctx, uint32_t segment, const WalEntry_t& e);
+
+    int fd_;
+    BlockBuilder* open_[MAX_DEVICES];   // Created on a device's first reading
+    uint8_t* pending_;                  // Sealed blocks waiting for write()
+    uint32_t pending_count_;
+    uint32_t block_count_;              // Blocks in the file plus pending
+    uint32_t corrupt_;
+    std::vector<uint32_t> damaged_;     // Blocks scan() skipped, ascending
+    uint64_t readings_;
+    std::vector<BlockRef_t> index_;
+
+    bool wal_on_;
+    WriteAheadLog wal_;
+    uint32_t seq_[MAX_DEVICES];         // Readings per device, durable or open
+    uint32_t first_segment_[MAX_DEVICES];   // WAL segment holding the open block's first reading
+    uint32_t synced_blocks_;            // Blocks known to be on disk
+    uint64_t replayed_;
+};
+
+#endif
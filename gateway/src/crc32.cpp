@@ -0,0 +1,31 @@
+#include "crc32.h"
+
+// Slicing-by-4 tables, built on first use
+static uint32_t table[4][256];
+
+static void build_table(void){
+    for(uint32_t i = 0; i < 256; i++){
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[0][i] = c;
+    }
+    for(uint32_t i = 0; i < 256; i++){
+        for(int t = 1; t < 4; t++) table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len){
+    static const bool init = (build_table(), true);
+    (void)init;
+
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while(len >= 4){
+        crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        crc = table[3][crc & 0xFF] ^ table[2][(crc >> 8) & 0xFF] ^ table[1][(crc >> 16) & 0xFF] ^ table[0][crc >> 24];
+        p += 4;
+        len -= 4;
+    }
+    while(len--) crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
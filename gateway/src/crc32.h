@@ -0,0 +1,15 @@
+#ifndef GATEWAY_CRC32_H
+#define GATEWAY_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, same as zlib). Pass the previous result as `crc` to
+// checksum data in pieces; start with 0.
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len);
+
+static inline uint32_t crc32(const void* data, size_t len){
+    return crc32_update(0, data, len);
+}
+
+#endif
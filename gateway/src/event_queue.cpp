@@ -0,0 +1,157 @@
+#include "event_queue.h"
+
+#include <chrono>
+
+static uint32_t round_pow2(uint32_t n){
+    uint32_t p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+EventQueue::EventQueue(uint32_t capacity)
+    : tail_(0), head_(0), dropped_(0), consumer_waiting_(false), drain_waiters_(0) {
+    uint32_t size = round_pow2(capacity < 2 ? 2 : capacity);
+    slots_ = new Slot[size];
+    mask_ = size - 1;
+    for(uint32_t i = 0; i < size; i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+EventQueue::~EventQueue(){
+    delete[] slots_;
+}
+
+// A slot at position `pos` is free for producers when seq == pos and
+// holds an event for the consumer when seq == pos + 1; the consumer hands
+// it to the next lap by setting seq = pos + capacity.
+bool EventQueue::push(const Event_t& ev){
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+
+    while(true){
+        slot = &slots_[pos & mask_];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if(diff == 0){
+            if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if(diff < 0){
+            // Slot still holds last lap's event: full
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->ev = ev;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    notify_consumer();
+    return true;
+}
+
+uint32_t EventQueue::push_batch(const Event_t* evs, uint32_t n){
+    if(n == 0) return 0;
+    if(n > mask_ + 1) n = mask_ + 1;
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+
+    while(true){
+        // The consumer frees slots in order, so if the batch's last slot is
+        // free for this lap all the ones before it are too
+        uint64_t last = pos + n - 1;
+        uint64_t seq = slots_[last & mask_].seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(seq - last);
+
+        if(diff == 0){
+            if(tail_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
+        } else if(diff < 0){
+            // Not enough room: queue what fits, in order, drop the rest
+            uint32_t queued = 0;
+            while(queued < n && push(evs[queued])) queued++;
+            if(queued < n) dropped_.fetch_add(n - queued - 1, std::memory_order_relaxed);
+            return queued;
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    for(uint32_t i = 0; i < n; i++){
+        Slot* slot = &slots_[(pos + i) & mask_];
+        slot->ev = evs[i];
+        slot->seq.store(pos + i + 1, std::memory_order_release);
+    }
+    notify_consumer();
+    return n;
+}
+
+// Pairs with the fence in pop_batch(): either the consumer sees the new
+// events before parking or we see it parked and wake it
+void EventQueue::notify_consumer(){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(consumer_waiting_.load(std::memory_order_relaxed)){
+        std::lock_guard<std::mutex> lock(mutex_);
+        not_empty_.notify_one();
+    }
+}
+
+uint32_t EventQueue::try_pop(Event_t* out, uint32_t max){
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    uint32_t n = 0;
+
+    while(n < max){
+        Slot* slot = &slots_[pos & mask_];
+        if(slot->seq.load(std::memory_order_acquire) != pos + 1) break;
+
+        out[n++] = slot->ev;
+        slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+        pos++;
+    }
+    if(n > 0) head_.store(pos, std::memory_order_release);
+    return n;
+}
+
+bool EventQueue::empty() const {
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    return slots_[pos & mask_].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+uint32_t EventQueue::pop_batch(Event_t* out, uint32_t max, uint32_t timeout_ms){
+    uint32_t n = try_pop(out, max);
+
+    if(n == 0 && timeout_ms > 0){
+        std::unique_lock<std::mutex> lock(mutex_);
+        consumer_waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(empty()) not_empty_.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+        consumer_waiting_.store(false, std::memory_order_relaxed);
+        lock.unlock();
+        n = try_pop(out, max);
+    }
+
+    if(n > 0 && drain_waiters_.load(std::memory_order_acquire) > 0){
+        std::lock_guard<std::mutex> lock(mutex_);
+        drained_.notify_all();
+    }
+    return n;
+}
+
+void EventQueue::wait_below(uint32_t level, uint32_t timeout_ms){
+    if(depth() <= level) return;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    drain_waiters_.fetch_add(1, std::memory_order_acq_rel);
+    drained_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]{ return depth() <= level; });
+    drain_waiters_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+// Approximate under concurrent pushes; claimed-but-unfilled slots count
+uint32_t EventQueue::depth() const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? (uint32_t)(tail - head) : 0;
+}
+
+void EventQueue::wake_all(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    not_empty_.notify_all();
+    drained_.notify_all();
+}
@@ -0,0 +1,77 @@
+#ifndef GATEWAY_EVENT_QUEUE_H
+#define GATEWAY_EVENT_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include "reading.h"
+
+#define QUEUE_CACHE_LINE    64
+
+// Bounded lock-free FIFO between the ingest loops (many producers) and the
+// sink dispatcher (single consumer).
+//
+// Each slot carries a sequence number that tells producers whether it is
+// free and the consumer whether it is filled, so push() is one CAS on the
+// tail plus a copy, and pop_batch() touches no shared counter per event.
+// Slots and the head/tail counters sit on their own cache lines so
+// producers on different cores don't false-share.
+//
+// push() never blocks: when the sinks fall behind, new events are dropped
+// and counted so ingest latency stays bounded. The mutex/condvars are only
+// used to park an idle consumer or a throttled producer.
+class EventQueue {
+public:
+    explicit EventQueue(uint32_t capacity);     // Rounded up to a power of two
+    ~EventQueue();
+
+    bool push(const Event_t& ev);
+
+    // Claim `n` consecutive slots with one CAS and wake the consumer once.
+    // When the batch doesn't fit, the prefix that does is queued and the
+    // rest dropped. Returns the number of events queued.
+    uint32_t push_batch(const Event_t* evs, uint32_t n);
+
+    // Move up to `max` events into `out`, waiting at most `timeout_ms` for
+    // the first. Single consumer only.
+    uint32_t pop_batch(Event_t* out, uint32_t max, uint32_t timeout_ms);
+
+    void wake_all();
+
+    // Block while more than `level` events are queued (at most `timeout_ms`).
+    // Ingest loops use this to stop reading when the sinks fall behind.
+    void wait_below(uint32_t level, uint32_t timeout_ms);
+
+    uint32_t depth() const;
+    uint32_t capacity() const { return mask_ + 1; }
+    uint64_t pushed() const { return tail_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(QUEUE_CACHE_LINE) Slot {
+        std::atomic<uint64_t> seq;
+        Event_t ev;
+    };
+    static_assert(sizeof(Slot) == QUEUE_CACHE_LINE, "an event and its sequence fill one cache line");
+
+    void notify_consumer();
+    uint32_t try_pop(Event_t* out, uint32_t max);
+    bool empty() const;
+
+    Slot* slots_;
+    uint32_t mask_;
+
+    alignas(QUEUE_CACHE_LINE) std::atomic<uint64_t> tail_;     // Next position to claim (producers)
+    alignas(QUEUE_CACHE_LINE) std::atomic<uint64_t> head_;     // Next position to read (consumer)
+    alignas(QUEUE_CACHE_LINE) std::atomic<uint64_t> dropped_;
+
+    // Parking; only touched when a side is idle or throttled
+    alignas(QUEUE_CACHE_LINE) std::atomic<bool> consumer_waiting_;
+    std::atomic<uint32_t> drain_waiters_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable drained_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "firmware.h"
+
+#include <stdlib.h>
+
+uint16_t fw_level_percent(uint32_t distance_cm, uint16_t height_cm){
+    uint32_t liquid_level_cm = (distance_cm >= height_cm) ? 0 : height_cm - distance_cm;
+    uint16_t percent = 0;
+    if(height_cm > 0) percent = (uint16_t)((liquid_level_cm * 100UL) / height_cm);
+    return percent > 100 ? 100 : percent;
+}
+
+Status_t fw_status(uint16_t percent, uint16_t water_adc, uint8_t* alert){
+    Status_t status;
+    if(water_adc > FW_CONTAMINATION_ADC) status = STATUS_CONTAMINATED;
+    else if(percent >= FW_OVERFLOW_PERCENT) status = STATUS_OVERFLOW;
+    else if(percent > 50) status = STATUS_HALF_FULL;
+    else status = STATUS_EMPTY;
+    *alert = (status == STATUS_CONTAMINATED || status == STATUS_OVERFLOW);
+    return status;
+}
+
+uint32_t fw_echo_distance_cm(uint16_t ticks){
+    uint32_t pulse_us = (uint32_t)ticks >> 1;
+    if(pulse_us >= 150 && pulse_us <= 23500) return pulse_us / 58;
+    return 0;
+}
+
+// uart_send_uint / uart_send_ulong: no padding, "0" for zero
+static char* put_uint(char* p, uint32_t num){
+    char digits[10];
+    uint8_t i = 0;
+    do {
+        digits[i++] = (char)('0' + num % 10);
+        num /= 10;
+    } while(num > 0);
+    while(i > 0) *p++ = digits[--i];
+    return p;
+}
+
+static char* put_str(char* p, const char* s){
+    while(*s) *p++ = *s++;
+    return p;
+}
+
+size_t fw_format_status(char* out, uint32_t t_ms, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert,
+                        uint32_t capture_age_ms){
+    char* p = out;
+    p = put_str(p, "T:");
+    p = put_uint(p, t_ms);
+    p = put_str(p, ",P:");
+    p = put_uint(p, percent);
+    p = put_str(p, ",W:");
+    p = put_uint(p, water_adc);
+    p = put_str(p, ",S:");
+    *p++ = (char)('0' + status);
+    p = put_str(p, ",A:");
+    *p++ = (char)('0' + alert);
+    p = put_str(p, ",C:");
+    p = put_uint(p, capture_age_ms > FW_CAPTURE_AGE_MAX_MS ? FW_CAPTURE_AGE_MAX_MS : capture_age_ms);
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+size_t fw_format_ack(char* out, uint16_t height_cm){
+    char* p = put_str(out, "H:");
+    p = put_uint(p, height_cm);
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+size_t fw_format_reset(char* out, uint8_t flags){
+    char* p = put_str(out, "R:");
+    p = put_uint(p, flags);
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+void fw_command_init(FwCommand_t* cmd){
+    cmd->len = 0;
+    cmd->buf[0] = '\0';
+}
+
+size_t fw_command_feed(FwCommand_t* cmd, const uint8_t* data, size_t len, uint16_t* height_cm,
+                       char* ack, size_t ack_cap){
+    size_t out = 0;
+    for(size_t i = 0; i < len; i++){
+        char c = (char)data[i];
+        if(c == '\n' || c == '\r'){
+            if(cmd->len == 0) continue;
+            cmd->buf[cmd->len] = '\0';
+            cmd->len = 0;
+
+            // The firmware keeps atoi()'s result in an int16_t
+            int16_t h = (int16_t)atoi(cmd->buf);
+            if(h > 0 && h <= FW_HEIGHT_MAX_CM){
+                *height_cm = (uint16_t)h;
+                char line[8];
+                size_t n = fw_format_ack(line, *height_cm);
+                for(size_t k = 0; k < n && out < ack_cap; k++) ack[out++] = line[k];
+            }
+        }
+        else if(c >= '0' && c <= '9'){
+            if(cmd->len < FW_CMD_BUF - 1) cmd->buf[cmd->len++] = c;
+            else cmd->len = 0; // Overflow: the digit is lost too
+        }
+    }
+    return out;
+}
@@ -0,0 +1,64 @@
+#ifndef GATEWAY_FIRMWARE_H
+#define GATEWAY_FIRMWARE_H
+
+// Host-side copy of the controller's decision logic and UART output
+// (src/main.cpp in the firmware tree), for simulators and load generators
+// that have to look exactly like a board on the wire.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "reading.h"
+
+// Same values as the firmware's THRESHOLDS / SETTINGS
+#define FW_CONTAMINATION_ADC    100
+#define FW_OVERFLOW_PERCENT     80
+#define FW_SEND_INTERVAL_MS     500
+#define FW_SENSOR_INTERVAL_MS   60
+#define FW_DEFAULT_HEIGHT_CM    10
+#define FW_HEIGHT_MAX_CM        499
+#define FW_CMD_BUF              8       // rx_buffer, including the terminator
+#define FW_CAPTURE_AGE_MAX_MS   999
+
+#define FW_PACKET_MAX           48      // "T:4294967295,P:100,W:65535,S:3,A:1,C:999\n" is 42
+
+// Level from the ultrasonic distance and container height:
+// (H - D) * 100 / H, 0 when D >= H, at most 100
+uint16_t fw_level_percent(uint32_t distance_cm, uint16_t height_cm);
+
+// Status and alert flag for a level and conductivity reading
+Status_t fw_status(uint16_t percent, uint16_t water_adc, uint8_t* alert);
+
+// Distance the echo capture ISR stores for a pulse of `ticks` (0.5 us timer
+// ticks); 0 outside the 150-23500 us window
+uint32_t fw_echo_distance_cm(uint16_t ticks);
+
+// "T:..,P:..,W:..,S:..,A:..,C:..\n" exactly as send_status_packet() writes
+// it; `capture_age_ms` is clamped like the firmware does. `out` needs
+// FW_PACKET_MAX bytes; returns the length.
+size_t fw_format_status(char* out, uint32_t t_ms, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert,
+                        uint32_t capture_age_ms);
+
+// "H:<cm>\n"
+size_t fw_format_ack(char* out, uint16_t height_cm);
+
+// "R:<flags>\n", sent once after startup like send_reset_packet(); `flags`
+// is MCUSR, bit n = ResetCause_t n
+size_t fw_format_reset(char* out, uint8_t flags);
+
+// Height command input, byte for byte as USART1_RX_vect and the main loop
+// handle it: digits are buffered (an overlong command starts over), CR/LF
+// ends a non-empty command, everything else is ignored.
+typedef struct {
+    char    buf[FW_CMD_BUF];
+    uint8_t len;
+} FwCommand_t;
+
+void fw_command_init(FwCommand_t* cmd);
+
+// Feed received bytes. Every accepted command (1-499 cm) updates
+// `*height_cm` and appends its "H:" acknowledgement to `ack` (up to
+// `ack_cap` bytes). Returns the number of ack bytes written.
+size_t fw_command_feed(FwCommand_t* cmd, const uint8_t* data, size_t len, uint16_t* height_cm,
+                       char* ack, size_t ack_cap);
+
+#endif
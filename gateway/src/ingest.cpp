@@ -0,0 +1,488 @@
+#include "ingest.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+#define EPOLL_BATCH     256
+
+//  PORT POOL
+PortPool::PortPool(uint32_t capacity)
+    : ports_(new Port_t[capacity]), used_(new uint8_t[capacity]), queued_(new uint8_t[capacity]),
+      free_(new uint16_t[capacity]), free_head_(0), free_count_(capacity), capacity_(capacity),
+      owner_(new uint32_t[capacity]) {
+    memset(used_, SLOT_NEW, capacity);
+    memset(queued_, 1, capacity);
+    memset(owner_, 0, capacity * sizeof(uint32_t));
+    // Hand out low ids first
+    for(uint32_t i = 0; i < capacity; i++) free_[i] = (uint16_t)i;
+}
+
+PortPool::~PortPool(){
+    delete[] ports_;
+    delete[] used_;
+    delete[] queued_;
+    delete[] free_;
+    delete[] owner_;
+}
+
+Port_t* PortPool::acquire(uint32_t peer, bool* moved){
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    uint16_t id = UINT16_MAX;
+    if(peer){
+        auto it = peer_ids_.find(peer);
+        if(it != peer_ids_.end() && used_[it->second] != SLOT_USED) id = it->second;
+    }
+    while(id == UINT16_MAX){
+        if(free_count_ == 0) return NULL;
+        uint16_t next = free_[free_head_];
+        free_head_ = (free_head_ + 1) % capacity_;
+        free_count_--;
+        queued_[next] = 0;
+        if(used_[next] != SLOT_USED) id = next;     // Else its peer took it back while queued
+    }
+
+    uint32_t prev = owner_[id];
+    if(moved) *moved = used_[id] == SLOT_RELEASED && (peer == 0 || prev != peer);
+    if(prev != peer){
+        auto it = peer_ids_.find(prev);
+        if(prev && it != peer_ids_.end() && it->second == id) peer_ids_.erase(it);
+        owner_[id] = peer;
+        if(peer) peer_ids_.emplace(peer, id);   // Keeps an existing binding
+    }
+    used_[id] = SLOT_USED;
+    port_init(&ports_[id], id);
+    return &ports_[id];
+}
+
+void PortPool::release(Port_t* port){
+    port_close(port);
+    std::lock_guard<std::mutex> lock(mutex_);
+    retired_lines_ += port->parser.status_lines + port->parser.ack_lines + port->parser.reset_lines;
+    for(uint8_t e = 0; e < TLM_ERR_COUNT; e++) retired_errors_[e] += port->parser.errors[e];
+    used_[port->id] = SLOT_RELEASED;
+    if(queued_[port->id]) return;
+    free_[(free_head_ + free_count_++) % capacity_] = port->id;
+    queued_[port->id] = 1;
+}
+
+//  EVENT LOOP
+struct IngestLoop {
+    IngestEngine* engine;
+    uint16_t index;
+    int epfd = -1;
+    int listen_fd = -1;
+    std::thread thread;
+    std::vector<Port_t*> ports;     // Owned by this loop's thread once started
+    uint8_t* buf;
+    Event_t pending[INGEST_EVENT_BATCH];
+    uint32_t pending_count = 0;
+    uint64_t read_us = 0;           // When the buffer being parsed was read
+    LatencyStages latency;
+
+    IngestLoop(IngestEngine* e, uint16_t i) : engine(e), index(i), buf(new uint8_t[INGEST_READ_BUF]) {}
+    ~IngestLoop(){
+        if(epfd >= 0) close(epfd);
+        if(listen_fd >= 0) close(listen_fd);
+        delete[] buf;
+    }
+
+    int watch(Port_t* port){
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = port;
+        return epoll_ctl(epfd, EPOLL_CTL_ADD, port->fd, &ev);
+    }
+
+    void unwatch(Port_t* port){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, port->fd, NULL);
+    }
+
+    // This loop's shard of the engine's counters
+    void count(MetricCounter& c, uint64_t n = 1) { c.add(index, n); }
+    IngestCounters& counters() { return engine->counters_; }
+    DeviceHealth_t& health(uint16_t id) { return engine->health_[id]; }
+
+    // Hand staged events to the queue in one claim
+    void flush(){
+        if(pending_count == 0) return;
+        uint64_t t = mono_us();
+        for(uint32_t i = 0; i < pending_count; i++){
+            EventTimes_t& times = pending[i].times;
+            latency.record(LAT_ENQUEUE, t - times.rx_us - times.parsed_dus);
+            times.queued_dus = (uint32_t)(t - times.rx_us);
+        }
+        engine->queue_->push_batch(pending, pending_count);
+        pending_count = 0;
+    }
+
+    // Tell the sinks a slot changed hands, ahead of the new device's readings
+    void stage_reset(uint16_t id){
+        if(pending_count == INGEST_EVENT_BATCH) flush();
+        Event_t& ev = pending[pending_count++];
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EVENT_DEVICE_RESET;
+        ev.reading.device_id = id;
+        ev.reading.rx_time_us = now_us();
+        ev.times.rx_us = mono_us();
+    }
+
+    int open_listener(uint16_t tcp_port);
+    void accept_all();
+    void handle(Port_t* port);
+    void drop(Port_t* port);
+    void retry_closed();
+    void run();
+};
+
+static void on_line(Port_t* port, const TlmLine_t* line, void* ctx){
+    IngestLoop* loop = (IngestLoop*)ctx;
+
+    IngestCounters& c = loop->counters();
+    DeviceHealth_t& health = loop->health(port->id);
+
+    switch(line->result){
+        case TLM_ERROR:
+            loop->count(c.malformed[line->error]); // The port's parser counts it too
+            return;
+        case TLM_RESET:
+            for(uint8_t b = 0; b < RESET_CAUSE_COUNT; b++){
+                if(line->reset_flags & (1u << b)) loop->count(c.resets[b]);
+            }
+            health.reset_flags.store(line->reset_flags, std::memory_order_relaxed);
+            health.reset_seen.store(1, std::memory_order_relaxed);
+            return;
+        case TLM_STATUS:
+            loop->count(c.status_lines);
+            if(health.online.load(std::memory_order_relaxed) &&
+               line->status.time_ms < health.uptime_ms.load(std::memory_order_relaxed)){
+                loop->count(c.restarts);
+            }
+            health.uptime_ms.store(line->status.time_ms, std::memory_order_relaxed);
+            health.online.store(1, std::memory_order_relaxed);
+            if(line->status.capture_age_ms == TLM_AGE_MAX) loop->count(c.echo_missing);
+            break;
+        default:
+            loop->count(c.ack_lines);
+            break;
+    }
+    if(loop->pending_count == INGEST_EVENT_BATCH) loop->flush();
+
+    Event_t& ev = loop->pending[loop->pending_count++];
+    memset(&ev, 0, sizeof(ev));
+    ev.times.rx_us = loop->read_us;
+    ev.times.parsed_dus = (uint32_t)(mono_us() - loop->read_us);
+    loop->latency.record(LAT_PARSE, ev.times.parsed_dus);
+
+    if(line->result == TLM_STATUS){
+        // Device side, from firmware that reports its capture age (and
+        // keeps T on a hardware timer)
+        uint16_t age = line->status.capture_age_ms;
+        if(age != TLM_AGE_NONE){
+            uint64_t wire_us = uart_wire_us(line->length, TLM_UART_BAUD);
+            uint64_t sent_us = (uint64_t)line->status.time_ms * 1000 + wire_us;
+            loop->latency.record(LAT_CAPTURE, (uint64_t)age * 1000);
+            loop->latency.record(LAT_UART, wire_us);
+            loop->latency.record(LAT_LINK, link_clock_delay(&port->link, sent_us, loop->read_us));
+        }
+
+        ev.type = EVENT_READING;
+        ev.reading.device_time_ms = line->status.time_ms;
+        ev.reading.percent = line->status.percent;
+        ev.reading.water_adc = line->status.water_adc;
+        ev.reading.status = line->status.status;
+        ev.reading.alert = line->status.alert;
+    } else {
+        ev.type = EVENT_HEIGHT_ACK;
+        ev.height_cm = line->height_cm;
+    }
+    ev.reading.device_id = port->id;
+    ev.reading.rx_time_us = now_us();
+}
+
+// Every loop binds its own SO_REUSEPORT socket, so the kernel shards
+// incoming device connections across loops without a hand-off
+int IngestLoop::open_listener(uint16_t tcp_port){
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -errno;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(tcp_port);
+
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0){
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL marks the listener
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    listen_fd = fd;
+    return 0;
+}
+
+void IngestLoop::accept_all(){
+    while(true){
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept4(listen_fd, (struct sockaddr*)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) return; // EAGAIN: backlog drained
+
+        bool moved;
+        Port_t* port = engine->pool_.acquire(peer.sin_addr.s_addr, &moved);
+        if(!port){
+            close(fd); // Device table full
+            continue;
+        }
+
+        char name[PORT_PATH_MAX];
+        snprintf(name, sizeof(name), "tcp:%s:%u", inet_ntoa(peer.sin_addr), (unsigned)ntohs(peer.sin_port));
+        port_attach_socket(port, fd, name);
+        port->loop = index;
+
+        if(watch(port) < 0){
+            engine->pool_.release(port);
+            continue;
+        }
+        engine->reset_health(port->id);
+        if(moved) stage_reset(port->id);
+        count(counters().connects);
+        ports.push_back(port);
+        if(engine->cfg_.height_cm) port_send_height(port, engine->cfg_.height_cm);
+    }
+}
+
+// Socket gone for good: forget it and free the slot
+void IngestLoop::drop(Port_t* port){
+    unwatch(port);
+    count(counters().disconnects);
+    health(port->id).online.store(0, std::memory_order_relaxed);
+    for(size_t i = 0; i < ports.size(); i++){
+        if(ports[i] == port){
+            ports[i] = ports.back();
+            ports.pop_back();
+            break;
+        }
+    }
+    engine->pool_.release(port);
+}
+
+void IngestLoop::handle(Port_t* port){
+    while(true){
+        ssize_t n = read(port->fd, buf, INGEST_READ_BUF);
+
+        if(n > 0){
+            read_us = mono_us();
+            count(counters().bytes, (uint64_t)n);
+            port_feed(port, buf, (size_t)n, on_line, this);
+            if(n < INGEST_READ_BUF) return; // Drained
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+        // EOF or error
+        switch(port->kind){
+            case PORT_PTY:
+                return; // Our held slave keeps the pty alive between simulators
+            case PORT_SERIAL:
+                fprintf(stderr, "%s: connection lost\n", port->path);
+                count(counters().disconnects);
+                health(port->id).online.store(0, std::memory_order_relaxed);
+                unwatch(port);
+                port_close(port);
+                return; // Reopened by retry_closed()
+            case PORT_SOCKET:
+                drop(port);
+                return;
+        }
+    }
+}
+
+// Serial device unplugged or rfcomm dropped: keep retrying
+void IngestLoop::retry_closed(){
+    for(Port_t* port : ports){
+        if(port->kind != PORT_SERIAL || port->fd >= 0) continue;
+        if(port_open_serial(port, port->path, port->baud) < 0) continue;
+
+        if(watch(port) < 0){
+            port_close(port);
+            continue;
+        }
+        fprintf(stderr, "%s: reconnected\n", port->path);
+        count(counters().connects);
+        if(engine->cfg_.height_cm) port_send_height(port, engine->cfg_.height_cm);
+    }
+}
+
+void IngestLoop::run(){
+    struct epoll_event events[EPOLL_BATCH];
+    EventQueue* queue = engine->queue_;
+    uint64_t next_retry = mono_ms() + INGEST_REOPEN_MS;
+
+    while(engine->running_){
+        // --- Backpressure: let the sinks catch up before reading more ---
+        if(queue->depth() > engine->cfg_.high_water){
+            engine->backpressure_waits_++;
+            queue->wait_below(engine->cfg_.low_water, INGEST_TIMER_MS);
+            continue;
+        }
+
+        int n = epoll_wait(epfd, events, EPOLL_BATCH, INGEST_TIMER_MS);
+        for(int i = 0; i < n; i++){
+            Port_t* port = (Port_t*)events[i].data.ptr;
+            if(!port) accept_all();
+            else handle(port);
+        }
+        flush();
+
+        uint64_t t = mono_ms();
+        if(t >= next_retry){
+            retry_closed();
+            next_retry = t + INGEST_REOPEN_MS;
+        }
+    }
+}
+
+//  ENGINE
+IngestEngine::IngestEngine(EventQueue* queue, const IngestConfig_t& cfg)
+    : queue_(queue), cfg_(cfg), pool_(MAX_DEVICES), running_(false), backpressure_waits_(0),
+      health_(new DeviceHealth_t[MAX_DEVICES]()) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    loop_count_ = cfg_.loops ? cfg_.loops : (uint16_t)(cpus > 0 ? cpus : 1);
+    if(loop_count_ > INGEST_MAX_LOOPS) loop_count_ = INGEST_MAX_LOOPS;
+
+    for(uint16_t i = 0; i < loop_count_; i++) loops_[i] = new IngestLoop(this, i);
+}
+
+IngestEngine::~IngestEngine(){
+    stop();
+    for(uint16_t i = 0; i < loop_count_; i++) delete loops_[i];
+    delete[] health_;
+}
+
+// New occupant of a device slot
+void IngestEngine::reset_health(uint16_t id){
+    DeviceHealth_t& h = health_[id];
+    h.uptime_ms.store(0, std::memory_order_relaxed);
+    h.reset_flags.store(0, std::memory_order_relaxed);
+    h.reset_seen.store(0, std::memory_order_relaxed);
+    h.online.store(0, std::memory_order_relaxed);
+}
+
+// Static sharding: device id modulo loop count
+Port_t* IngestEngine::assign(Port_t* port){
+    port->loop = (uint16_t)(port->id % loop_count_);
+    loops_[port->loop]->ports.push_back(port);
+    reset_health(port->id);
+    if(port->fd >= 0 && cfg_.height_cm) port_send_height(port, cfg_.height_cm);
+    return port;
+}
+
+int IngestEngine::add_serial(const char* path, uint32_t baud, Port_t** out){
+    Port_t* port = pool_.acquire();
+    if(out) *out = port;
+    if(!port) return -ENOSPC;
+
+    // On failure path and baud are kept and retry_closed() keeps trying
+    int rc = port_open_serial(port, path, baud);
+    assign(port);
+    return rc;
+}
+
+Port_t* IngestEngine::add_pty(){
+    Port_t* port = pool_.acquire();
+    if(!port) return NULL;
+
+    int rc = port_open_pty(port);
+    if(rc < 0){
+        pool_.release(port);
+        errno = -rc;
+        return NULL;
+    }
+    return assign(port);
+}
+
+Port_t* IngestEngine::add_socket(int fd, const char* name){
+    Port_t* port = pool_.acquire();
+    if(!port) return NULL;
+
+    int rc = port_attach_socket(port, fd, name);
+    if(rc < 0){
+        pool_.release(port);
+        errno = -rc;
+        return NULL;
+    }
+    return assign(port);
+}
+
+int IngestEngine::start(){
+    for(uint16_t i = 0; i < loop_count_; i++){
+        IngestLoop* loop = loops_[i];
+
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if(loop->epfd < 0) return -errno;
+
+        for(Port_t* port : loop->ports){
+            if(port->fd >= 0 && loop->watch(port) < 0) return -errno;
+        }
+        if(cfg_.listen_port){
+            int rc = loop->open_listener(cfg_.listen_port);
+            if(rc < 0) return rc;
+        }
+    }
+
+    running_ = true;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for(uint16_t i = 0; i < loop_count_; i++){
+        IngestLoop* loop = loops_[i];
+        loop->thread = std::thread(&IngestLoop::run, loop);
+
+        // One loop per core when there are enough cores (best effort)
+        if(cpus > 1){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            pthread_setaffinity_np(loop->thread.native_handle(), sizeof(set), &set);
+        }
+    }
+    return 0;
+}
+
+void IngestEngine::collect_latency(LatencyStages* out) const {
+    for(uint16_t i = 0; i < loop_count_; i++) out->add(loops_[i]->latency);
+}
+
+const LatencyStages& IngestEngine::loop_latency(uint16_t loop) const {
+    return loops_[loop]->latency;
+}
+
+void IngestEngine::stop(){
+    if(!running_.exchange(false)) return;
+    queue_->wake_all();
+    for(uint16_t i = 0; i < loop_count_; i++){
+        if(loops_[i]->thread.joinable()) loops_[i]->thread.join();
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef GATEWAY_INGEST_H
+#define GATEWAY_INGEST_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "event_queue.h"
+#include "latency.h"
+#include "metrics.h"
+#include "port.h"
+
+#define INGEST_MAX_LOOPS        64
+#define INGEST_READ_BUF         (64 * 1024)     // Per-loop read buffer, shared by its ports
+#define INGEST_EVENT_BATCH      32              // Events staged per loop before one queue push
+#define INGEST_TIMER_MS         100             // Stop-check period
+#define INGEST_REOPEN_MS        1000            // Retry period for lost serial ports
+
+typedef struct {
+    uint16_t loops;         // Event loops (threads), 0 = one per online CPU
+    uint32_t high_water;    // Queue depth at which loops stop reading...
+    uint32_t low_water;     // ...and the depth at which they resume
+    uint16_t height_cm;     // Sent to every port on (re)connect, 0 = none
+    uint16_t listen_port;   // TCP port for networked devices, 0 = off
+} IngestConfig_t;
+
+// Counters kept by the ingest loops, one shard per loop
+struct IngestCounters {
+    MetricCounter bytes;
+    MetricCounter status_lines;
+    MetricCounter ack_lines;
+    MetricCounter malformed[TLM_ERR_COUNT];
+    MetricCounter echo_missing;                 // C saturated: the sensor hasn't answered for a second
+    MetricCounter restarts;                     // A device's T went backwards
+    MetricCounter resets[RESET_CAUSE_COUNT];    // "R:" lines, per flag
+    MetricCounter connects;                     // Accepted sockets, reopened serial ports
+    MetricCounter disconnects;
+};
+
+// Latest state of one device, written by its loop, read by scrapes
+typedef struct {
+    std::atomic<uint32_t> uptime_ms;    // T of the latest status packet
+    std::atomic<uint8_t>  reset_flags;  // From the latest "R:" line
+    std::atomic<uint8_t>  reset_seen;
+    std::atomic<uint8_t>  online;       // Connected and heard from
+} DeviceHealth_t;
+
+// Fixed pool of Port_t slots allocated once at startup. A slot's index is
+// the device id carried by its readings.
+//
+// A TCP device gets back the id its address had last time, as long as that
+// slot is free. Other slots are handed out least recently released first,
+// so an id only moves to another device once the free ones run out.
+// Devices behind one address (NAT) share a single remembered id.
+class PortPool {
+public:
+    explicit PortPool(uint32_t capacity);
+    ~PortPool();
+
+    // Initialised slot, NULL when exhausted. `peer` is a TCP device's IPv4
+    // address (0 = none); *moved is set when the slot last held a
+    // different (or unknown) device.
+    Port_t* acquire(uint32_t peer = 0, bool* moved = NULL);
+    void release(Port_t* port);     // Closes the port and returns the slot
+
+    Port_t* at(uint32_t id) { return &ports_[id]; }
+    uint32_t capacity() const { return capacity_; }
+    bool in_use(uint32_t id) const { return used_[id] == SLOT_USED; }
+
+    // Parser counters of released slots, so closed connections still count
+    uint64_t retired_lines() const { return retired_lines_; }
+    uint64_t retired_errors(TlmError_t e) const { return retired_errors_[e]; }
+
+private:
+    enum { SLOT_NEW = 0, SLOT_USED, SLOT_RELEASED };
+
+    std::mutex mutex_;
+    Port_t* ports_;
+    uint8_t* used_;                 // SLOT_*
+    uint8_t* queued_;               // In free_; a slot taken back by its peer stays queued
+    uint16_t* free_;                // FIFO ring of released slots
+    uint32_t free_head_;
+    uint32_t free_count_;
+    uint32_t capacity_;
+    uint32_t* owner_;               // Peer address a slot was last given to, 0 = none
+    std::unordered_map<uint32_t, uint16_t> peer_ids_;
+    uint64_t retired_lines_ = 0;
+    uint64_t retired_errors_[TLM_ERR_COUNT] = {};
+};
+
+struct IngestLoop;
+
+// Non-blocking ingest: ports are sharded across one epoll loop per core.
+// Each loop reads into its own buffer, decodes in place and pushes events
+// onto the shared queue; when the queue passes `high_water` the loops stop
+// reading, so the kernel buffers (and tty/TCP flow control) absorb the burst
+// instead of the gateway dropping readings.
+class IngestEngine {
+public:
+    IngestEngine(EventQueue* queue, const IngestConfig_t& cfg);
+    ~IngestEngine();
+
+    // Register ports before start(). add_serial() returns 0 or -errno; a
+    // serial port that fails to open is still kept (*port set) and retried.
+    // *port is NULL only when the pool is full. The others return NULL when
+    // the pool is full (or the pty could not be created, errno set).
+    int add_serial(const char* path, uint32_t baud, Port_t** port = NULL);
+    Port_t* add_pty();
+    Port_t* add_socket(int fd, const char* name);
+
+    int start();    // 0 or -errno
+    void stop();    // Signal the loops and join them
+
+    bool running() const { return running_; }
+    uint16_t loop_count() const { return loop_count_; }
+    PortPool& ports() { return pool_; }
+    uint64_t backpressure_waits() const { return backpressure_waits_; }
+
+    // Add every loop's capture..enqueue histograms to `out` (any thread)
+    void collect_latency(LatencyStages* out) const;
+    const LatencyStages& loop_latency(uint16_t loop) const;
+
+    const IngestCounters& counters() const { return counters_; }
+    const DeviceHealth_t& health(uint32_t id) const { return health_[id]; }
+
+private:
+    friend struct IngestLoop;
+
+    Port_t* assign(Port_t* port);
+    void reset_health(uint16_t id);
+
+    EventQueue* queue_;
+    IngestConfig_t cfg_;
+    PortPool pool_;
+    uint16_t loop_count_;
+    IngestLoop* loops_[INGEST_MAX_LOOPS];
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> backpressure_waits_;
+    IngestCounters counters_;
+    DeviceHealth_t* health_;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "latency.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+//  HISTOGRAM
+void LatencyHistogram::reset(){
+    for(uint32_t i = 0; i < LAT_BUCKETS; i++) counts_[i].store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other){
+    for(uint32_t i = 0; i < LAT_BUCKETS; i++){
+        uint64_t n = other.counts_[i].load(std::memory_order_relaxed);
+        if(n) counts_[i].store(counts_[i].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    sum_.store(sum_.load(std::memory_order_relaxed) + other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void LatencyHistogram::subtract(const LatencyHistogram& other){
+    for(uint32_t i = 0; i < LAT_BUCKETS; i++){
+        uint64_t n = other.counts_[i].load(std::memory_order_relaxed);
+        if(n) counts_[i].store(counts_[i].load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+    sum_.store(sum_.load(std::memory_order_relaxed) - other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t n = 0;
+    for(uint32_t i = 0; i < LAT_BUCKETS; i++) n += counts_[i].load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t LatencyHistogram::count_to(uint64_t us) const {
+    uint32_t last = bucket(us > LAT_MAX_US ? LAT_MAX_US : us);
+    uint64_t n = 0;
+    for(uint32_t i = 0; i <= last; i++) n += counts_[i].load(std::memory_order_relaxed);
+    return n;
+}
+
+double LatencyHistogram::mean() const {
+    uint64_t n = count();
+    return n ? (double)sum_.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t n = count();
+    if(n == 0) return 0;
+
+    // Smallest bucket with at least p% of the values at or below it
+    uint64_t rank = (uint64_t)(p / 100.0 * n + 0.5);
+    if(rank < 1) rank = 1;
+    if(rank > n) rank = n;
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < LAT_BUCKETS; i++){
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if(seen >= rank) return bucket_top(i);
+    }
+    return LAT_MAX_US;
+}
+
+uint64_t LatencyHistogram::max() const {
+    for(uint32_t i = LAT_BUCKETS; i-- > 0;){
+        if(counts_[i].load(std::memory_order_relaxed)) return bucket_top(i);
+    }
+    return 0;
+}
+
+//  STAGES
+const char* lat_stage_name(uint8_t stage){
+    switch(stage){
+        case LAT_CAPTURE: return "capture";
+        case LAT_UART:    return "uart";
+        case LAT_LINK:    return "link";
+        case LAT_PARSE:   return "parse";
+        case LAT_ENQUEUE: return "enqueue";
+        case LAT_QUEUE:   return "queue";
+        case LAT_COMMIT:  return "commit";
+        case LAT_GATEWAY: return "gateway";
+        default:          return "unknown";
+    }
+}
+
+void LatencyStages::add(const LatencyStages& other){
+    for(uint8_t s = 0; s < LAT_STAGE_COUNT; s++) stage[s].add(other.stage[s]);
+}
+
+void LatencyStages::subtract(const LatencyStages& other){
+    for(uint8_t s = 0; s < LAT_STAGE_COUNT; s++) stage[s].subtract(other.stage[s]);
+}
+
+void LatencyStages::reset(){
+    for(uint8_t s = 0; s < LAT_STAGE_COUNT; s++) stage[s].reset();
+}
+
+void LatencyStages::print(FILE* out, const char* title) const {
+    fprintf(out, "%-10s %10s %9s %9s %9s %9s %9s %9s\n", title, "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for(uint8_t s = 0; s < LAT_STAGE_COUNT; s++){
+        const LatencyHistogram& h = stage[s];
+        uint64_t n = h.count();
+        if(n == 0) continue;
+        fprintf(out, "  %-8s %10" PRIu64 " %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f ms\n",
+                lat_stage_name(s), n, h.mean() / 1000.0,
+                h.percentile(50) / 1000.0, h.percentile(90) / 1000.0, h.percentile(99) / 1000.0,
+                h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+    }
+}
+
+//  LINK DELAY
+void link_clock_reset(LinkClock_t* c){
+    memset(c, 0, sizeof(*c));
+}
+
+uint64_t link_clock_delay(LinkClock_t* c, uint64_t sent_us, uint64_t rx_us){
+    if(c->count > 0 && sent_us < c->last_sent_us) link_clock_reset(c);
+    c->last_sent_us = sent_us;
+
+    int64_t offset = (int64_t)(rx_us - sent_us);
+    c->offset_us[c->next] = offset;
+    c->next = (uint8_t)((c->next + 1) % LAT_LINK_WINDOW);
+    if(c->count < LAT_LINK_WINDOW) c->count++;
+
+    int64_t floor = offset;
+    for(uint8_t i = 0; i < c->count; i++){
+        if(c->offset_us[i] < floor) floor = c->offset_us[i];
+    }
+    return (uint64_t)(offset - floor);
+}
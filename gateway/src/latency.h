@@ -0,0 +1,123 @@
+#ifndef GATEWAY_LATENCY_H
+#define GATEWAY_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+// LATENCY HISTOGRAMS
+//
+// Log-linear buckets in the style of HdrHistogram: values below 32 us get a
+// bucket each, above that every power of two is split into 32, so a
+// percentile is reported within 1/32 (3%) of the true value. 1024 buckets
+// cover 1 us to 19 hours in 8 KB, and recording is a shift and an add.
+//
+// Each histogram has a single writer thread; record() is a relaxed load and
+// store, no locked instruction. Other threads may add() it into their own
+// copy at any time to take a snapshot.
+#define LAT_SUB_BITS        5
+#define LAT_SUB_COUNT       (1u << LAT_SUB_BITS)
+#define LAT_BUCKETS         1024
+#define LAT_MAX_US          ((1ULL << 36) - 1)      // Larger values are clamped
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() { reset(); }
+
+    void record(uint64_t us){
+        if(us > LAT_MAX_US) us = LAT_MAX_US;
+        std::atomic<uint64_t>& b = counts_[bucket(us)];
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_.store(sum_.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    }
+
+    void reset();
+    void add(const LatencyHistogram& other);
+    void subtract(const LatencyHistogram& other);   // `other` must be an earlier snapshot of this
+
+    uint64_t count() const;
+    uint64_t count_to(uint64_t us) const;   // Values in the buckets up to the one holding `us`
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    double mean() const;
+    uint64_t percentile(double p) const;    // p in 0-100, 0 when empty
+    uint64_t max() const;                   // Top of the highest non-empty bucket
+
+    static uint32_t bucket(uint64_t us){
+        if(us < LAT_SUB_COUNT) return (uint32_t)us;
+        uint32_t shift = (uint32_t)(63 - __builtin_clzll(us)) - LAT_SUB_BITS;
+        return (shift << LAT_SUB_BITS) + (uint32_t)(us >> shift);
+    }
+
+    // Largest value that lands in bucket `b`
+    static uint64_t bucket_top(uint32_t b){
+        if(b < 2 * LAT_SUB_COUNT) return b;
+        uint32_t shift = (b >> LAT_SUB_BITS) - 1;
+        return (((uint64_t)(b - (shift << LAT_SUB_BITS)) + 1) << shift) - 1;
+    }
+
+private:
+    std::atomic<uint64_t> counts_[LAT_BUCKETS];
+    std::atomic<uint64_t> sum_;
+};
+
+// PIPELINE STAGES
+//
+// A status packet's way from the echo to storage. The first three are
+// measured on the device side (the controller's clock, the packet length,
+// the arrival pattern); the rest on the gateway's monotonic clock.
+typedef enum {
+    LAT_CAPTURE = 0,    // Echo captured -> packet started (the C field)
+    LAT_UART,           // Packet on the board's 9600 baud UART, from its length
+    LAT_LINK,           // Bluetooth / serial link, above its floor over the last few seconds
+    LAT_PARSE,          // read() returned -> line decoded
+    LAT_ENQUEUE,        // Decoded -> pushed onto the event queue
+    LAT_QUEUE,          // Pushed -> taken by the dispatcher
+    LAT_COMMIT,         // Taken -> written and flushed by every sink
+    LAT_GATEWAY,        // read() returned -> committed
+    LAT_STAGE_COUNT
+} LatStage_t;
+
+const char* lat_stage_name(uint8_t stage);
+
+// One histogram per stage, written by one thread
+struct LatencyStages {
+    LatencyHistogram stage[LAT_STAGE_COUNT];
+
+    void record(LatStage_t s, uint64_t us) { stage[s].record(us); }
+    void add(const LatencyStages& other);
+    void subtract(const LatencyStages& other);
+    void reset();
+
+    // Count, mean and p50/p90/p99/p99.9/max per stage, in milliseconds
+    void print(FILE* out, const char* title) const;
+};
+
+// LINK DELAY
+//
+// The controller's clock isn't synchronised with ours, so the link delay
+// is measured against the best delivery in the last LAT_LINK_WINDOW
+// packets: the constant part of the path drops out and what remains is
+// buffering, retransmission and scheduling delay. A short window also keeps
+// the two clocks' drift out of it.
+#define LAT_LINK_WINDOW     8       // Packets, 4 s at the firmware's rate
+
+typedef struct {
+    int64_t  offset_us[LAT_LINK_WINDOW];    // Receive time minus device send time
+    uint64_t last_sent_us;
+    uint8_t  count;
+    uint8_t  next;
+} LinkClock_t;
+
+void link_clock_reset(LinkClock_t* c);
+
+// Delay of a packet that left the device's UART at `sent_us` device time
+// and was read at `rx_us` (monotonic). A device clock that went backwards
+// (reboot) starts the window over.
+uint64_t link_clock_delay(LinkClock_t* c, uint64_t sent_us, uint64_t rx_us);
+
+// Time a `bytes` long line spends on a UART at `baud` (8N1)
+static inline uint64_t uart_wire_us(uint32_t bytes, uint32_t baud){
+    return (uint64_t)bytes * 10 * 1000000ULL / baud;
+}
+
+#endif
@@ -0,0 +1,566 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "clock.h"
+#include "column_store.h"
+#include "event_queue.h"
+#include "ingest.h"
+#include "latency.h"
+#include "metrics.h"
+#include "mqtt.h"
+#include "port.h"
+#include "rollup.h"
+#include "rules.h"
+#include "shm_ring.h"
+#include "sinks.h"
+#include "websocket.h"
+
+// SETTINGS
+#define QUEUE_CAPACITY          65536   // Events buffered between ingest loops and sinks
+#define QUEUE_HIGH_WATER        49152   // Ingest loops pause reading above this depth...
+#define QUEUE_LOW_WATER         16384   // ...and resume below this one
+#define DISPATCH_BATCH          256     // Events handed to the sinks per wakeup
+#define FLUSH_INTERVAL_MS       100     // Upper bound on sink buffering
+
+//  GLOBAL STATE
+static volatile sig_atomic_t stop_requested = 0;
+static LatencyStages dispatch_latency;  // queue / commit / gateway stages
+static LatencyHistogram flush_latency;  // One flush of every sink
+static MetricCounter committed;         // Events flushed by the sinks (dispatcher shard 0)
+
+typedef struct {
+    std::vector<const char*> paths;
+    uint32_t baud = 9600;
+    uint16_t pty_count = 0;
+    uint16_t height_cm = 0;           // 0 = don't send
+    uint16_t loops = 0;               // 0 = one per CPU
+    uint16_t listen_port = 0;         // 0 = no TCP listener
+    const char* store_path = NULL;    // CSV; readings.csv unless -d is given
+    const char* tsdb_path = NULL;     // Columnar block store
+    int32_t wal_sync_ms = 0;          // WalConfig_t::sync_ms
+    uint8_t wal = 1;
+    const char* rollup_dir = NULL;    // 1 min / 1 h / 1 day summaries
+    uint32_t retention_days[TIER_COUNT] = {};   // 0 = tier default
+    const char* rules_path = NULL;    // Alert rules (rules.h)
+    uint8_t quiet = 0;
+    uint32_t latency_s = 0;           // Stage latency report period, 0 = off
+    uint16_t metrics_port = 0;        // Prometheus endpoint on localhost, 0 = off
+    const char* metrics_file = NULL;  // Prometheus text snapshot
+    std::string mqtt_host;            // Empty = no MQTT bridge
+    uint16_t mqtt_port = MQTT_PORT;
+    const char* mqtt_prefix = MQTT_DEFAULTS.prefix;
+    const char* mqtt_spool = NULL;
+    uint8_t mqtt_qos = 1;
+    uint16_t ws_port = 0;             // Live WebSocket stream on localhost, 0 = off
+    const char* shm_name = NULL;      // Shared-memory ring for local readers
+    uint32_t shm_slots = SHM_SLOTS_DEFAULT;
+} Options_t;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s [options] [PORT...]\n"
+        "  PORT            Serial or rfcomm device, e.g. /dev/ttyUSB0 /dev/rfcomm0\n"
+        "  -b BAUD         Serial baud rate (default 9600)\n"
+        "  -p, --pty N     Create N pseudo-terminals instead of/in addition to PORTs\n"
+        "  -l TCP_PORT     Accept networked devices (serial-over-TCP) on this port\n"
+        "  -j LOOPS        Ingest event loops (default: one per CPU)\n"
+        "  -H, --height CM Send a container height command to every port on connect\n"
+        "  -o FILE         CSV reading log (default readings.csv without -d, '-' = stdout)\n"
+        "  -d FILE         Columnar block store (compressed, ~1.5 bytes per reading)\n"
+        "  --wal-sync MODE WAL durability for -d: always (default), MS between fsyncs, never\n"
+        "  --no-wal        No write-ahead log; a crash loses readings in open blocks\n"
+        "  -R DIR          Maintain 1m/1h/1d rollups in DIR\n"
+        "  --retention M,H,D  Rollup retention in days per tier (default 14,400,3650)\n"
+        "  --rules FILE    Evaluate the alert rules in FILE (see README)\n"
+        "  -q              Don't log alerts / acks\n"
+        "  --latency S     Print per-stage latency percentiles every S seconds and at exit\n"
+        "  --metrics PORT  Serve Prometheus metrics on http://127.0.0.1:PORT/metrics\n"
+        "  --metrics-file FILE  Rewrite a Prometheus text snapshot every 10 s and at exit\n"
+        "  --mqtt HOST[:PORT]   Publish readings and alerts to an MQTT broker (default port 1883)\n"
+        "  --mqtt-prefix P      Topic prefix (default tankgw)\n"
+        "  --mqtt-spool FILE    Keep messages here while the broker is unreachable\n"
+        "  --mqtt-qos 0|1       Publish QoS (default 1, acknowledged)\n"
+        "  --ws PORT       Stream readings live on ws://127.0.0.1:PORT/live\n"
+        "  --shm NAME      Publish readings to shared-memory ring /dev/shm/NAME (e.g. tankgw)\n"
+        "  --shm-slots N   Ring size in readings (default 65536)\n",
+        argv0);
+}
+
+static int parse_options(int argc, char** argv, Options_t* opt){
+    for(int i = 1; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-b") && next){ opt->baud = (uint32_t)atoi(next); i++; }
+        else if((!strcmp(a, "-p") || !strcmp(a, "--pty")) && next){ opt->pty_count = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-l") && next){ opt->listen_port = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-j") && next){ opt->loops = (uint16_t)atoi(next); i++; }
+        else if((!strcmp(a, "-H") || !strcmp(a, "--height")) && next){ opt->height_cm = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-o") && next){ opt->store_path = next; i++; }
+        else if(!strcmp(a, "-d") && next){ opt->tsdb_path = next; i++; }
+        else if(!strcmp(a, "--wal-sync") && next){
+            if(!strcmp(next, "always")) opt->wal_sync_ms = 0;
+            else if(!strcmp(next, "never")) opt->wal_sync_ms = WAL_SYNC_NEVER;
+            else if(atoi(next) > 0) opt->wal_sync_ms = atoi(next);
+            else return -1;
+            i++;
+        }
+        else if(!strcmp(a, "--no-wal")){ opt->wal = 0; }
+        else if(!strcmp(a, "-R") && next){ opt->rollup_dir = next; i++; }
+        else if(!strcmp(a, "--retention") && next){
+            uint32_t* r = opt->retention_days;
+            if(sscanf(next, "%u,%u,%u", &r[TIER_1M], &r[TIER_1H], &r[TIER_1D]) != 3) return -1;
+            i++;
+        }
+        else if(!strcmp(a, "--rules") && next){ opt->rules_path = next; i++; }
+        else if(!strcmp(a, "-q")){ opt->quiet = 1; }
+        else if(!strcmp(a, "--latency") && next){ opt->latency_s = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "--metrics") && next){ opt->metrics_port = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "--metrics-file") && next){ opt->metrics_file = next; i++; }
+        else if(!strcmp(a, "--mqtt") && next){
+            const char* colon = strrchr(next, ':');
+            opt->mqtt_host.assign(next, colon ? (size_t)(colon - next) : strlen(next));
+            if(colon) opt->mqtt_port = (uint16_t)atoi(colon + 1);
+            if(opt->mqtt_host.empty() || !opt->mqtt_port) return -1;
+            i++;
+        }
+        else if(!strcmp(a, "--mqtt-prefix") && next){ opt->mqtt_prefix = next; i++; }
+        else if(!strcmp(a, "--mqtt-spool") && next){ opt->mqtt_spool = next; i++; }
+        else if(!strcmp(a, "--mqtt-qos") && next){ opt->mqtt_qos = (uint8_t)(atoi(next) ? 1 : 0); i++; }
+        else if(!strcmp(a, "--ws") && next){ opt->ws_port = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "--shm") && next){ opt->shm_name = next; i++; }
+        else if(!strcmp(a, "--shm-slots") && next){ opt->shm_slots = (uint32_t)atoi(next); i++; }
+        else if(a[0] == '-'){ return -1; }
+        else { opt->paths.push_back(a); }
+    }
+    if(opt->paths.empty() && opt->pty_count == 0 && opt->listen_port == 0) return -1;
+    if(opt->paths.size() + opt->pty_count > MAX_DEVICES) return -1;
+    if(!opt->store_path && !opt->tsdb_path) opt->store_path = "readings.csv";
+    return 0;
+}
+
+//  LATENCY
+static void collect_latency(IngestEngine* engine, LatencyStages* out){
+    out->reset();
+    engine->collect_latency(out);
+    out->add(dispatch_latency);
+}
+
+// Stage percentiles since the previous report
+static void report_latency(IngestEngine* engine, uint32_t period_s){
+    static LatencyStages total, last, interval;
+    collect_latency(engine, &total);
+    interval.reset();
+    interval.add(total);
+    interval.subtract(last);
+    last.reset();
+    last.add(total);
+
+    char title[32];
+    snprintf(title, sizeof(title), "last %us", (unsigned)period_s);
+    interval.print(stderr, title);
+}
+
+//  METRICS
+typedef struct {
+    EventQueue* queue;
+    IngestEngine* engine;
+    MqttBridge* mqtt;                   // NULL without --mqtt
+    LiveStream* live;                   // NULL without --ws
+    ShmPublisher* shm;                  // NULL without --shm
+} MetricsSources_t;
+
+static double queue_depth(void* ctx) { return ((MetricsSources_t*)ctx)->queue->depth(); }
+static double queue_capacity(void* ctx) { return ((MetricsSources_t*)ctx)->queue->capacity(); }
+static double queue_dropped(void* ctx) { return (double)((MetricsSources_t*)ctx)->queue->dropped(); }
+static double backpressure_waits(void* ctx) { return (double)((MetricsSources_t*)ctx)->engine->backpressure_waits(); }
+static double mqtt_connected(void* ctx) { return ((MetricsSources_t*)ctx)->mqtt->connected(); }
+static double mqtt_acked(void* ctx) { return (double)((MetricsSources_t*)ctx)->mqtt->acked(); }
+static double mqtt_spooled(void* ctx) { return (double)((MetricsSources_t*)ctx)->mqtt->spooled(); }
+static double mqtt_spool_bytes(void* ctx) { return (double)((MetricsSources_t*)ctx)->mqtt->spool_bytes(); }
+static double mqtt_dropped(void* ctx) { return (double)((MetricsSources_t*)ctx)->mqtt->dropped(); }
+static double mqtt_connects(void* ctx) { return (double)((MetricsSources_t*)ctx)->mqtt->connects(); }
+static double ws_clients(void* ctx) { return ((MetricsSources_t*)ctx)->live->clients(); }
+static double ws_messages(void* ctx) { return (double)((MetricsSources_t*)ctx)->live->messages(); }
+static double ws_dropped(void* ctx) { return (double)((MetricsSources_t*)ctx)->live->dropped(); }
+static double ws_closed_slow(void* ctx) { return (double)((MetricsSources_t*)ctx)->live->closed_slow(); }
+static double shm_published(void* ctx) { return (double)((MetricsSources_t*)ctx)->shm->published(); }
+
+static double devices_online(void* ctx){
+    IngestEngine* engine = ((MetricsSources_t*)ctx)->engine;
+    uint32_t n = 0;
+    for(uint32_t id = 0; id < MAX_DEVICES; id++) n += engine->health(id).online.load(std::memory_order_relaxed);
+    return n;
+}
+
+// Per device: uptime from its clock, and the cause of its last reset
+static void collect_uptime(void* ctx, std::string* out){
+    IngestEngine* engine = ((MetricsSources_t*)ctx)->engine;
+    char labels[32];
+    for(uint32_t id = 0; id < MAX_DEVICES; id++){
+        const DeviceHealth_t& h = engine->health(id);
+        if(!h.online.load(std::memory_order_relaxed)) continue;
+        snprintf(labels, sizeof(labels), "device=\"%u\"", (unsigned)id);
+        metrics_sample(out, "tankgw_device_uptime_seconds", labels, h.uptime_ms.load(std::memory_order_relaxed) / 1000.0);
+    }
+}
+
+static void collect_last_reset(void* ctx, std::string* out){
+    IngestEngine* engine = ((MetricsSources_t*)ctx)->engine;
+    char labels[64];
+    for(uint32_t id = 0; id < MAX_DEVICES; id++){
+        const DeviceHealth_t& h = engine->health(id);
+        if(!h.reset_seen.load(std::memory_order_relaxed)) continue;
+        uint8_t flags = h.reset_flags.load(std::memory_order_relaxed);
+        for(uint8_t b = 0; b < RESET_CAUSE_COUNT; b++){
+            if(!(flags & (1u << b))) continue;
+            snprintf(labels, sizeof(labels), "device=\"%u\",cause=\"%s\"", (unsigned)id, reset_cause_name(b));
+            metrics_sample(out, "tankgw_device_last_reset", labels, 1);
+        }
+    }
+}
+
+static void register_metrics(MetricsRegistry* m, MetricsSources_t* src){
+    IngestEngine* engine = src->engine;
+    const IngestCounters& c = engine->counters();
+    char labels[64];
+
+    m->counter("tankgw_received_bytes_total", "Bytes read from devices", NULL, &c.bytes);
+    m->counter("tankgw_lines_total", "Lines decoded, by type", "type=\"status\"", &c.status_lines);
+    m->counter("tankgw_lines_total", "Lines decoded, by type", "type=\"ack\"", &c.ack_lines);
+    m->counter("tankgw_malformed_lines_total", "Lines dropped as malformed (the protocol has no checksum)", "kind=\"syntax\"", &c.malformed[TLM_ERR_SYNTAX]);
+    m->counter("tankgw_malformed_lines_total", "Lines dropped as malformed (the protocol has no checksum)", "kind=\"range\"", &c.malformed[TLM_ERR_RANGE]);
+    m->counter("tankgw_malformed_lines_total", "Lines dropped as malformed (the protocol has no checksum)", "kind=\"overlong\"", &c.malformed[TLM_ERR_OVERLONG]);
+    m->counter("tankgw_echo_missing_total", "Status packets whose echo was over a second old (sensor not answering)", NULL, &c.echo_missing);
+    m->counter("tankgw_device_restarts_total", "Device clocks seen going backwards", NULL, &c.restarts);
+    for(uint8_t b = 0; b < RESET_CAUSE_COUNT; b++){
+        snprintf(labels, sizeof(labels), "cause=\"%s\"", reset_cause_name(b));
+        m->counter("tankgw_device_resets_total", "Device startups reported, by reset flag", labels, &c.resets[b]);
+    }
+    m->counter("tankgw_connects_total", "Devices connected or reconnected", NULL, &c.connects);
+    m->counter("tankgw_disconnects_total", "Device connections lost", NULL, &c.disconnects);
+    m->gauge("tankgw_devices_online", "Devices connected and reporting", NULL, devices_online, src);
+
+    m->gauge("tankgw_queue_depth", "Events waiting for the sinks", NULL, queue_depth, src);
+    m->gauge("tankgw_queue_capacity", "Event queue size", NULL, queue_capacity, src);
+    m->counter("tankgw_queue_dropped_total", "Events dropped on a full queue", NULL, queue_dropped, src);
+    m->counter("tankgw_backpressure_waits_total", "Times an ingest loop paused for the sinks", NULL, backpressure_waits, src);
+    m->counter("tankgw_committed_events_total", "Events written and flushed by every sink", NULL, &committed);
+
+    for(uint8_t s = 0; s < LAT_STAGE_COUNT; s++){
+        std::vector<const LatencyHistogram*> shards;
+        for(uint16_t i = 0; i < engine->loop_count(); i++) shards.push_back(&engine->loop_latency(i).stage[s]);
+        shards.push_back(&dispatch_latency.stage[s]);
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", lat_stage_name(s));
+        m->histogram("tankgw_stage_latency_seconds", "Per-stage latency from echo capture to commit", labels, shards);
+    }
+    m->histogram("tankgw_store_flush_seconds", "Time to flush every sink (CSV, store and WAL sync, rollups)", NULL, { &flush_latency });
+
+    m->collector("tankgw_device_uptime_seconds", "Device clock (T) of the latest packet", "gauge", collect_uptime, src);
+    m->collector("tankgw_device_last_reset", "Flags of the device's last reported reset", "gauge", collect_last_reset, src);
+
+    if(src->mqtt){
+        m->gauge("tankgw_mqtt_connected", "1 while the MQTT broker connection is up", NULL, mqtt_connected, src);
+        m->counter("tankgw_mqtt_published_total", "Messages acknowledged by the broker", NULL, mqtt_acked, src);
+        m->counter("tankgw_mqtt_spooled_total", "Messages written to the spool while the broker was away", NULL, mqtt_spooled, src);
+        m->gauge("tankgw_mqtt_spool_bytes", "Spooled bytes not yet sent", NULL, mqtt_spool_bytes, src);
+        m->counter("tankgw_mqtt_dropped_total", "Messages dropped (no spool, or spool full)", NULL, mqtt_dropped, src);
+        m->counter("tankgw_mqtt_connects_total", "Broker connections made", NULL, mqtt_connects, src);
+        m->histogram("tankgw_mqtt_publish_seconds", "Time from reading to broker acknowledgement", NULL, { &src->mqtt->publish_latency() });
+    }
+    if(src->live){
+        m->gauge("tankgw_ws_clients", "Live stream subscribers", NULL, ws_clients, src);
+        m->counter("tankgw_ws_messages_total", "Readings queued to live stream subscribers", NULL, ws_messages, src);
+        m->counter("tankgw_ws_dropped_total", "Readings dropped by a slow subscriber's policy", NULL, ws_dropped, src);
+        m->counter("tankgw_ws_closed_slow_total", "Slow subscribers disconnected (policy=close)", NULL, ws_closed_slow, src);
+    }
+    if(src->shm) m->counter("tankgw_shm_published_total", "Readings published to the shared-memory ring", NULL, shm_published, src);
+}
+
+//  ALERTS
+typedef struct {
+    FILE* log;                          // NULL with -q
+    MqttBridge* mqtt;                   // NULL without --mqtt
+} AlertOutputs_t;
+
+static void notify_alert(void* ctx, const AlertEvent_t& ev){
+    AlertOutputs_t* out = (AlertOutputs_t*)ctx;
+    if(out->log) alert_print(out->log, ev);
+    if(out->mqtt) out->mqtt->publish_alert(ev);
+}
+
+//  DISPATCHER
+typedef struct {
+    uint64_t rx_us;
+    uint64_t taken_us;
+} Uncommitted_t;
+
+static void dispatch_loop(EventQueue* queue, std::vector<Sink*>& sinks, IngestEngine* engine, uint32_t latency_s){
+    static Event_t batch[DISPATCH_BATCH];
+    std::vector<Uncommitted_t> uncommitted;     // Taken since the last flush
+    uint64_t last_flush = mono_ms();
+    uint64_t next_report = latency_s ? last_flush + latency_s * 1000ULL : UINT64_MAX;
+
+    while(true){
+        uint32_t n = queue->pop_batch(batch, DISPATCH_BATCH, FLUSH_INTERVAL_MS);
+        uint64_t taken = mono_us();
+
+        for(uint32_t i = 0; i < n; i++){
+            const Event_t& ev = batch[i];
+            for(Sink* s : sinks){
+                if(ev.type == EVENT_READING) s->on_reading(ev.reading);
+                else if(ev.type == EVENT_HEIGHT_ACK) s->on_height_ack(ev.reading.device_id, ev.height_cm);
+                else s->on_device_reset(ev.reading.device_id);
+            }
+            dispatch_latency.record(LAT_QUEUE, taken - ev.times.rx_us - ev.times.queued_dus);
+            uncommitted.push_back({ ev.times.rx_us, taken });
+        }
+
+        // Flush once the backlog is drained, or at least every FLUSH_INTERVAL_MS
+        uint64_t t = mono_ms();
+        if(n < DISPATCH_BATCH || t - last_flush >= FLUSH_INTERVAL_MS){
+            uint64_t start = mono_us();
+            for(Sink* s : sinks) s->flush();
+            last_flush = t;
+
+            uint64_t done = mono_us();
+            flush_latency.record(done - start);
+            for(const Uncommitted_t& u : uncommitted){
+                dispatch_latency.record(LAT_COMMIT, done - u.taken_us);
+                dispatch_latency.record(LAT_GATEWAY, done - u.rx_us);
+            }
+            committed.add(0, uncommitted.size());
+            uncommitted.clear();
+        }
+        if(t >= next_report){
+            report_latency(engine, latency_s);
+            next_report = t + latency_s * 1000ULL;
+        }
+
+        // Stop ingest first, then exit once the queue is empty
+        if(stop_requested && engine->running()) engine->stop();
+        if(!engine->running() && n == 0) break;
+    }
+}
+
+// MAIN PROGRAM
+int main(int argc, char** argv){
+    Options_t opt;
+    if(parse_options(argc, argv, &opt) < 0){
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // --- Ingest ---
+    EventQueue queue(QUEUE_CAPACITY);
+    IngestConfig_t cfg;
+    cfg.loops = opt.loops;
+    cfg.high_water = QUEUE_HIGH_WATER;
+    cfg.low_water = QUEUE_LOW_WATER;
+    cfg.height_cm = opt.height_cm;
+    cfg.listen_port = opt.listen_port;
+    IngestEngine engine(&queue, cfg);
+
+    for(const char* path : opt.paths){
+        Port_t* port;
+        int rc = engine.add_serial(path, opt.baud, &port);
+        if(!port){
+            fprintf(stderr, "%s: no free device slot\n", path);
+            return 1;
+        }
+        if(rc < 0) fprintf(stderr, "%s: %s (will retry)\n", path, strerror(-rc));
+    }
+    for(uint16_t i = 0; i < opt.pty_count; i++){
+        Port_t* port = engine.add_pty();
+        if(!port){
+            fprintf(stderr, "pty: %s\n", strerror(errno));
+            return 1;
+        }
+        printf("dev%u: %s\n", (unsigned)port->id, port->path);
+    }
+    fflush(stdout);
+
+    // --- Sinks ---
+    std::vector<Sink*> sinks;
+    FILE* store = NULL;
+    if(opt.store_path){
+        store = !strcmp(opt.store_path, "-") ? stdout : fopen(opt.store_path, "a");
+        if(!store){
+            fprintf(stderr, "%s: %s\n", opt.store_path, strerror(errno));
+            return 1;
+        }
+        static char store_buf[1 << 16];
+        setvbuf(store, store_buf, _IOFBF, sizeof(store_buf));
+    }
+    CsvStore csv(store);
+    if(store) sinks.push_back(&csv);
+
+    static ColumnStore tsdb; // Open-block table is too large for the stack
+    if(opt.tsdb_path){
+        WalConfig_t wal = WAL_DEFAULTS;
+        wal.sync_ms = opt.wal_sync_ms;
+        int rc = tsdb.open(opt.tsdb_path, opt.wal ? &wal : NULL);
+        if(rc < 0){
+            fprintf(stderr, "%s: %s\n", opt.tsdb_path, strerror(-rc));
+            return 1;
+        }
+        if(tsdb.corrupt_blocks()) fprintf(stderr, "%s: skipping %u damaged blocks\n", opt.tsdb_path, tsdb.corrupt_blocks());
+        if(tsdb.replayed()) fprintf(stderr, "%s: recovered %" PRIu64 " readings from the WAL\n", opt.tsdb_path, tsdb.replayed());
+        sinks.push_back(&tsdb);
+    }
+
+    static RollupStore rollups;
+    if(opt.rollup_dir){
+        int rc = rollups.open(opt.rollup_dir, opt.retention_days);
+        if(rc < 0){
+            fprintf(stderr, "%s: %s\n", opt.rollup_dir, strerror(-rc));
+            return 1;
+        }
+        sinks.push_back(&rollups);
+    }
+
+    // Incidents from A flags and rules, one notification each
+    static AlertTracker tracker;
+    static MqttBridge mqtt;
+    AlertOutputs_t alert_outputs = { opt.quiet ? NULL : stderr, opt.mqtt_host.empty() ? NULL : &mqtt };
+    if(alert_outputs.log || alert_outputs.mqtt) tracker.set_notify(notify_alert, &alert_outputs);
+    AlertLog alerts(&tracker, opt.quiet ? NULL : stderr);
+    sinks.push_back(&alerts);
+
+    static RuleEngine rules(&tracker);
+    if(opt.rules_path){
+        std::string error;
+        if(rules.load(opt.rules_path, &error) < 0){
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        fprintf(stderr, "%s: %zu rules, %zu groups, %zu windows\n", opt.rules_path,
+                rules.rule_count(), rules.group_count() - 1, rules.window_count());
+        sinks.insert(sinks.end() - 1, &rules);  // Ahead of the alert log, which runs the tracker's timers
+    }
+
+    // Last, so alerts raised in this round's flush go out with it
+    if(alert_outputs.mqtt){
+        MqttConfig_t mc = MQTT_DEFAULTS;
+        mc.host = opt.mqtt_host.c_str();
+        mc.port = opt.mqtt_port;
+        mc.prefix = opt.mqtt_prefix;
+        mc.spool_path = opt.mqtt_spool;
+        mc.qos = opt.mqtt_qos;
+        int rc = mqtt.start(mc);
+        if(rc < 0){
+            fprintf(stderr, "%s: %s\n", opt.mqtt_spool ? opt.mqtt_spool : "mqtt", strerror(-rc));
+            return 1;
+        }
+        if(mqtt.spool_bytes()) fprintf(stderr, "%s: %" PRIu64 " bytes to resend\n", opt.mqtt_spool, mqtt.spool_bytes());
+        sinks.push_back(&mqtt);
+    }
+
+    static LiveStream live;
+    if(opt.ws_port){
+        int rc = live.start(opt.ws_port, opt.rules_path ? &rules : NULL);
+        if(rc < 0){
+            fprintf(stderr, "ws: %s\n", strerror(-rc));
+            return 1;
+        }
+        sinks.push_back(&live);
+    }
+
+    // First, so local readers see a reading before the stores spend time on it
+    static ShmPublisher shm;
+    if(opt.shm_name){
+        int rc = shm.open(opt.shm_name, opt.shm_slots);
+        if(rc < 0){
+            fprintf(stderr, "shm %s: %s\n", opt.shm_name, strerror(-rc));
+            return 1;
+        }
+        sinks.insert(sinks.begin(), &shm);
+    }
+
+    // --- Run ---
+    int rc = engine.start();
+    if(rc < 0){
+        fprintf(stderr, "ingest: %s\n", strerror(-rc));
+        return 1;
+    }
+    if(opt.listen_port){
+        fprintf(stderr, "listening on tcp:%u (%u loops)\n", (unsigned)opt.listen_port, (unsigned)engine.loop_count());
+    }
+
+    static MetricsRegistry metrics;
+    static MetricsServer metrics_server;
+    MetricsSources_t metrics_src = { &queue, &engine, alert_outputs.mqtt, opt.ws_port ? &live : NULL,
+                                   opt.shm_name ? &shm : NULL };
+    if(opt.metrics_port || opt.metrics_file){
+        register_metrics(&metrics, &metrics_src);
+        rc = metrics_server.start(&metrics, opt.metrics_port, opt.metrics_file);
+        if(rc < 0){
+            fprintf(stderr, "metrics: %s\n", strerror(-rc));
+            engine.stop();
+            return 1;
+        }
+    }
+
+    dispatch_loop(&queue, sinks, &engine, opt.latency_s);
+    mqtt.stop();
+    live.stop();
+    shm.close();
+    metrics_server.stop();
+
+    // --- Summary ---
+    PortPool& pool = engine.ports();
+    uint64_t ok = pool.retired_lines();
+    uint64_t syntax = pool.retired_errors(TLM_ERR_SYNTAX);
+    uint64_t range = pool.retired_errors(TLM_ERR_RANGE);
+    uint64_t overlong = pool.retired_errors(TLM_ERR_OVERLONG);
+    for(uint32_t id = 0; id < pool.capacity(); id++){
+        if(!pool.in_use(id)) continue;
+        Port_t* p = pool.at(id);
+        ok += p->parser.status_lines + p->parser.ack_lines + p->parser.reset_lines;
+        syntax += p->parser.errors[TLM_ERR_SYNTAX];
+        range += p->parser.errors[TLM_ERR_RANGE];
+        overlong += p->parser.errors[TLM_ERR_OVERLONG];
+    }
+    fprintf(stderr, "lines ok: %" PRIu64 ", malformed: %" PRIu64 " syntax / %" PRIu64 " range / %" PRIu64
+            " overlong, dropped: %" PRIu64 ", backpressure waits: %" PRIu64 "\n",
+            ok, syntax, range, overlong, queue.dropped(), engine.backpressure_waits());
+    fprintf(stderr, "alerts: %" PRIu64 " opened, %" PRIu64 " resolved, %u open, %" PRIu64 " repeats coalesced, %" PRIu64
+            " flapping, %" PRIu64 " rate limited\n", tracker.events(ALERT_OPENED), tracker.events(ALERT_RESOLVED), tracker.open(),
+            tracker.coalesced(), tracker.events(ALERT_FLAPPING), tracker.rate_limited());
+    if(alert_outputs.mqtt){
+        fprintf(stderr, "mqtt: %" PRIu64 " queued, %" PRIu64 " published, %" PRIu64 " spooled (%" PRIu64 " bytes left), %"
+                PRIu64 " dropped, %" PRIu64 " connects\n", mqtt.queued(), mqtt.acked(), mqtt.spooled(), mqtt.spool_bytes(),
+                mqtt.dropped(), mqtt.connects());
+    }
+    if(opt.latency_s){
+        static LatencyStages total;
+        collect_latency(&engine, &total);
+        total.print(stderr, "latency");
+    }
+
+    if(opt.tsdb_path){
+        tsdb.close();
+        fprintf(stderr, "%s: %" PRIu64 " readings in %zu blocks\n", opt.tsdb_path, tsdb.readings(), tsdb.index().size());
+    }
+    if(opt.rollup_dir) rollups.close();
+    if(store && store != stdout) fclose(store);
+    return 0;
+}
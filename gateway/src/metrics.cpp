@@ -0,0 +1,304 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+#define SERVER_POLL_MS      200     // Stop-check period
+#define CLIENT_TIMEOUT_MS   1000    // For the request to arrive
+
+// Histogram bucket bounds in seconds: 100 us to 10 s
+static const double histogram_bounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+//  COUNTER
+MetricCounter::MetricCounter(){
+    for(uint32_t i = 0; i < METRICS_MAX_SHARDS; i++) shards_[i].value.store(0, std::memory_order_relaxed);
+}
+
+uint64_t MetricCounter::value() const {
+    uint64_t v = 0;
+    for(uint32_t i = 0; i < METRICS_MAX_SHARDS; i++) v += shards_[i].value.load(std::memory_order_relaxed);
+    return v;
+}
+
+//  REGISTRY
+void MetricsRegistry::add(Entry e){
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(std::move(e));
+}
+
+void MetricsRegistry::counter(const char* name, const char* help, const char* labels, const MetricCounter* c){
+    Entry e = {};
+    e.kind = M_COUNTER;
+    e.name = name;
+    e.help = help;
+    e.labels = labels ? labels : "";
+    e.type = "counter";
+    e.counter = c;
+    add(std::move(e));
+}
+
+void MetricsRegistry::counter(const char* name, const char* help, const char* labels, MetricGaugeFn fn, void* ctx){
+    Entry e = {};
+    e.kind = M_COUNTER_FN;
+    e.name = name;
+    e.help = help;
+    e.labels = labels ? labels : "";
+    e.type = "counter";
+    e.read = fn;
+    e.ctx = ctx;
+    add(std::move(e));
+}
+
+void MetricsRegistry::gauge(const char* name, const char* help, const char* labels, MetricGaugeFn fn, void* ctx){
+    Entry e = {};
+    e.kind = M_GAUGE;
+    e.name = name;
+    e.help = help;
+    e.labels = labels ? labels : "";
+    e.type = "gauge";
+    e.read = fn;
+    e.ctx = ctx;
+    add(std::move(e));
+}
+
+void MetricsRegistry::histogram(const char* name, const char* help, const char* labels,
+                                const std::vector<const LatencyHistogram*>& shards){
+    Entry e = {};
+    e.kind = M_HISTOGRAM;
+    e.name = name;
+    e.help = help;
+    e.labels = labels ? labels : "";
+    e.type = "histogram";
+    e.shards = shards;
+    add(std::move(e));
+}
+
+void MetricsRegistry::collector(const char* name, const char* help, const char* type, MetricCollectFn fn, void* ctx){
+    Entry e = {};
+    e.kind = M_COLLECTOR;
+    e.name = name;
+    e.help = help;
+    e.type = type;
+    e.collect = fn;
+    e.ctx = ctx;
+    add(std::move(e));
+}
+
+void metrics_sample(std::string* out, const char* name, const char* labels, double value){
+    char line[256];
+    int n;
+    if(labels && labels[0]) n = snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, labels, value);
+    else n = snprintf(line, sizeof(line), "%s %.15g\n", name, value);
+    if(n > 0) out->append(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+// Cumulative le buckets, _sum and _count, all in seconds
+static void render_histogram(std::string* out, const std::string& name, const std::string& labels,
+                             const std::vector<const LatencyHistogram*>& shards){
+    static LatencyHistogram merged; // 8 KB; renders are serialised by the registry mutex
+    merged.reset();
+    for(const LatencyHistogram* h : shards) merged.add(*h);
+
+    std::string bucket_name = name + "_bucket";
+    std::string sep = labels.empty() ? "" : labels + ",";
+    char le[320];
+    for(double bound : histogram_bounds){
+        snprintf(le, sizeof(le), "%sle=\"%g\"", sep.c_str(), bound);
+        metrics_sample(out, bucket_name.c_str(), le, (double)merged.count_to((uint64_t)(bound * 1e6)));
+    }
+    uint64_t count = merged.count();
+    snprintf(le, sizeof(le), "%sle=\"+Inf\"", sep.c_str());
+    metrics_sample(out, bucket_name.c_str(), le, (double)count);
+    metrics_sample(out, (name + "_sum").c_str(), labels.c_str(), merged.sum() / 1e6);
+    metrics_sample(out, (name + "_count").c_str(), labels.c_str(), (double)count);
+}
+
+void MetricsRegistry::render(std::string* out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string* family = NULL;
+
+    for(const Entry& e : entries_){
+        if(!family || *family != e.name){
+            out->append("# HELP " + e.name + " " + e.help + "\n");
+            out->append("# TYPE " + e.name + " " + e.type + "\n");
+            family = &e.name;
+        }
+        switch(e.kind){
+            case M_COUNTER:
+                metrics_sample(out, e.name.c_str(), e.labels.c_str(), (double)e.counter->value());
+                break;
+            case M_COUNTER_FN:
+            case M_GAUGE:
+                metrics_sample(out, e.name.c_str(), e.labels.c_str(), e.read(e.ctx));
+                break;
+            case M_HISTOGRAM:
+                render_histogram(out, e.name, e.labels, e.shards);
+                break;
+            case M_COLLECTOR:
+                e.collect(e.ctx, out);
+                break;
+        }
+    }
+}
+
+//  SERVER
+MetricsServer::MetricsServer() : registry_(NULL), listen_fd_(-1), running_(false) {}
+
+MetricsServer::~MetricsServer(){
+    stop();
+}
+
+int MetricsServer::start(const MetricsRegistry* registry, uint16_t http_port, const char* snapshot_path){
+    registry_ = registry;
+    snapshot_path_ = snapshot_path ? snapshot_path : "";
+
+    if(http_port){
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0) return -errno;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        // Local only: put a reverse proxy in front to expose it
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(http_port);
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0){
+            int err = errno;
+            close(fd);
+            return -err;
+        }
+        listen_fd_ = fd;
+    }
+
+    if(!snapshot_path_.empty()){
+        int rc = write_snapshot();
+        if(rc < 0) return rc;
+    }
+    running_ = true;
+    thread_ = std::thread(&MetricsServer::run, this);
+    return 0;
+}
+
+void MetricsServer::stop(){
+    if(!running_.exchange(false)) return;
+    if(thread_.joinable()) thread_.join();
+    if(listen_fd_ >= 0) close(listen_fd_);
+    listen_fd_ = -1;
+    if(!snapshot_path_.empty()) write_snapshot();
+}
+
+// Write to a temporary file and rename, so readers never see half a scrape
+int MetricsServer::write_snapshot(){
+    std::string body;
+    registry_->render(&body);
+
+    std::string tmp = snapshot_path_ + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if(!f) return -errno;
+    size_t n = fwrite(body.data(), 1, body.size(), f);
+    int rc = (fclose(f) != 0 || n != body.size()) ? -EIO : 0;
+    if(rc == 0 && rename(tmp.c_str(), snapshot_path_.c_str()) < 0) rc = -errno;
+    if(rc < 0) unlink(tmp.c_str());
+    return rc;
+}
+
+static void send_all(int fd, const char* data, size_t len){
+    while(len > 0){
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN){
+            struct pollfd p = { fd, POLLOUT, 0 };
+            if(poll(&p, 1, CLIENT_TIMEOUT_MS) <= 0) return;
+            continue;
+        }
+        if(n <= 0) return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// One request per connection, then close
+void MetricsServer::serve(int fd){
+    char req[METRICS_REQUEST_MAX];
+    size_t len = 0;
+    uint64_t deadline = mono_ms() + CLIENT_TIMEOUT_MS;
+
+    while(len < sizeof(req) - 1){
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if(n > 0){
+            len += (size_t)n;
+            req[len] = '\0';
+            if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+            continue;
+        }
+        if(n == 0 || (errno != EAGAIN && errno != EINTR)) return;
+        uint64_t now = mono_ms();
+        if(now >= deadline) return;
+        struct pollfd p = { fd, POLLIN, 0 };
+        poll(&p, 1, (int)(deadline - now));
+    }
+    req[len] = '\0';
+
+    bool head = !strncmp(req, "HEAD ", 5);
+    const char* path = head ? req + 5 : (!strncmp(req, "GET ", 4) ? req + 4 : NULL);
+    char header[256];
+
+    if(!path){
+        static const char bad[] = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, bad, sizeof(bad) - 1);
+        return;
+    }
+    if(strncmp(path, "/metrics ", 9) && strncmp(path, "/metrics?", 9) && strncmp(path, "/ ", 2)){
+        static const char missing[] = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+        send_all(fd, missing, sizeof(missing) - 1);
+        return;
+    }
+
+    std::string body;
+    registry_->render(&body);
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+    send_all(fd, header, (size_t)n);
+    if(!head) send_all(fd, body.data(), body.size());
+}
+
+void MetricsServer::run(){
+    uint64_t next_snapshot = mono_ms() + METRICS_SNAPSHOT_MS;
+
+    while(running_){
+        if(listen_fd_ >= 0){
+            struct pollfd p = { listen_fd_, POLLIN, 0 };
+            if(poll(&p, 1, SERVER_POLL_MS) > 0){
+                while(true){
+                    int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if(fd < 0) break;
+                    serve(fd);
+                    close(fd);
+                }
+            }
+        } else {
+            poll(NULL, 0, SERVER_POLL_MS);
+        }
+
+        uint64_t now = mono_ms();
+        if(!snapshot_path_.empty() && now >= next_snapshot){
+            write_snapshot();
+            next_snapshot = now + METRICS_SNAPSHOT_MS;
+        }
+    }
+}
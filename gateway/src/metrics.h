@@ -0,0 +1,118 @@
+#ifndef GATEWAY_METRICS_H
+#define GATEWAY_METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency.h"
+
+// METRICS
+//
+// Counters are sharded by writer thread: each ingest loop (and the
+// dispatcher) adds to its own cache line with a relaxed load and store, and
+// a scrape sums the shards. Histograms are the writers' own
+// LatencyHistogram objects, merged the same way. Gauges are read through a
+// callback at scrape time. Nothing on the hot path takes a lock.
+//
+// MetricsRegistry renders everything in the Prometheus text format;
+// MetricsServer serves that on a local HTTP port and/or writes it to a
+// snapshot file.
+#define METRICS_MAX_SHARDS      66      // INGEST_MAX_LOOPS + the dispatcher + one spare
+#define METRICS_CACHE_LINE      64
+#define METRICS_SNAPSHOT_MS     10000   // Snapshot file period
+#define METRICS_REQUEST_MAX     4096
+
+class MetricCounter {
+public:
+    MetricCounter();
+
+    // Only the thread that owns `shard` may add to it
+    void add(uint32_t shard, uint64_t n = 1){
+        std::atomic<uint64_t>& v = shards_[shard].value;
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+
+private:
+    struct alignas(METRICS_CACHE_LINE) Shard {
+        std::atomic<uint64_t> value;
+    };
+    Shard shards_[METRICS_MAX_SHARDS];
+};
+
+typedef double (*MetricGaugeFn)(void* ctx);
+
+// Writes any number of samples for one metric family, e.g. one per device
+typedef void (*MetricCollectFn)(void* ctx, std::string* out);
+
+class MetricsRegistry {
+public:
+    // Register a sample. Metrics are rendered in registration order, and
+    // samples of one family (same name) must be registered together.
+    // `labels` is the inside of the braces, e.g. "kind=\"syntax\"", or NULL.
+    void counter(const char* name, const char* help, const char* labels, const MetricCounter* c);
+    void counter(const char* name, const char* help, const char* labels, MetricGaugeFn fn, void* ctx);
+    void gauge(const char* name, const char* help, const char* labels, MetricGaugeFn fn, void* ctx);
+    void histogram(const char* name, const char* help, const char* labels,
+                   const std::vector<const LatencyHistogram*>& shards);
+    void collector(const char* name, const char* help, const char* type, MetricCollectFn fn, void* ctx);
+
+    // Prometheus text exposition format (version 0.0.4)
+    void render(std::string* out) const;
+
+private:
+    typedef enum { M_COUNTER, M_COUNTER_FN, M_GAUGE, M_HISTOGRAM, M_COLLECTOR } Kind_t;
+
+    struct Entry {
+        Kind_t kind;
+        std::string name;
+        std::string help;
+        std::string labels;
+        const char* type;
+        const MetricCounter* counter;
+        MetricGaugeFn read;
+        MetricCollectFn collect;
+        void* ctx;
+        std::vector<const LatencyHistogram*> shards;
+    };
+
+    void add(Entry e);
+
+    mutable std::mutex mutex_;      // Scrapes from the server and the snapshot writer
+    std::vector<Entry> entries_;
+};
+
+// Append one "name{labels} value" line
+void metrics_sample(std::string* out, const char* name, const char* labels, double value);
+
+class MetricsServer {
+public:
+    MetricsServer();
+    ~MetricsServer();
+
+    // Serve GET /metrics on 127.0.0.1:`http_port` (0 = no server) and
+    // rewrite `snapshot_path` every METRICS_SNAPSHOT_MS (NULL = none).
+    // Returns 0 or -errno.
+    int start(const MetricsRegistry* registry, uint16_t http_port, const char* snapshot_path);
+
+    // Write a last snapshot and stop
+    void stop();
+
+private:
+    void run();
+    void serve(int fd);
+    int write_snapshot();
+
+    const MetricsRegistry* registry_;
+    int listen_fd_;
+    std::string snapshot_path_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+};
+
+#endif
@@ -0,0 +1,656 @@
+#include "mqtt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "clock.h"
+
+#define REC_HEADER          12          // u64 queued_us, u16 topic length, u16 payload length
+#define OUT_MAX             (1u << 20)  // Encoded bytes buffered per send
+#define SPOOL_READ          65536
+#define CONNECT_TIMEOUT_MS  3000
+#define IDLE_POLL_MS        100
+
+//  CODEC
+static void put_u16(std::string* out, uint16_t v){
+    out->push_back((char)(v >> 8));
+    out->push_back((char)(v & 0xFF));
+}
+
+static void put_length(std::string* out, size_t len){
+    do {
+        uint8_t b = len & 0x7F;
+        len >>= 7;
+        if(len) b |= 0x80;
+        out->push_back((char)b);
+    } while(len);
+}
+
+void mqtt_encode_connect(std::string* out, const char* client_id, uint16_t keepalive_s){
+    size_t id_len = strlen(client_id);
+    out->push_back((char)(MQTT_CONNECT << 4));
+    put_length(out, 10 + 2 + id_len);
+    put_u16(out, 4);
+    out->append("MQTT", 4);
+    out->push_back(4);                  // Protocol level 3.1.1
+    out->push_back(0x02);               // Clean session
+    put_u16(out, keepalive_s);
+    put_u16(out, (uint16_t)id_len);
+    out->append(client_id, id_len);
+}
+
+void mqtt_encode_publish(std::string* out, const char* topic, size_t topic_len,
+                         const char* payload, size_t payload_len, uint8_t qos, uint16_t id, bool dup){
+    out->push_back((char)((MQTT_PUBLISH << 4) | (dup ? 0x08 : 0) | (qos << 1)));
+    put_length(out, 2 + topic_len + (qos ? 2 : 0) + payload_len);
+    put_u16(out, (uint16_t)topic_len);
+    out->append(topic, topic_len);
+    if(qos) put_u16(out, id);
+    out->append(payload, payload_len);
+}
+
+void mqtt_encode_simple(std::string* out, MqttPacket_t type, uint16_t id){
+    switch(type){
+        case MQTT_PUBACK:
+            out->push_back((char)(MQTT_PUBACK << 4));
+            out->push_back(2);
+            put_u16(out, id);
+            break;
+        case MQTT_CONNACK:
+            out->push_back((char)(MQTT_CONNACK << 4));
+            out->push_back(2);
+            put_u16(out, id);           // Session present 0, return code in the low byte
+            break;
+        default:
+            out->push_back((char)(type << 4));
+            out->push_back(0);
+            break;
+    }
+}
+
+int mqtt_packet_length(const uint8_t* buf, size_t len, size_t* header_len){
+    size_t remaining = 0;
+    for(size_t i = 1; i <= 4; i++){
+        if(i >= len) return 0;
+        remaining |= (size_t)(buf[i] & 0x7F) << (7 * (i - 1));
+        if(!(buf[i] & 0x80)){
+            *header_len = i + 1;
+            if(len < i + 1 + remaining) return 0;
+            return (int)(i + 1 + remaining);
+        }
+    }
+    return -EPROTO;
+}
+
+//  RECORDS
+static inline uint16_t get_u16(const char* p){
+    return (uint16_t)((uint8_t)p[0] | ((uint8_t)p[1] << 8));
+}
+
+static inline size_t record_len(const char* p){
+    return REC_HEADER + get_u16(p + 8) + get_u16(p + 10);
+}
+
+// Records in `data`; a partial one at the end isn't counted
+static uint64_t count_records(const char* data, size_t len){
+    uint64_t n = 0;
+    for(size_t off = 0; off + REC_HEADER <= len; n++){
+        size_t rl = record_len(data + off);
+        if(off + rl > len) break;
+        off += rl;
+    }
+    return n;
+}
+
+static bool write_all(int fd, const char* data, size_t len, uint64_t offset){
+    while(len > 0){
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+//  BRIDGE
+MqttBridge::MqttBridge()
+    : cfg_(MQTT_DEFAULTS), stopping_(false), running_(false), wake_fd_(-1), fd_(-1), queue_off_(0), next_id_(0),
+      last_send_ms_(0), ping_sent_ms_(0), spool_fd_(-1), spool_read_(0), spool_size_(0), spool_buf_off_(0),
+      spool_inflight_(0), queued_(0), acked_(0), spooled_(0), spool_bytes_(0), dropped_(0), connects_(0) {}
+
+MqttBridge::~MqttBridge(){
+    stop();
+}
+
+int MqttBridge::start(const MqttConfig_t& cfg){
+    cfg_ = cfg;
+    if(cfg_.qos > 1) cfg_.qos = 1;
+    if(cfg_.inflight == 0) cfg_.inflight = 1;
+    if(cfg_.inflight > 65535) cfg_.inflight = 65535;   // Packet ids must stay unique
+    prefix_ = cfg_.prefix ? cfg_.prefix : "";
+
+    if(cfg_.client_id) client_id_ = cfg_.client_id;
+    else {
+        char host[64];
+        if(gethostname(host, sizeof(host)) < 0) strcpy(host, "local");
+        host[sizeof(host) - 1] = '\0';
+        client_id_ = std::string("tankgw-") + host;
+    }
+
+    if(cfg_.spool_path){
+        int rc = spool_open();
+        if(rc < 0) return rc;
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wake_fd_ < 0) return -errno;
+    running_ = true;
+    thread_ = std::thread(&MqttBridge::run, this);
+    return 0;
+}
+
+void MqttBridge::stop(){
+    if(!running_) return;
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake();
+    thread_.join();
+    running_ = false;
+    close(wake_fd_);
+    wake_fd_ = -1;
+
+    queue_.append(incoming_);
+    incoming_.clear();
+    spool_rewrite();
+    if(spool_fd_ >= 0) close(spool_fd_);
+    spool_fd_ = -1;
+}
+
+void MqttBridge::wake(){
+    uint64_t one = 1;
+    if(write(wake_fd_, &one, sizeof(one)) < 0) {}   // Already signalled
+}
+
+//  SINK SIDE (dispatcher thread)
+void MqttBridge::add(const char* topic, size_t topic_len, const char* payload, size_t payload_len){
+    uint64_t t = mono_us();
+    char header[REC_HEADER];
+    memcpy(header, &t, 8);
+    header[8] = (char)(topic_len & 0xFF);
+    header[9] = (char)(topic_len >> 8);
+    header[10] = (char)(payload_len & 0xFF);
+    header[11] = (char)(payload_len >> 8);
+    batch_.append(header, REC_HEADER);
+    batch_.append(topic, topic_len);
+    batch_.append(payload, payload_len);
+    queued_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MqttBridge::on_reading(const Reading_t& r){
+    char topic[MQTT_TOPIC_MAX];
+    char payload[MQTT_PAYLOAD_MAX];
+    int tl = snprintf(topic, sizeof(topic), "%s/dev%u/reading", prefix_.c_str(), (unsigned)r.device_id);
+    int pl = snprintf(payload, sizeof(payload), "{\"t\":%" PRIu64 ",\"T\":%u,\"P\":%u,\"W\":%u,\"S\":\"%s\",\"A\":%u}",
+                      r.rx_time_us / 1000, r.device_time_ms, (unsigned)r.percent, (unsigned)r.water_adc,
+                      status_name(r.status), (unsigned)r.alert);
+    if(tl >= (int)sizeof(topic) || pl >= (int)sizeof(payload)) return;
+    add(topic, (size_t)tl, payload, (size_t)pl);
+}
+
+void MqttBridge::publish_alert(const AlertEvent_t& ev){
+    char topic[MQTT_TOPIC_MAX];
+    char payload[MQTT_PAYLOAD_MAX];
+    int tl, pl;
+
+    if(ev.type == ALERT_SUPPRESSED){
+        tl = snprintf(topic, sizeof(topic), "%s/alerts/suppressed", prefix_.c_str());
+        pl = snprintf(payload, sizeof(payload), "{\"t\":%" PRId64 ",\"event\":\"SUPPRESSED\",\"dropped\":%u}",
+                      ev.at_ms, ev.suppressed);
+    } else {
+        const Reading_t& r = ev.detail.reading;
+        if(ev.detail.group) tl = snprintf(topic, sizeof(topic), "%s/group/%s/alert", prefix_.c_str(), ev.detail.group);
+        else tl = snprintf(topic, sizeof(topic), "%s/dev%u/alert", prefix_.c_str(), (unsigned)r.device_id);
+        pl = snprintf(payload, sizeof(payload),
+                      "{\"t\":%" PRId64 ",\"event\":\"%s\",\"incident\":%u,\"name\":\"%s\",\"opened\":%" PRId64
+                      ",\"repeats\":%u,\"stale\":%u,\"active\":%u,\"dev\":%u,\"P\":%u,\"W\":%u,\"S\":\"%s\"}",
+                      ev.at_ms, alert_event_name(ev.type), ev.incident, ev.detail.name, ev.opened_ms, ev.repeats,
+                      (unsigned)ev.stale, (unsigned)ev.active, (unsigned)r.device_id, (unsigned)r.percent,
+                      (unsigned)r.water_adc, status_name(r.status));
+    }
+    if(tl >= (int)sizeof(topic) || pl >= (int)sizeof(payload)) return;
+    add(topic, (size_t)tl, payload, (size_t)pl);
+}
+
+// One hand-off per dispatch batch, so the bridge thread is woken at the
+// batch rate, not the message rate
+void MqttBridge::flush(){
+    if(batch_.empty() || !running_) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(incoming_.empty()) incoming_.swap(batch_);
+        else incoming_.append(batch_);
+    }
+    batch_.clear();
+    wake();
+}
+
+//  SPOOL
+// An existing spool is sent first; a record cut short by a crash is dropped
+int MqttBridge::spool_open(){
+    spool_fd_ = open(cfg_.spool_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(spool_fd_ < 0) return -errno;
+
+    std::string buf;
+    uint64_t off = 0, valid = 0;
+    char chunk[SPOOL_READ];
+    for(;;){
+        ssize_t n = pread(spool_fd_, chunk, sizeof(chunk), (off_t)(off + buf.size()));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        buf.append(chunk, (size_t)n);
+        size_t pos = 0;
+        while(pos + REC_HEADER <= buf.size() && pos + record_len(buf.data() + pos) <= buf.size()) pos += record_len(buf.data() + pos);
+        buf.erase(0, pos);
+        off += pos;
+        valid = off;
+    }
+    struct stat st;
+    if(fstat(spool_fd_, &st) == 0 && (uint64_t)st.st_size != valid && ftruncate(spool_fd_, (off_t)valid) < 0) return -errno;
+
+    spool_size_ = valid;
+    spool_bytes_.store(valid, std::memory_order_relaxed);
+    return 0;
+}
+
+// Live records waiting in memory go to the spool, or are dropped without one
+void MqttBridge::spool_pending(){
+    const char* data = queue_.data() + queue_off_;
+    size_t len = queue_.size() - queue_off_;
+    if(!len) return;
+
+    uint64_t n = count_records(data, len);
+    if(spool_fd_ < 0 || spool_size_ + len > cfg_.spool_max || !write_all(spool_fd_, data, len, spool_size_)){
+        dropped_.fetch_add(n, std::memory_order_relaxed);
+    } else {
+        spool_size_ += len;
+        spooled_.fetch_add(n, std::memory_order_relaxed);
+        spool_bytes_.store(spool_size_ - spool_read_, std::memory_order_relaxed);
+    }
+    queue_.clear();
+    queue_off_ = 0;
+}
+
+bool MqttBridge::spool_next(std::string* record){
+    if(spool_read_ >= spool_size_) return false;
+
+    size_t avail = spool_buf_.size() - spool_buf_off_;
+    if(avail < REC_HEADER || avail < record_len(spool_buf_.data() + spool_buf_off_)){
+        spool_buf_.erase(0, spool_buf_off_);
+        spool_buf_off_ = 0;
+        char chunk[SPOOL_READ];
+        uint64_t at = spool_read_ + spool_buf_.size();
+        size_t want = (size_t)std::min<uint64_t>(sizeof(chunk), spool_size_ - at);
+        ssize_t n = pread(spool_fd_, chunk, want, (off_t)at);
+        if(n > 0) spool_buf_.append(chunk, (size_t)n);
+        avail = spool_buf_.size();
+        if(avail < REC_HEADER || avail < record_len(spool_buf_.data())){
+            // Unreadable: give up on the rest rather than send garbage
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            spool_read_ = spool_size_;
+            spool_buf_.clear();
+            return false;
+        }
+    }
+
+    size_t rl = record_len(spool_buf_.data() + spool_buf_off_);
+    record->assign(spool_buf_.data() + spool_buf_off_, rl);
+    spool_buf_off_ += rl;
+    spool_read_ += rl;
+    spool_bytes_.store(spool_size_ - spool_read_, std::memory_order_relaxed);
+    return true;
+}
+
+// Drained and acknowledged: start the file over
+void MqttBridge::spool_reset(){
+    if(spool_fd_ < 0 || !spool_size_ || spool_read_ < spool_size_ || spool_inflight_) return;
+    if(ftruncate(spool_fd_, 0) < 0) return;
+    spool_read_ = spool_size_ = 0;
+    spool_buf_.clear();
+    spool_buf_off_ = 0;
+    spool_bytes_.store(0, std::memory_order_relaxed);
+}
+
+// At shutdown, leave exactly the unacknowledged messages in the spool, in
+// order: in flight, then unread spool, then live
+void MqttBridge::spool_rewrite(){
+    uint64_t rest = count_records(queue_.data() + queue_off_, queue_.size() - queue_off_);
+    if(spool_fd_ < 0){
+        dropped_.fetch_add(rest + inflight_.size(), std::memory_order_relaxed);
+        inflight_.clear();
+        return;
+    }
+    // Nothing sent from the spool yet: appending is enough. Otherwise
+    // rewrite it from spool_read_, or the next run resends the sent part.
+    if(inflight_.empty() && spool_read_ == 0){
+        spool_pending();
+        fsync(spool_fd_);
+        return;
+    }
+
+    std::string tmp = std::string(cfg_.spool_path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    uint64_t off = 0;
+    for(size_t i = 0; ok && i < inflight_.size(); i++){
+        ok = write_all(fd, inflight_[i].record.data(), inflight_[i].record.size(), off);
+        off += inflight_[i].record.size();
+    }
+    char chunk[SPOOL_READ];
+    for(uint64_t at = spool_read_; ok && at < spool_size_; ){
+        ssize_t n = pread(spool_fd_, chunk, (size_t)std::min<uint64_t>(sizeof(chunk), spool_size_ - at), (off_t)at);
+        ok = n > 0 && write_all(fd, chunk, (size_t)n, off);
+        at += (uint64_t)n;
+        off += (uint64_t)n;
+    }
+    if(ok) ok = write_all(fd, queue_.data() + queue_off_, queue_.size() - queue_off_, off);
+    if(ok) ok = fsync(fd) == 0;
+    if(fd >= 0) close(fd);
+    if(ok) ok = rename(tmp.c_str(), cfg_.spool_path) == 0;
+
+    if(!ok){
+        unlink(tmp.c_str());
+        dropped_.fetch_add(rest + inflight_.size() - spool_inflight_, std::memory_order_relaxed);
+    } else {
+        spooled_.fetch_add(rest + inflight_.size() - spool_inflight_, std::memory_order_relaxed);
+    }
+    inflight_.clear();
+    queue_.clear();
+    queue_off_ = 0;
+}
+
+//  CONNECTION (bridge thread)
+int MqttBridge::connect_broker(){
+    char service[8];
+    snprintf(service, sizeof(service), "%u", (unsigned)cfg_.port);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(cfg_.host, service, &hints, &res) != 0) return -EHOSTUNREACH;
+
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        freeaddrinfo(res);
+        return -errno;
+    }
+    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if(rc < 0 && errno != EINPROGRESS){
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    // Wait for the TCP handshake, send CONNECT, wait for CONNACK
+    uint64_t deadline = mono_ms() + CONNECT_TIMEOUT_MS;
+    struct pollfd p = { fd, POLLOUT, 0 };
+    int err = 0;
+    socklen_t elen = sizeof(err);
+    if(poll(&p, 1, CONNECT_TIMEOUT_MS) <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &elen) < 0 || err){
+        close(fd);
+        return err ? -err : -ETIMEDOUT;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Batches are written whole; don't hold the tail
+
+    std::string hello;
+    mqtt_encode_connect(&hello, client_id_.c_str(), cfg_.keepalive_s);
+    if(send(fd, hello.data(), hello.size(), MSG_NOSIGNAL) != (ssize_t)hello.size()){
+        close(fd);
+        return -EIO;
+    }
+
+    uint8_t ack[4];
+    size_t got = 0;
+    while(got < sizeof(ack)){
+        uint64_t now = mono_ms();
+        p.events = POLLIN;
+        if(now >= deadline || poll(&p, 1, (int)(deadline - now)) <= 0) break;
+        ssize_t n = recv(fd, ack + got, sizeof(ack) - got, 0);
+        if(n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EINTR))) break;
+        if(n > 0) got += (size_t)n;
+    }
+    if(got < sizeof(ack) || ack[0] != (MQTT_CONNACK << 4) || ack[1] != 2 || ack[3] != 0){
+        close(fd);
+        return (got == sizeof(ack) && ack[3]) ? -EACCES : -ECONNREFUSED;
+    }
+
+    in_.clear();
+    out_.clear();
+    ping_sent_ms_ = 0;
+    last_send_ms_ = mono_ms();
+    fd_.store(fd, std::memory_order_relaxed);
+    connects_.fetch_add(1, std::memory_order_relaxed);
+
+    // Whatever was unacknowledged goes first, flagged as a possible duplicate
+    for(size_t i = 0; i < inflight_.size(); i++) send_record(inflight_[i].record, inflight_[i].id, true);
+    return 0;
+}
+
+void MqttBridge::disconnect(){
+    int fd = fd_.exchange(-1, std::memory_order_relaxed);
+    if(fd >= 0) close(fd);
+    out_.clear();
+    in_.clear();
+}
+
+void MqttBridge::send_record(const std::string& record, uint16_t id, bool dup){
+    const char* p = record.data();
+    uint16_t tl = get_u16(p + 8);
+    uint16_t pl = get_u16(p + 10);
+    mqtt_encode_publish(&out_, p + REC_HEADER, tl, p + REC_HEADER + tl, pl, cfg_.qos, id, dup);
+}
+
+// Spool first, then live records, so reconnecting keeps the order
+bool MqttBridge::next_record(std::string* record, bool* from_spool){
+    *from_spool = spool_next(record);
+    if(*from_spool) return true;
+    if(queue_off_ >= queue_.size()) return false;
+
+    size_t rl = record_len(queue_.data() + queue_off_);
+    record->assign(queue_.data() + queue_off_, rl);
+    queue_off_ += rl;
+    return true;
+}
+
+void MqttBridge::fill_window(){
+    std::string record;
+    bool from_spool;
+    while((cfg_.qos == 0 || inflight_.size() < cfg_.inflight) && out_.size() < OUT_MAX &&
+          next_record(&record, &from_spool)){
+        if(cfg_.qos == 0){
+            send_record(record, 0, false);
+            acked_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if(++next_id_ == 0) next_id_ = 1;
+        send_record(record, next_id_, false);
+        inflight_.push_back(Inflight_t());
+        inflight_.back().id = next_id_;
+        inflight_.back().from_spool = from_spool;
+        inflight_.back().record.swap(record);
+        spool_inflight_ += from_spool;
+    }
+}
+
+void MqttBridge::ack(uint16_t id){
+    size_t i = 0;
+    while(i < inflight_.size() && inflight_[i].id != id) i++;    // Nearly always the front
+    if(i == inflight_.size()) return;
+
+    uint64_t queued_us;
+    memcpy(&queued_us, inflight_[i].record.data(), 8);
+    uint64_t now = mono_us();
+    latency_.record(now > queued_us ? now - queued_us : 0);
+    spool_inflight_ -= inflight_[i].from_spool;
+    acked_.fetch_add(1, std::memory_order_relaxed);
+    if(i == 0) inflight_.pop_front();
+    else inflight_.erase(inflight_.begin() + (long)i);
+}
+
+int MqttBridge::send_out(){
+    int fd = fd_.load(std::memory_order_relaxed);
+    size_t off = 0;
+    while(off < out_.size()){
+        ssize_t n = send(fd, out_.data() + off, out_.size() - off, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN) break;
+        if(n <= 0) return -EPIPE;
+        off += (size_t)n;
+    }
+    if(off) last_send_ms_ = mono_ms();
+    out_.erase(0, off);
+    return 0;
+}
+
+int MqttBridge::read_in(){
+    int fd = fd_.load(std::memory_order_relaxed);
+    char buf[16384];
+    for(;;){
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN) break;
+        if(n <= 0) return -ECONNRESET;
+        in_.append(buf, (size_t)n);
+        if((size_t)n < sizeof(buf)) break;
+    }
+
+    size_t off = 0, header;
+    for(;;){
+        const uint8_t* p = (const uint8_t*)in_.data() + off;
+        int len = mqtt_packet_length(p, in_.size() - off, &header);
+        if(len < 0) return len;
+        if(len == 0) break;
+        switch(p[0] >> 4){
+            case MQTT_PUBACK:
+                if(len >= 4) ack((uint16_t)((p[2] << 8) | p[3]));
+                break;
+            case MQTT_PINGRESP:
+                ping_sent_ms_ = 0;
+                break;
+            default:
+                break;
+        }
+        off += (size_t)len;
+    }
+    in_.erase(0, off);
+    return 0;
+}
+
+//  THREAD
+void MqttBridge::run(){
+    uint64_t retry_ms = 0, backoff = MQTT_RETRY_MIN_MS, stop_ms = 0;
+
+    for(;;){
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!incoming_.empty()){
+                if(queue_off_ >= queue_.size()){
+                    queue_.swap(incoming_);
+                    queue_off_ = 0;
+                } else {
+                    queue_.erase(0, queue_off_);
+                    queue_off_ = 0;
+                    queue_.append(incoming_);
+                }
+                incoming_.clear();
+            }
+            stopping = stopping_;
+        }
+        uint64_t now = mono_ms();
+        if(stopping && !stop_ms) stop_ms = now + MQTT_STOP_WAIT_MS;
+
+        if(!connected() && !stopping && now >= retry_ms){
+            if(connect_broker() == 0) backoff = MQTT_RETRY_MIN_MS;
+            else {
+                retry_ms = now + backoff;
+                backoff = std::min<uint64_t>(backoff * 2, MQTT_RETRY_MAX_MS);
+            }
+        }
+
+        if(!connected()){
+            if(stopping) break;
+            spool_pending();
+            struct pollfd p = { wake_fd_, POLLIN, 0 };
+            now = mono_ms();
+            poll(&p, 1, retry_ms > now ? (int)std::min<uint64_t>(retry_ms - now, IDLE_POLL_MS) : 0);
+            uint64_t v;
+            if(read(wake_fd_, &v, sizeof(v)) < 0) {}
+            continue;
+        }
+
+        // A broker that can't keep up: don't let memory grow without bound
+        if(queue_.size() - queue_off_ > MQTT_QUEUE_MAX) spool_pending();
+
+        fill_window();
+        if(send_out() < 0){
+            disconnect();
+            continue;
+        }
+        spool_reset();
+
+        now = mono_ms();
+        bool done = inflight_.empty() && out_.empty() && queue_off_ >= queue_.size() && spool_read_ >= spool_size_;
+        if(stopping && (done || now >= stop_ms)){
+            if(done){
+                std::string bye;
+                mqtt_encode_simple(&bye, MQTT_DISCONNECT, 0);
+                send(fd_.load(std::memory_order_relaxed), bye.data(), bye.size(), MSG_NOSIGNAL);
+            }
+            disconnect();
+            break;
+        }
+
+        // Keepalive: ping when idle for half the interval, give up after a whole one
+        uint64_t keepalive_ms = (uint64_t)cfg_.keepalive_s * 1000;
+        if(keepalive_ms){
+            if(ping_sent_ms_ && now - ping_sent_ms_ >= keepalive_ms){
+                disconnect();
+                continue;
+            }
+            if(!ping_sent_ms_ && now - last_send_ms_ >= keepalive_ms / 2){
+                mqtt_encode_simple(&out_, MQTT_PINGREQ, 0);
+                ping_sent_ms_ = now;
+                continue;
+            }
+        }
+
+        struct pollfd p[2] = {
+            { fd_.load(std::memory_order_relaxed), (short)(POLLIN | (out_.empty() ? 0 : POLLOUT)), 0 },
+            { wake_fd_, POLLIN, 0 }
+        };
+        if(poll(p, 2, IDLE_POLL_MS) < 0 && errno != EINTR) break;
+        if(p[1].revents & POLLIN){
+            uint64_t v;
+            if(read(wake_fd_, &v, sizeof(v)) < 0) {}
+        }
+        if((p[0].revents & (POLLIN | POLLERR | POLLHUP)) && read_in() < 0) disconnect();
+    }
+}
@@ -0,0 +1,178 @@
+#ifndef GATEWAY_MQTT_H
+#define GATEWAY_MQTT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "alerts.h"
+#include "latency.h"
+#include "reading.h"
+#include "sinks.h"
+
+// MQTT BRIDGE
+//
+// Publishes readings and alert incidents to a broker over MQTT 3.1.1:
+//
+//   <prefix>/dev<N>/reading        {"t":<rx ms>,"T":..,"P":..,"W":..,"S":..,"A":..}
+//   <prefix>/dev<N>/alert          {"t":..,"event":"OPENED","incident":41,"name":"alert",...}
+//   <prefix>/group/<name>/alert    group rules
+//   <prefix>/alerts/suppressed     {"t":..,"dropped":N}
+//
+// The sink side only formats messages into a batch; flush() hands the
+// batch to the bridge thread, which writes many PUBLISH packets per send()
+// and keeps up to `inflight` QoS 1 messages unacknowledged (pipelined).
+// PUBACKs usually arrive in order, so the in-flight list is a FIFO.
+//
+// While the broker is unreachable, messages are appended to a spool file;
+// after reconnecting the bridge resends what was in flight, then drains the
+// spool, then live messages, so order is kept. Delivery is at least once: a
+// crash while draining resends the spool from its start.
+#define MQTT_PORT               1883
+#define MQTT_KEEPALIVE_S        30
+#define MQTT_INFLIGHT           256
+#define MQTT_SPOOL_MAX          (256ull << 20)  // Messages past this are dropped
+#define MQTT_QUEUE_MAX          (8u << 20)      // Pending bytes kept in memory before spooling
+#define MQTT_TOPIC_MAX          128
+#define MQTT_PAYLOAD_MAX        512
+#define MQTT_RETRY_MIN_MS       500             // Reconnect backoff, doubling...
+#define MQTT_RETRY_MAX_MS       10000           // ...up to this
+#define MQTT_STOP_WAIT_MS       2000            // For acks at shutdown
+
+typedef enum {
+    MQTT_CONNECT = 1,
+    MQTT_CONNACK = 2,
+    MQTT_PUBLISH = 3,
+    MQTT_PUBACK = 4,
+    MQTT_PINGREQ = 12,
+    MQTT_PINGRESP = 13,
+    MQTT_DISCONNECT = 14
+} MqttPacket_t;
+
+// Packet encoders append to `out`
+void mqtt_encode_connect(std::string* out, const char* client_id, uint16_t keepalive_s);
+void mqtt_encode_publish(std::string* out, const char* topic, size_t topic_len,
+                         const char* payload, size_t payload_len, uint8_t qos, uint16_t id, bool dup);
+void mqtt_encode_simple(std::string* out, MqttPacket_t type, uint16_t id);   // PUBACK (id), PINGREQ, PINGRESP, DISCONNECT, CONNACK
+
+// Length of the complete packet at `buf` (fixed header included), 0 if
+// more bytes are needed, -EPROTO if the length field is malformed
+int mqtt_packet_length(const uint8_t* buf, size_t len, size_t* header_len);
+
+typedef struct {
+    const char* host;
+    uint16_t port;
+    const char* client_id;      // NULL = tankgw-<hostname>
+    const char* prefix;         // Topic prefix
+    const char* spool_path;     // NULL = drop messages while the broker is away
+    uint64_t spool_max;         // Bytes
+    uint32_t inflight;          // QoS 1 window
+    uint16_t keepalive_s;
+    uint8_t  qos;               // 0 or 1
+} MqttConfig_t;
+
+static const MqttConfig_t MQTT_DEFAULTS = {
+    "127.0.0.1", MQTT_PORT, NULL, "tankgw", NULL, MQTT_SPOOL_MAX, MQTT_INFLIGHT, MQTT_KEEPALIVE_S, 1
+};
+
+class MqttBridge : public Sink {
+public:
+    MqttBridge();
+    ~MqttBridge();
+
+    // Open the spool and start the bridge thread, which connects (and
+    // reconnects) in the background. Returns 0 or -errno.
+    int start(const MqttConfig_t& cfg);
+
+    // Hand over what is queued, wait up to MQTT_STOP_WAIT_MS for acks and
+    // spool whatever is left
+    void stop();
+
+    void on_reading(const Reading_t& r) override;
+    void flush() override;
+
+    // An alert incident, from the tracker's notify callback
+    void publish_alert(const AlertEvent_t& ev);
+
+    bool connected() const { return fd_.load(std::memory_order_relaxed) >= 0; }
+    uint64_t queued() const { return queued_.load(std::memory_order_relaxed); }
+    uint64_t acked() const { return acked_.load(std::memory_order_relaxed); }     // Or sent, at QoS 0
+    uint64_t spooled() const { return spooled_.load(std::memory_order_relaxed); }
+    uint64_t spool_bytes() const { return spool_bytes_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t connects() const { return connects_.load(std::memory_order_relaxed); }
+    const LatencyHistogram& publish_latency() const { return latency_; }   // Queued -> acked
+
+private:
+    // A message, in memory and in the spool:
+    //   u64 queued_us (monotonic), u16 topic length, u16 payload length, topic, payload
+    typedef struct {
+        uint16_t id;                // Packet id
+        bool from_spool;            // Still in the spool file until acked
+        std::string record;
+    } Inflight_t;
+
+    void add(const char* topic, size_t topic_len, const char* payload, size_t payload_len);
+    void wake();
+    void run();
+    int connect_broker();
+    void disconnect();
+    bool next_record(std::string* record, bool* from_spool);
+    void fill_window();
+    void send_record(const std::string& record, uint16_t id, bool dup);
+    void ack(uint16_t id);
+    int send_out();
+    int read_in();
+    int spool_open();
+    void spool_pending();
+    bool spool_next(std::string* record);
+    void spool_reset();
+    void spool_rewrite();
+
+    MqttConfig_t cfg_;
+    std::string client_id_;
+    std::string prefix_;
+
+    // Dispatcher side
+    std::string batch_;
+
+    // Hand-off
+    std::mutex mutex_;
+    std::string incoming_;
+    bool stopping_;
+    bool running_;
+    int wake_fd_;                   // eventfd
+
+    // Bridge thread
+    std::thread thread_;
+    std::atomic<int> fd_;
+    std::string queue_;             // Live records not yet sent
+    size_t queue_off_;
+    std::string out_;               // Encoded packets not yet written
+    std::string in_;                // Received bytes not yet parsed
+    std::deque<Inflight_t> inflight_;
+    uint16_t next_id_;
+    uint64_t last_send_ms_;
+    uint64_t ping_sent_ms_;
+
+    int spool_fd_;
+    uint64_t spool_read_;           // Offset of the next record to send
+    uint64_t spool_size_;
+    std::string spool_buf_;         // Read ahead, from spool_read_
+    size_t spool_buf_off_;
+    size_t spool_inflight_;         // In flight and read from the spool
+
+    std::atomic<uint64_t> queued_;
+    std::atomic<uint64_t> acked_;
+    std::atomic<uint64_t> spooled_;
+    std::atomic<uint64_t> spool_bytes_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> connects_;
+    LatencyHistogram latency_;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "port.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baud_to_speed(uint32_t baud){
+    switch(baud){
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        default:     return B9600; // Firmware default (UBRR1 = 103)
+    }
+}
+
+// Raw 8N1, no echo, no line discipline
+static int set_raw(int fd, uint32_t baud){
+    struct termios tio;
+    if(tcgetattr(fd, &tio) < 0) return -errno;
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+
+    if(tcsetattr(fd, TCSANOW, &tio) < 0) return -errno;
+    return 0;
+}
+
+void port_init(Port_t* port, uint16_t id){
+    memset(port, 0, sizeof(*port));
+    port->fd = -1;
+    port->hold_fd = -1;
+    port->id = id;
+    port->baud = 9600;
+    tlm_parser_init(&port->parser);
+}
+
+int port_open_serial(Port_t* port, const char* path, uint32_t baud){
+    snprintf(port->path, sizeof(port->path), "%s", path);
+    port->baud = baud;
+    port->kind = PORT_SERIAL;
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0) return -errno;
+
+    int rc = set_raw(fd, baud);
+    if(rc < 0){
+        close(fd);
+        return rc;
+    }
+    port->fd = fd;
+    port->parser.carry_len = 0; // Drop any fragment from before the reconnect
+    port->parser.overrun = 0;
+    return 0;
+}
+
+int port_open_pty(Port_t* port){
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(master < 0) return -errno;
+
+    if(grantpt(master) < 0 || unlockpt(master) < 0){
+        int err = errno;
+        close(master);
+        return -err;
+    }
+
+    const char* slave = ptsname(master);
+    if(!slave){
+        int err = errno;
+        close(master);
+        return -err;
+    }
+    snprintf(port->path, sizeof(port->path), "%s", slave);
+
+    // Hold the slave open ourselves so reads on the master don't fail with
+    // EIO while no simulator is attached
+    int hold = open(port->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if(hold < 0){
+        int err = errno;
+        close(master);
+        return -err;
+    }
+    set_raw(hold, 9600);
+    set_raw(master, 9600);
+
+    port->fd = master;
+    port->hold_fd = hold;
+    port->kind = PORT_PTY;
+    return 0;
+}
+
+int port_attach_socket(Port_t* port, int fd, const char* name){
+    int flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -errno;
+
+    snprintf(port->path, sizeof(port->path), "%s", name);
+    port->fd = fd;
+    port->kind = PORT_SOCKET;
+    return 0;
+}
+
+void port_close(Port_t* port){
+    if(port->fd >= 0) close(port->fd);
+    if(port->hold_fd >= 0) close(port->hold_fd);
+    port->fd = -1;
+    port->hold_fd = -1;
+}
+
+int port_send_height(Port_t* port, uint16_t height_cm){
+    char cmd[8];
+    int n = snprintf(cmd, sizeof(cmd), "%u\n", (unsigned)height_cm);
+
+    if(port->fd < 0) return -EBADF;
+    if(write(port->fd, cmd, (size_t)n) != n) return -errno;
+    return 0;
+}
+
+void port_feed(Port_t* port, const uint8_t* data, size_t len, LineCallback_t on_line, void* ctx){
+    TlmLine_t lines[PORT_FEED_BATCH];
+    size_t n_lines;
+    port->bytes_rx += len;
+
+    while(len > 0){
+        size_t n = tlm_feed_batch(&port->parser, data, len, lines, PORT_FEED_BATCH, &n_lines);
+        data += n;
+        len -= n;
+        for(size_t i = 0; i < n_lines; i++) on_line(port, &lines[i], ctx);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef GATEWAY_PORT_H
+#define GATEWAY_PORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "latency.h"
+#include "telemetry.h"
+
+#define PORT_PATH_MAX       64
+#define PORT_FEED_BATCH     32      // Lines decoded per tlm_feed_batch() call
+
+typedef enum {
+    PORT_SERIAL = 0,    // tty / rfcomm: reopened after errors
+    PORT_PTY,           // Local test terminal
+    PORT_SOCKET         // Stream socket (TCP client, socketpair): released on EOF
+} PortKind_t;
+
+// One serial, rfcomm, pty or socket connection to a tank controller
+typedef struct {
+    char     path[PORT_PATH_MAX];   // Device path (pty: the slave end, socket: peer address)
+    int      fd;                    // Read/write descriptor, -1 when closed
+    int      hold_fd;               // pty only: our own slave handle, keeps the master from EIO
+    uint16_t id;                    // Device index used in readings
+    uint32_t baud;
+    PortKind_t kind;
+    uint16_t loop;                  // Ingest loop that owns the descriptor
+
+    // Line framing, decoding and malformed-line counters
+    TlmParser_t parser;
+    uint64_t bytes_rx;
+    LinkClock_t link;               // Link delay tracking (ingest loop only)
+} Port_t;
+
+void port_init(Port_t* port, uint16_t id);
+
+// Open a tty (e.g. /dev/ttyUSB0, /dev/rfcomm0) in raw 8N1 mode. Returns 0 or -errno.
+int port_open_serial(Port_t* port, const char* path, uint32_t baud);
+
+// Create a pseudo-terminal; port->path receives the slave path that a
+// simulator should open. Returns 0 or -errno.
+int port_open_pty(Port_t* port);
+
+// Adopt an already connected stream descriptor (made non-blocking here)
+int port_attach_socket(Port_t* port, int fd, const char* name);
+
+void port_close(Port_t* port);
+
+// Send a height command ("<cm>\n"), as the app's height field does
+int port_send_height(Port_t* port, uint16_t height_cm);
+
+// Decode received bytes and invoke `on_line` for every complete line,
+// including malformed ones (line->result == TLM_ERROR)
+typedef void (*LineCallback_t)(Port_t* port, const TlmLine_t* line, void* ctx);
+void port_feed(Port_t* port, const uint8_t* data, size_t len, LineCallback_t on_line, void* ctx);
+
+#endif
@@ -0,0 +1,240 @@
+#include "query.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "column_store.h"
+
+//  BLOCK FILE
+BlockFile::BlockFile() : fd_(-1), scanned_(0) {}
+
+BlockFile::~BlockFile(){
+    close();
+}
+
+int BlockFile::open(const char* path){
+    close();
+    fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd_ < 0) return -errno;
+    return refresh();
+}
+
+void BlockFile::close(){
+    for(uint8_t* m : maps_) munmap(m, (size_t)BLOCKFILE_MAP_BLOCKS * BLOCK_SIZE);
+    maps_.clear();
+    if(fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    scanned_ = 0;
+    index_.clear();
+    for(uint32_t i = 0; i < MAX_DEVICES; i++) by_device_[i].clear();
+}
+
+int BlockFile::refresh(){
+    struct stat st;
+    if(fstat(fd_, &st) < 0) return -errno;
+
+    // Only whole blocks; a block the writer is still appending shows up
+    // on a later refresh
+    uint32_t blocks = (uint32_t)(st.st_size / BLOCK_SIZE);
+    int rc = map_through(blocks);
+    if(rc < 0) return rc;
+
+    // Checking touches every new block; drop the pages as we go so opening
+    // a large file doesn't leave (or peak at) all of it resident
+    uint32_t first = scanned_;
+    for(; scanned_ < blocks; scanned_++){
+        if(scanned_ - first == 256){
+            drop_pages(first, scanned_);
+            first = scanned_;
+        }
+        const uint8_t* buf = maps_[scanned_ / BLOCKFILE_MAP_BLOCKS] + (size_t)(scanned_ % BLOCKFILE_MAP_BLOCKS) * BLOCK_SIZE;
+        if(!block_check(buf)){
+            // Inside the writer's last batch this may be a write in
+            // progress: look again next time. Further back it's damage.
+            if(blocks - scanned_ <= STORE_WRITE_BLOCKS) break;
+            continue;
+        }
+
+        BlockRef_t ref;
+        ref.block_no = scanned_;
+        memcpy(&ref.hdr, buf, sizeof(ref.hdr));
+        if(ref.hdr.device_id >= MAX_DEVICES) continue;
+        by_device_[ref.hdr.device_id].push_back((uint32_t)index_.size());
+        index_.push_back(ref);
+    }
+    drop_pages(first, scanned_);
+    return 0;
+}
+
+// Windows may reach past the end of the file; the part beyond it can't be
+// touched, but fills in as the writer appends without remapping
+int BlockFile::map_through(uint32_t blocks){
+    size_t window = (size_t)BLOCKFILE_MAP_BLOCKS * BLOCK_SIZE;
+    while((uint64_t)maps_.size() * BLOCKFILE_MAP_BLOCKS < blocks){
+        void* m = mmap(NULL, window, PROT_READ, MAP_SHARED, fd_, (off_t)maps_.size() * (off_t)window);
+        if(m == MAP_FAILED) return -errno;
+        madvise(m, window, MADV_SEQUENTIAL);
+        maps_.push_back((uint8_t*)m);
+    }
+    return 0;
+}
+
+const uint8_t* BlockFile::block(const BlockRef_t& ref) const {
+    uint32_t w = ref.block_no / BLOCKFILE_MAP_BLOCKS;
+    if(ref.block_no >= scanned_ || w >= maps_.size()) return NULL;
+    return maps_[w] + (size_t)(ref.block_no % BLOCKFILE_MAP_BLOCKS) * BLOCK_SIZE;
+}
+
+void BlockFile::drop_pages(uint32_t from, uint32_t to) const {
+    while(from < to){
+        uint32_t w = from / BLOCKFILE_MAP_BLOCKS;
+        uint32_t end = (w + 1) * BLOCKFILE_MAP_BLOCKS;
+        if(end > to) end = to;
+        madvise(maps_[w] + (size_t)(from % BLOCKFILE_MAP_BLOCKS) * BLOCK_SIZE, (size_t)(end - from) * BLOCK_SIZE, MADV_DONTNEED);
+        from = end;
+    }
+}
+
+void BlockFile::release(const BlockRef_t& ref) const {
+    if(block(ref)) drop_pages(ref.block_no, ref.block_no + 1);
+}
+
+//  AGGREGATION
+static void stats_init(RangeStats_t* s){
+    memset(s, 0, sizeof(*s));
+    s->percent_min = 0xFFFF;
+    s->water_min = 0xFFFF;
+    s->t_first_ms = INT64_MAX;
+    s->t_last_ms = INT64_MIN;
+}
+
+static void stats_add_header(RangeStats_t* s, const BlockHeader_t& h){
+    s->count += h.count;
+    if(h.t_first_ms < s->t_first_ms) s->t_first_ms = h.t_first_ms;
+    if(h.t_last_ms > s->t_last_ms) s->t_last_ms = h.t_last_ms;
+    if(h.percent_min < s->percent_min) s->percent_min = h.percent_min;
+    if(h.percent_max > s->percent_max) s->percent_max = h.percent_max;
+    s->percent_sum += h.percent_sum;
+    if(h.water_min < s->water_min) s->water_min = h.water_min;
+    if(h.water_max > s->water_max) s->water_max = h.water_max;
+    s->water_sum += h.water_sum;
+    for(uint8_t k = 0; k < STATUS_COUNT; k++) s->status_count[k] += h.status_count[k];
+    s->alert_count += h.alert_count;
+}
+
+static void stats_add_reading(RangeStats_t* s, const Reading_t& r, int64_t t_ms){
+    s->count++;
+    if(t_ms < s->t_first_ms) s->t_first_ms = t_ms;
+    if(t_ms > s->t_last_ms) s->t_last_ms = t_ms;
+    if(r.percent < s->percent_min) s->percent_min = r.percent;
+    if(r.percent > s->percent_max) s->percent_max = r.percent;
+    s->percent_sum += r.percent;
+    if(r.water_adc < s->water_min) s->water_min = r.water_adc;
+    if(r.water_adc > s->water_max) s->water_max = r.water_adc;
+    s->water_sum += r.water_adc;
+    s->status_count[r.status & 0x3]++;
+    s->alert_count += r.alert;
+}
+
+// Decode one block in place and add the readings inside [from, to]
+static bool add_decoded(const BlockFile& file, const BlockRef_t& ref, int64_t from_ms, int64_t to_ms, RangeStats_t* out){
+    const uint8_t* block = file.block(ref);
+    if(!block) return false;
+
+    BlockCursor cur(block);
+    Reading_t r;
+    while(cur.next(&r)){
+        int64_t t_ms = (int64_t)(r.rx_time_us / 1000);
+        if(t_ms >= from_ms && t_ms <= to_ms) stats_add_reading(out, r, t_ms);
+    }
+    return true;
+}
+
+static uint32_t add_block(const BlockFile& file, const BlockRef_t& ref, int64_t from_ms, int64_t to_ms, RangeStats_t* out){
+    const BlockHeader_t& h = ref.hdr;
+
+    if(h.t_last_ms < from_ms || h.t_first_ms > to_ms){
+        out->blocks_skipped++;
+        return 0;
+    }
+    if(h.t_first_ms >= from_ms && h.t_last_ms <= to_ms){
+        stats_add_header(out, h);
+        out->blocks_summarised++;
+        return 0;
+    }
+    out->blocks_decoded++;
+    return add_decoded(file, ref, from_ms, to_ms, out) ? 0 : 1;
+}
+
+uint32_t query_range(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, RangeStats_t* out){
+    const std::vector<BlockRef_t>& index = file.index();
+    uint32_t failed = 0;
+    stats_init(out);
+
+    if(device_id == QUERY_ALL_DEVICES){
+        for(const BlockRef_t& ref : index) failed += add_block(file, ref, from_ms, to_ms, out);
+    } else if(device_id < MAX_DEVICES){
+        for(uint32_t pos : file.device_blocks(device_id)) failed += add_block(file, index[pos], from_ms, to_ms, out);
+    }
+    return failed;
+}
+
+uint32_t query_range_scan(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, RangeStats_t* out){
+    uint32_t failed = 0;
+    stats_init(out);
+
+    for(const BlockRef_t& ref : file.index()){
+        if(device_id != QUERY_ALL_DEVICES && ref.hdr.device_id != device_id) continue;
+        out->blocks_decoded++;
+        if(!add_decoded(file, ref, from_ms, to_ms, out)) failed++;
+    }
+    return failed;
+}
+
+//  STREAMING
+RangeCursor::RangeCursor(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, bool release)
+    : file_(file), device_id_(device_id), from_ms_(from_ms), to_ms_(to_ms), release_(release),
+      pos_(0), decoded_(0), failed_(0) {
+    memset(&ref_, 0, sizeof(ref_));
+}
+
+bool RangeCursor::next_block(){
+    const std::vector<BlockRef_t>& index = file_.index();
+    bool all = (device_id_ == QUERY_ALL_DEVICES);
+    if(!all && device_id_ >= MAX_DEVICES) return false;
+
+    while(true){
+        const std::vector<uint32_t>& positions = file_.device_blocks(all ? 0 : device_id_);
+        size_t end = all ? index.size() : positions.size();
+        if(pos_ >= end) return false;
+
+        const BlockRef_t& ref = index[all ? pos_ : positions[pos_]];
+        pos_++;
+        if(ref.hdr.t_last_ms < from_ms_ || ref.hdr.t_first_ms > to_ms_) continue;
+
+        const uint8_t* block = file_.block(ref);
+        if(!block){
+            failed_++;
+            continue;
+        }
+        ref_ = ref;
+        cur_.start(block);
+        decoded_++;
+        return true;
+    }
+}
+
+bool RangeCursor::next(Reading_t* out){
+    while(true){
+        while(cur_.next(out)){
+            int64_t t_ms = (int64_t)(out->rx_time_us / 1000);
+            if(t_ms >= from_ms_ && t_ms <= to_ms_) return true;
+        }
+        if(release_ && decoded_) file_.release(ref_);
+        if(!next_block()) return false;
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef GATEWAY_QUERY_H
+#define GATEWAY_QUERY_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "block.h"
+
+#define QUERY_ALL_DEVICES   0xFFFF
+#define BLOCKFILE_MAP_BLOCKS 16384  // Blocks per mapping window (64 MB)
+
+// Read-only view of a column store file. Safe to open while the gateway
+// is appending: refresh() indexes blocks written since the last call.
+//
+// Blocks are read in place from shared, read-only mappings of the file.
+// Windows are a fixed 64 MB and never remapped, so pointers from block()
+// stay valid across refresh() until close(). Readers take no locks and
+// share nothing with the writer but the page cache, so any number of
+// them can run while it appends. (A reader would fault if the writer cut
+// the file under a block it had indexed; the writer only truncates blocks
+// that never finished writing.)
+class BlockFile {
+public:
+    BlockFile();
+    ~BlockFile();
+
+    int open(const char* path);     // 0 or -errno
+    void close();
+    int refresh();                  // Index newly appended blocks, 0 or -errno
+
+    const std::vector<BlockRef_t>& index() const { return index_; }
+
+    // Block positions (into index()) of one device, in file order
+    const std::vector<uint32_t>& device_blocks(uint16_t device_id) const { return by_device_[device_id]; }
+
+    // The block's BLOCK_SIZE bytes in the mapping, verified when it was
+    // indexed; NULL if it isn't mapped
+    const uint8_t* block(const BlockRef_t& ref) const;
+
+    // Drop a block's pages from this process once consumed, so a reader
+    // streaming the whole file keeps a flat resident size
+    void release(const BlockRef_t& ref) const;
+
+private:
+    int map_through(uint32_t blocks);
+    void drop_pages(uint32_t from, uint32_t to) const;
+
+    int fd_;
+    uint32_t scanned_;              // Blocks looked at so far (valid or not)
+    std::vector<uint8_t*> maps_;    // Window k covers blocks [k, k+1) * BLOCKFILE_MAP_BLOCKS
+    std::vector<BlockRef_t> index_;
+    std::vector<uint32_t> by_device_[MAX_DEVICES];
+};
+
+// Aggregates over a time range. min/max are only meaningful when count > 0.
+typedef struct {
+    uint64_t count;
+    int64_t  t_first_ms;            // Earliest / latest matching reading
+    int64_t  t_last_ms;
+    uint16_t percent_min;
+    uint16_t percent_max;
+    uint64_t percent_sum;
+    uint16_t water_min;
+    uint16_t water_max;
+    uint64_t water_sum;
+    uint64_t status_count[STATUS_COUNT];
+    uint64_t alert_count;
+
+    // Cost: blocks rejected by their time span, answered from the header
+    // alone, and decoded because they straddle a range edge
+    uint32_t blocks_skipped;
+    uint32_t blocks_summarised;
+    uint32_t blocks_decoded;
+} RangeStats_t;
+
+// Count / min / max / avg / status histogram of the readings with
+// from_ms <= receive time <= to_ms, for one device or QUERY_ALL_DEVICES.
+// Blocks fully inside the range are answered from their headers, so the
+// cost is O(blocks) plus decoding at most the edge blocks. Returns the
+// number of blocks that failed to read (skipped).
+uint32_t query_range(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, RangeStats_t* out);
+
+// Same, by decoding every reading in every block; for checking and benchmarks
+uint32_t query_range_scan(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, RangeStats_t* out);
+
+// Streams the readings of one device or QUERY_ALL_DEVICES with
+// from_ms <= receive time <= to_ms, block by block in file order (each
+// device's readings come out in time order). Blocks outside the range are
+// skipped by their headers and the rest decoded in place from the
+// mapping, so memory use doesn't depend on the size of the range.
+class RangeCursor {
+public:
+    // With `release`, a block's pages are dropped once it is decoded
+    RangeCursor(const BlockFile& file, uint16_t device_id, int64_t from_ms, int64_t to_ms, bool release = false);
+
+    // Next matching reading; false at the end of the file as indexed
+    bool next(Reading_t* out);
+
+    uint32_t blocks_decoded() const { return decoded_; }
+    uint32_t blocks_failed() const { return failed_; }
+
+private:
+    bool next_block();
+
+    const BlockFile& file_;
+    uint16_t device_id_;
+    int64_t from_ms_;
+    int64_t to_ms_;
+    bool release_;
+    size_t pos_;                    // Next position in index() or device_blocks()
+    BlockRef_t ref_;                // Block being decoded
+    BlockCursor cur_;
+    uint32_t decoded_;
+    uint32_t failed_;
+};
+
+static inline double range_avg(uint64_t sum, uint64_t count){
+    return count ? (double)sum / (double)count : 0.0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef GATEWAY_READING_H
+#define GATEWAY_READING_H
+
+#include <stdint.h>
+
+#define MAX_DEVICES     16384   // Device ids are 0..MAX_DEVICES-1
+
+// STATUS CODES (same values as Status_t in the firmware's src/main.cpp)
+typedef enum {
+    STATUS_EMPTY = 0,
+    STATUS_HALF_FULL,
+    STATUS_OVERFLOW,
+    STATUS_CONTAMINATED,
+    STATUS_COUNT
+} Status_t;
+
+// RESET CAUSES (bits of the firmware's "R:" startup line, the AVR's MCUSR)
+typedef enum {
+    RESET_POWER_ON = 0,
+    RESET_EXTERNAL,
+    RESET_BROWN_OUT,
+    RESET_WATCHDOG,
+    RESET_JTAG,
+    RESET_CAUSE_COUNT
+} ResetCause_t;
+
+// One decoded "T:..,P:..,W:..,S:..,A:.." packet
+typedef struct {
+    uint64_t rx_time_us;      // Gateway receive time (CLOCK_REALTIME, us)
+    uint32_t device_time_ms;  // T = milliseconds since device startup
+    uint16_t device_id;       // Index of the port the packet arrived on
+    uint16_t percent;         // P = fill level 0-100
+    uint16_t water_adc;       // W = conductivity ADC 0-1023
+    uint8_t  status;          // S = Status_t
+    uint8_t  alert;           // A = 0/1
+} Reading_t;
+
+// Events travelling from the port readers to the sinks
+typedef enum {
+    EVENT_READING = 0,   // Status packet
+    EVENT_HEIGHT_ACK,    // "H:<cm>" confirmation of a height command
+    EVENT_DEVICE_RESET   // The device id now belongs to a different device
+} EventType_t;
+
+// Monotonic stage timestamps, for latency tracking. The later stages are
+// offsets from rx_us so an event and its slot's sequence fit a cache line.
+typedef struct {
+    uint64_t rx_us;           // read() returned the line's last byte
+    uint32_t parsed_dus;      // Line decoded, us after rx_us
+    uint32_t queued_dus;      // Pushed onto the event queue, us after rx_us
+} EventTimes_t;
+
+typedef struct {
+    Reading_t    reading;     // For other events only device_id/rx_time_us are set
+    EventTimes_t times;
+    uint16_t     height_cm;   // EVENT_HEIGHT_ACK payload
+    uint8_t      type;        // EventType_t
+} Event_t;
+
+#endif
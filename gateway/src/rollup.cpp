@@ -0,0 +1,491 @@
+#include "rollup.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+#include "clock.h"
+
+#define DAY_MS      86400000LL
+#define EMPTY_BUCKET INT64_MIN
+#define SNAP_FILE   "open.snap"
+#define SNAP_MAGIC  "RSN1"
+
+typedef struct {
+    char     magic[4];
+    uint32_t gen;
+    uint32_t rows[TIER_COUNT];      // Open buckets...
+    uint32_t pending[TIER_COUNT];   // ...and rows a failed write left behind, tier by tier after this
+} SnapHeader_t;
+
+const RollupTierInfo_t ROLLUP_TIERS[TIER_COUNT] = {
+    { "1m", 60000LL,    DAY_MS,         14 },
+    { "1h", 3600000LL,  30 * DAY_MS,    400 },
+    { "1d", DAY_MS,     365 * DAY_MS,   3650 },
+};
+
+static inline int64_t floor_to(int64_t t, int64_t width){
+    int64_t q = t / width;
+    if(t % width < 0) q--;
+    return q * width;
+}
+
+static void row_init(RollupRow_t* row, uint16_t device_id, int64_t bucket_ms){
+    memset(row, 0, sizeof(*row));
+    row->bucket_ms = bucket_ms;
+    row->device_id = device_id;
+    row->percent_min = 0xFF;
+    row->water_min = 0xFFFF;
+}
+
+void rollup_merge(RollupRow_t* dst, const RollupRow_t& src){
+    if(src.count){
+        if(src.percent_min < dst->percent_min) dst->percent_min = src.percent_min;
+        if(src.percent_max > dst->percent_max) dst->percent_max = src.percent_max;
+        if(src.water_min < dst->water_min) dst->water_min = src.water_min;
+        if(src.water_max > dst->water_max) dst->water_max = src.water_max;
+    }
+    dst->count += src.count;
+    dst->percent_sum += src.percent_sum;
+    dst->water_sum += src.water_sum;
+    dst->alert_count += src.alert_count;
+    dst->alert_onsets += src.alert_onsets;
+    for(uint8_t k = 0; k < STATUS_COUNT; k++) dst->status_ms[k] += src.status_ms[k];
+}
+
+// Segment files are named after the UTC date they start on
+static void segment_path(char* out, size_t len, const char* dir, RollupTier_t tier, int64_t segment_ms){
+    time_t secs = (time_t)(segment_ms / 1000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    snprintf(out, len, "%s/%s/%04d%02d%02d.roll", dir, ROLLUP_TIERS[tier].name,
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+static bool parse_segment_name(const char* name, int64_t* segment_ms){
+    int y, m, d;
+    char tail[8];
+    if(sscanf(name, "%4d%2d%2d%7s", &y, &m, &d, tail) != 4 || strcmp(tail, ".roll") != 0) return false;
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = y - 1900;
+    tm.tm_mon = m - 1;
+    tm.tm_mday = d;
+    *segment_ms = (int64_t)timegm(&tm) * 1000;
+    return true;
+}
+
+//  STORE
+RollupStore::RollupStore() : devices_(new DeviceState_t[MAX_DEVICES]), gen_(1), saved_ms_(0) {
+    dir_[0] = '\0';
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        open_[t] = new RollupRow_t[MAX_DEVICES];
+        for(uint32_t i = 0; i < MAX_DEVICES; i++) open_[t][i].bucket_ms = EMPTY_BUCKET;
+        fd_[t] = -1;
+        segment_[t] = EMPTY_BUCKET;
+        newest_segment_[t] = EMPTY_BUCKET;
+        rows_written_[t] = 0;
+        retention_ms_[t] = ROLLUP_TIERS[t].default_retention_days * DAY_MS;
+    }
+    for(uint32_t i = 0; i < MAX_DEVICES; i++){
+        devices_[i].last_ms = INT64_MIN;
+        devices_[i].last_status = 0;
+        devices_[i].last_alert = 0;
+    }
+}
+
+RollupStore::~RollupStore(){
+    close();
+    for(uint8_t t = 0; t < TIER_COUNT; t++) delete[] open_[t];
+    delete[] devices_;
+}
+
+int RollupStore::open(const char* dir, const uint32_t* retention_days){
+    snprintf(dir_, sizeof(dir_), "%s", dir);
+    if(mkdir(dir_, 0755) < 0 && errno != EEXIST) return -errno;
+
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%s", dir_, ROLLUP_TIERS[t].name);
+        if(mkdir(path, 0755) < 0 && errno != EEXIST) return -errno;
+        if(retention_days && retention_days[t]) retention_ms_[t] = retention_days[t] * DAY_MS;
+    }
+    load_open();
+    saved_ms_ = mono_ms();
+    return 0;
+}
+
+void RollupStore::close(){
+    if(!dir_[0]) return;
+
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        for(uint32_t i = 0; i < MAX_DEVICES; i++){
+            RollupRow_t& row = open_[t][i];
+            if(row.bucket_ms == EMPTY_BUCKET) continue;
+            emit((RollupTier_t)t, row);
+            row.bucket_ms = EMPTY_BUCKET;
+        }
+    }
+    flush();
+    save_open();    // Empty now; keeps the generation for the next run
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        if(fd_[t] >= 0) ::close(fd_[t]);
+        fd_[t] = -1;
+        segment_[t] = EMPTY_BUCKET;
+    }
+    dir_[0] = '\0';
+}
+
+void RollupStore::emit(RollupTier_t tier, const RollupRow_t& row){
+    std::vector<RollupRow_t>& rows = pending_[tier];
+    if(rows.size() >= ROLLUP_PENDING_MAX){
+        // Writes keep failing: give up the oldest rather than grow
+        size_t n = rows.size() - ROLLUP_PENDING_MAX / 2;
+        fprintf(stderr, "rollup %s: %zu rows dropped, writes failing\n", ROLLUP_TIERS[tier].name, n);
+        rows.erase(rows.begin(), rows.begin() + n);
+    }
+    rows.push_back(row);
+}
+
+static bool write_all(int fd, const void* data, size_t len){
+    const uint8_t* p = (const uint8_t*)data;
+    while(len > 0){
+        ssize_t n = write(fd, p, len);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Replace DIR/open.snap with the open buckets and any rows still pending
+// after a failed write; everything else emitted so far is in its segment
+int RollupStore::save_open(){
+    SnapHeader_t h;
+    memcpy(h.magic, SNAP_MAGIC, 4);
+    h.gen = gen_;
+    std::vector<RollupRow_t> rows;
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        size_t before = rows.size();
+        for(uint32_t i = 0; i < MAX_DEVICES; i++){
+            if(open_[t][i].bucket_ms != EMPTY_BUCKET) rows.push_back(open_[t][i]);
+        }
+        h.rows[t] = (uint32_t)(rows.size() - before);
+        h.pending[t] = (uint32_t)pending_[t].size();
+        rows.insert(rows.end(), pending_[t].begin(), pending_[t].end());
+    }
+
+    char tmp[300], path[300];
+    snprintf(tmp, sizeof(tmp), "%s/" SNAP_FILE ".tmp", dir_);
+    snprintf(path, sizeof(path), "%s/" SNAP_FILE, dir_);
+    int fd = ::open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) return -errno;
+    bool ok = write_all(fd, &h, sizeof(h)) && write_all(fd, rows.data(), rows.size() * sizeof(RollupRow_t));
+    int rc = ok ? 0 : -errno;
+    ::close(fd);
+    if(rc == 0 && rename(tmp, path) < 0) rc = -errno;
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(-rc));
+        unlink(tmp);
+    }
+    gen_++;
+    saved_ms_ = mono_ms();
+    return rc;
+}
+
+// (bucket, device) of the rows tagged `gen` at the end of a segment file,
+// i.e. those written after the snapshot before `gen`
+static void tail_rows(const char* path, uint32_t gen, std::set<std::pair<int64_t, uint16_t>>* out){
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return;
+    struct stat st;
+    if(fstat(fd, &st) == 0){
+        RollupRow_t rows[256];
+        off_t end = st.st_size - st.st_size % (off_t)sizeof(RollupRow_t);
+        bool done = false;
+        while(end > 0 && !done){
+            off_t n = end / (off_t)sizeof(RollupRow_t);
+            if(n > 256) n = 256;
+            end -= n * (off_t)sizeof(RollupRow_t);
+            if(pread(fd, rows, (size_t)n * sizeof(RollupRow_t), end) != n * (off_t)sizeof(RollupRow_t)) break;
+            for(off_t i = n; i-- > 0;){
+                if(rows[i].gen != gen){
+                    done = true;
+                    break;
+                }
+                out->insert(std::make_pair(rows[i].bucket_ms, rows[i].device_id));
+            }
+        }
+    }
+    ::close(fd);
+}
+
+// Take back the open buckets and pending rows of the last snapshot, less
+// the ones written out after it
+void RollupStore::load_open(){
+    char path[300];
+    snprintf(path, sizeof(path), "%s/" SNAP_FILE, dir_);
+    FILE* f = fopen(path, "rb");
+    if(!f) return;
+
+    SnapHeader_t h;
+    std::vector<RollupRow_t> rows;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, SNAP_MAGIC, 4) == 0;
+    if(ok){
+        size_t total = 0;
+        for(uint8_t t = 0; t < TIER_COUNT; t++){
+            ok = ok && h.rows[t] <= MAX_DEVICES && h.pending[t] <= ROLLUP_PENDING_MAX;
+            total += (size_t)h.rows[t] + h.pending[t];
+        }
+        if(ok){
+            rows.resize(total);
+            ok = fread(rows.data(), sizeof(RollupRow_t), total, f) == total;
+        }
+    }
+    fclose(f);
+    if(!ok){
+        fprintf(stderr, "%s: damaged, open buckets not restored\n", path);
+        return;
+    }
+
+    size_t i = 0;
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        RollupTier_t tier = (RollupTier_t)t;
+        uint32_t n = h.rows[t] + h.pending[t];
+        std::set<int64_t> segments;
+        for(uint32_t k = 0; k < n; k++) segments.insert(floor_to(rows[i + k].bucket_ms, ROLLUP_TIERS[t].segment_ms));
+        std::set<std::pair<int64_t, uint16_t>> written;
+        for(int64_t seg : segments){
+            char file[320];
+            segment_path(file, sizeof(file), dir_, tier, seg);
+            tail_rows(file, h.gen + 1, &written);
+        }
+        for(uint32_t k = 0; k < n; k++, i++){
+            const RollupRow_t& row = rows[i];
+            if(row.device_id >= MAX_DEVICES || written.count(std::make_pair(row.bucket_ms, row.device_id))) continue;
+            if(k < h.rows[t]) open_[t][row.device_id] = row;
+            else pending_[t].push_back(row);
+        }
+    }
+    gen_ = h.gen + 2;   // Past anything the crashed run tagged
+}
+
+void RollupStore::on_reading(const Reading_t& r){
+    if(!dir_[0] || r.device_id >= MAX_DEVICES) return;
+
+    uint16_t id = r.device_id;
+    DeviceState_t& dev = devices_[id];
+    int64_t t = (int64_t)(r.rx_time_us / 1000);
+    uint8_t status = r.status & 0x3;
+
+    for(uint8_t k = 0; k < TIER_COUNT; k++){
+        RollupTier_t tier = (RollupTier_t)k;
+        RollupRow_t& row = open_[k][id];
+        int64_t width = ROLLUP_TIERS[k].bucket_ms;
+
+        // --- Credit the time since the previous reading to its status ---
+        // The gap is capped well below the smallest bucket, so it crosses
+        // at most one bucket boundary
+        if(dev.last_ms != INT64_MIN && t > dev.last_ms){
+            int64_t a = dev.last_ms;
+            int64_t b = (t - a > ROLLUP_MAX_GAP_MS) ? a + ROLLUP_MAX_GAP_MS : t;
+            while(a < b){
+                int64_t start = floor_to(a, width);
+                int64_t end = (b < start + width) ? b : start + width;
+                if(row.bucket_ms != start){
+                    if(row.bucket_ms != EMPTY_BUCKET) emit(tier, row);
+                    row_init(&row, id, start);
+                }
+                row.status_ms[dev.last_status] += (uint32_t)(end - a);
+                a = end;
+            }
+        }
+
+        // --- Add the reading to its bucket ---
+        int64_t start = floor_to(t, width);
+        if(row.bucket_ms != start){
+            if(row.bucket_ms != EMPTY_BUCKET) emit(tier, row);
+            row_init(&row, id, start);
+        }
+        row.count++;
+        row.percent_sum += r.percent;
+        row.water_sum += r.water_adc;
+        if(r.percent < row.percent_min) row.percent_min = (uint8_t)r.percent;
+        if(r.percent > row.percent_max) row.percent_max = (uint8_t)r.percent;
+        if(r.water_adc < row.water_min) row.water_min = r.water_adc;
+        if(r.water_adc > row.water_max) row.water_max = r.water_adc;
+        row.alert_count += r.alert;
+        if(r.alert && !dev.last_alert) row.alert_onsets++;
+    }
+
+    dev.last_ms = t;
+    dev.last_status = status;
+    dev.last_alert = r.alert;
+}
+
+// Don't credit the previous device's status across the gap
+void RollupStore::on_device_reset(uint16_t device_id){
+    if(device_id >= MAX_DEVICES) return;
+    devices_[device_id].last_ms = INT64_MIN;
+    devices_[device_id].last_alert = 0;
+}
+
+void RollupStore::flush(){
+    for(uint8_t t = 0; t < TIER_COUNT; t++){
+        if(!pending_[t].empty()) write_rows((RollupTier_t)t);
+    }
+    if(dir_[0] && mono_ms() - saved_ms_ >= ROLLUP_SNAPSHOT_MS) save_open();
+}
+
+// Rows that can't be written stay pending for the next flush (and the
+// snapshot); a partly written row is cut off again
+int RollupStore::write_rows(RollupTier_t tier){
+    std::vector<RollupRow_t>& rows = pending_[tier];
+    int64_t segment_width = ROLLUP_TIERS[tier].segment_ms;
+    size_t i = 0;
+    int rc = 0;
+
+    while(i < rows.size() && rc == 0){
+        // Run of rows belonging to the same segment (almost always all of them)
+        int64_t seg = floor_to(rows[i].bucket_ms, segment_width);
+        size_t j = i + 1;
+        while(j < rows.size() && floor_to(rows[j].bucket_ms, segment_width) == seg) j++;
+
+        if(seg != segment_[tier] || fd_[tier] < 0){
+            if(fd_[tier] >= 0) ::close(fd_[tier]);
+            char path[320];
+            segment_path(path, sizeof(path), dir_, tier, seg);
+            fd_[tier] = ::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            segment_[tier] = seg;
+            if(fd_[tier] < 0){
+                rc = -errno;
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                break;
+            }
+
+            // Cut a torn row left by a crash so rows stay aligned
+            struct stat st;
+            if(fstat(fd_[tier], &st) == 0 && st.st_size % sizeof(RollupRow_t)){
+                if(ftruncate(fd_[tier], st.st_size - st.st_size % (off_t)sizeof(RollupRow_t)) < 0) rc = -errno;
+            }
+            if(newest_segment_[tier] == EMPTY_BUCKET || seg > newest_segment_[tier]){
+                newest_segment_[tier] = seg;
+                expire(tier, seg);
+            }
+        }
+
+        // Tagged as written after the last snapshot (see load_open)
+        for(size_t k = i; k < j; k++) rows[k].gen = gen_;
+        size_t len = (j - i) * sizeof(RollupRow_t);
+        size_t done = 0;
+        const uint8_t* p = (const uint8_t*)&rows[i];
+        while(done < len){
+            ssize_t n = write(fd_[tier], p + done, len - done);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                rc = -errno;
+                fprintf(stderr, "rollup %s: write: %s\n", ROLLUP_TIERS[tier].name, strerror(errno));
+                break;
+            }
+            done += (size_t)n;
+        }
+        size_t whole = done / sizeof(RollupRow_t);
+        if(done % sizeof(RollupRow_t)){
+            struct stat st;
+            if(fstat(fd_[tier], &st) == 0 && ftruncate(fd_[tier], st.st_size - (off_t)(done % sizeof(RollupRow_t))) < 0){
+                ::close(fd_[tier]);     // Reopening cuts it
+                fd_[tier] = -1;
+            }
+        }
+        rows_written_[tier] += whole;
+        i += whole;
+    }
+    rows.erase(rows.begin(), rows.begin() + i);
+    return rc;
+}
+
+// Drop segments that end more than the retention before the newest one
+void RollupStore::expire(RollupTier_t tier, int64_t newest){
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s", dir_, ROLLUP_TIERS[tier].name);
+    DIR* d = opendir(path);
+    if(!d) return;
+
+    struct dirent* e;
+    while((e = readdir(d)) != NULL){
+        int64_t seg;
+        if(!parse_segment_name(e->d_name, &seg)) continue;
+        if(seg <= newest - retention_ms_[tier]){
+            char file[600];
+            snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+            unlink(file);
+        }
+    }
+    closedir(d);
+}
+
+//  READING
+int rollup_read(const char* dir, RollupTier_t tier, uint16_t device_id, int64_t from_ms, int64_t to_ms,
+                std::vector<RollupRow_t>* out){
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s", dir, ROLLUP_TIERS[tier].name);
+    DIR* d = opendir(path);
+    if(!d) return -errno;
+
+    size_t first = out->size();
+    int64_t width = ROLLUP_TIERS[tier].segment_ms;
+    struct dirent* e;
+    RollupRow_t rows[256];
+
+    while((e = readdir(d)) != NULL){
+        int64_t seg;
+        if(!parse_segment_name(e->d_name, &seg)) continue;
+        if(seg + width <= from_ms || seg >= to_ms) continue;
+
+        char file[600];
+        snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+        FILE* f = fopen(file, "rb");
+        if(!f) continue;
+
+        size_t n;
+        while((n = fread(rows, sizeof(RollupRow_t), 256, f)) > 0){
+            for(size_t i = 0; i < n; i++){
+                const RollupRow_t& r = rows[i];
+                if(r.bucket_ms < from_ms || r.bucket_ms >= to_ms) continue;
+                if(device_id != 0xFFFF && r.device_id != device_id) continue;
+                out->push_back(r);
+            }
+        }
+        fclose(f);
+    }
+    closedir(d);
+
+    // Sort and fold rows written for the same bucket by separate runs
+    std::sort(out->begin() + first, out->end(), [](const RollupRow_t& a, const RollupRow_t& b){
+        return a.bucket_ms != b.bucket_ms ? a.bucket_ms < b.bucket_ms : a.device_id < b.device_id;
+    });
+    size_t w = first;
+    for(size_t i = first; i < out->size(); i++){
+        if(w > first && (*out)[w - 1].bucket_ms == (*out)[i].bucket_ms && (*out)[w - 1].device_id == (*out)[i].device_id){
+            rollup_merge(&(*out)[w - 1], (*out)[i]);
+        } else {
+            (*out)[w++] = (*out)[i];
+        }
+    }
+    out->resize(w);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef GATEWAY_ROLLUP_H
+#define GATEWAY_ROLLUP_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "reading.h"
+#include "sinks.h"
+
+#define ROLLUP_MAX_GAP_MS   5000    // Longer silences aren't credited to any status
+#define ROLLUP_SNAPSHOT_MS  10000   // Open buckets are saved this often
+#define ROLLUP_PENDING_MAX  65536   // Rows kept per tier while writes fail
+
+typedef enum {
+    TIER_1M = 0,
+    TIER_1H,
+    TIER_1D,
+    TIER_COUNT
+} RollupTier_t;
+
+typedef struct {
+    const char* name;               // Subdirectory and CLI name
+    int64_t bucket_ms;
+    int64_t segment_ms;             // Rows are filed per segment; retention drops whole segments
+    uint32_t default_retention_days;
+} RollupTierInfo_t;
+
+extern const RollupTierInfo_t ROLLUP_TIERS[TIER_COUNT];
+
+// Summary of one device over one bucket. Fixed size, little-endian on disk.
+typedef struct {
+    int64_t  bucket_ms;             // Bucket start, epoch ms (UTC aligned)
+    uint16_t device_id;
+    uint8_t  percent_min;
+    uint8_t  percent_max;
+    uint16_t water_min;
+    uint16_t water_max;
+    uint32_t count;                 // Readings
+    uint32_t percent_sum;
+    uint32_t water_sum;
+    uint32_t alert_count;           // Readings with A = 1
+    uint32_t alert_onsets;          // A going 0 -> 1
+    uint32_t status_ms[STATUS_COUNT];   // Time spent in each Status_t
+    uint32_t gen;                   // Next snapshot's generation when written (crash recovery)
+} RollupRow_t;
+
+static_assert(sizeof(RollupRow_t) == 56, "rollup rows are 56 bytes");
+
+// STORAGE: 1 min / 1 h / 1 day summaries maintained as readings arrive.
+// Each device has one open bucket per tier; a bucket is written when the
+// device's next reading lands in a later one. Rows go to DIR/<tier>/ in
+// one file per segment (a day of 1 min rows, 30 days of 1 h rows, a year
+// of 1 d rows), so each tier's retention just deletes old files.
+//
+// Time in status: the gap between two readings is credited to the first
+// one's status, up to ROLLUP_MAX_GAP_MS.
+//
+// Open buckets only live in memory, so every ROLLUP_SNAPSHOT_MS flush()
+// saves them, with any rows a failed write left pending, to DIR/open.snap,
+// and open() takes them back. Rows are tagged with the generation of the
+// next snapshot as they are written; a row the snapshot holds that was
+// written out before a crash (tagged with the following generation, at the
+// end of its segment file) is not restored, so nothing is counted twice.
+// A crash loses at most the readings since the last snapshot.
+class RollupStore : public Sink {
+public:
+    RollupStore();
+    ~RollupStore();
+
+    // Create DIR and the tier subdirectories and restore the open buckets
+    // a crashed run left. retention_days[] of 0 keeps the tier's default.
+    // Returns 0 or -errno.
+    int open(const char* dir, const uint32_t* retention_days = NULL);
+
+    // Write the open buckets too; a later run appending to the same bucket
+    // adds a second row that readers merge
+    void close();
+
+    void on_reading(const Reading_t& r) override;
+    void on_device_reset(uint16_t device_id) override;
+    void flush() override;
+
+    uint64_t rows_written(RollupTier_t tier) const { return rows_written_[tier]; }
+
+private:
+    typedef struct {
+        int64_t  last_ms;           // Previous reading, INT64_MIN before the first
+        uint8_t  last_status;
+        uint8_t  last_alert;
+    } DeviceState_t;
+
+    void emit(RollupTier_t tier, const RollupRow_t& row);
+    int save_open();
+    void load_open();
+    int write_rows(RollupTier_t tier);
+    void expire(RollupTier_t tier, int64_t now_segment);
+
+    char dir_[256];
+    int64_t retention_ms_[TIER_COUNT];
+    RollupRow_t* open_[TIER_COUNT];         // [MAX_DEVICES], bucket_ms = INT64_MIN when empty
+    DeviceState_t* devices_;                // [MAX_DEVICES]
+    std::vector<RollupRow_t> pending_[TIER_COUNT];
+    int fd_[TIER_COUNT];                    // Current segment file per tier
+    int64_t segment_[TIER_COUNT];
+    int64_t newest_segment_[TIER_COUNT];    // Drives retention
+    uint64_t rows_written_[TIER_COUNT];
+    uint32_t gen_;                          // Tag of rows emitted now; the next snapshot's number
+    uint64_t saved_ms_;                     // Last snapshot, monotonic
+};
+
+// Rows of one tier with from_ms <= bucket_ms < to_ms, for one device or
+// QUERY_ALL_DEVICES (0xFFFF), sorted by (bucket, device) with duplicate
+// rows merged. Returns 0 or -errno.
+int rollup_read(const char* dir, RollupTier_t tier, uint16_t device_id, int64_t from_ms, int64_t to_ms,
+                std::vector<RollupRow_t>* out);
+
+// Fold `src` into `dst` (same or different buckets)
+void rollup_merge(RollupRow_t* dst, const RollupRow_t& src);
+
+#endif
@@ -0,0 +1,684 @@
+#include "rules.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define EPOCH_SLACK_MS  86400000LL
+
+static const char* const field_names[RULE_FIELD_COUNT] = { "P", "W", "S", "A" };
+static const char* const status_names[STATUS_COUNT] = { "EMPTY", "HALF_FULL", "OVERFLOW", "CONTAMINATED" };
+static const char* const agg_names[4] = { "avg", "min", "max", "delta" };
+
+static inline double apply(uint32_t op, double a, double b){
+    switch(op){
+        case RULE_OP_ADD: return a + b;
+        case RULE_OP_SUB: return a - b;
+        case RULE_OP_MUL: return a * b;
+        case RULE_OP_DIV: return b != 0 ? a / b : 0;
+        case RULE_OP_LT:  return a < b;
+        case RULE_OP_LE:  return a <= b;
+        case RULE_OP_GT:  return a > b;
+        case RULE_OP_GE:  return a >= b;
+        case RULE_OP_EQ:  return a == b;
+        case RULE_OP_NE:  return a != b;
+        case RULE_OP_AND: return a != 0 && b != 0;
+        case RULE_OP_OR:  return a != 0 || b != 0;
+        default:          return 0;
+    }
+}
+
+//  COMPILER
+// One statement per line; recursive descent straight to postfix code, with
+// constant operands folded as they are emitted.
+struct RuleEngine::Parser {
+    RuleEngine* engine;
+    const char* p;
+    const char* source;
+    uint32_t line;
+    std::string* error;
+
+    uint32_t group = RULE_GROUP_ALL;    // Of the rule being compiled
+    bool in_count = false;
+    bool uses_fields = false;           // Outside count()
+    bool uses_count = false;
+
+    bool fail(const char* fmt, const char* arg = ""){
+        if(error){
+            char msg[256];
+            int n = snprintf(msg, sizeof(msg), "%s:%u: ", source, (unsigned)line);
+            snprintf(msg + n, sizeof(msg) - n, fmt, arg);
+            *error = msg;
+        }
+        return false;
+    }
+
+    void skip(){
+        while(*p == ' ' || *p == '\t' || *p == '\r') p++;
+    }
+
+    bool at_end(){
+        skip();
+        return *p == '\0';
+    }
+
+    bool accept(const char* tok){
+        skip();
+        size_t n = strlen(tok);
+        if(strncmp(p, tok, n)) return false;
+        p += n;
+        return true;
+    }
+
+    bool accept_word(const char* word){
+        skip();
+        size_t n = strlen(word);
+        if(strncmp(p, word, n) || isalnum((unsigned char)p[n]) || p[n] == '_') return false;
+        p += n;
+        return true;
+    }
+
+    bool expect(const char* tok){
+        if(accept(tok)) return true;
+        return fail("expected '%s'", tok);
+    }
+
+    bool ident(std::string* out){
+        skip();
+        if(!isalpha((unsigned char)*p) && *p != '_') return false;
+        const char* start = p;
+        while(isalnum((unsigned char)*p) || *p == '_') p++;
+        out->assign(start, p - start);
+        return true;
+    }
+
+    // A number, optionally with a duration unit; *unit_ms is 0 without one
+    bool number(double* v, int64_t* unit_ms){
+        skip();
+        if(!isdigit((unsigned char)*p) && *p != '.') return false;
+        char* end;
+        *v = strtod(p, &end);
+        if(end == p) return false;      // A lone '.'
+        p = end;
+        *unit_ms = 0;
+        if(!strncmp(p, "ms", 2) && !isalpha((unsigned char)p[2])){ *unit_ms = 1; p += 2; }
+        else if(*p == 's' && !isalpha((unsigned char)p[1])){ *unit_ms = 1000; p++; }
+        else if(*p == 'm' && !isalpha((unsigned char)p[1])){ *unit_ms = 60000; p++; }
+        else if(*p == 'h' && !isalpha((unsigned char)p[1])){ *unit_ms = 3600000; p++; }
+        return true;
+    }
+
+    bool duration(int64_t* ms){
+        double v;
+        int64_t unit;
+        if(!number(&v, &unit) || unit == 0 || v < 0) return fail("expected a duration such as 30s or 5m");
+        *ms = (int64_t)(v * unit);
+        return true;
+    }
+
+    void emit(std::vector<RuleInstr_t>* code, uint32_t op, uint32_t arg = 0, double k = 0){
+        code->push_back({ op, arg, k });
+    }
+
+    void emit_unary(std::vector<RuleInstr_t>* code, uint32_t op, size_t start){
+        if(code->size() == start + 1 && (*code)[start].op == RULE_OP_CONST){
+            double& k = (*code)[start].k;
+            k = (op == RULE_OP_NEG) ? -k : (k == 0);
+            return;
+        }
+        emit(code, op);
+    }
+
+    // `start` is where the left operand's code begins
+    void emit_binary(std::vector<RuleInstr_t>* code, uint32_t op, size_t start){
+        if(code->size() == start + 2 && (*code)[start].op == RULE_OP_CONST && (*code)[start + 1].op == RULE_OP_CONST){
+            (*code)[start].k = apply(op, (*code)[start].k, (*code)[start + 1].k);
+            code->pop_back();
+            return;
+        }
+        emit(code, op);
+    }
+
+    bool expr(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        if(!conjunction(code)) return false;
+        while(accept("||") || accept_word("or")){
+            if(!conjunction(code)) return false;
+            emit_binary(code, RULE_OP_OR, start);
+        }
+        return true;
+    }
+
+    bool conjunction(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        if(!negation(code)) return false;
+        while(accept("&&") || accept_word("and")){
+            if(!negation(code)) return false;
+            emit_binary(code, RULE_OP_AND, start);
+        }
+        return true;
+    }
+
+    bool negation(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        skip();
+        if((p[0] == '!' && p[1] != '=' && accept("!")) || accept_word("not")){
+            if(!negation(code)) return false;
+            emit_unary(code, RULE_OP_NOT, start);
+            return true;
+        }
+        return comparison(code);
+    }
+
+    bool comparison(std::vector<RuleInstr_t>* code){
+        static const struct { const char* tok; uint32_t op; } ops[] = {
+            { "<=", RULE_OP_LE }, { ">=", RULE_OP_GE }, { "==", RULE_OP_EQ }, { "!=", RULE_OP_NE },
+            { "<", RULE_OP_LT }, { ">", RULE_OP_GT },
+        };
+        size_t start = code->size();
+        if(!sum(code)) return false;
+        for(const auto& o : ops){
+            if(!accept(o.tok)) continue;
+            if(!sum(code)) return false;
+            emit_binary(code, o.op, start);
+            break;
+        }
+        return true;
+    }
+
+    bool sum(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        if(!product(code)) return false;
+        while(true){
+            uint32_t op;
+            if(accept("+")) op = RULE_OP_ADD;
+            else if(accept("-")) op = RULE_OP_SUB;
+            else return true;
+            if(!product(code)) return false;
+            emit_binary(code, op, start);
+        }
+    }
+
+    bool product(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        if(!unary(code)) return false;
+        while(true){
+            uint32_t op;
+            if(accept("*")) op = RULE_OP_MUL;
+            else if(accept("/")) op = RULE_OP_DIV;
+            else return true;
+            if(!unary(code)) return false;
+            emit_binary(code, op, start);
+        }
+    }
+
+    bool unary(std::vector<RuleInstr_t>* code){
+        size_t start = code->size();
+        if(accept("-")){
+            if(!unary(code)) return false;
+            emit_unary(code, RULE_OP_NEG, start);
+            return true;
+        }
+        return primary(code);
+    }
+
+    bool field(uint8_t* out){
+        std::string name;
+        if(!ident(&name)) return fail("expected a field (P, W, S or A)");
+        for(uint8_t f = 0; f < RULE_FIELD_COUNT; f++){
+            if(name == field_names[f]){
+                *out = f;
+                return true;
+            }
+        }
+        return fail("'%s' is not a field (P, W, S or A)", name.c_str());
+    }
+
+    bool primary(std::vector<RuleInstr_t>* code){
+        double v;
+        int64_t unit;
+        if(accept("(")){
+            if(!expr(code)) return false;
+            return expect(")");
+        }
+        if(number(&v, &unit)){
+            if(unit) return fail("unexpected duration; durations go in windows and after 'for'");
+            emit(code, RULE_OP_CONST, 0, v);
+            return true;
+        }
+
+        std::string name;
+        if(!ident(&name)) return *p ? fail("unexpected '%.1s'", p) : fail("unexpected end of rule");
+
+        for(uint8_t f = 0; f < RULE_FIELD_COUNT; f++){
+            if(name != field_names[f]) continue;
+            if(!in_count) uses_fields = true;
+            emit(code, RULE_OP_FIELD, f);
+            return true;
+        }
+        for(uint8_t s = 0; s < STATUS_COUNT; s++){
+            if(name != status_names[s]) continue;
+            emit(code, RULE_OP_CONST, 0, s);
+            return true;
+        }
+        for(uint8_t a = 0; a < 4; a++){
+            if(name != agg_names[a]) continue;
+            uint8_t f;
+            int64_t window_ms;
+            if(!expect("(") || !field(&f) || !expect(",") || !duration(&window_ms) || !expect(")")) return false;
+            if(window_ms < 1000) return fail("%s() window is shorter than 1s", agg_names[a]);
+            if(!in_count) uses_fields = true;
+            emit(code, RULE_OP_WINDOW, (engine->window_id(f, window_ms) << 2) | a);
+            return true;
+        }
+        if(name == "count"){
+            if(in_count) return fail("count() inside count()");
+            Term term;
+            term.group = group;
+            in_count = true;
+            if(!expect("(") || !expr(&term.code) || !expect(")")) return false;
+            in_count = false;
+            if(!check_depth(term.code)) return false;
+            emit(code, RULE_OP_COUNT, (uint32_t)engine->terms_.size());
+            engine->terms_.push_back(term);
+            engine->term_counts_.push_back(0);
+            uses_count = true;
+            return true;
+        }
+        return fail("unknown name '%s'", name.c_str());
+    }
+
+    bool check_depth(const std::vector<RuleInstr_t>& code){
+        int depth = 0, max = 0;
+        for(const RuleInstr_t& in : code){
+            if(in.op <= RULE_OP_COUNT) depth++;
+            else if(in.op > RULE_OP_NOT) depth--;
+            if(depth > max) max = depth;
+        }
+        if(max > RULE_STACK_MAX) return fail("expression too deeply nested");
+        return true;
+    }
+
+    // group NAME ID|FIRST-LAST ...
+    bool group_statement(){
+        std::string name;
+        if(!ident(&name)) return fail("expected a group name");
+        if(engine->group_id(name) != UINT32_MAX) return fail("group '%s' is already defined", name.c_str());
+        if(engine->groups_.size() >= RULE_MAX_GROUPS) return fail("too many groups");
+
+        Group g;
+        g.name = name;
+        g.members.assign(MAX_DEVICES / 8, 0);
+        uint32_t ids = 0;
+        while(!at_end()){
+            double first, last;
+            int64_t unit;
+            if(!number(&first, &unit) || unit) return fail("expected a device id or range");
+            last = first;
+            if(accept("-") && (!number(&last, &unit) || unit)) return fail("expected the end of the range");
+            if(first < 0 || last >= MAX_DEVICES || first > last) return fail("bad device range");
+            for(uint32_t id = (uint32_t)first; id <= (uint32_t)last; id++) g.members[id >> 3] |= (uint8_t)(1u << (id & 7));
+            ids++;
+            accept(",");
+        }
+        if(!ids) return fail("group '%s' has no devices", name.c_str());
+        engine->groups_.push_back(g);
+        return true;
+    }
+
+    // rule NAME [in GROUP]: EXPR [for DURATION]
+    bool rule_statement(){
+        Rule rule;
+        if(!ident(&rule.name)) return fail("expected a rule name");
+        if(rule.name.size() > RULE_NAME_MAX) return fail("rule name is too long");
+        for(const Rule& r : engine->rules_){
+            if(r.name == rule.name) return fail("rule '%s' is already defined", rule.name.c_str());
+        }
+        if(accept_word("in")){
+            std::string name;
+            if(!ident(&name)) return fail("expected a group name");
+            group = engine->group_id(name);
+            if(group == UINT32_MAX) return fail("unknown group '%s'", name.c_str());
+        }
+        if(!expect(":") || !expr(&rule.code)) return false;
+
+        rule.for_ms = 0;
+        if(accept_word("for") && !duration(&rule.for_ms)) return false;
+        if(!at_end()) return fail("unexpected '%s'", p);
+        if(uses_count && uses_fields) return fail("fields outside count() in a group rule");
+        if(!check_depth(rule.code)) return false;
+
+        rule.group = group;
+        rule.group_rule = uses_count;
+        rule.group_since_ms = -1;
+        rule.group_firing = false;
+        engine->rules_.push_back(rule);
+        return true;
+    }
+
+    bool statement(){
+        if(accept_word("group")) return group_statement();
+        if(accept_word("rule")) return rule_statement();
+        return fail("expected 'group' or 'rule'");
+    }
+};
+
+//  ENGINE
+RuleEngine::RuleEngine(AlertTracker* alerts)
+    : alerts_(alerts), devices_(new Device*[MAX_DEVICES]()), epoch_ms_(INT64_MIN),
+      stale_ms_(alerts ? alerts->config().stale_ms : ALERT_DEFAULTS.stale_ms), expired_ms_(0),
+      evaluations_(0), transitions_(0) {
+    Group all;
+    all.name = "all";
+    groups_.push_back(all);
+}
+
+RuleEngine::~RuleEngine(){
+    for(uint32_t i = 0; i < MAX_DEVICES; i++) delete devices_[i];
+    delete[] devices_;
+}
+
+int RuleEngine::load(const char* path, std::string* error){
+    FILE* f = fopen(path, "r");
+    if(!f){
+        int err = errno;
+        if(error) *error = std::string(path) + ": " + strerror(err);
+        return -err;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    fclose(f);
+    return compile(text.c_str(), path, error);
+}
+
+int RuleEngine::compile(const char* text, const char* source, std::string* error){
+    if(!profiles_.empty()){
+        if(error) *error = std::string(source) + ": rules must be loaded before the first reading";
+        return -EBUSY;
+    }
+
+    uint32_t line_no = 0;
+    while(*text){
+        const char* eol = strchr(text, '\n');
+        size_t len = eol ? (size_t)(eol - text) : strlen(text);
+        std::string line(text, len);
+        text += len + (eol ? 1 : 0);
+        line_no++;
+
+        size_t hash = line.find('#');
+        if(hash != std::string::npos) line.resize(hash);
+
+        Parser parser;
+        parser.engine = this;
+        parser.p = line.c_str();
+        parser.source = source;
+        parser.line = line_no;
+        parser.error = error;
+        if(parser.at_end()) continue;
+        if(!parser.statement()) return -EINVAL;
+    }
+    return 0;
+}
+
+uint32_t RuleEngine::window_id(uint8_t field, int64_t window_ms){
+    int64_t bucket_ms = window_ms / RULE_WINDOW_BUCKETS;
+    for(uint32_t i = 0; i < windows_.size(); i++){
+        if(windows_[i].field == field && windows_[i].bucket_ms == bucket_ms) return i;
+    }
+    windows_.push_back({ field, bucket_ms });
+    window_cache_.resize(windows_.size() * 4);
+    return (uint32_t)windows_.size() - 1;
+}
+
+uint32_t RuleEngine::group_id(const std::string& name) const {
+    for(uint32_t i = 0; i < groups_.size(); i++){
+        if(groups_[i].name == name) return i;
+    }
+    return UINT32_MAX;
+}
+
+bool RuleEngine::group_members(const std::string& name, std::vector<uint8_t>* bitmap) const {
+    uint32_t g = group_id(name);
+    if(g == UINT32_MAX) return false;
+    *bitmap = groups_[g].members;
+    return true;
+}
+
+bool RuleEngine::in_group(uint32_t group, uint16_t device_id) const {
+    if(group == RULE_GROUP_ALL) return true;
+    return groups_[group].members[device_id >> 3] & (1u << (device_id & 7));
+}
+
+void RuleEngine::link_program(const std::vector<RuleInstr_t>& code, Profile* p){
+    for(const RuleInstr_t& in : code){
+        if(in.op != RULE_OP_WINDOW) continue;
+        uint32_t w = in.arg >> 2;
+        if(p->window_pos[w] >= 0) continue;
+        p->window_pos[w] = (int32_t)p->windows.size();
+        p->windows.push_back(w);
+    }
+}
+
+// State of a device, created with the profile of its group memberships
+RuleEngine::Device* RuleEngine::device(uint16_t device_id){
+    if(devices_[device_id]) return devices_[device_id];
+
+    std::vector<uint32_t> groups;
+    for(uint32_t g = 0; g < groups_.size(); g++){
+        if(in_group(g, device_id)) groups.push_back(g);
+    }
+
+    auto it = profile_ids_.find(groups);
+    uint32_t id;
+    if(it != profile_ids_.end()) id = it->second;
+    else {
+        Profile p;
+        p.window_pos.assign(windows_.size(), -1);
+        for(uint32_t r = 0; r < rules_.size(); r++){
+            if(!std::binary_search(groups.begin(), groups.end(), rules_[r].group)) continue;
+            (rules_[r].group_rule ? p.group_rules : p.rules).push_back(r);
+            link_program(rules_[r].code, &p);
+        }
+        for(uint32_t t = 0; t < terms_.size(); t++){
+            if(!std::binary_search(groups.begin(), groups.end(), terms_[t].group)) continue;
+            p.terms.push_back(t);
+            link_program(terms_[t].code, &p);
+        }
+        id = (uint32_t)profiles_.size();
+        profiles_.push_back(p);
+        profile_ids_[groups] = id;
+    }
+
+    const Profile& p = profiles_[id];
+    Device* d = new Device;
+    d->profile = id;
+    d->buckets.assign(p.windows.size() * RULE_WINDOW_BUCKETS, RuleBucket_t());
+    d->since_ms.assign(p.rules.size(), -1);
+    d->firing.assign(p.rules.size(), 0);
+    d->term.assign(p.terms.size(), 0);
+    d->seen_ms = 0;
+    devices_[device_id] = d;
+    return d;
+}
+
+// All four aggregates over the buckets still inside the window, into
+// out[RuleAgg_t]; delta is `current` less the first value of the oldest one
+static void window_aggregate(const RuleBucket_t* ring, uint32_t index, uint16_t current, double* out){
+
+    uint32_t oldest = UINT32_MAX, first = 0, min = UINT32_MAX, max = 0, count = 0;
+    uint64_t sum = 0;
+    for(uint32_t i = 0; i < RULE_WINDOW_BUCKETS; i++){
+        const RuleBucket_t& b = ring[i];
+        if(b.index == 0 || b.index > index || index - b.index >= RULE_WINDOW_BUCKETS) continue;
+        if(b.index < oldest){
+            oldest = b.index;
+            first = b.first;
+        }
+        if(b.min < min) min = b.min;
+        if(b.max > max) max = b.max;
+        sum += b.sum;
+        count += b.count;
+    }
+    if(!count){
+        out[RULE_AGG_AVG] = out[RULE_AGG_MIN] = out[RULE_AGG_MAX] = out[RULE_AGG_DELTA] = 0;
+        return;
+    }
+    out[RULE_AGG_AVG] = (double)sum / count;
+    out[RULE_AGG_MIN] = min;
+    out[RULE_AGG_MAX] = max;
+    out[RULE_AGG_DELTA] = (double)current - first;
+}
+
+double RuleEngine::run(const std::vector<RuleInstr_t>& code, const uint16_t* fields){
+    double stack[RULE_STACK_MAX];
+    int sp = 0;
+
+    evaluations_++;
+    for(const RuleInstr_t& in : code){
+        switch(in.op){
+            case RULE_OP_CONST: stack[sp++] = in.k; break;
+            case RULE_OP_FIELD: stack[sp++] = fields[in.arg]; break;
+            case RULE_OP_WINDOW: stack[sp++] = window_cache_[in.arg]; break;
+            case RULE_OP_COUNT: stack[sp++] = term_counts_[in.arg]; break;
+            case RULE_OP_NEG:   stack[sp - 1] = -stack[sp - 1]; break;
+            case RULE_OP_NOT:   stack[sp - 1] = (stack[sp - 1] == 0); break;
+            default:
+                sp--;
+                stack[sp - 1] = apply(in.op, stack[sp - 1], stack[sp]);
+                break;
+        }
+    }
+    return sp ? stack[0] : 0;
+}
+
+void RuleEngine::notify(uint32_t rule_id, uint32_t subject, bool firing, const Reading_t& r, int64_t now_ms){
+    if(!alerts_) return;
+    const Rule& rule = rules_[rule_id];
+    AlertDetail_t detail = { rule.name.c_str(), rule.group_rule ? groups_[rule.group].name.c_str() : NULL, r };
+    alerts_->observe(alert_key(ALERT_SOURCE_FLAG + 1 + rule_id, subject), firing, now_ms + epoch_ms_, detail);
+}
+
+// Condition held `hold` at `now_ms`: start or reset the for-timer, fire or clear
+static inline int step(bool hold, int64_t now_ms, int64_t for_ms, int64_t* since_ms, bool firing){
+    if(!hold){
+        *since_ms = -1;
+        return firing ? -1 : 0;
+    }
+    if(*since_ms < 0) *since_ms = now_ms;
+    return (!firing && now_ms - *since_ms >= for_ms) ? 1 : 0;
+}
+
+void RuleEngine::on_reading(const Reading_t& r){
+    if(r.device_id >= MAX_DEVICES || rules_.empty()) return;
+
+    // Times are kept relative to the first reading, less a day for stragglers
+    int64_t now = (int64_t)(r.rx_time_us / 1000);
+    if(epoch_ms_ == INT64_MIN) epoch_ms_ = now - EPOCH_SLACK_MS;
+    now = (now > epoch_ms_) ? now - epoch_ms_ : 0;
+
+    Device* d = device(r.device_id);
+    const Profile& p = profiles_[d->profile];
+    const uint16_t fields[RULE_FIELD_COUNT] = { r.percent, r.water_adc, r.status, r.alert };
+
+    // --- Windows ---
+    for(size_t i = 0; i < p.windows.size(); i++){
+        const Window& w = windows_[p.windows[i]];
+        uint32_t index = (uint32_t)(now / w.bucket_ms) + 1;
+        RuleBucket_t& b = d->buckets[i * RULE_WINDOW_BUCKETS + index % RULE_WINDOW_BUCKETS];
+        uint16_t v = fields[w.field];
+        if(index > b.index){
+            b.index = index;
+            b.first = b.min = b.max = v;
+            b.count = 1;
+            b.sum = v;
+        }
+        else if(index == b.index){
+            if(v < b.min) b.min = v;
+            if(v > b.max) b.max = v;
+            if(b.count < UINT16_MAX){
+                b.count++;
+                b.sum += v;
+            }
+        }
+        // Older than the bucket in its slot: too late to count
+
+        window_aggregate(&d->buckets[i * RULE_WINDOW_BUCKETS], index, v, &window_cache_[(size_t)p.windows[i] << 2]);
+    }
+
+    // --- count() terms ---
+    d->seen_ms = now;
+    if(!terms_.empty() && now - expired_ms_ >= ALERT_TICK_MS) expire_terms(now);
+    for(size_t i = 0; i < p.terms.size(); i++){
+        uint32_t t = p.terms[i];
+        uint8_t v = run(terms_[t].code, fields) != 0;
+        if(v == d->term[i]) continue;
+        if(v) term_counts_[t]++;
+        else term_counts_[t]--;
+        d->term[i] = v;
+    }
+
+    // --- Rules: transitions, and each reading while firing, go to the tracker ---
+    for(size_t i = 0; i < p.rules.size(); i++){
+        uint32_t id = p.rules[i];
+        const Rule& rule = rules_[id];
+        int change = step(run(rule.code, fields) != 0, now, rule.for_ms, &d->since_ms[i], d->firing[i]);
+        if(change){
+            d->firing[i] = change > 0;
+            transitions_++;
+        }
+        if(change || d->firing[i]) notify(id, r.device_id, d->firing[i], r, now);
+    }
+    for(uint32_t id : p.group_rules){
+        Rule& rule = rules_[id];
+        int change = step(run(rule.code, fields) != 0, now, rule.for_ms, &rule.group_since_ms, rule.group_firing);
+        if(change){
+            rule.group_firing = change > 0;
+            transitions_++;
+        }
+        if(change || rule.group_firing) notify(id, ALERT_GROUP | rule.group, rule.group_firing, r, now);
+    }
+}
+
+// Windows, conditions and count() terms start over with the new device
+void RuleEngine::on_device_reset(uint16_t device_id){
+    if(device_id >= MAX_DEVICES || !devices_[device_id]) return;
+    Device* d = devices_[device_id];
+    const Profile& p = profiles_[d->profile];
+    for(size_t i = 0; i < p.terms.size(); i++){
+        if(d->term[i]) term_counts_[p.terms[i]]--;
+    }
+    delete d;
+    devices_[device_id] = NULL;
+}
+
+// A device's term bits only change on its own readings; take the ones
+// that have gone quiet out of the counts until they report again
+void RuleEngine::expire_terms(int64_t now_ms){
+    expired_ms_ = now_ms;
+    for(uint32_t id = 0; id < MAX_DEVICES; id++){
+        Device* d = devices_[id];
+        if(!d || now_ms - d->seen_ms < stale_ms_) continue;
+        const Profile& p = profiles_[d->profile];
+        for(size_t i = 0; i < p.terms.size(); i++){
+            if(!d->term[i]) continue;
+            term_counts_[p.terms[i]]--;
+            d->term[i] = 0;
+        }
+    }
+}
+
+uint32_t RuleEngine::firing() const {
+    uint32_t n = 0;
+    for(const Rule& rule : rules_) n += rule.group_firing;
+    for(uint32_t i = 0; i < MAX_DEVICES; i++){
+        if(!devices_[i]) continue;
+        for(uint8_t f : devices_[i]->firing) n += f;
+    }
+    return n;
+}
@@ -0,0 +1,190 @@
+#ifndef GATEWAY_RULES_H
+#define GATEWAY_RULES_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "alerts.h"
+#include "reading.h"
+#include "sinks.h"
+
+// ALERT RULES
+//
+// Site-specific conditions on top of the firmware's own A flag, written in a
+// small rules file:
+//
+//   group north 0-15 32         # device ids and ranges
+//   rule overflow: P > 90 for 30s
+//   rule adc_rising: delta(W, 1m) >= 20
+//   rule farm_contaminated in north: count(S == CONTAMINATED) >= 3
+//
+// Expressions use the packet fields P, W, S, A, numbers, the Status_t
+// names, + - * /, comparisons, && || ! (or and/or/not) and
+//   avg(F, D)  min(F, D)  max(F, D)  delta(F, D)    over the last D of a device
+//   count(EXPR)                                      devices of the group where EXPR holds
+// Durations are a number with ms, s, m or h. "for D" makes a rule fire only
+// once its condition has held for D; without it the rule fires at once.
+// Firing rules feed the AlertTracker (alerts.h), keyed by rule and device
+// or group, which turns them into incidents.
+//
+// Every rule is compiled to postfix bytecode (constants folded) and run on
+// each reading of the devices in its group; there is no history to rescan:
+//   - Windows are rings of RULE_WINDOW_BUCKETS buckets (first/min/max/sum/
+//     count) per device, shared by all rules using the same field and
+//     length. The current bucket is only partly filled, so a window covers
+//     the last 7D/8 to D. Each is aggregated once per reading, however many
+//     rules read it.
+//   - count() keeps one truth bit per device and a running count per group.
+//     A device silent for the tracker's stale_ms drops out of the count
+//     until its next reading.
+//   - A rule using count() is a group rule: it fires once for the group, and
+//     may not read a device's fields outside count().
+// Devices with the same group memberships share a profile: the rules,
+// windows and count() terms that apply to them.
+#define RULE_WINDOW_BUCKETS     8
+#define RULE_STACK_MAX          32
+#define RULE_MAX_GROUPS         1024
+#define RULE_NAME_MAX           48
+#define RULE_GROUP_ALL          0       // Implicit group of every device
+
+typedef enum {
+    RULE_OP_CONST = 0,  // push k
+    RULE_OP_FIELD,      // push reading field `arg` (RuleField_t)
+    RULE_OP_WINDOW,     // push aggregate `arg & 3` (RuleAgg_t) of window `arg >> 2`
+    RULE_OP_COUNT,      // push running count of term `arg`
+    RULE_OP_NEG,
+    RULE_OP_NOT,
+    RULE_OP_ADD,
+    RULE_OP_SUB,
+    RULE_OP_MUL,
+    RULE_OP_DIV,        // x / 0 = 0
+    RULE_OP_LT,
+    RULE_OP_LE,
+    RULE_OP_GT,
+    RULE_OP_GE,
+    RULE_OP_EQ,
+    RULE_OP_NE,
+    RULE_OP_AND,
+    RULE_OP_OR
+} RuleOp_t;
+
+typedef enum { RULE_FIELD_P = 0, RULE_FIELD_W, RULE_FIELD_S, RULE_FIELD_A, RULE_FIELD_COUNT } RuleField_t;
+typedef enum { RULE_AGG_AVG = 0, RULE_AGG_MIN, RULE_AGG_MAX, RULE_AGG_DELTA } RuleAgg_t;
+
+typedef struct {
+    uint32_t op;
+    uint32_t arg;
+    double   k;
+} RuleInstr_t;
+
+typedef struct {
+    uint32_t index;             // Time / bucket length + 1; 0 = empty
+    uint16_t first;
+    uint16_t min;
+    uint16_t max;
+    uint16_t count;
+    uint32_t sum;
+} RuleBucket_t;
+
+class RuleEngine : public Sink {
+public:
+    // Firing rules are reported to `alerts` (NULL = counted only)
+    explicit RuleEngine(AlertTracker* alerts);
+    ~RuleEngine();
+
+    // Compile rules from a file or a string, before the first reading.
+    // Returns 0, or -EINVAL with "source:line: message" in *error (or
+    // -errno if the file can't be read).
+    int load(const char* path, std::string* error);
+    int compile(const char* text, const char* source, std::string* error);
+
+    void on_reading(const Reading_t& r) override;
+    void on_device_reset(uint16_t device_id) override;
+
+    size_t rule_count() const { return rules_.size(); }
+    size_t group_count() const { return groups_.size(); }
+    size_t window_count() const { return windows_.size(); }
+    uint64_t evaluations() const { return evaluations_; }   // Rule programs run
+    uint64_t transitions() const { return transitions_; }   // Fired + cleared
+    uint32_t firing() const;                                 // (rule, device or group) pairs now firing
+
+    // Device bitmap of a named group (empty for "all"), for other consumers
+    // of the site layout; false if there is no such group. Groups don't
+    // change after compile(), so any thread may call this.
+    bool group_members(const std::string& name, std::vector<uint8_t>* bitmap) const;
+
+private:
+    struct Group {
+        std::string name;
+        std::vector<uint8_t> members;       // Bitmap over device ids; empty for RULE_GROUP_ALL
+    };
+
+    struct Rule {
+        std::string name;
+        uint32_t group;
+        int64_t for_ms;
+        bool group_rule;                    // Uses count()
+        std::vector<RuleInstr_t> code;
+        int64_t group_since_ms;             // Group rules: condition true since, -1 = false
+        bool group_firing;
+    };
+
+    struct Term {                           // One count() argument
+        uint32_t group;
+        std::vector<RuleInstr_t> code;
+    };
+
+    struct Window {
+        uint8_t field;
+        int64_t bucket_ms;
+    };
+
+    struct Profile {
+        std::vector<uint32_t> rules;        // Device rules
+        std::vector<uint32_t> group_rules;
+        std::vector<uint32_t> terms;
+        std::vector<uint32_t> windows;
+        std::vector<int32_t> window_pos;    // Window id -> index in `windows`, -1 if unused
+    };
+
+    struct Device {
+        uint32_t profile;
+        std::vector<RuleBucket_t> buckets;  // [profile windows][RULE_WINDOW_BUCKETS]
+        std::vector<int64_t> since_ms;      // Per profile rule: condition true since, -1 = false
+        std::vector<uint8_t> firing;
+        std::vector<uint8_t> term;          // Per profile count() term: last value
+        int64_t seen_ms;                    // Last reading
+    };
+
+    struct Parser;
+    friend struct Parser;
+
+    uint32_t window_id(uint8_t field, int64_t window_ms);
+    uint32_t group_id(const std::string& name) const;
+    bool in_group(uint32_t group, uint16_t device_id) const;
+    Device* device(uint16_t device_id);
+    void link_program(const std::vector<RuleInstr_t>& code, Profile* p);
+    double run(const std::vector<RuleInstr_t>& code, const uint16_t* fields);
+    void expire_terms(int64_t now_ms);
+    void notify(uint32_t rule_id, uint32_t subject, bool firing, const Reading_t& r, int64_t now_ms);
+
+    AlertTracker* alerts_;
+    std::vector<Group> groups_;
+    std::vector<Rule> rules_;
+    std::vector<Term> terms_;
+    std::vector<Window> windows_;
+    std::vector<double> window_cache_;      // [window][RuleAgg_t] of the reading being evaluated
+    std::vector<uint32_t> term_counts_;     // [terms_] devices where the term holds
+    std::vector<Profile> profiles_;
+    std::map<std::vector<uint32_t>, uint32_t> profile_ids_;  // Group memberships -> profile
+    Device** devices_;                      // [MAX_DEVICES], created on first reading
+    int64_t epoch_ms_;                      // Rule times are ms since this
+    int64_t stale_ms_;                      // count() ignores devices silent this long
+    int64_t expired_ms_;                    // Last expire_terms() scan
+    uint64_t evaluations_;
+    uint64_t transitions_;
+};
+
+#endif
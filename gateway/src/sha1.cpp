@@ -0,0 +1,76 @@
+#include "sha1.h"
+
+#include <string.h>
+
+static inline uint32_t rol(uint32_t x, uint32_t n){
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t* p){
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++){
+        w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) | ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for(int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for(int i = 0; i < 80; i++){
+        uint32_t f, k;
+        if(i < 20){ f = (b & c) | (~b & d); k = 0x5A827999; }
+        else if(i < 40){ f = b ^ c ^ d; k = 0x6ED9EBA1; }
+        else if(i < 60){ f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void sha1(const void* data, size_t len, uint8_t digest[SHA1_DIGEST_LEN]){
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    const uint8_t* p = (const uint8_t*)data;
+    size_t left = len;
+    for(; left >= 64; p += 64, left -= 64) sha1_block(h, p);
+
+    // Last block(s): 0x80, zeros, bit length big-endian
+    uint8_t tail[128];
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = (left < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for(int i = 0; i < 8; i++) tail[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    sha1_block(h, tail);
+    if(tail_len == 128) sha1_block(h, tail + 64);
+
+    for(int i = 0; i < 5; i++){
+        digest[4 * i] = (uint8_t)(h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)h[i];
+    }
+}
+
+size_t base64_encode(const uint8_t* data, size_t len, char* out){
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for(size_t i = 0; i < len; i += 3){
+        uint32_t v = (uint32_t)data[i] << 16;
+        if(i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if(i + 2 < len) v |= data[i + 2];
+        out[n++] = alphabet[(v >> 18) & 63];
+        out[n++] = alphabet[(v >> 12) & 63];
+        out[n++] = (i + 1 < len) ? alphabet[(v >> 6) & 63] : '=';
+        out[n++] = (i + 2 < len) ? alphabet[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
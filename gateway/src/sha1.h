@@ -0,0 +1,16 @@
+#ifndef GATEWAY_SHA1_H
+#define GATEWAY_SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-1, for the WebSocket handshake only (RFC 6455 fixes the hash; it
+// authenticates nothing)
+#define SHA1_DIGEST_LEN     20
+
+void sha1(const void* data, size_t len, uint8_t digest[SHA1_DIGEST_LEN]);
+
+// Standard base64 with padding; `out` needs 4 * ((len + 2) / 3) + 1 bytes
+size_t base64_encode(const uint8_t* data, size_t len, char* out);
+
+#endif
@@ -0,0 +1,206 @@
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+static_assert(sizeof(ShmSlot_t) == 32, "slot layout is shared with readers");
+static_assert(sizeof(ShmHeader_t) <= SHM_HEADER_SIZE, "header must fit its page");
+
+// shm_open() wants a single leading slash
+static int segment_name(char* out, size_t len, const char* name){
+    if(!name || !name[0] || strchr(name + 1, '/')) return -EINVAL;
+    int n = snprintf(out, len, "%s%s", name[0] == '/' ? "" : "/", name);
+    return (n < 0 || (size_t)n >= len) ? -ENAMETOOLONG : 0;
+}
+
+//  WRITER
+ShmPublisher::ShmPublisher()
+    : header_(NULL), ring_(NULL), map_size_(0), mask_(0), next_(0), published_(0) {
+    name_[0] = '\0';
+}
+
+ShmPublisher::~ShmPublisher(){
+    close();
+}
+
+int ShmPublisher::open(const char* name, uint32_t slots){
+    close();        // A segment this publisher already had
+    int rc = segment_name(name_, sizeof(name_), name);
+    if(rc < 0) return rc;
+    uint32_t size = 2;
+    while(size < slots && size < SHM_SLOTS_MAX) size <<= 1;
+
+    // Readers of a previous run keep their mapping of the old segment and
+    // notice it's stale; this one starts empty
+    shm_unlink(name_);
+    int fd = shm_open(name_, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0) return -errno;
+    size_t map_size = SHM_HEADER_SIZE + (size_t)size * sizeof(ShmSlot_t);
+    void* map = MAP_FAILED;
+    if(ftruncate(fd, (off_t)map_size) == 0) map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = -errno;
+    ::close(fd);
+    if(map == MAP_FAILED){
+        shm_unlink(name_);
+        return rc;
+    }
+
+    // From here close() undoes it all
+    header_ = (ShmHeader_t*)map;
+    map_size_ = map_size;
+    ring_ = (ShmSlot_t*)((uint8_t*)map + SHM_HEADER_SIZE);
+    mask_ = size - 1;
+    next_ = 0;
+    published_.store(0, std::memory_order_relaxed);
+    header_->version = SHM_VERSION;
+    header_->slot_size = sizeof(ShmSlot_t);
+    header_->slots = size;
+    header_->writer_pid = (uint32_t)getpid();
+    header_->created_us = now_us();
+    header_->head.store(0, std::memory_order_relaxed);
+    header_->closed.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = SHM_MAGIC;
+    return 0;
+}
+
+void ShmPublisher::close(){
+    if(!header_) return;
+    header_->closed.store(1, std::memory_order_release);
+    munmap(header_, map_size_);
+    shm_unlink(name_);
+    header_ = NULL;
+    ring_ = NULL;
+}
+
+void ShmPublisher::on_reading(const Reading_t& r){
+    if(!ring_) return;
+    ShmSlot_t* s = &ring_[next_ & mask_];
+    s->seq.store(2 * next_ + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s->rx_time_us.store(r.rx_time_us, std::memory_order_relaxed);
+    s->device.store((uint64_t)r.device_time_ms | (uint64_t)r.device_id << 32 | (uint64_t)r.percent << 48,
+                    std::memory_order_relaxed);
+    s->values.store((uint64_t)r.water_adc | (uint64_t)r.status << 16 | (uint64_t)r.alert << 24, std::memory_order_relaxed);
+    s->seq.store(2 * next_ + 2, std::memory_order_release);
+    next_++;
+    header_->head.store(next_, std::memory_order_release);
+    published_.store(next_, std::memory_order_release);
+}
+
+//  READER
+ShmReader::ShmReader()
+    : header_(NULL), ring_(NULL), map_size_(0), mask_(0), next_(0), lost_(0) {}
+
+ShmReader::~ShmReader(){
+    close();
+}
+
+int ShmReader::open(const char* name, bool from_oldest){
+    close();
+    char path[64];
+    int rc = segment_name(path, sizeof(path), name);
+    if(rc < 0) return rc;
+    int fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if(fd < 0) return -errno;
+    struct stat st;
+    if(fstat(fd, &st) < 0){
+        rc = -errno;
+        ::close(fd);
+        return rc;
+    }
+    if((size_t)st.st_size < SHM_HEADER_SIZE){
+        ::close(fd);
+        return -EAGAIN;     // Still being created
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    rc = -errno;
+    ::close(fd);
+    if(map == MAP_FAILED) return rc;
+
+    const ShmHeader_t* h = (const ShmHeader_t*)map;
+    uint64_t magic = h->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(magic != SHM_MAGIC || h->version != SHM_VERSION || h->slot_size != sizeof(ShmSlot_t) ||
+       !h->slots || (h->slots & (h->slots - 1)) ||
+       (size_t)st.st_size < SHM_HEADER_SIZE + (size_t)h->slots * sizeof(ShmSlot_t)){
+        munmap(map, (size_t)st.st_size);
+        return magic == SHM_MAGIC || magic == 0 ? -EAGAIN : -EPROTO;
+    }
+
+    header_ = h;
+    ring_ = (const ShmSlot_t*)((const uint8_t*)map + SHM_HEADER_SIZE);
+    map_size_ = (size_t)st.st_size;
+    mask_ = h->slots - 1;
+    next_ = h->head.load(std::memory_order_acquire);
+    if(from_oldest) next_ = next_ > h->slots ? next_ - h->slots : 0;
+    lost_ = 0;
+    return 0;
+}
+
+void ShmReader::close(){
+    if(!header_) return;
+    munmap((void*)header_, map_size_);
+    header_ = NULL;
+    ring_ = NULL;
+}
+
+uint32_t ShmReader::read(Reading_t* out, uint32_t max){
+    if(!ring_) return 0;
+    uint32_t n = 0;
+    while(n < max){
+        const ShmSlot_t* s = &ring_[next_ & mask_];
+        uint64_t want = 2 * next_ + 2;
+        uint64_t seq = s->seq.load(std::memory_order_acquire);
+        if(seq < want) break;           // Not written yet (odd: being written)
+
+        if(seq == want){
+            uint64_t rx = s->rx_time_us.load(std::memory_order_relaxed);
+            uint64_t device = s->device.load(std::memory_order_relaxed);
+            uint64_t values = s->values.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(s->seq.load(std::memory_order_relaxed) == want){
+                Reading_t* r = &out[n++];
+                r->rx_time_us = rx;
+                r->device_time_ms = (uint32_t)device;
+                r->device_id = (uint16_t)(device >> 32);
+                r->percent = (uint16_t)(device >> 48);
+                r->water_adc = (uint16_t)values;
+                r->status = (uint8_t)(values >> 16);
+                r->alert = (uint8_t)(values >> 24);
+                next_++;
+                continue;
+            }
+        }
+
+        // Lapped: skip to an eighth of the ring behind the writer, so the
+        // reader has room to catch up before it is lapped again
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        uint64_t size = (uint64_t)mask_ + 1;
+        uint64_t resume = head > size ? head - size + size / 8 : 0;
+        if(resume <= next_) resume = next_ + 1;
+        lost_ += resume - next_;
+        next_ = resume;
+    }
+    return n;
+}
+
+bool ShmReader::stale() const {
+    if(!header_) return true;
+    if(header_->closed.load(std::memory_order_acquire)) return true;
+    return kill((pid_t)header_->writer_pid, 0) < 0 && errno == ESRCH;
+}
+
+uint64_t ShmReader::lag() const {
+    if(!header_) return 0;
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    return head > next_ ? head - next_ : 0;
+}
@@ -0,0 +1,115 @@
+#ifndef GATEWAY_SHM_RING_H
+#define GATEWAY_SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "reading.h"
+#include "sinks.h"
+
+// SHARED-MEMORY RING
+//
+// Readings for processes on the gateway box, in a POSIX shared memory
+// segment (/dev/shm/<name>) holding a header page and a power-of-two ring of
+// 32-byte slots. One writer, the dispatcher, stores each reading as it
+// arrives; any number of readers follow it without locks, system calls or
+// any write to the segment, so they can't slow the gateway or each other.
+//
+// Every slot has a sequence word. Publishing record n (from 0) sets it odd,
+// 2n+1, stores the fields, then sets it even, 2n+2, with release ordering.
+// A reader expecting record n loads the word: below 2n+2 means not yet
+// written, 2n+2 means copy the fields and check the word is unchanged, and
+// anything else means the writer has lapped the reader, which then skips
+// ahead and counts the records it lost. The fields are relaxed atomics,
+// so a torn copy is detected rather than undefined.
+//
+// The reader half (ShmReader) is the client library: link shm_ring.o and
+// include this header and reading.h.
+#define SHM_MAGIC               0x474E4952574B4E54ULL   // "TNKWRING"
+#define SHM_VERSION             1
+#define SHM_SLOTS_DEFAULT       65536                   // 2 MB, ~3 s of a full fleet
+#define SHM_SLOTS_MAX           (1u << 24)
+#define SHM_HEADER_SIZE         4096
+#define SHM_CACHE_LINE          64
+#define SHM_NAME_DEFAULT        "/tankgw"
+
+typedef struct {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> rx_time_us;
+    std::atomic<uint64_t> device;       // device_time_ms | device_id << 32 | percent << 48
+    std::atomic<uint64_t> values;       // water_adc | status << 16 | alert << 24
+} ShmSlot_t;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slots;                     // Power of two
+    uint32_t writer_pid;
+    uint64_t created_us;                // Wall clock; changes when the gateway restarts
+    alignas(SHM_CACHE_LINE) std::atomic<uint64_t> head;    // Records published
+    alignas(SHM_CACHE_LINE) std::atomic<uint32_t> closed;  // Writer has stopped
+} ShmHeader_t;
+
+// Writer: a sink that publishes every reading
+class ShmPublisher : public Sink {
+public:
+    ShmPublisher();
+    ~ShmPublisher();
+
+    // Create (replacing a stale one) and map segment `name`. Returns 0 or -errno.
+    int open(const char* name, uint32_t slots);
+
+    // Mark the ring closed and unlink it; mapped readers keep their copy
+    void close();
+
+    void on_reading(const Reading_t& r) override;
+
+    uint64_t published() const { return published_.load(std::memory_order_acquire); }  // Any thread
+    uint32_t slots() const { return mask_ + 1; }
+
+private:
+    ShmHeader_t* header_;
+    ShmSlot_t* ring_;
+    size_t map_size_;
+    uint32_t mask_;
+    uint64_t next_;                         // Dispatcher thread only
+    std::atomic<uint64_t> published_;       // next_, for the metrics thread
+    char name_[64];
+};
+
+// Reader: follows a ring from another process
+class ShmReader {
+public:
+    ShmReader();
+    ~ShmReader();
+
+    // Map segment `name` read-only, positioned at the newest record (or the
+    // oldest still in the ring, with `from_oldest`). Returns 0 or -errno;
+    // -ENOENT until the gateway has created it.
+    int open(const char* name, bool from_oldest);
+    void close();
+
+    // Copy up to `max` new readings, oldest first. Never blocks; returns
+    // 0 when the reader has caught up.
+    uint32_t read(Reading_t* out, uint32_t max);
+
+    // The gateway closed the ring or exited (it creates a new segment when
+    // it restarts): reopen. A system call, so check when idle.
+    bool stale() const;
+
+    uint64_t position() const { return next_; }
+    uint64_t lag() const;               // Published but not yet read
+    uint64_t lost() const { return lost_; }    // Overwritten before they were read
+
+private:
+    const ShmHeader_t* header_;
+    const ShmSlot_t* ring_;
+    size_t map_size_;
+    uint32_t mask_;
+    uint64_t next_;
+    uint64_t lost_;
+};
+
+#endif
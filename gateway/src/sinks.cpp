@@ -0,0 +1,61 @@
+#include "sinks.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "clock.h"
+
+const char* status_name(uint8_t status){
+    switch(status){
+        case STATUS_EMPTY:        return "EMPTY";
+        case STATUS_HALF_FULL:    return "HALF_FULL";
+        case STATUS_OVERFLOW:     return "OVERFLOW";
+        case STATUS_CONTAMINATED: return "CONTAMINATED";
+        default:                  return "UNKNOWN";
+    }
+}
+
+const char* reset_cause_name(uint8_t cause){
+    switch(cause){
+        case RESET_POWER_ON:  return "power_on";
+        case RESET_EXTERNAL:  return "external";
+        case RESET_BROWN_OUT: return "brown_out";
+        case RESET_WATCHDOG:  return "watchdog";
+        case RESET_JTAG:      return "jtag";
+        default:              return "unknown";
+    }
+}
+
+//  STORAGE
+CsvStore::CsvStore(FILE* out) : out_(out) {}
+
+void CsvStore::on_reading(const Reading_t& r){
+    // rx_time_us,device,T,P,W,S,A
+    fprintf(out_, "%" PRIu64 ",%u,%" PRIu32 ",%u,%u,%u,%u\n",
+            r.rx_time_us, (unsigned)r.device_id, r.device_time_ms,
+            (unsigned)r.percent, (unsigned)r.water_adc,
+            (unsigned)r.status, (unsigned)r.alert);
+}
+
+void CsvStore::flush(){
+    fflush(out_);
+}
+
+//  ALERTING
+AlertLog::AlertLog(AlertTracker* alerts, FILE* out) : alerts_(alerts), out_(out) {}
+
+void AlertLog::on_reading(const Reading_t& r){
+    if(r.device_id >= MAX_DEVICES) return;
+
+    AlertDetail_t detail = { "alert", NULL, r };
+    alerts_->observe(alert_key(ALERT_SOURCE_FLAG, r.device_id), r.alert, (int64_t)(r.rx_time_us / 1000), detail);
+}
+
+void AlertLog::on_height_ack(uint16_t device_id, uint16_t height_cm){
+    if(out_) fprintf(out_, "dev%u: height set to %ucm\n", (unsigned)device_id, (unsigned)height_cm);
+}
+
+void AlertLog::flush(){
+    alerts_->tick((int64_t)(now_us() / 1000));
+    if(out_) fflush(out_);
+}
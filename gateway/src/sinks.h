@@ -0,0 +1,47 @@
+#ifndef GATEWAY_SINKS_H
+#define GATEWAY_SINKS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "alerts.h"
+#include "reading.h"
+
+// Consumer of decoded events. Sinks run on the dispatcher thread only.
+class Sink {
+public:
+    virtual ~Sink() {}
+    virtual void on_reading(const Reading_t& r) = 0;
+    virtual void on_height_ack(uint16_t device_id, uint16_t height_cm) { (void)device_id; (void)height_cm; }
+    virtual void on_device_reset(uint16_t device_id) { (void)device_id; }   // Forget per-device state
+    virtual void flush() {}
+};
+
+// STORAGE: append readings as CSV lines
+class CsvStore : public Sink {
+public:
+    explicit CsvStore(FILE* out);
+    void on_reading(const Reading_t& r) override;
+    void flush() override;
+
+private:
+    FILE* out_;
+};
+
+// ALERTING: feed each device's alert flag to the incident tracker, run its
+// timers, and log height acknowledgements to `out` (NULL = don't)
+class AlertLog : public Sink {
+public:
+    AlertLog(AlertTracker* alerts, FILE* out);
+    void on_reading(const Reading_t& r) override;
+    void on_height_ack(uint16_t device_id, uint16_t height_cm) override;
+    void flush() override;
+
+private:
+    AlertTracker* alerts_;
+    FILE* out_;
+};
+
+const char* status_name(uint8_t status);
+const char* reset_cause_name(uint8_t cause);
+
+#endif
@@ -0,0 +1,342 @@
+#include "tank_model.h"
+
+#include <math.h>
+#include <string.h>
+
+#define GRAVITY             9.81
+#define DISCHARGE_COEFF     0.62    // Sharp-edged orifice
+#define MAX_SUBSTEP_S       0.1     // Flow integration step
+#define STEEP_SLOPE         0.05    // Wave slope (rad) at which dropout_wave applies in full
+
+static const TankConfig_t PRESETS[] = {
+    // cistern: 1000 L, pump on a float switch, a few draws an hour
+    {
+        { TANK_VERTICAL_CYLINDER, 1.0, 0, 0, 1.3, 0.10, 0.5, 0.05, 0.015, 0, 0.02 },
+        { 40, 0.2, 0.9, 3, 4, 8, 2 },
+        { 3, 0.002, 0.05, 0.003, 38000, 0.02, 4.0 },
+        { 250, 600, 0.5, 0.16, 1.0, 0.2, 0.5, 0.02 },
+        { 18, 6, 12 },
+        -1, 0
+    },
+    // ibc: 1000 L intermediate bulk container, 2" valve
+    {
+        { TANK_BOX, 0, 1.2, 1.0, 1.0, 0.16, 0.3, 0.03, 0.025, 0, 0.015 },
+        { 60, 0.1, 0.95, 2, 3, 10, 3 },
+        { 3, 0.002, 0.05, 0.006, 38000, 0.02, 4.0 },
+        { 250, 600, 0.5, 0.16, 1.0, 0.2, 0.5, 0.02 },
+        { 18, 6, 12 },
+        -1, 0
+    },
+    // drum: 200 L drum lying on its side
+    {
+        { TANK_HORIZONTAL_CYLINDER, 0.57, 0.85, 0, 0.57, 0.05, 0.2, 0.03, 0.012, 0, 0.02 },
+        { 20, 0.25, 0.85, 4, 2, 6, 2 },
+        { 3, 0.003, 0.08, 0.01, 38000, 0.02, 4.0 },
+        { 250, 600, 0.5, 0.16, 1.0, 0.2, 0.5, 0.02 },
+        { 18, 6, 8 },
+        -1, 0
+    },
+    // tower: 15 m3 storage tower, sensor near the HC-SR04's range limit
+    {
+        { TANK_VERTICAL_CYLINDER, 2.5, 0, 0, 3.0, 0.30, 0.6, 0.10, 0.025, 0, 0.01 },
+        { 150, 0.3, 0.9, 6, 10, 4, 3 },
+        { 4, 0.005, 0.05, 0.002, 38000, 0.02, 4.0 },
+        { 250, 600, 0.5, 0.16, 1.0, 0.2, 0.5, 0.02 },
+        { 18, 6, 24 },
+        -1, 0
+    },
+};
+
+static const char* PRESET_NAMES[] = { "cistern", "ibc", "drum", "tower" };
+
+const TankConfig_t TANK_DEFAULTS = PRESETS[0];
+
+const TankConfig_t* tank_preset(const char* name){
+    for(size_t i = 0; i < sizeof(PRESETS) / sizeof(PRESETS[0]); i++){
+        if(!strcmp(name, PRESET_NAMES[i])) return &PRESETS[i];
+    }
+    return NULL;
+}
+
+static double orifice_m3s(double diameter_m, double head_m){
+    if(diameter_m <= 0 || head_m <= 0) return 0;
+    return DISCHARGE_COEFF * M_PI * diameter_m * diameter_m / 4 * sqrt(2 * GRAVITY * head_m);
+}
+
+// Cross-section of a circle of radius r filled to h
+static double segment_area(double r, double h){
+    if(h <= 0) return 0;
+    if(h >= 2 * r) return M_PI * r * r;
+    return r * r * acos((r - h) / r) - (r - h) * sqrt(2 * r * h - h * h);
+}
+
+TankModel::TankModel(){
+    init(TANK_DEFAULTS, 1);
+}
+
+void TankModel::init(const TankConfig_t& cfg, uint64_t seed){
+    cfg_ = cfg;
+    rng_ = 0x9E3779B97F4A7C15ULL * (seed + 1);
+
+    const TankGeometry_t& g = cfg_.geometry;
+    if(g.shape == TANK_HORIZONTAL_CYLINDER) cfg_.geometry.height_m = g.diameter_m;
+    depth_m_ = cfg_.geometry.height_m;
+    capacity_m3_ = volume_for(depth_m_);
+
+    double fill = cfg_.initial_fill >= 0 ? cfg_.initial_fill : 0.2 + 0.7 * uniform();
+    t_s_ = 0;
+    volume_m3_ = fill * capacity_m3_;
+    level_m_ = depth_m_ / 2;
+    level_m_ = level_for(volume_m3_);
+    pump_on_ = false;
+    draw_left_s_ = 0;
+    inflow_m3s_ = outflow_m3s_ = 0;
+    slosh_re_ = slosh_im_ = slope_ = 0;
+
+    const AmbientConfig_t& a = cfg_.ambient;
+    water_c_ = a.mean_c;
+    conductivity_us_cm_ = cfg_.probe.clean_us_cm;
+    drift_lsb_ = 0;
+}
+
+uint16_t TankModel::sensor_height_cm() const {
+    return (uint16_t)lround((depth_m_ + cfg_.geometry.sensor_gap_m) * 100);
+}
+
+//  GEOMETRY
+double TankModel::volume_for(double level_m) const {
+    const TankGeometry_t& g = cfg_.geometry;
+    if(level_m <= 0) return 0;
+    switch(g.shape){
+        case TANK_VERTICAL_CYLINDER:
+            return M_PI * g.diameter_m * g.diameter_m / 4 * fmin(level_m, g.height_m);
+        case TANK_HORIZONTAL_CYLINDER:
+            return segment_area(g.diameter_m / 2, level_m) * g.length_m;
+        default:
+            return g.length_m * g.width_m * fmin(level_m, g.height_m);
+    }
+}
+
+double TankModel::level_for(double volume_m3) const {
+    const TankGeometry_t& g = cfg_.geometry;
+    if(volume_m3 <= 0) return 0;
+    switch(g.shape){
+        case TANK_VERTICAL_CYLINDER:
+            return volume_m3 / (M_PI * g.diameter_m * g.diameter_m / 4);
+        case TANK_HORIZONTAL_CYLINDER: {
+            // No closed form. Newton from the current level (dV/dh is the
+            // surface area) usually lands in two steps; bisection otherwise.
+            double h = fmin(fmax(level_m_, 0.01 * g.diameter_m), 0.99 * g.diameter_m);
+            for(int i = 0; i < 6; i++){
+                double err = volume_for(h) - volume_m3;
+                if(fabs(err) < 1e-9) return h;
+                h -= err / (surface_width(h) * g.length_m);
+                if(h <= 0 || h >= g.diameter_m) break;
+            }
+            double lo = 0, hi = g.diameter_m;
+            for(int i = 0; i < 40; i++){
+                double mid = (lo + hi) / 2;
+                if(volume_for(mid) < volume_m3) lo = mid;
+                else hi = mid;
+            }
+            return (lo + hi) / 2;
+        }
+        default:
+            return volume_m3 / (g.length_m * g.width_m);
+    }
+}
+
+// Free-surface width along the slosh direction
+double TankModel::surface_width(double level_m) const {
+    const TankGeometry_t& g = cfg_.geometry;
+    switch(g.shape){
+        case TANK_VERTICAL_CYLINDER:
+            return g.diameter_m;
+        case TANK_HORIZONTAL_CYLINDER: {
+            double r = g.diameter_m / 2;
+            double h = fmin(fmax(level_m, 0), g.diameter_m);
+            return 2 * sqrt(fmax(2 * r * h - h * h, 0));
+        }
+        default:
+            return g.length_m;
+    }
+}
+
+//  FLOWS
+void TankModel::update_flows(double dt_s){
+    const TankFlows_t& f = cfg_.flows;
+    const TankGeometry_t& g = cfg_.geometry;
+    double level = level_m_;
+    double fill = volume_m3_ / capacity_m3_;
+
+    // A start or stop slaps the surface as hard as the running pump stirs it
+    double kick = f.wave_mm_per_lps * f.pump_lpm / 60 / 1000;
+    if(f.pump_lpm > 0 && !pump_on_ && fill < f.pump_on_fraction){
+        pump_on_ = true;
+        slosh_re_ += kick;
+    }
+    else if(pump_on_ && fill >= f.pump_off_fraction){
+        pump_on_ = false;
+        slosh_re_ -= kick;
+    }
+
+    if(draw_left_s_ > 0) draw_left_s_ = fmax(draw_left_s_ - dt_s, 0);
+    else if(f.draws_per_hour > 0 && uniform() < f.draws_per_hour / 3600 * dt_s){
+        draw_left_s_ = exponential(f.draw_minutes * 60);
+        slosh_im_ += kick / 2;
+    }
+
+    inflow_m3s_ = pump_on_ ? f.pump_lpm / 60000 : 0;
+    outflow_m3s_ = orifice_m3s(g.leak_diameter_m, level);
+    if(draw_left_s_ > 0) outflow_m3s_ += orifice_m3s(g.outlet_diameter_m, level);
+
+    double before = volume_m3_;
+    volume_m3_ += (inflow_m3s_ - outflow_m3s_) * dt_s;
+    if(volume_m3_ < 0){
+        outflow_m3s_ = inflow_m3s_ + before / dt_s;
+        volume_m3_ = 0;
+    }
+    if(volume_m3_ > capacity_m3_){
+        outflow_m3s_ += (volume_m3_ - capacity_m3_) / dt_s;   // Over the brim
+        volume_m3_ = capacity_m3_;
+    }
+    level_m_ = level_for(volume_m3_);
+
+    // Fresh supply water dilutes whatever got in; draws don't change it
+    const ProbeConfig_t& p = cfg_.probe;
+    if(volume_m3_ > 1e-4){
+        double mix = fmin(inflow_m3s_ * dt_s / volume_m3_, 1.0);
+        conductivity_us_cm_ += mix * (p.clean_us_cm - conductivity_us_cm_);
+    }
+    if(p.contaminations_per_day > 0 && uniform() < p.contaminations_per_day / 86400 * dt_s){
+        conductivity_us_cm_ += p.contamination_us_cm;
+    }
+    drift_lsb_ += p.drift_lsb_per_day * dt_s / 86400 + p.wander_lsb_per_day * sqrt(dt_s / 86400) * gaussian();
+}
+
+// First sloshing mode as a damped oscillator kept in complex form, so the
+// update is exact for any step. Pump inflow drives it with noise scaled so
+// its RMS settles at wave_mm_per_lps per litre/second.
+void TankModel::update_slosh(double dt_s, double inflow_m3s){
+    const TankGeometry_t& g = cfg_.geometry;
+    double level = level_m_;
+    double width = surface_width(level);
+    if(level < 0.005 || width < 0.02){
+        slosh_re_ = slosh_im_ = slope_ = 0;
+        return;
+    }
+
+    double k = (g.shape == TANK_VERTICAL_CYLINDER) ? 1.8412 / (g.diameter_m / 2) : M_PI / width;
+    double omega = sqrt(GRAVITY * k * tanh(k * level));
+    double zeta = g.slosh_damping;
+    double decay = exp(-zeta * omega * dt_s);
+    double wd = omega * sqrt(fmax(1 - zeta * zeta, 0)) * dt_s;
+    double c = cos(wd), s = sin(wd);
+    double re = decay * (slosh_re_ * c - slosh_im_ * s);
+    double im = decay * (slosh_re_ * s + slosh_im_ * c);
+
+    double target = cfg_.flows.wave_mm_per_lps * (inflow_m3s * 1000) / 1000;  // mm per L/s, in m
+    double inject = target * sqrt(fmax(1 - decay * decay, 0));
+    slosh_re_ = re + inject * gaussian();
+    slosh_im_ = im + inject * gaussian();
+    slope_ = k * hypot(slosh_re_, slosh_im_);
+}
+
+//  SENSORS
+// HC-SR04 echo pulse as Timer5 sees it: 0.5 us ticks in a 16-bit counter,
+// so a timed-out pulse (38 ms) wraps once, as it does in the ISR
+uint16_t TankModel::echo(double distance_m, double air_c, uint8_t* kind){
+    const EchoConfig_t& e = cfg_.echo;
+    double sound_ms = 331.3 * sqrt(1 + air_c / 273.15);
+    double pulse_us;
+
+    double p_drop = e.dropout + e.dropout_wave * fmin(slope_ / STEEP_SLOPE, 1.0);
+    if(distance_m < e.min_range_m){
+        *kind = ECHO_NEAR;
+        pulse_us = 80 + 100 * uniform();
+    }
+    else if(distance_m > e.max_range_m || uniform() < p_drop){
+        *kind = ECHO_DROPOUT;
+        pulse_us = e.timeout_us;
+    }
+    else if(uniform() < e.multipath){
+        // Image source behind the nearest wall
+        const TankGeometry_t& g = cfg_.geometry;
+        double wall = surface_width(level_m_) / 2 * (1 - g.sensor_offset);
+        *kind = ECHO_MULTIPATH;
+        pulse_us = (distance_m + sqrt(distance_m * distance_m + 4 * wall * wall)) / sound_ms * 1e6;
+    }
+    else {
+        *kind = ECHO_OK;
+        pulse_us = 2 * distance_m / sound_ms * 1e6;
+    }
+    pulse_us += e.jitter_us * gaussian();
+    if(pulse_us < 0) pulse_us = 0;
+    return (uint16_t)((uint64_t)llround(pulse_us * 2) & 0xFFFF);
+}
+
+uint16_t TankModel::probe(double level_m, double water_c){
+    const ProbeConfig_t& p = cfg_.probe;
+    double code;
+    if(level_m < cfg_.geometry.probe_height_m){
+        code = fabs(p.noise_lsb * gaussian());    // Dry: open circuit, input pulled low
+    } else {
+        double us_cm = conductivity_us_cm_ * (1 + p.temp_coeff * (water_c - 25));
+        code = p.adc_per_us_cm * us_cm + drift_lsb_ + p.noise_lsb * gaussian();
+    }
+    long adc = lround(code);
+    return (uint16_t)(adc < 0 ? 0 : adc > 1023 ? 1023 : adc);
+}
+
+void TankModel::step(double dt_s, TankSample_t* out){
+    const AmbientConfig_t& a = cfg_.ambient;
+    int n = (int)ceil(dt_s / MAX_SUBSTEP_S);
+    if(n < 1) n = 1;
+    double h = dt_s / n;
+    double air_c = a.mean_c;
+
+    for(int i = 0; i < n; i++){
+        t_s_ += h;
+        double hour = cfg_.start_hour + t_s_ / 3600;
+        air_c = a.mean_c + a.swing_c * cos(2 * M_PI * (hour - 15) / 24);
+        if(a.water_lag_hours > 0) water_c_ += (air_c - water_c_) * fmin(h / (a.water_lag_hours * 3600), 1.0);
+        update_flows(h);
+        update_slosh(h, inflow_m3s_);
+    }
+
+    const TankGeometry_t& g = cfg_.geometry;
+    double level = level_m_;
+    double surface = level + sin(M_PI / 2 * g.sensor_offset) * slosh_re_;
+    if(pump_on_) surface += cfg_.flows.ripple_mm / 1000 * gaussian();
+    surface = fmin(fmax(surface, 0), depth_m_);
+
+    out->t_s = t_s_;
+    out->level_m = level;
+    out->surface_m = surface;
+    out->volume_l = volume_m3_ * 1000;
+    out->inflow_lpm = inflow_m3s_ * 60000;
+    out->outflow_lpm = outflow_m3s_ * 60000;
+    out->air_c = air_c;
+    out->water_c = water_c_;
+    out->conductivity_us_cm = conductivity_us_cm_ * (1 + cfg_.probe.temp_coeff * (water_c_ - 25));
+    out->echo_ticks = echo(depth_m_ + g.sensor_gap_m - surface, air_c, &out->echo_kind);
+    out->water_adc = probe(level, water_c_);
+}
+
+//  RANDOMNESS (xorshift64*, seeded per model)
+double TankModel::uniform(){
+    rng_ ^= rng_ >> 12;
+    rng_ ^= rng_ << 25;
+    rng_ ^= rng_ >> 27;
+    return ((rng_ * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double TankModel::gaussian(){
+    double u = uniform();
+    double v = uniform();
+    return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+double TankModel::exponential(double mean){
+    return -log(1 - uniform()) * mean;
+}
@@ -0,0 +1,163 @@
+#ifndef GATEWAY_TANK_MODEL_H
+#define GATEWAY_TANK_MODEL_H
+
+// Physical model of one installation, for exercising filters, slosh/leak
+// detection and prediction code with realistic inputs: tank geometry,
+// pump and draw-off flows, sloshing, the HC-SR04's echo behaviour and the
+// conductivity probe. Each step yields what the controller would capture
+// (Timer5 echo ticks and the ADC code) next to the ground truth. Traces
+// depend only on the configuration and the seed.
+
+#include <stdint.h>
+
+typedef enum {
+    TANK_VERTICAL_CYLINDER = 0,
+    TANK_HORIZONTAL_CYLINDER,   // Lying drum; `length_m` along the axis
+    TANK_BOX
+} TankShape_t;
+
+typedef struct {
+    TankShape_t shape;
+    double diameter_m;          // Cylinders
+    double length_m;            // Horizontal cylinder axis, box length (the slosh direction)
+    double width_m;             // Box
+    double height_m;            // Vertical cylinder / box; a horizontal cylinder is its diameter
+    double sensor_gap_m;        // Sensor face above the brim
+    double sensor_offset;       // Sensor distance from the centre as a fraction of the half-width
+    double probe_height_m;      // Conductivity probe tip above the floor
+    double outlet_diameter_m;   // Draw-off valve orifice at the floor
+    double leak_diameter_m;     // Permanent leak at the floor, 0 = none
+    double slosh_damping;       // Damping ratio of the first sloshing mode
+} TankGeometry_t;
+
+typedef struct {
+    double pump_lpm;            // Inflow while the pump runs, 0 = no pump
+    double pump_on_fraction;    // Float switch: pump starts below this fill...
+    double pump_off_fraction;   // ...and stops above this one
+    double draws_per_hour;      // Draw-off events (outlet valve opened), Poisson
+    double draw_minutes;        // Mean valve-open time
+    double wave_mm_per_lps;     // RMS slosh per litre/second of pump inflow
+    double ripple_mm;           // Surface roughness under the inflow jet (1 sigma)
+} TankFlows_t;
+
+typedef struct {
+    double jitter_us;           // Echo timing noise (1 sigma)
+    double dropout;             // Chance of no echo on a calm surface
+    double dropout_wave;        // Extra chance at full wave steepness
+    double multipath;           // Chance the echo comes back via a wall
+    double timeout_us;          // Echo pin high time when nothing returns
+    double min_range_m;         // Closer than this the module reads garbage
+    double max_range_m;
+} EchoConfig_t;
+
+typedef struct {
+    double clean_us_cm;         // Conductivity of the supply water at 25 C
+    double contamination_us_cm; // Step added by a contamination event
+    double contaminations_per_day;
+    double adc_per_us_cm;       // Probe + divider gain into the 10-bit ADC
+    double noise_lsb;           // ADC noise (1 sigma)
+    double drift_lsb_per_day;   // Electrode fouling
+    double wander_lsb_per_day;  // Random-walk drift (1 sigma per sqrt(day))
+    double temp_coeff;          // Relative conductivity change per C from 25 C
+} ProbeConfig_t;
+
+typedef struct {
+    double mean_c;              // Air temperature in the sensor gap
+    double swing_c;             // Diurnal amplitude (warmest at 15:00)
+    double water_lag_hours;     // Water temperature time constant
+} AmbientConfig_t;
+
+typedef struct {
+    TankGeometry_t geometry;
+    TankFlows_t    flows;
+    EchoConfig_t   echo;
+    ProbeConfig_t  probe;
+    AmbientConfig_t ambient;
+    double initial_fill;        // Fraction of capacity, < 0 = random
+    double start_hour;          // Time of day at t = 0
+} TankConfig_t;
+
+// 1000 L vertical cistern with a pump on a float switch
+extern const TankConfig_t TANK_DEFAULTS;
+
+// Configuration by name: "cistern", "ibc", "drum", "tower". NULL if unknown.
+const TankConfig_t* tank_preset(const char* name);
+
+typedef enum {
+    ECHO_OK = 0,
+    ECHO_DROPOUT,       // Nothing came back; the pin stayed high for timeout_us
+    ECHO_MULTIPATH,     // Came back the long way round, via a wall
+    ECHO_NEAR           // Surface inside the dead zone
+} EchoKind_t;
+
+typedef struct {
+    double   t_s;                   // Model time
+    // Ground truth
+    double   level_m;               // Mean surface height above the floor
+    double   surface_m;             // Surface under the sensor, waves included
+    double   volume_l;
+    double   inflow_lpm;
+    double   outflow_lpm;           // Draw-off, leak and overflow
+    double   air_c;
+    double   water_c;
+    double   conductivity_us_cm;    // At water temperature
+    // What the controller captures
+    uint16_t echo_ticks;            // Echo pulse in 0.5 us Timer5 ticks, 16-bit like the ISR
+    uint16_t water_adc;
+    uint8_t  echo_kind;             // EchoKind_t
+} TankSample_t;
+
+class TankModel {
+public:
+    TankModel();
+
+    void init(const TankConfig_t& cfg, uint64_t seed);
+
+    // Advance by dt_s and take one sensor reading (a trigger and an ADC
+    // conversion, like one pass of the firmware's sensor cycle)
+    void step(double dt_s, TankSample_t* out);
+
+    double capacity_l() const { return capacity_m3_ * 1000.0; }
+    double depth_m() const { return depth_m_; }
+
+    // Sensor face to floor: the container height the firmware should be set to
+    uint16_t sensor_height_cm() const;
+
+    const TankConfig_t& config() const { return cfg_; }
+
+private:
+    double level_for(double volume_m3) const;
+    double volume_for(double level_m) const;
+    double surface_width(double level_m) const;
+    void update_flows(double dt_s);
+    void update_slosh(double dt_s, double inflow_m3s);
+    uint16_t echo(double distance_m, double air_c, uint8_t* kind);
+    uint16_t probe(double level_m, double water_c);
+
+    double uniform();
+    double gaussian();
+    double exponential(double mean);
+
+    TankConfig_t cfg_;
+    uint64_t rng_;
+    double capacity_m3_;
+    double depth_m_;
+
+    double t_s_;
+    double volume_m3_;
+    double level_m_;            // level_for(volume_m3_), kept in step
+    bool   pump_on_;
+    double draw_left_s_;        // Remaining valve-open time, 0 = closed
+    double inflow_m3s_;
+    double outflow_m3s_;
+
+    double slosh_re_;           // Complex amplitude of the first mode (m)
+    double slosh_im_;
+    double slope_;              // Current surface slope, for echo scatter
+
+    double water_c_;
+    double conductivity_us_cm_; // At 25 C
+    double drift_lsb_;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "wal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "clock.h"
+#include "crc32.h"
+
+WriteAheadLog::WriteAheadLog()
+    : cfg_(WAL_DEFAULTS), fd_(-1), segment_(0), bytes_(0), synced_(0), last_sync_ms_(0),
+      commits_(0), syncs_(0), torn_(0) {
+    dir_[0] = '\0';
+    buf_.reserve(sizeof(WalRecordHeader_t) + 256 * sizeof(WalEntry_t));
+    buf_.resize(sizeof(WalRecordHeader_t));
+}
+
+WriteAheadLog::~WriteAheadLog(){
+    close();
+}
+
+void WriteAheadLog::segment_path(char* out, size_t len, uint32_t segment) const {
+    snprintf(out, len, "%s/%08u.wal", dir_, segment);
+}
+
+// New and deleted segment files only survive power loss once their
+// directory entry is synced too
+int WriteAheadLog::sync_dir(){
+    int dfd = ::open(dir_, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dfd < 0) return -errno;
+    int rc = fsync(dfd) < 0 ? -errno : 0;
+    ::close(dfd);
+    return rc;
+}
+
+int WriteAheadLog::open(const char* dir, const WalConfig_t& cfg){
+    if(strlen(dir) >= sizeof(dir_)) return -ENAMETOOLONG;
+    snprintf(dir_, sizeof(dir_), "%s", dir);
+    cfg_ = cfg;
+    bytes_ = synced_ = 0;
+    commits_ = syncs_ = torn_ = 0;
+    if(mkdir(dir_, 0755) < 0 && errno != EEXIST) return -errno;
+
+    DIR* d = opendir(dir_);
+    if(!d) return -errno;
+    segments_.clear();
+    while(struct dirent* e = readdir(d)){
+        uint32_t n;
+        char tail[8];
+        if(sscanf(e->d_name, "%8u%7s", &n, tail) == 2 && !strcmp(tail, ".wal")) segments_.push_back(n);
+    }
+    closedir(d);
+    std::sort(segments_.begin(), segments_.end());
+    segment_ = segments_.empty() ? 0 : segments_.back();
+    return 0;
+}
+
+int64_t WriteAheadLog::replay(WalReplayFn fn, void* ctx){
+    std::vector<uint8_t> body;
+    int64_t entries = 0;
+
+    for(uint32_t seg : segments_){
+        char path[300];
+        segment_path(path, sizeof(path), seg);
+        int fd = ::open(path, O_RDWR | O_CLOEXEC);
+        if(fd < 0) return -errno;
+
+        off_t pos = 0;
+        while(true){
+            WalRecordHeader_t hdr;
+            if(pread(fd, &hdr, sizeof(hdr), pos) != (ssize_t)sizeof(hdr)) break;
+            if(hdr.magic != WAL_RECORD_MAGIC || hdr.segment != seg || hdr.count == 0 || hdr.count > WAL_RECORD_MAX) break;
+
+            size_t len = (size_t)hdr.count * sizeof(WalEntry_t);
+            body.resize(len);
+            if(pread(fd, body.data(), len, pos + (off_t)sizeof(hdr)) != (ssize_t)len) break;
+
+            uint32_t crc = hdr.crc;
+            hdr.crc = 0;
+            if(crc32_update(crc32(&hdr, sizeof(hdr)), body.data(), len) != crc) break;
+
+            const WalEntry_t* e = (const WalEntry_t*)body.data();
+            for(uint32_t i = 0; i < hdr.count; i++) fn(ctx, seg, e[i]);
+            entries += hdr.count;
+            pos += (off_t)(sizeof(hdr) + len);
+        }
+
+        // Anything past the last good record never finished; drop it so a
+        // later replay doesn't trip over it again
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > pos){
+            torn_++;
+            if(ftruncate(fd, pos) < 0 || fdatasync(fd) < 0){
+                int err = errno;
+                ::close(fd);
+                return -err;
+            }
+        }
+        ::close(fd);
+    }
+    return entries;
+}
+
+bool WriteAheadLog::first_entry(uint32_t segment, WalEntry_t* out){
+    char path[300];
+    segment_path(path, sizeof(path), segment);
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+
+    bool ok = false;
+    WalRecordHeader_t hdr;
+    if(pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && hdr.magic == WAL_RECORD_MAGIC &&
+       hdr.segment == segment && hdr.count > 0 && hdr.count <= WAL_RECORD_MAX){
+        size_t len = (size_t)hdr.count * sizeof(WalEntry_t);
+        std::vector<uint8_t> body(len);
+        if(pread(fd, body.data(), len, sizeof(hdr)) == (ssize_t)len){
+            uint32_t crc = hdr.crc;
+            hdr.crc = 0;
+            ok = crc32_update(crc32(&hdr, sizeof(hdr)), body.data(), len) == crc;
+            if(ok) memcpy(out, body.data(), sizeof(*out));
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+int WriteAheadLog::start(){
+    segment_++;
+    char path[300];
+    segment_path(path, sizeof(path), segment_);
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0) return -errno;
+    segments_.push_back(segment_);
+    bytes_ = synced_ = 0;
+    last_sync_ms_ = mono_ms();
+    return sync_dir();
+}
+
+void WriteAheadLog::append(const WalEntry_t& e){
+    const uint8_t* p = (const uint8_t*)&e;
+    buf_.insert(buf_.end(), p, p + sizeof(e));
+    if(buf_.size() >= sizeof(WalRecordHeader_t) + WAL_RECORD_MAX * sizeof(WalEntry_t)) commit();
+}
+
+int WriteAheadLog::commit(){
+    if(fd_ < 0) return -EBADF;
+
+    size_t len = buf_.size();
+    if(len > sizeof(WalRecordHeader_t)){
+        WalRecordHeader_t hdr;
+        hdr.magic = WAL_RECORD_MAGIC;
+        hdr.crc = 0;
+        hdr.count = (uint32_t)((len - sizeof(hdr)) / sizeof(WalEntry_t));
+        hdr.segment = segment_;
+        memcpy(buf_.data(), &hdr, sizeof(hdr));
+        hdr.crc = crc32(buf_.data(), len);
+        memcpy(buf_.data(), &hdr, sizeof(hdr));
+
+        size_t done = 0;
+        while(done < len){
+            ssize_t n = write(fd_, buf_.data() + done, len - done);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                int err = errno;
+                // Cut the partial record so the next one starts on a boundary
+                if(ftruncate(fd_, (off_t)bytes_) < 0) err = errno;
+                buf_.resize(sizeof(WalRecordHeader_t));
+                return -err;
+            }
+            done += (size_t)n;
+        }
+        bytes_ += len;
+        commits_++;
+        buf_.resize(sizeof(WalRecordHeader_t));
+    }
+
+    // Idle commits still sync, so the tail of a burst isn't left waiting
+    // for the next reading
+    if(synced_ == bytes_ || cfg_.sync_ms == WAL_SYNC_NEVER) return 0;
+    if(cfg_.sync_ms > 0 && mono_ms() - last_sync_ms_ < (uint64_t)cfg_.sync_ms) return 0;
+    return sync();
+}
+
+int WriteAheadLog::sync(){
+    if(fd_ < 0 || synced_ == bytes_) return 0;
+    if(fdatasync(fd_) < 0) return -errno;
+    synced_ = bytes_;
+    last_sync_ms_ = mono_ms();
+    syncs_++;
+    return 0;
+}
+
+int WriteAheadLog::rotate(){
+    int rc = commit();
+    if(rc == 0) rc = sync();
+    if(rc < 0) return rc;
+    ::close(fd_);
+    fd_ = -1;
+    return start();
+}
+
+void WriteAheadLog::remove_before(uint32_t segment){
+    size_t removed = 0;
+    while(removed < segments_.size() && segments_[removed] < segment){
+        char path[300];
+        segment_path(path, sizeof(path), segments_[removed]);
+        if(unlink(path) < 0 && errno != ENOENT) break;
+        removed++;
+    }
+    if(removed == 0) return;
+    segments_.erase(segments_.begin(), segments_.begin() + removed);
+    sync_dir();
+}
+
+void WriteAheadLog::close(){
+    if(fd_ < 0) return;
+    commit();
+    sync();
+    ::close(fd_);
+    fd_ = -1;
+}
@@ -0,0 +1,128 @@
+#ifndef GATEWAY_WAL_H
+#define GATEWAY_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "reading.h"
+
+// WRITE-AHEAD LOG
+//
+// Readings are logged before they reach the column store's in-memory open
+// blocks, so a crash or power loss only costs what was never synced. The
+// log is a directory of numbered segment files; each holds records of
+//
+//   header   magic, CRC-32 of header + entries, entry count, segment number
+//   entries  WalEntry_t[count]
+//
+// A record is one group commit: every reading since the previous commit,
+// written with a single write() and synced according to WalConfig_t.
+#define WAL_RECORD_MAGIC    0x314C4157u     // "WAL1"
+#define WAL_RECORD_MAX      8192            // Entries per record before an early commit
+#define WAL_SEGMENT_BYTES   (32u << 20)
+#define WAL_KEEP_SEGMENTS   8
+#define WAL_SYNC_NEVER      (-1)
+
+typedef struct {
+    int32_t  sync_ms;           // 0 = fdatasync every commit, N = at most every N ms, WAL_SYNC_NEVER
+    uint32_t segment_bytes;     // Start a new segment (and checkpoint) past this size
+    uint32_t keep_segments;     // Open blocks first logged this many segments ago are sealed at checkpoint
+} WalConfig_t;
+
+static const WalConfig_t WAL_DEFAULTS = { 0, WAL_SEGMENT_BYTES, WAL_KEEP_SEGMENTS };
+
+// One reading as logged. Little-endian on disk.
+typedef struct {
+    uint64_t rx_time_us;
+    uint32_t device_time_ms;
+    uint32_t seq;               // Per-device reading number, i.e. its position in the store
+    uint16_t device_id;
+    uint16_t percent;
+    uint16_t water_adc;
+    uint8_t  status;
+    uint8_t  alert;
+} WalEntry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;               // CRC-32 of header (this field zeroed) and entries
+    uint32_t count;
+    uint32_t segment;           // Guards against a record copied into the wrong file
+} WalRecordHeader_t;
+
+static_assert(sizeof(WalEntry_t) == 24, "WAL entries are 24 bytes");
+static_assert(sizeof(WalRecordHeader_t) == 16, "WAL record header is 16 bytes");
+
+typedef void (*WalReplayFn)(void* ctx, uint32_t segment, const WalEntry_t& e);
+
+class WriteAheadLog {
+public:
+    WriteAheadLog();
+    ~WriteAheadLog();
+
+    // Create `dir` if needed and find existing segments. Nothing is written
+    // until start(). Returns 0 or -errno.
+    int open(const char* dir, const WalConfig_t& cfg);
+
+    // Feed every intact entry of the existing segments, oldest first. A
+    // segment ends at its first torn or damaged record, which is cut off.
+    // Returns the number of entries or -errno.
+    int64_t replay(WalReplayFn fn, void* ctx);
+
+    // First entry of `segment`'s first record, if that record is intact
+    bool first_entry(uint32_t segment, WalEntry_t* out);
+
+    // Open a fresh segment after the existing ones. Returns 0 or -errno.
+    int start();
+
+    // Buffer one entry for the next commit
+    void append(const WalEntry_t& e);
+
+    // Write buffered entries as one record, then sync if the policy says
+    // so. Returns 0 or -errno.
+    int commit();
+
+    // Make everything committed so far durable
+    int sync();
+
+    bool rotate_due() const { return fd_ >= 0 && bytes_ >= cfg_.segment_bytes; }
+
+    // Sync and close the current segment and open the next. Returns 0 or -errno.
+    int rotate();
+
+    // Delete segments numbered below `segment`
+    void remove_before(uint32_t segment);
+
+    // Commit, sync and close
+    void close();
+
+    const WalConfig_t& config() const { return cfg_; }
+    uint32_t segment() const { return segment_; }
+    uint32_t segment_count() const { return (uint32_t)segments_.size(); }
+    const std::vector<uint32_t>& segments() const { return segments_; }
+    uint64_t bytes() const { return bytes_; }           // Current segment, written
+    uint64_t synced_bytes() const { return synced_; }   // Current segment, durable
+    uint64_t commits() const { return commits_; }
+    uint64_t syncs() const { return syncs_; }
+    uint64_t torn_records() const { return torn_; }
+
+private:
+    void segment_path(char* out, size_t len, uint32_t segment) const;
+    int sync_dir();
+
+    char dir_[256];
+    WalConfig_t cfg_;
+    int fd_;
+    uint32_t segment_;
+    std::vector<uint32_t> segments_;    // On disk, ascending, including the current one
+    std::vector<uint8_t> buf_;          // Record header + buffered entries
+    uint64_t bytes_;
+    uint64_t synced_;
+    uint64_t last_sync_ms_;
+    uint64_t commits_;
+    uint64_t syncs_;
+    uint64_t torn_;
+};
+
+#endif
@@ -0,0 +1,551 @@
+#include "websocket.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+#include "sha1.h"
+
+#define WS_GUID         "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define EPOLL_BATCH     64
+
+static const char BAD_REQUEST[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+LiveStream::LiveStream()
+    : groups_(NULL), current_(NULL), running_(false), listen_fd_(-1), wake_fd_(-1), epoll_fd_(-1),
+      latest_(new uint8_t[(size_t)MAX_DEVICES * WS_FRAME_MAX]()), clients_count_(0), messages_(0), dropped_(0),
+      closed_slow_(0) {}
+
+LiveStream::~LiveStream(){
+    stop();
+    delete current_;
+    delete[] latest_;
+}
+
+int LiveStream::start(uint16_t port, const RuleEngine* groups){
+    groups_ = groups;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -errno;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Local only, like the metrics endpoint: put a proxy in front to expose it
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    listen_fd_ = fd;
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 256) < 0){
+        int err = errno;
+        release();
+        return -err;
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd_;
+    bool ok = wake_fd_ >= 0 && epoll_fd_ >= 0 && epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == 0;
+    ev.data.ptr = &wake_fd_;
+    if(!ok || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0){
+        int err = errno;
+        release();
+        return -err;
+    }
+
+    running_ = true;
+    thread_ = std::thread(&LiveStream::run, this);
+    return 0;
+}
+
+void LiveStream::stop(){
+    if(!running_.exchange(false)) return;
+    uint64_t one = 1;
+    if(write(wake_fd_, &one, sizeof(one)) < 0) {}
+    thread_.join();
+    release();
+}
+
+// Everything start() set up; also undoes a start() that failed halfway
+void LiveStream::release(){
+    while(!clients_.empty()) kill(clients_.back());
+    for(Client* c : dead_){
+        for(const Chunk& k : c->queue) unref(k.block);
+        close(c->fd);
+        delete c;
+    }
+    clients_.clear();
+    dead_.clear();
+    for(Block* b : pending_) delete b;
+    pending_.clear();
+    if(epoll_fd_ >= 0) close(epoll_fd_);
+    if(wake_fd_ >= 0) close(wake_fd_);
+    if(listen_fd_ >= 0) close(listen_fd_);
+    epoll_fd_ = wake_fd_ = listen_fd_ = -1;
+}
+
+uint16_t LiveStream::port() const {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if(listen_fd_ < 0 || getsockname(listen_fd_, (struct sockaddr*)&addr, &len) < 0) return 0;
+    return ntohs(addr.sin_port);
+}
+
+//  DISPATCHER SIDE
+// The whole frame, header and all, is built here once; subscribers only
+// ever point at it
+void LiveStream::on_reading(const Reading_t& r){
+    char buf[WS_FRAME_MAX];
+    char* payload = buf + 4;
+    int n = snprintf(payload, WS_FRAME_MAX - 5, "{\"dev\":%u,\"t\":%" PRIu64 ",\"T\":%u,\"P\":%u,\"W\":%u,\"S\":\"%s\",\"A\":%u}",
+                     (unsigned)r.device_id, r.rx_time_us / 1000, r.device_time_ms, (unsigned)r.percent,
+                     (unsigned)r.water_adc, status_name(r.status), (unsigned)r.alert);
+    if(n < 0 || n >= WS_FRAME_MAX - 5) return;
+
+    char* frame;
+    if(n < 126){
+        frame = payload - 2;
+        frame[1] = (char)n;
+    } else {
+        frame = payload - 4;
+        frame[1] = 126;
+        frame[2] = (char)(n >> 8);
+        frame[3] = (char)(n & 0xFF);
+    }
+    frame[0] = (char)0x81;              // FIN, text
+
+    if(!current_){
+        current_ = new Block();
+        current_->refs = 0;
+        current_->offsets.push_back(0);
+    }
+    current_->data.append(frame, (size_t)(payload + n - frame));
+    current_->offsets.push_back((uint32_t)current_->data.size());
+    current_->devices.push_back(r.device_id);
+}
+
+void LiveStream::flush(){
+    if(!current_ || !running_) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(current_);
+    }
+    current_ = NULL;
+    uint64_t one = 1;
+    if(write(wake_fd_, &one, sizeof(one)) < 0) {}   // Already signalled
+}
+
+//  SERVER THREAD
+void LiveStream::unref(Block* b){
+    if(--b->refs == 0) delete b;
+}
+
+void LiveStream::run(){
+    struct epoll_event events[EPOLL_BATCH];
+    std::vector<Block*> blocks;
+
+    while(running_){
+        int n = epoll_wait(epoll_fd_, events, EPOLL_BATCH, 1000);
+        for(int i = 0; i < n; i++){
+            void* ptr = events[i].data.ptr;
+            if(ptr == &listen_fd_){
+                accept_clients();
+            } else if(ptr == &wake_fd_){
+                uint64_t v;
+                if(read(wake_fd_, &v, sizeof(v)) < 0) {}
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    blocks.swap(pending_);
+                }
+                for(Block* b : blocks) broadcast(b);
+                blocks.clear();
+            } else {
+                Client* c = (Client*)ptr;
+                if(!c->dead && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) read_client(c);
+                if(!c->dead && (events[i].events & EPOLLOUT)) write_client(c);
+            }
+        }
+
+        // Freed only now: later events of this batch may still name them
+        for(Client* c : dead_){
+            for(const Chunk& k : c->queue) unref(k.block);
+            close(c->fd);
+            delete c;
+        }
+        dead_.clear();
+    }
+}
+
+void LiveStream::accept_clients(){
+    for(;;){
+        int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) return;
+        if(clients_.size() >= WS_MAX_CLIENTS){
+            close(fd);
+            continue;
+        }
+        Client* c = new Client();
+        c->fd = fd;
+        c->index = (uint32_t)clients_.size();
+        c->open = c->want_out = c->closing = c->dead = false;
+        c->policy = WS_DROP_OLD;
+        c->buffer = WS_BUFFER_DEFAULT;
+        c->queued = c->sent = 0;
+        clients_.push_back(c);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void LiveStream::kill(Client* c){
+    if(c->dead) return;
+    c->dead = true;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, NULL);
+    if(c->open) clients_count_.fetch_sub(1, std::memory_order_relaxed);
+
+    Client* last = clients_.back();
+    clients_[c->index] = last;
+    last->index = c->index;
+    clients_.pop_back();
+    dead_.push_back(c);
+}
+
+void LiveStream::read_client(Client* c){
+    char buf[4096];
+    for(;;){
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && errno == EAGAIN) break;
+        if(n <= 0){
+            kill(c);
+            return;
+        }
+        if(c->closing) continue;        // Nothing more to act on
+        c->in.append(buf, (size_t)n);
+        if(c->in.size() > WS_REQUEST_MAX){
+            kill(c);
+            return;
+        }
+    }
+
+    if(!c->open && !c->closing){
+        size_t end = c->in.find("\r\n\r\n");
+        if(end == std::string::npos) return;
+        c->in[end] = '\0';
+        int rc = handshake(c);
+        c->in.erase(0, end + 4);
+        if(rc < 0){
+            c->ctl = (rc == -ENOENT) ? NOT_FOUND : BAD_REQUEST;
+            c->closing = true;
+            c->in.clear();
+        } else {
+            c->open = true;
+            clients_count_.fetch_add(1, std::memory_order_relaxed);
+            send_snapshot(c);
+        }
+    }
+    if(c->open && !c->closing) handle_frames(c);
+    if(!c->dead && !c->want_out) write_client(c);
+}
+
+// Header value, up to the end of its line (case-insensitive name)
+static bool header(const char* req, const char* name, char* value, size_t cap){
+    size_t nlen = strlen(name);
+    for(const char* line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")){
+        line += 2;
+        if(strncasecmp(line, name, nlen) || line[nlen] != ':') continue;
+        const char* v = line + nlen + 1;
+        while(*v == ' ' || *v == '\t') v++;
+        size_t len = strcspn(v, "\r\n");
+        while(len && (v[len - 1] == ' ' || v[len - 1] == '\t')) len--;
+        if(len >= cap) return false;
+        memcpy(value, v, len);
+        value[len] = '\0';
+        return true;
+    }
+    return false;
+}
+
+static void set_range(std::vector<uint8_t>* bitmap, const char* spec){
+    while(*spec && *spec != '&'){
+        char* end;
+        unsigned long a = strtoul(spec, &end, 10);
+        unsigned long b = a;
+        if(end == spec) return;
+        if(*end == '-') b = strtoul(end + 1, &end, 10);
+        for(unsigned long id = a; id <= b && id < MAX_DEVICES; id++) (*bitmap)[id >> 3] |= (uint8_t)(1u << (id & 7));
+        spec = (*end == ',') ? end + 1 : end;
+        if(*end != ',') return;
+    }
+}
+
+// GET /live?... with the upgrade headers: choose the filter and policy and
+// queue the 101 reply. -EINVAL (400) or -ENOENT (404) otherwise.
+int LiveStream::handshake(Client* c){
+    const char* req = c->in.c_str();
+    if(strncmp(req, "GET ", 4)) return -EINVAL;
+    const char* path = req + 4;
+    size_t path_len = strcspn(path, " ");
+    std::string target(path, path_len);
+    size_t q = target.find('?');
+    std::string query = (q == std::string::npos) ? "" : target.substr(q + 1);
+    if(target.compare(0, q, "/live")) return -ENOENT;
+
+    char key[64], upgrade[32], version[8];
+    if(!header(req, "Upgrade", upgrade, sizeof(upgrade)) || strcasecmp(upgrade, "websocket")) return -EINVAL;
+    if(!header(req, "Sec-WebSocket-Version", version, sizeof(version)) || strcmp(version, "13")) return -EINVAL;
+    if(!header(req, "Sec-WebSocket-Key", key, sizeof(key)) || !key[0]) return -EINVAL;
+
+    // Query: devices=, group=, policy=, buffer=
+    std::vector<uint8_t> filter(MAX_DEVICES / 8, 0);
+    bool filtered = false;
+    for(size_t pos = 0; pos < query.size(); ){
+        size_t amp = query.find('&', pos);
+        if(amp == std::string::npos) amp = query.size();
+        std::string param = query.substr(pos, amp - pos);
+        pos = amp + 1;
+        size_t eq = param.find('=');
+        if(eq == std::string::npos) return -EINVAL;
+        std::string name = param.substr(0, eq), value = param.substr(eq + 1);
+
+        if(name == "devices"){
+            set_range(&filter, value.c_str());
+            filtered = true;
+        } else if(name == "group"){
+            std::vector<uint8_t> members;
+            if(!groups_ || !groups_->group_members(value, &members)) return -EINVAL;
+            if(members.empty()) std::fill(filter.begin(), filter.end(), 0xFF);
+            for(size_t i = 0; i < members.size() && i < filter.size(); i++) filter[i] |= members[i];
+            filtered = true;
+        } else if(name == "policy"){
+            if(value == "drop-old") c->policy = WS_DROP_OLD;
+            else if(value == "drop-new") c->policy = WS_DROP_NEW;
+            else if(value == "close") c->policy = WS_CLOSE_SLOW;
+            else return -EINVAL;
+        } else if(name == "buffer"){
+            unsigned long kb = strtoul(value.c_str(), NULL, 10);
+            if(!kb || kb > WS_BUFFER_MAX / 1024) return -EINVAL;
+            c->buffer = (uint32_t)(kb * 1024);
+        } else {
+            return -EINVAL;
+        }
+    }
+    if(filtered) c->filter.swap(filter);
+
+    // Accept = base64(SHA-1(key + GUID))
+    char accept[32];
+    uint8_t digest[SHA1_DIGEST_LEN];
+    std::string k = std::string(key) + WS_GUID;
+    sha1(k.data(), k.size(), digest);
+    base64_encode(digest, sizeof(digest), accept);
+    c->ctl = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+    c->ctl += accept;
+    c->ctl += "\r\n\r\n";
+    return 0;
+}
+
+// Client frames are masked and small; answer close and ping, ignore the rest
+void LiveStream::handle_frames(Client* c){
+    while(c->in.size() >= 2 && !c->closing){
+        const uint8_t* p = (const uint8_t*)c->in.data();
+        uint8_t opcode = p[0] & 0x0F;
+        size_t len = p[1] & 0x7F, pos = 2;
+        if(!(p[1] & 0x80) || len == 127){
+            kill(c);                    // Unmasked, or larger than we'd ever accept
+            return;
+        }
+        if(len == 126){
+            if(c->in.size() < 4) return;
+            len = ((size_t)p[2] << 8) | p[3];
+            pos = 4;
+        }
+        if(c->in.size() < pos + 4 + len) return;
+
+        uint8_t payload[125];
+        const uint8_t* mask = p + pos;
+        size_t keep = len < sizeof(payload) ? len : sizeof(payload);
+        for(size_t i = 0; i < keep; i++) payload[i] = p[pos + 4 + i] ^ mask[i & 3];
+
+        if(opcode == 0x8){              // Close: echo the status code, then hang up
+            c->ctl.push_back((char)0x88);
+            c->ctl.push_back((char)(len >= 2 ? 2 : 0));
+            if(len >= 2) c->ctl.append((const char*)payload, 2);
+            c->closing = true;
+        } else if(opcode == 0x9 && len <= 125){
+            c->ctl.push_back((char)0x8A);
+            c->ctl.push_back((char)len);
+            c->ctl.append((const char*)payload, len);
+        }
+        c->in.erase(0, pos + 4 + len);
+    }
+}
+
+void LiveStream::write_client(Client* c){
+    struct iovec iov[WS_IOV_MAX];
+    for(;;){
+        // Control data only goes out between messages
+        int n = 0;
+        bool ctl_first = !c->ctl.empty() && c->sent == 0;
+        if(ctl_first){
+            iov[n].iov_base = (void*)c->ctl.data();
+            iov[n++].iov_len = c->ctl.size();
+        }
+        // Closing: only finish the message already started, then the reply
+        size_t chunks = !c->closing ? c->queue.size() : c->sent ? 1 : 0;
+        for(size_t i = 0; i < chunks && n < WS_IOV_MAX; i++){
+            const Chunk& k = c->queue[i];
+            size_t skip = i ? 0 : c->sent;
+            iov[n].iov_base = (void*)(k.block->data.data() + k.off + skip);
+            iov[n++].iov_len = k.len - skip;
+        }
+        if(n == 0) break;
+
+        ssize_t w = writev(c->fd, iov, n);
+        if(w < 0 && errno == EINTR) continue;
+        if(w < 0 && errno == EAGAIN){
+            if(!c->want_out){
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT;
+                ev.data.ptr = c;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+                c->want_out = true;
+            }
+            return;
+        }
+        if(w <= 0){
+            kill(c);
+            return;
+        }
+
+        size_t left = (size_t)w;
+        if(ctl_first){
+            size_t m = left < c->ctl.size() ? left : c->ctl.size();
+            c->ctl.erase(0, m);
+            left -= m;
+        }
+        while(left){
+            Chunk& k = c->queue.front();
+            size_t rest = k.len - c->sent;
+            if(left < rest){
+                c->sent += left;
+                break;
+            }
+            left -= rest;
+            c->queued -= k.len;
+            c->sent = 0;
+            unref(k.block);
+            c->queue.pop_front();
+        }
+    }
+
+    if(c->closing){
+        kill(c);
+        return;
+    }
+    if(c->want_out){
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = false;
+    }
+}
+
+// Queue frames [first, end) of `b`, applying the subscriber's policy if its
+// queue is over its limit. The chunk being written is never dropped, and
+// one chunk is always admitted to an otherwise empty queue.
+void LiveStream::enqueue(Client* c, Block* b, uint32_t first, uint32_t end){
+    uint32_t off = b->offsets[first];
+    uint32_t len = b->offsets[end] - off;
+    uint32_t frames = end - first;
+
+    if(c->queued && c->queued + len > c->buffer){
+        switch(c->policy){
+            case WS_DROP_NEW:
+                dropped_.fetch_add(frames, std::memory_order_relaxed);
+                return;
+            case WS_CLOSE_SLOW:
+                closed_slow_.fetch_add(1, std::memory_order_relaxed);
+                kill(c);
+                return;
+            default: {
+                size_t keep = c->sent ? 1 : 0;
+                while(c->queue.size() > keep && c->queued + len > c->buffer){
+                    Chunk& old = c->queue[keep];
+                    dropped_.fetch_add(old.frames, std::memory_order_relaxed);
+                    c->queued -= old.len;
+                    unref(old.block);
+                    c->queue.erase(c->queue.begin() + (long)keep);
+                }
+                break;
+            }
+        }
+    }
+
+    b->refs++;
+    c->queue.push_back({ b, off, len, frames });
+    c->queued += len;
+    messages_.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void LiveStream::broadcast(Block* b){
+    uint32_t count = (uint32_t)b->devices.size();
+    for(uint32_t i = 0; i < count; i++){
+        uint8_t* slot = latest_ + (size_t)b->devices[i] * WS_FRAME_MAX;
+        slot[0] = (uint8_t)(b->offsets[i + 1] - b->offsets[i]);
+        memcpy(slot + 1, b->data.data() + b->offsets[i], slot[0]);
+    }
+
+    b->refs = 1;                        // Ours, while we hand it out
+    for(size_t n = clients_.size(); n-- > 0; ){   // Backwards: kill() moves the last client into the hole
+        Client* c = clients_[n];
+        if(!c->open || c->closing) continue;
+        if(c->filter.empty()) enqueue(c, b, 0, count);
+        else {
+            // Runs of consecutive matching frames share one queue entry
+            for(uint32_t i = 0; i < count; ){
+                while(i < count && !wants(c, b->devices[i])) i++;
+                uint32_t j = i;
+                while(j < count && wants(c, b->devices[j])) j++;
+                if(j > i) enqueue(c, b, i, j);
+                if(c->dead) break;
+                i = j;
+            }
+        }
+        if(!c->dead && !c->want_out && !c->queue.empty()) write_client(c);
+    }
+    unref(b);
+}
+
+// The latest reading of every device the new subscriber wants, in one block
+void LiveStream::send_snapshot(Client* c){
+    Block* b = new Block();
+    b->refs = 1;
+    b->offsets.push_back(0);
+    for(uint32_t id = 0; id < MAX_DEVICES; id++){
+        const uint8_t* slot = latest_ + (size_t)id * WS_FRAME_MAX;
+        if(!slot[0] || !wants(c, (uint16_t)id)) continue;
+        b->data.append((const char*)slot + 1, slot[0]);
+        b->offsets.push_back((uint32_t)b->data.size());
+        b->devices.push_back((uint16_t)id);
+    }
+    if(!b->devices.empty()) enqueue(c, b, 0, (uint32_t)b->devices.size());
+    unref(b);
+}
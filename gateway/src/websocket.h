@@ -0,0 +1,140 @@
+#ifndef GATEWAY_WEBSOCKET_H
+#define GATEWAY_WEBSOCKET_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "reading.h"
+#include "rules.h"
+#include "sinks.h"
+
+// LIVE STREAM
+//
+// A WebSocket endpoint for control-room screens, ws://127.0.0.1:PORT/live,
+// sending one text message per reading:
+//
+//   {"dev":7,"t":1730000000123,"T":1689771,"P":82,"W":35,"S":"OVERFLOW","A":1}
+//
+// starting with the latest reading of every matching device. Options go in
+// the query string, e.g. /live?group=north&policy=drop-new:
+//   devices=0-15,32     only these devices
+//   group=north         only a group of the rules file (several are OR'ed)
+//   policy=drop-old     a subscriber that can't keep up loses its oldest
+//                       queued messages (default), or
+//          drop-new     the new ones until it catches up, or
+//          close        is disconnected
+//   buffer=KB           its queue limit (default 1024)
+//
+// Each dispatcher flush serialises its readings once, as finished frames,
+// into one reference-counted block. Subscribers queue references to it —
+// the whole block when unfiltered, runs of matching frames otherwise — and
+// the server thread writes them with writev(), so a thousand viewers cost a
+// thousand iovecs, not a thousand encodings or copies. Blocks are freed when
+// the last subscriber has written or dropped its slice.
+#define WS_MAX_CLIENTS          8192
+#define WS_BUFFER_DEFAULT       (1u << 20)
+#define WS_BUFFER_MAX           (64u << 20)
+#define WS_REQUEST_MAX          4096
+#define WS_FRAME_MAX            160     // One reading, frame header included
+#define WS_IOV_MAX              64
+
+typedef enum { WS_DROP_OLD = 0, WS_DROP_NEW, WS_CLOSE_SLOW } WsPolicy_t;
+
+class LiveStream : public Sink {
+public:
+    LiveStream();
+    ~LiveStream();
+
+    // Listen on 127.0.0.1:`port` (0 = any, see port()). `groups` resolves
+    // group= (NULL = none). Returns 0 or -errno.
+    int start(uint16_t port, const RuleEngine* groups);
+    void stop();
+
+    void on_reading(const Reading_t& r) override;
+    void flush() override;
+
+    uint16_t port() const;
+    uint32_t clients() const { return clients_count_.load(std::memory_order_relaxed); }
+    uint64_t messages() const { return messages_.load(std::memory_order_relaxed); }     // Queued to subscribers
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }       // By drop policies
+    uint64_t closed_slow() const { return closed_slow_.load(std::memory_order_relaxed); }
+
+private:
+    struct Block {
+        uint32_t refs;                  // Server thread only
+        std::string data;               // Frames back to back
+        std::vector<uint32_t> offsets;  // Frame starts, plus the end
+        std::vector<uint16_t> devices;
+    };
+
+    struct Chunk {
+        Block* block;
+        uint32_t off;
+        uint32_t len;
+        uint32_t frames;
+    };
+
+    struct Client {
+        int fd;
+        uint32_t index;                 // In clients_
+        bool open;                      // Handshake done
+        bool want_out;                  // EPOLLOUT registered
+        bool closing;                   // Close once `ctl` is written
+        bool dead;
+        uint8_t policy;
+        uint32_t buffer;
+        std::vector<uint8_t> filter;    // Device bitmap, empty = all
+        std::string in;
+        std::string ctl;                // Handshake reply and control frames, sent between messages
+        std::deque<Chunk> queue;
+        size_t queued;                  // Bytes in `queue`
+        size_t sent;                    // Of queue.front()
+    };
+
+    void run();
+    void release();
+    void accept_clients();
+    void read_client(Client* c);
+    int handshake(Client* c);
+    void handle_frames(Client* c);
+    void write_client(Client* c);
+    void kill(Client* c);
+    void broadcast(Block* b);
+    void enqueue(Client* c, Block* b, uint32_t first, uint32_t end);
+    void send_snapshot(Client* c);
+    static void unref(Block* b);
+    bool wants(const Client* c, uint16_t device_id) const {
+        return c->filter.empty() || (c->filter[device_id >> 3] & (1u << (device_id & 7)));
+    }
+
+    const RuleEngine* groups_;
+
+    // Dispatcher side
+    Block* current_;
+
+    // Hand-off
+    std::mutex mutex_;
+    std::vector<Block*> pending_;
+    std::atomic<bool> running_;
+
+    // Server thread
+    std::thread thread_;
+    int listen_fd_;
+    int wake_fd_;
+    int epoll_fd_;
+    std::vector<Client*> clients_;
+    std::vector<Client*> dead_;
+    uint8_t* latest_;                   // [MAX_DEVICES][WS_FRAME_MAX], frame length in the first byte
+
+    std::atomic<uint32_t> clients_count_;
+    std::atomic<uint64_t> messages_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> closed_slow_;
+};
+
+#endif
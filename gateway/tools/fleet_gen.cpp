@@ -0,0 +1,775 @@
+// Virtual tank fleet: N simulated controllers speaking the firmware's
+// protocol, for load-testing the gateway without hardware.
+//
+// Every device sends status packets byte-for-byte as send_status_packet()
+// does, answers height commands with "H:<cm>" like the main loop, and reads
+// its sensors from its own seeded tank model (src/tank_model.h) every 60 ms
+// of device time. Each boot (power-on at start, then any --restart) is
+// announced with an "R:<MCUSR>" line. Links can be made unreliable: send
+// jitter, packets split across writes, damaged packets and link drops.
+//
+//   ./bin/tankgw -l 7000 -j 4 -q -d /tmp/fleet.tsdb &
+//   ./bin/fleet_gen -c 127.0.0.1:7000 -n 1000 -r 10 --corrupt 0.01 -t 60
+//
+//   ./bin/fleet_gen --pty -n 8 > ptys.txt &         # gateway opens the slaves
+//   ./bin/tankgw -o - $(cut -d' ' -f2 ptys.txt)
+//
+//   ./bin/tankgw --pty 4 -o -                        # gateway owns the ptys
+//   ./bin/fleet_gen /dev/pts/3 /dev/pts/4 /dev/pts/5 /dev/pts/6
+//
+// A report line goes to stderr every interval: packets and bytes per
+// second, send lag (actual write time against the packet's schedule, so
+// generator overload and gateway back-pressure both show up), commands
+// and acks, and the injected faults.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "../bench/fleet_sim.h"
+#include "clock.h"
+#include "firmware.h"
+#include "port.h"
+#include "tank_model.h"
+
+#define GEN_OUT_MAX         64          // Queued chunks per device before packets are skipped
+#define GEN_CHUNK_MAX       (FW_PACKET_MAX + 16)
+#define GEN_CONNECT_MS      2000        // TCP connect timeout
+#define GEN_STALL_RETRY_US  1000        // Retry period for a device whose writes would block
+#define GEN_EPOLL_EVENTS    256
+#define GEN_LAG_SAMPLES     (1 << 20)   // Reservoir behind the run's overall lag percentiles
+
+typedef enum {
+    LINK_TCP = 0,       // One connection per device to a tankgw -l listener
+    LINK_PTY,           // Our own pty per device, the gateway opens the slave
+    LINK_PATH           // Existing terminal (e.g. a tankgw --pty slave)
+} LinkKind_t;
+
+typedef enum {
+    DEV_UP = 0,
+    DEV_CONNECTING,
+    DEV_DOWN,           // Link drop: packets are lost until down_until_us
+    DEV_DEAD            // Terminal went away for good
+} DevState_t;
+
+// One write's worth of bytes, due at `due_us`
+typedef struct {
+    uint64_t due_us;
+    uint8_t  len;
+    uint8_t  ends_packet;   // Last piece of a status packet: counts it and its lag
+    char     data[GEN_CHUNK_MAX];
+} Chunk_t;
+
+typedef struct {
+    Port_t   port;
+    uint32_t index;
+    DevState_t state;
+    uint64_t rng;
+
+    // Firmware state
+    uint32_t t_ms;
+    uint16_t height_cm;
+    FwCommand_t cmd;
+
+    // Sensors, sampled every FW_SENSOR_INTERVAL_MS of device time
+    TankModel tank;
+    uint32_t next_sensor_ms;
+    uint32_t distance_cm;
+    uint16_t water_adc;
+    uint32_t echo_ms;           // Device time the last echo ended
+    uint8_t  reset_flags;       // "R:" line still to send after a boot, 0 = none
+    uint64_t next_restart_us;   // 0 = no restarts
+
+    uint64_t next_packet_us;
+    uint64_t next_drop_us;      // 0 = no drops
+    uint64_t down_until_us;
+    uint64_t retry_us;          // Earliest retry after a write that would block
+    std::deque<Chunk_t> out;
+    uint32_t out_off;           // Bytes of out.front() already written
+    uint64_t wake_us;           // Time of this device's scheduled heap entry
+} VirtualDevice_t;
+
+typedef struct {
+    LinkKind_t link = LINK_TCP;
+    const char* host = NULL;
+    const char* service = NULL;
+    std::vector<const char*> paths;
+    uint32_t devices = 1;
+    double rate_hz = 1000.0 / FW_SEND_INTERVAL_MS;
+    double seconds = 0;             // 0 = until interrupted
+    TankConfig_t tank = TANK_DEFAULTS;
+    uint32_t jitter_ms = 0;
+    double fragment = 0;
+    uint32_t frag_gap_ms = 5;
+    double corrupt = 0;
+    double disconnect_s = 0;        // Mean time between drops, 0 = never
+    uint32_t outage_ms = 2000;
+    double restart_s = 0;           // Mean time between device restarts, 0 = never
+    uint64_t seed = 1;
+    double report_s = 1;
+} Options_t;
+
+typedef struct {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t commands;
+    uint64_t acks;
+    uint64_t corrupted;
+    uint64_t fragmented;
+    uint64_t drops;
+    uint64_t restarts;
+    uint64_t lost;          // Packets generated while the link was down
+    uint64_t skipped;       // Packets not queued because the device was backed up
+    uint64_t stalls;        // Writes that would block
+    std::vector<uint32_t> lag_us;
+} Stats_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static Options_t opt;
+static std::vector<VirtualDevice_t> fleet;
+static Stats_t interval_stats;
+static Stats_t total_stats;
+static int epfd = -1;
+static uint32_t dead_devices = 0;
+static uint64_t reservoir_rng = 0x2545F4914F6CDD1DULL;
+static uint64_t lag_samples = 0;
+static uint32_t interval_ms = FW_SEND_INTERVAL_MS;
+static struct sockaddr_storage gw_addr;
+static socklen_t gw_addr_len = 0;
+
+typedef std::pair<uint64_t, uint32_t> Wake_t;
+static std::priority_queue<Wake_t, std::vector<Wake_t>, std::greater<Wake_t>> wakeups;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s [options] (-c HOST:PORT | --pty | PATH...)\n"
+        "  -c HOST:PORT    Connect every device to a gateway listener (tankgw -l)\n"
+        "  --pty           Create a pseudo-terminal per device, print the slave paths\n"
+        "  PATH...         Attach one device to each existing terminal (tankgw --pty)\n"
+        "  -n N            Virtual devices for -c / --pty (default 1)\n"
+        "  -r HZ           Status packets per second per device (default 2)\n"
+        "  -t SECONDS      Stop after this long (default: until Ctrl+C)\n"
+        "  --tank TANK     Preset (cistern, ibc, drum, tower) or cistern depth in cm\n"
+        "  --jitter MS     Delay each packet by a random 0..MS\n"
+        "  --fragment P    Probability a packet is written in 2-4 pieces\n"
+        "  --frag-gap MS   Gap between the pieces (default 5)\n"
+        "  --corrupt P     Probability a packet is damaged (bit flip, lost byte, noise, cut)\n"
+        "  --disconnect S  Mean seconds between link drops per device (default: none)\n"
+        "  --outage MS     Length of a link drop (default 2000)\n"
+        "  --restart S     Mean seconds between device restarts (default: none)\n"
+        "  -s SEED         Random seed (default 1)\n"
+        "  -i SECONDS      Report interval (default 1)\n",
+        argv0);
+}
+
+static int parse_options(int argc, char** argv){
+    for(int i = 1; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-c") && next){
+            static char host[256];
+            const char* colon = strrchr(next, ':');
+            if(!colon || colon == next || (size_t)(colon - next) >= sizeof(host)) return -1;
+            memcpy(host, next, (size_t)(colon - next));
+            host[colon - next] = '\0';
+            opt.host = host;
+            opt.service = colon + 1;
+            opt.link = LINK_TCP;
+            i++;
+        }
+        else if(!strcmp(a, "--pty")){ opt.link = LINK_PTY; }
+        else if(!strcmp(a, "-n") && next){ opt.devices = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "-r") && next){ opt.rate_hz = atof(next); i++; }
+        else if(!strcmp(a, "-t") && next){ opt.seconds = atof(next); i++; }
+        else if(!strcmp(a, "--tank") && next){
+            const TankConfig_t* preset = tank_preset(next);
+            if(preset) opt.tank = *preset;
+            else if(atoi(next) > 0) opt.tank.geometry.height_m = atoi(next) / 100.0;
+            else return -1;
+            i++;
+        }
+        else if(!strcmp(a, "--jitter") && next){ opt.jitter_ms = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "--fragment") && next){ opt.fragment = atof(next); i++; }
+        else if(!strcmp(a, "--frag-gap") && next){ opt.frag_gap_ms = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "--corrupt") && next){ opt.corrupt = atof(next); i++; }
+        else if(!strcmp(a, "--disconnect") && next){ opt.disconnect_s = atof(next); i++; }
+        else if(!strcmp(a, "--outage") && next){ opt.outage_ms = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "--restart") && next){ opt.restart_s = atof(next); i++; }
+        else if(!strcmp(a, "-s") && next){ opt.seed = (uint64_t)atoll(next); i++; }
+        else if(!strcmp(a, "-i") && next){ opt.report_s = atof(next); i++; }
+        else if(a[0] == '-'){ return -1; }
+        else { opt.paths.push_back(a); }
+    }
+
+    if(!opt.paths.empty()){
+        if(opt.host || opt.link == LINK_PTY) return -1;
+        opt.link = LINK_PATH;
+        opt.devices = (uint32_t)opt.paths.size();
+    }
+    else if(opt.link == LINK_TCP && !opt.host) return -1;
+
+    if(opt.devices == 0 || opt.devices > MAX_DEVICES) return -1;
+    if(opt.rate_hz <= 0 || opt.report_s <= 0) return -1;
+    return 0;
+}
+
+//  RANDOMNESS
+static double uniform(VirtualDevice_t* d){
+    return xorshift(&d->rng) / 4294967296.0;
+}
+
+static uint32_t rnd(VirtualDevice_t* d, uint32_t n){
+    return n ? xorshift(&d->rng) % n : 0;
+}
+
+static uint64_t next_drop_time(VirtualDevice_t* d, uint64_t now){
+    if(opt.disconnect_s <= 0) return 0;
+    double wait_s = -log(1.0 - uniform(d)) * opt.disconnect_s;
+    return now + 1000 + (uint64_t)(wait_s * 1e6);
+}
+
+static uint64_t next_restart_time(VirtualDevice_t* d, uint64_t now){
+    if(opt.restart_s <= 0) return 0;
+    double wait_s = -log(1.0 - uniform(d)) * opt.restart_s;
+    return now + 1000 + (uint64_t)(wait_s * 1e6);
+}
+
+//  OUTPUT QUEUE
+static void queue_chunk(VirtualDevice_t* d, uint64_t due_us, const char* data, size_t len, bool ends_packet){
+    Chunk_t c;
+    c.due_us = due_us;
+    c.len = (uint8_t)len;
+    c.ends_packet = ends_packet;
+    memcpy(c.data, data, len);
+    d->out.push_back(c);
+}
+
+// Damage a packet the ways a marginal UART / Bluetooth link does
+static size_t corrupt_packet(VirtualDevice_t* d, char* line, size_t len){
+    switch(rnd(d, 4)){
+        case 0:     // Bit flip
+            line[rnd(d, (uint32_t)len)] ^= (char)(1u << rnd(d, 8));
+            return len;
+        case 1: {   // Lost byte
+            size_t at = rnd(d, (uint32_t)len);
+            memmove(line + at, line + at + 1, len - at - 1);
+            return len - 1;
+        }
+        case 2: {   // Noise burst
+            size_t at = rnd(d, (uint32_t)len);
+            size_t n = 1 + rnd(d, 8);
+            memmove(line + at + n, line + at, len - at);
+            for(size_t i = 0; i < n; i++) line[at + i] = (char)rnd(d, 256);
+            return len + n;
+        }
+        default:    // Cut short: runs into the next packet
+            return 1 + rnd(d, (uint32_t)len - 1);
+    }
+}
+
+static void emit_packet(VirtualDevice_t* d, uint64_t sched_us){
+    d->t_ms += interval_ms;
+    while((int32_t)(d->t_ms - d->next_sensor_ms) >= 0){
+        TankSample_t s;
+        d->tank.step(FW_SENSOR_INTERVAL_MS / 1000.0, &s);
+        d->distance_cm = fw_echo_distance_cm(s.echo_ticks);
+        d->water_adc = s.water_adc;
+        d->echo_ms = d->next_sensor_ms + s.echo_ticks / 2000u;
+        d->next_sensor_ms += FW_SENSOR_INTERVAL_MS;
+    }
+
+    uint16_t percent = fw_level_percent(d->distance_cm, d->height_cm);
+    uint8_t alert;
+    Status_t status = fw_status(percent, d->water_adc, &alert);
+
+    if(d->state != DEV_UP){
+        interval_stats.lost++;
+        return;
+    }
+    if(d->out.size() >= GEN_OUT_MAX){
+        interval_stats.skipped++;
+        return;
+    }
+
+    if(d->reset_flags){
+        char reset[8];
+        queue_chunk(d, sched_us, reset, fw_format_reset(reset, d->reset_flags), false);
+        d->reset_flags = 0;
+    }
+
+    char line[GEN_CHUNK_MAX];
+    int32_t age = (int32_t)(d->t_ms - d->echo_ms);
+    size_t len = fw_format_status(line, d->t_ms, percent, d->water_adc, status, alert, age > 0 ? (uint32_t)age : 0);
+    if(opt.corrupt > 0 && uniform(d) < opt.corrupt){
+        len = corrupt_packet(d, line, len);
+        interval_stats.corrupted++;
+    }
+
+    uint64_t due = sched_us;
+    if(opt.jitter_ms) due += rnd(d, opt.jitter_ms * 1000 + 1);
+
+    if(len >= 2 && opt.fragment > 0 && uniform(d) < opt.fragment){
+        uint32_t pieces = 2 + rnd(d, 3);
+        if(pieces > len) pieces = (uint32_t)len;
+        size_t at = 0;
+        for(uint32_t k = 0; k < pieces; k++){
+            size_t n = (k + 1 == pieces) ? len - at : 1 + rnd(d, (uint32_t)(len - at - (pieces - k - 1)));
+            queue_chunk(d, due + (uint64_t)k * opt.frag_gap_ms * 1000, line + at, n, k + 1 == pieces);
+            at += n;
+        }
+        interval_stats.fragmented++;
+    } else {
+        queue_chunk(d, due, line, len, true);
+    }
+}
+
+//  LINKS
+static void watch(VirtualDevice_t* d, uint32_t events){
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = d->index;
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, d->port.fd, &ev) < 0) epoll_ctl(epfd, EPOLL_CTL_ADD, d->port.fd, &ev);
+}
+
+static void link_up(VirtualDevice_t* d, uint64_t now){
+    d->state = DEV_UP;
+    d->next_drop_us = next_drop_time(d, now);
+}
+
+static void start_connect(VirtualDevice_t* d, uint64_t now){
+    int fd = socket(gw_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        d->state = DEV_DOWN;
+        d->down_until_us = now + (uint64_t)opt.outage_ms * 1000;
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // A UART bridge doesn't batch lines
+
+    int rc = connect(fd, (struct sockaddr*)&gw_addr, gw_addr_len);
+    d->port.fd = fd;
+    if(rc == 0){
+        watch(d, EPOLLIN);
+        link_up(d, now);
+    } else if(errno == EINPROGRESS){
+        watch(d, EPOLLOUT);
+        d->state = DEV_CONNECTING;
+        d->down_until_us = now + (uint64_t)GEN_CONNECT_MS * 1000;
+    } else {
+        close(fd);
+        d->port.fd = -1;
+        d->state = DEV_DOWN;
+        d->down_until_us = now + (uint64_t)opt.outage_ms * 1000;
+    }
+}
+
+// Drop the link for an outage. Sockets are closed (the gateway frees the
+// slot); terminals just go quiet, like a board that walked out of range.
+static void link_down(VirtualDevice_t* d, uint64_t now){
+    if(d->port.kind == PORT_SOCKET && d->port.fd >= 0){
+        close(d->port.fd);
+        d->port.fd = -1;
+    }
+    d->state = DEV_DOWN;
+    d->down_until_us = now + (uint64_t)opt.outage_ms * 1000;
+    d->out.clear();
+    d->out_off = 0;
+    fw_command_init(&d->cmd);
+}
+
+static void link_dead(VirtualDevice_t* d){
+    fprintf(stderr, "%s: terminal closed\n", d->port.path);
+    if(d->port.fd >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, d->port.fd, NULL);
+    port_close(&d->port);
+    d->state = DEV_DEAD;
+    d->out.clear();
+    dead_devices++;
+}
+
+static void link_lost(VirtualDevice_t* d, uint64_t now){
+    if(opt.link == LINK_TCP) link_down(d, now);
+    else link_dead(d);
+}
+
+static void flush_output(VirtualDevice_t* d, uint64_t now){
+    if(d->state != DEV_UP || d->out.empty() || now < d->retry_us) return;
+
+    char buf[GEN_OUT_MAX * GEN_CHUNK_MAX];
+    size_t len = 0;
+    size_t chunks = 0;
+    for(const Chunk_t& c : d->out){
+        if(c.due_us > now) break;
+        size_t off = chunks == 0 ? d->out_off : 0;
+        memcpy(buf + len, c.data + off, c.len - off);
+        len += c.len - off;
+        chunks++;
+    }
+    if(len == 0) return;
+
+    ssize_t n = write(d->port.fd, buf, len);
+    if(n < 0){
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+            interval_stats.stalls++;
+            d->retry_us = now + GEN_STALL_RETRY_US;
+        } else {
+            link_lost(d, now);
+        }
+        return;
+    }
+    interval_stats.bytes += (uint64_t)n;
+
+    size_t left = (size_t)n;
+    while(left > 0){
+        Chunk_t& c = d->out.front();
+        size_t rest = c.len - d->out_off;
+        if(left < rest){
+            d->out_off += (uint32_t)left;
+            break;
+        }
+        left -= rest;
+        if(c.ends_packet){
+            interval_stats.packets++;
+            interval_stats.lag_us.push_back((uint32_t)std::min<uint64_t>(now - c.due_us, UINT32_MAX));
+        }
+        d->out.pop_front();
+        d->out_off = 0;
+    }
+    if((size_t)n < len){
+        interval_stats.stalls++;
+        d->retry_us = now + GEN_STALL_RETRY_US;
+    }
+}
+
+static void on_readable(VirtualDevice_t* d, uint64_t now){
+    uint8_t buf[512];
+    while(true){
+        ssize_t n = read(d->port.fd, buf, sizeof(buf));
+        if(n > 0){
+            if(d->state != DEV_UP) continue; // Nothing gets through a dropped link
+
+            for(ssize_t i = 0; i < n; i++) if(buf[i] == '\n' || buf[i] == '\r') interval_stats.commands++;
+            char ack[64];
+            size_t len = fw_command_feed(&d->cmd, buf, (size_t)n, &d->height_cm, ack, sizeof(ack));
+            size_t start = 0;
+            for(size_t i = 0; i < len; i++){
+                if(ack[i] != '\n') continue;
+                if(d->out.size() < GEN_OUT_MAX) queue_chunk(d, now, ack + start, i + 1 - start, false);
+                interval_stats.acks++;
+                start = i + 1;
+            }
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if(n < 0 && errno == EINTR) continue;
+        if(n == 0 && d->port.kind != PORT_SOCKET) return; // Raw tty with VMIN 0: drained
+        link_lost(d, now);   // EOF from the gateway, or the terminal is gone
+        return;
+    }
+}
+
+static void on_connected(VirtualDevice_t* d, uint64_t now){
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(d->port.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0){
+        link_down(d, now);
+        return;
+    }
+    watch(d, EPOLLIN);
+    link_up(d, now);
+}
+
+// Reset the board with a random cause: T starts over, a half-received
+// command is lost and the next thing it sends is the "R:" line. The height
+// is kept, as if the gateway had re-sent it.
+static void restart(VirtualDevice_t* d, uint64_t now){
+    static const uint8_t causes[] = { 1u << RESET_EXTERNAL, 1u << RESET_BROWN_OUT, 1u << RESET_WATCHDOG };
+    d->reset_flags = causes[rnd(d, 3)];
+    d->t_ms = 0;
+    d->next_sensor_ms = 0;
+    d->echo_ms = 0;
+    fw_command_init(&d->cmd);
+    d->next_restart_us = next_restart_time(d, now);
+    interval_stats.restarts++;
+}
+
+//  SCHEDULER
+static void schedule(VirtualDevice_t* d, uint64_t now){
+    uint64_t t;
+    if(d->state == DEV_DEAD) return;
+    if(d->state == DEV_DOWN || d->state == DEV_CONNECTING){
+        t = std::min(d->down_until_us, d->next_packet_us);
+    } else {
+        t = d->next_packet_us;
+        if(d->next_drop_us && d->next_drop_us < t) t = d->next_drop_us;
+        if(!d->out.empty()) t = std::min(t, std::max(d->out.front().due_us, d->retry_us));
+    }
+    if(t < now) t = now;
+    if(t == d->wake_us) return;
+    d->wake_us = t;
+    wakeups.push(Wake_t(t, d->index));
+}
+
+static void service(VirtualDevice_t* d, uint64_t now){
+    if(d->state == DEV_DEAD) return;
+
+    if(d->state == DEV_CONNECTING && now >= d->down_until_us) link_down(d, now);
+    else if(d->state == DEV_DOWN && now >= d->down_until_us){
+        if(opt.link == LINK_TCP) start_connect(d, now);
+        else link_up(d, now);
+    }
+    else if(d->state == DEV_UP && d->next_drop_us && now >= d->next_drop_us){
+        interval_stats.drops++;
+        link_down(d, now);
+    }
+
+    if(d->next_restart_us && now >= d->next_restart_us) restart(d, now);
+
+    while(d->next_packet_us <= now){
+        emit_packet(d, d->next_packet_us);
+        d->next_packet_us += (uint64_t)interval_ms * 1000;
+    }
+    flush_output(d, now);
+}
+
+static int open_device(VirtualDevice_t* d, uint32_t index, uint64_t now){
+    port_init(&d->port, (uint16_t)index);
+    d->index = index;
+    d->rng = 0x9E3779B97F4A7C15ULL * (opt.seed * 65537 + index + 1);
+    d->t_ms = rnd(d, interval_ms);                          // Powered on as the run starts
+    d->reset_flags = 1u << RESET_POWER_ON;
+    fw_command_init(&d->cmd);
+    TankConfig_t tank = opt.tank;
+    tank.probe.clean_us_cm *= 0.6 + 0.8 * uniform(d);        // Supplies differ from site to site
+    d->tank.init(tank, opt.seed * 65537 + index);
+    d->height_cm = std::min<uint16_t>(d->tank.sensor_height_cm(), FW_HEIGHT_MAX_CM);
+    d->next_sensor_ms = d->t_ms;
+    d->distance_cm = 0;
+    d->water_adc = 0;
+    d->echo_ms = d->t_ms;
+    d->next_packet_us = now + rnd(d, interval_ms * 1000);   // Spread the fleet across one interval
+    d->retry_us = 0;
+    d->out_off = 0;
+    d->wake_us = 0;
+    d->next_restart_us = next_restart_time(d, now);
+    d->state = DEV_DOWN;
+    d->down_until_us = now;
+
+    int rc = 0;
+    if(opt.link == LINK_PTY){
+        rc = port_open_pty(&d->port);
+        if(rc == 0) printf("dev%u: %s\n", index, d->port.path);
+    }
+    else if(opt.link == LINK_PATH){
+        rc = port_open_serial(&d->port, opt.paths[index], 9600);
+        if(rc < 0) fprintf(stderr, "%s: %s\n", opt.paths[index], strerror(-rc));
+    }
+    else {
+        d->port.kind = PORT_SOCKET;
+        snprintf(d->port.path, sizeof(d->port.path), "%s:%s", opt.host, opt.service);
+    }
+    if(rc < 0) return rc;
+    if(d->port.fd >= 0){
+        watch(d, EPOLLIN);
+        link_up(d, now);
+    }
+    return 0;
+}
+
+//  REPORTING
+static void percentile_ms(std::vector<uint32_t>& v, double* p50, double* p99, double* max){
+    if(v.empty()){
+        *p50 = *p99 = *max = 0;
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    *p50 = v[v.size() / 2] / 1000.0;
+    *p99 = v[std::min(v.size() - 1, v.size() * 99 / 100)] / 1000.0;
+    *max = v.back() / 1000.0;
+}
+
+static void report(double elapsed_s, double span_s){
+    uint32_t up = 0;
+    for(const VirtualDevice_t& d : fleet) if(d.state == DEV_UP) up++;
+
+    Stats_t& s = interval_stats;
+    double p50, p99, max;
+    percentile_ms(s.lag_us, &p50, &p99, &max);
+    fprintf(stderr, "%7.1fs  up %u/%u  %8.0f pkt/s %8.1f KB/s  lag p50 %.2f p99 %.2f max %.2f ms"
+                    "  cmd %llu ack %llu  bad %llu frag %llu drop %llu rst %llu lost %llu skip %llu stall %llu\n",
+            elapsed_s, up, (unsigned)fleet.size(), s.packets / span_s, s.bytes / span_s / 1e3, p50, p99, max,
+            (unsigned long long)s.commands, (unsigned long long)s.acks, (unsigned long long)s.corrupted,
+            (unsigned long long)s.fragmented, (unsigned long long)s.drops, (unsigned long long)s.restarts,
+            (unsigned long long)s.lost,
+            (unsigned long long)s.skipped, (unsigned long long)s.stalls);
+
+    Stats_t& t = total_stats;
+    t.packets += s.packets;
+    t.bytes += s.bytes;
+    t.commands += s.commands;
+    t.acks += s.acks;
+    t.corrupted += s.corrupted;
+    t.fragmented += s.fragmented;
+    t.drops += s.drops;
+    t.restarts += s.restarts;
+    t.lost += s.lost;
+    t.skipped += s.skipped;
+    t.stalls += s.stalls;
+    for(uint32_t lag : s.lag_us){
+        // Uniform sample of the whole run, so long runs don't grow without bound
+        lag_samples++;
+        if(t.lag_us.size() < GEN_LAG_SAMPLES) t.lag_us.push_back(lag);
+        else {
+            uint64_t k = ((uint64_t)xorshift(&reservoir_rng) << 32 | xorshift(&reservoir_rng)) % lag_samples;
+            if(k < GEN_LAG_SAMPLES) t.lag_us[k] = lag;
+        }
+    }
+    s = Stats_t();
+}
+
+static void summary(double elapsed_s){
+    Stats_t& t = total_stats;
+    double p50, p99, max;
+    percentile_ms(t.lag_us, &p50, &p99, &max);
+    fprintf(stderr, "\n%u devices, %.1f s: %llu packets (%.0f/s), %.1f MB, send lag p50 %.2f / p99 %.2f / max %.2f ms\n",
+            (unsigned)fleet.size(), elapsed_s, (unsigned long long)t.packets, t.packets / elapsed_s, t.bytes / 1e6,
+            p50, p99, max);
+    fprintf(stderr, "commands %llu, acks %llu; injected: %llu damaged, %llu fragmented, %llu link drops, %llu restarts; "
+                    "%llu packets lost while not connected, %llu skipped while backed up, %llu stalled writes\n",
+            (unsigned long long)t.commands, (unsigned long long)t.acks, (unsigned long long)t.corrupted,
+            (unsigned long long)t.fragmented, (unsigned long long)t.drops, (unsigned long long)t.restarts,
+            (unsigned long long)t.lost,
+            (unsigned long long)t.skipped, (unsigned long long)t.stalls);
+}
+
+// MAIN PROGRAM
+int main(int argc, char** argv){
+    if(parse_options(argc, argv) < 0){
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // T counts milliseconds, so the fastest cadence is one packet per ms
+    interval_ms = (uint32_t)(1000.0 / opt.rate_hz + 0.5);
+    if(interval_ms == 0) interval_ms = 1;
+
+    if(opt.link == LINK_TCP){
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        int rc = getaddrinfo(opt.host, opt.service, &hints, &res);
+        if(rc != 0){
+            fprintf(stderr, "%s:%s: %s\n", opt.host, opt.service, gai_strerror(rc));
+            return 1;
+        }
+        memcpy(&gw_addr, res->ai_addr, res->ai_addrlen);
+        gw_addr_len = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0){
+        perror("epoll_create1");
+        return 1;
+    }
+
+    uint64_t start = mono_us();
+    fleet.resize(opt.devices);
+    for(uint32_t i = 0; i < opt.devices; i++){
+        int rc = open_device(&fleet[i], i, start);
+        if(rc < 0){
+            if(opt.link == LINK_PTY) fprintf(stderr, "pty: %s\n", strerror(-rc));
+            return 1;
+        }
+        schedule(&fleet[i], start);
+    }
+    fflush(stdout);
+    fprintf(stderr, "%u devices, one packet per %u ms each (%.0f packets/s)\n",
+            opt.devices, interval_ms, opt.devices * 1000.0 / interval_ms);
+
+    static struct epoll_event events[GEN_EPOLL_EVENTS];
+    uint64_t report_us = (uint64_t)(opt.report_s * 1e6);
+    uint64_t end_us = opt.seconds > 0 ? start + (uint64_t)(opt.seconds * 1e6) : UINT64_MAX;
+    uint64_t last_report = start;
+
+    while(!stop_requested){
+        uint64_t now = mono_us();
+        if(now >= end_us) break;
+
+        uint64_t until = std::min(last_report + report_us, end_us);
+        if(!wakeups.empty()) until = std::min(until, wakeups.top().first);
+        int timeout_ms = until > now ? (int)((until - now + 999) / 1000) : 0;
+
+        int n = epoll_wait(epfd, events, GEN_EPOLL_EVENTS, timeout_ms);
+        if(n < 0 && errno != EINTR){
+            perror("epoll_wait");
+            return 1;
+        }
+        now = mono_us();
+
+        for(int i = 0; i < n; i++){
+            VirtualDevice_t* d = &fleet[events[i].data.u32];
+            if(d->state == DEV_CONNECTING) on_connected(d, now);
+            else if(d->state != DEV_DEAD) on_readable(d, now);
+            if(d->state != DEV_DEAD) flush_output(d, now);  // Acks go out straight away
+            schedule(d, now);
+        }
+
+        while(!wakeups.empty() && wakeups.top().first <= now){
+            Wake_t w = wakeups.top();
+            wakeups.pop();
+            VirtualDevice_t* d = &fleet[w.second];
+            if(d->wake_us != w.first) continue; // Superseded
+            d->wake_us = 0;
+            service(d, now);
+            schedule(d, now);
+        }
+
+        if(now - last_report >= report_us){
+            report((now - start) / 1e6, (now - last_report) / 1e6);
+            last_report = now;
+        }
+
+        if(dead_devices == opt.devices){
+            fprintf(stderr, "every terminal has gone away\n");
+            break;
+        }
+    }
+
+    uint64_t now = mono_us();
+    report((now - start) / 1e6, std::max(1e-3, (now - last_report) / 1e6));
+    summary((now - start) / 1e6);
+    for(VirtualDevice_t& d : fleet) port_close(&d.port);
+    close(epfd);
+    return 0;
+}
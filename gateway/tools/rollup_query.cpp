@@ -0,0 +1,169 @@
+// Print rollup rows (tankgw -R) for a time range: one line per bucket and
+// device, or per bucket across the fleet.
+//
+//   ./bin/rollup_query rollups -g 1h -D 3 --last 86400
+//   ./bin/rollup_query rollups -g 1d --fleet
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "clock.h"
+#include "rollup.h"
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s DIR [options]\n"
+        "  -g 1m|1h|1d     Tier (default 1h)\n"
+        "  -D DEVICE       Only this device id (default: all)\n"
+        "  -f MS           From bucket start, epoch ms (default: start)\n"
+        "  -t MS           To, epoch ms, exclusive (default: end)\n"
+        "  --last SECONDS  Shorthand for -f now-SECONDS\n"
+        "  --fleet         Merge devices: one line per bucket\n"
+        "  --total         Only the summary line\n",
+        argv0);
+}
+
+// Rows summed across devices or buckets; wider than RollupRow_t so fleet
+// and multi-day totals don't overflow
+typedef struct {
+    int64_t  bucket_ms;
+    uint64_t count;
+    uint32_t percent_min, percent_max, water_min, water_max;
+    uint64_t percent_sum, water_sum;
+    uint64_t alert_count, alert_onsets;
+    uint64_t status_ms[STATUS_COUNT];
+} Agg_t;
+
+static void agg_init(Agg_t* a, int64_t bucket_ms){
+    memset(a, 0, sizeof(*a));
+    a->bucket_ms = bucket_ms;
+    a->percent_min = 0xFF;
+    a->water_min = 0xFFFF;
+}
+
+static void agg_add(Agg_t* a, const RollupRow_t& r){
+    if(r.count){
+        if(r.percent_min < a->percent_min) a->percent_min = r.percent_min;
+        if(r.percent_max > a->percent_max) a->percent_max = r.percent_max;
+        if(r.water_min < a->water_min) a->water_min = r.water_min;
+        if(r.water_max > a->water_max) a->water_max = r.water_max;
+    }
+    a->count += r.count;
+    a->percent_sum += r.percent_sum;
+    a->water_sum += r.water_sum;
+    a->alert_count += r.alert_count;
+    a->alert_onsets += r.alert_onsets;
+    for(uint8_t k = 0; k < STATUS_COUNT; k++) a->status_ms[k] += r.status_ms[k];
+}
+
+static void print_agg(const Agg_t& a, int device){
+    char when[32];
+    time_t secs = (time_t)(a.bucket_ms / 1000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+
+    uint64_t total_ms = 0;
+    for(uint8_t k = 0; k < STATUS_COUNT; k++) total_ms += a.status_ms[k];
+
+    if(device < 0) printf("%s  %4s  ", when, "all");
+    else printf("%s  %4d  ", when, device);
+
+    if(a.count){
+        printf("%7" PRIu64 "  P %3u/%5.1f/%3u  W %4u/%6.1f/%4u", a.count,
+               a.percent_min, (double)a.percent_sum / a.count, a.percent_max,
+               a.water_min, (double)a.water_sum / a.count, a.water_max);
+    } else {
+        printf("%7d  %-16s  %-20s", 0, "P -", "W -");
+    }
+    for(uint8_t k = 0; k < STATUS_COUNT; k++){
+        printf("  %5.1f%%", total_ms ? 100.0 * a.status_ms[k] / total_ms : 0.0);
+    }
+    printf("  %5" PRIu64 " %4" PRIu64 "\n", a.alert_count, a.alert_onsets);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 2;
+    }
+    const char* dir = argv[1];
+    RollupTier_t tier = TIER_1H;
+    uint16_t device = 0xFFFF;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    bool fleet = false, total_only = false;
+
+    for(int i = 2; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-g") && next){
+            int k = 0;
+            while(k < TIER_COUNT && strcmp(ROLLUP_TIERS[k].name, next)) k++;
+            if(k == TIER_COUNT){
+                usage(argv[0]);
+                return 2;
+            }
+            tier = (RollupTier_t)k;
+            i++;
+        }
+        else if(!strcmp(a, "-D") && next){ device = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-f") && next){ from_ms = atoll(next); i++; }
+        else if(!strcmp(a, "-t") && next){ to_ms = atoll(next); i++; }
+        else if(!strcmp(a, "--last") && next){ from_ms = (int64_t)(now_us() / 1000) - atoll(next) * 1000; i++; }
+        else if(!strcmp(a, "--fleet")){ fleet = true; }
+        else if(!strcmp(a, "--total")){ total_only = true; }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<RollupRow_t> rows;
+    int rc = rollup_read(dir, tier, device, from_ms, to_ms, &rows);
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", dir, strerror(-rc));
+        return 1;
+    }
+
+    if(!total_only){
+        printf("%-16s  %4s  %7s  %-16s  %-20s  %6s  %6s  %6s  %6s  %5s %4s\n", "bucket (UTC)", "dev", "n",
+               "P min/avg/max", "W min/avg/max", "EMPTY", "HALF", "OVER", "CONT", "alert", "ons");
+    }
+
+    Agg_t total, bucket;
+    agg_init(&total, 0);
+    agg_init(&bucket, INT64_MIN);
+
+    for(const RollupRow_t& r : rows){
+        agg_add(&total, r);
+        if(total_only) continue;
+        if(!fleet){
+            Agg_t one;
+            agg_init(&one, r.bucket_ms);
+            agg_add(&one, r);
+            print_agg(one, r.device_id);
+            continue;
+        }
+        if(r.bucket_ms != bucket.bucket_ms){
+            if(bucket.bucket_ms != INT64_MIN) print_agg(bucket, -1);
+            agg_init(&bucket, r.bucket_ms);
+        }
+        agg_add(&bucket, r);
+    }
+    if(fleet && !total_only && bucket.bucket_ms != INT64_MIN) print_agg(bucket, -1);
+
+    printf("%zu rows, %" PRIu64 " readings", rows.size(), total.count);
+    if(total.count){
+        printf(", P avg %.1f%%, W avg %.1f, %" PRIu64 " alert onsets",
+               (double)total.percent_sum / total.count, (double)total.water_sum / total.count, total.alert_onsets);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Check alert rule files before handing them to tankgw --rules, or with no
+// arguments run the compiler's own cases: good sources must compile, bad
+// ones must be rejected with -EINVAL, and nothing may hang. Every compile
+// runs in a child process with a time limit.
+//
+//   ./bin/rules_check                 built-in cases
+//   ./bin/rules_check FILE...         compile each file, print any error
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "rules.h"
+
+#define COMPILE_TIMEOUT_S   2
+
+#define RC_OK       0
+#define RC_INVALID  1
+#define RC_OTHER    2
+#define RC_HUNG     3
+
+static const char* const good_cases[] = {
+    "rule overflow: P > 90 for 30s",
+    "rule adc_rising: delta(W, 1m) >= 20   # comment",
+    "group north 0-15 32\nrule farm in north: count(S == CONTAMINATED) >= 3",
+    "group g 3, 4-6, 9\nrule low in g: avg(P, 5m) < .5 * 20 and not (S == EMPTY)",
+    "rule r: max(W, 30s) - min(W, 30s) > 100 || A == 1 for 1.5s",
+    "\n# only comments\n\n",
+};
+
+static const char* const bad_cases[] = {
+    "group g 3 .",
+    "group g .",
+    "group g 3 -",
+    "group g",
+    "group g 20-10",
+    "group g 3\ngroup g 4",
+    "rule r: P > .",
+    "rule r: P >",
+    "rule r P > 1",
+    "rule r: P > 1 for .s",
+    "rule r: P > 1 for 5",
+    "rule r: P > 5s",
+    "rule r: avg(P, 500ms) > 1",
+    "rule r: avg(X, 1m) > 1",
+    "rule r: count(count(A == 1) > 0) > 1",
+    "rule r in nowhere: P > 1",
+    "group g 1\nrule r in g: count(A == 1) > 1 && P > 5",
+    "rule r: P > 1\nrule r: P > 2",
+    "rule r: (P > 1",
+    "rule r: P > 1 )",
+    "bogus",
+};
+
+// Compile a file (is_file) or a source string in a child. Returns RC_*.
+static int compile_in_child(const char* what, bool is_file, std::string* error){
+    int fds[2];
+    if(pipe(fds) < 0) return RC_OTHER;
+    pid_t pid = fork();
+    if(pid < 0){
+        close(fds[0]);
+        close(fds[1]);
+        return RC_OTHER;
+    }
+    if(pid == 0){
+        close(fds[0]);
+        alarm(COMPILE_TIMEOUT_S);
+        RuleEngine engine(NULL);
+        std::string err;
+        int rc = is_file ? engine.load(what, &err) : engine.compile(what, "case", &err);
+        if(write(fds[1], err.data(), err.size()) < 0){}
+        _exit(rc == 0 ? RC_OK : rc == -EINVAL ? RC_INVALID : RC_OTHER);
+    }
+    close(fds[1]);
+    char buf[512];
+    ssize_t n;
+    error->clear();
+    while((n = read(fds[0], buf, sizeof(buf))) > 0) error->append(buf, (size_t)n);
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if(WIFSIGNALED(status)) return WTERMSIG(status) == SIGALRM ? RC_HUNG : RC_OTHER;
+    return WEXITSTATUS(status);
+}
+
+static const char* rc_name(int rc){
+    switch(rc){
+        case RC_OK:      return "compiled";
+        case RC_INVALID: return "rejected";
+        case RC_HUNG:    return "HUNG";
+        default:         return "failed";
+    }
+}
+
+static bool run_case(const char* text, int want){
+    std::string error;
+    int rc = compile_in_child(text, false, &error);
+    bool ok = rc == want;
+    std::string shown(text);
+    for(char& c : shown) if(c == '\n') c = '|';
+    if(error.empty()) printf("%-4s %-9s %s\n", ok ? "ok" : "FAIL", rc_name(rc), shown.c_str());
+    else printf("%-4s %-9s %-60s %s\n", ok ? "ok" : "FAIL", rc_name(rc), shown.c_str(), error.c_str());
+    return ok;
+}
+
+int main(int argc, char** argv){
+    if(argc > 1){
+        int failed = 0;
+        for(int i = 1; i < argc; i++){
+            std::string error;
+            int rc = compile_in_child(argv[i], true, &error);
+            if(rc == RC_OK) printf("%s: ok\n", argv[i]);
+            else if(rc == RC_HUNG) printf("%s: compiler did not finish in %us\n", argv[i], COMPILE_TIMEOUT_S);
+            else printf("%s\n", error.c_str());
+            failed += rc != RC_OK;
+        }
+        return failed ? 1 : 0;
+    }
+
+    uint32_t cases = 0, failed = 0;
+    for(const char* text : good_cases){
+        cases++;
+        failed += !run_case(text, RC_OK);
+    }
+    for(const char* text : bad_cases){
+        cases++;
+        failed += !run_case(text, RC_INVALID);
+    }
+    printf("\n%u cases, %u failed\n", cases, failed);
+    return failed ? 1 : 0;
+}
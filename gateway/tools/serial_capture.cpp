@@ -0,0 +1,213 @@
+// Record raw serial bytes with their arrival times (src/capture.h), for
+// replaying field incidents with bin/serial_replay. Runs in place of the
+// gateway on the same ports; nothing is parsed or dropped, though lines
+// are counted so a bad capture shows up straight away.
+//
+//   ./bin/serial_capture -o tank.cap /dev/rfcomm0 /dev/ttyUSB0
+//   ./bin/serial_capture -o sim.cap --pty 2 -t 60      # record a simulator
+//
+// The file is flushed every second, so a killed capture loses at most
+// the last second.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "clock.h"
+#include "port.h"
+
+#define CAPTURE_FLUSH_MS    1000
+#define CAPTURE_REOPEN_MS   1000
+#define CAPTURE_READ_BUF    4096
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s -o FILE [options] [PORT...]\n"
+        "  PORT            Serial or rfcomm device, one capture channel each\n"
+        "  -o FILE         Capture file to write\n"
+        "  -b BAUD         Serial baud rate (default 9600)\n"
+        "  -p, --pty N     Also create N pseudo-terminals and capture what is written to them\n"
+        "  -H CM           Send a container height command on every (re)open, as tankgw -H does\n"
+        "  -t SECONDS      Stop after this long (default: until Ctrl+C)\n",
+        argv0);
+}
+
+// The parser keeps its own line and error counts; nothing else to do
+static void ignore_line(Port_t* port, const TlmLine_t* line, void* ctx){
+    (void)port;
+    (void)line;
+    (void)ctx;
+}
+
+static void watch(int epfd, Port_t* port, uint32_t channel){
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = channel;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, port->fd, &ev);
+}
+
+int main(int argc, char** argv){
+    const char* out_path = NULL;
+    uint32_t baud = 9600;
+    uint16_t pty_count = 0;
+    uint16_t height_cm = 0;
+    double seconds = 0;
+    std::vector<const char*> paths;
+
+    for(int i = 1; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-o") && next){ out_path = next; i++; }
+        else if(!strcmp(a, "-b") && next){ baud = (uint32_t)atoi(next); i++; }
+        else if((!strcmp(a, "-p") || !strcmp(a, "--pty")) && next){ pty_count = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-H") && next){ height_cm = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-t") && next){ seconds = atof(next); i++; }
+        else if(a[0] == '-'){
+            usage(argv[0]);
+            return 2;
+        }
+        else { paths.push_back(a); }
+    }
+    if(!out_path || (paths.empty() && pty_count == 0)){
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0){
+        perror("epoll_create1");
+        return 1;
+    }
+
+    // --- Ports, one capture channel each ---
+    std::vector<Port_t> ports(paths.size() + pty_count);
+    std::vector<std::string> names;
+    for(size_t i = 0; i < paths.size(); i++){
+        Port_t* port = &ports[i];
+        port_init(port, (uint16_t)i);
+        int rc = port_open_serial(port, paths[i], baud);
+        if(rc < 0) fprintf(stderr, "%s: %s (will retry)\n", paths[i], strerror(-rc));
+        else {
+            watch(epfd, port, (uint32_t)i);
+            if(height_cm) port_send_height(port, height_cm);
+        }
+        names.push_back(paths[i]);
+    }
+    for(uint16_t k = 0; k < pty_count; k++){
+        size_t i = paths.size() + k;
+        Port_t* port = &ports[i];
+        port_init(port, (uint16_t)i);
+        int rc = port_open_pty(port);
+        if(rc < 0){
+            fprintf(stderr, "pty: %s\n", strerror(-rc));
+            return 1;
+        }
+        watch(epfd, port, (uint32_t)i);
+        printf("ch%zu: %s\n", i, port->path);
+        names.push_back(port->path);
+    }
+    fflush(stdout);
+
+    static CaptureWriter cap;
+    int rc = cap.open(out_path, names);
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", out_path, strerror(-rc));
+        return 1;
+    }
+
+    // --- Capture ---
+    static uint8_t buf[CAPTURE_READ_BUF];
+    uint64_t start = mono_ms();
+    uint64_t end = seconds > 0 ? start + (uint64_t)(seconds * 1000) : UINT64_MAX;
+    uint64_t last_flush = start;
+    uint64_t last_retry = start;
+
+    while(!stop_requested && mono_ms() < end){
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, 100);
+        if(n < 0 && errno != EINTR){
+            perror("epoll_wait");
+            break;
+        }
+
+        for(int i = 0; i < n; i++){
+            Port_t* port = &ports[events[i].data.u32];
+            while(true){
+                ssize_t got = read(port->fd, buf, sizeof(buf));
+                if(got > 0){
+                    // Timestamp first: the file write may take a while
+                    uint64_t t = mono_us();
+                    if(cap.write(port->id, t, buf, (size_t)got) < 0){
+                        fprintf(stderr, "%s: write failed\n", out_path);
+                        stop_requested = 1;
+                        break;
+                    }
+                    port_feed(port, buf, (size_t)got, ignore_line, NULL);
+                    if(got < (ssize_t)sizeof(buf)) break;
+                    continue;
+                }
+                if(got < 0 && (errno == EAGAIN || errno == EINTR)) break;
+                if(port->kind == PORT_PTY) break; // Held slave: writer went away, more may come
+
+                fprintf(stderr, "%s: connection lost\n", port->path);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, port->fd, NULL);
+                port_close(port);
+                break;
+            }
+        }
+
+        uint64_t now = mono_ms();
+        if(now - last_flush >= CAPTURE_FLUSH_MS){
+            cap.flush();
+            last_flush = now;
+        }
+        if(now - last_retry >= CAPTURE_REOPEN_MS){
+            for(Port_t& port : ports){
+                if(port.kind != PORT_SERIAL || port.fd >= 0) continue;
+                if(port_open_serial(&port, port.path, baud) < 0) continue;
+                fprintf(stderr, "%s: reconnected\n", port.path);
+                watch(epfd, &port, port.id);
+                if(height_cm) port_send_height(&port, height_cm);
+            }
+            last_retry = now;
+        }
+    }
+
+    cap.close();
+    double secs = (mono_ms() - start) / 1000.0;
+    fprintf(stderr, "%.1f s: %" PRIu64 " records, %" PRIu64 " bytes captured, %" PRIu64 " byte file\n",
+            secs, cap.records(), cap.payload_bytes(), cap.file_bytes());
+    for(Port_t& port : ports){
+        const TlmParser_t& p = port.parser;
+        uint64_t bad = (uint64_t)p.errors[TLM_ERR_SYNTAX] + p.errors[TLM_ERR_RANGE] + p.errors[TLM_ERR_OVERLONG];
+        fprintf(stderr, "  ch%u %s: %" PRIu64 " bytes, %" PRIu64 " status + %" PRIu64 " ack lines, %" PRIu64 " malformed\n",
+                (unsigned)port.id, port.path, port.bytes_rx, (uint64_t)p.status_lines, (uint64_t)p.ack_lines, bad);
+        port_close(&port);
+    }
+    close(epfd);
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Play a capture from bin/serial_capture back into terminals, byte for
+// byte, at the original pace, N times faster or as fast as the reader
+// takes it. Each capture channel goes to its own pty (--pty, the reader
+// opens the printed slave) or to one of the PATHs, e.g. the slaves of
+// tankgw --pty.
+//
+//   ./bin/tankgw --pty 2 -o - &
+//   ./bin/serial_replay tank.cap -x 60 /dev/pts/3 /dev/pts/4
+//   ./bin/serial_replay tank.cap --afap --pty
+//   ./bin/serial_replay tank.cap --dump | less
+//
+// Reads are replayed as the same writes, so line fragmentation across
+// reads is reproduced too (at -x 1; faster playback may coalesce them in
+// the reader).
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "capture.h"
+#include "clock.h"
+#include "port.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s FILE [options] (--pty | PATH... | --dump)\n"
+        "  --pty           Create a pseudo-terminal per channel and print the slave paths\n"
+        "  PATH...         Write channel N to the Nth terminal (e.g. tankgw --pty slaves)\n"
+        "  -x SPEED        Playback speed factor (default 1)\n"
+        "  --afap          As fast as the reader keeps up\n"
+        "  -w SECONDS      Wait before playing, so readers can attach (default 2 with --pty)\n"
+        "  --dump          Print the records instead of playing them\n",
+        argv0);
+}
+
+static void sleep_until_us(uint64_t mono_deadline_us){
+    struct timespec ts;
+    ts.tv_sec = (time_t)(mono_deadline_us / 1000000ULL);
+    ts.tv_nsec = (long)(mono_deadline_us % 1000000ULL) * 1000L;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop_requested){}
+}
+
+// Blocking write on a non-blocking descriptor: a slow reader holds playback back
+static int write_all(int fd, const uint8_t* data, size_t len){
+    while(len > 0 && !stop_requested){
+        ssize_t n = write(fd, data, len);
+        if(n > 0){
+            data += n;
+            len -= (size_t)n;
+            continue;
+        }
+        if(n < 0 && errno != EAGAIN && errno != EINTR) return -errno;
+        struct pollfd p = { fd, POLLOUT, 0 };
+        poll(&p, 1, 100);
+    }
+    return 0;
+}
+
+static int dump(CaptureReader& cap){
+    time_t start = (time_t)(cap.start_us() / 1000000);
+    printf("# capture started %s", ctime(&start));
+    for(uint16_t c = 0; c < cap.channels(); c++) printf("# ch%u: %s\n", (unsigned)c, cap.channel_name(c));
+
+    CaptureRecord_t rec;
+    while(cap.next(&rec)){
+        printf("%12.6f ch%u %4u  ", rec.t_us / 1e6, (unsigned)rec.channel, rec.len);
+        for(uint32_t i = 0; i < rec.len; i++){
+            uint8_t b = rec.data[i];
+            if(b == '\n') fputs("\\n", stdout);
+            else if(b == '\r') fputs("\\r", stdout);
+            else if(b == '\\') fputs("\\\\", stdout);
+            else if(isprint(b)) putchar(b);
+            else printf("\\x%02x", b);
+        }
+        putchar('\n');
+    }
+    if(cap.truncated()) printf("# truncated after the last record\n");
+    return 0;
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    double speed = 1;
+    bool afap = false;
+    bool pty = false;
+    bool dump_only = false;
+    double wait_s = -1;
+    std::vector<const char*> targets;
+
+    for(int i = 2; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-x") && next){ speed = atof(next); i++; }
+        else if(!strcmp(a, "--afap")){ afap = true; }
+        else if(!strcmp(a, "--pty")){ pty = true; }
+        else if(!strcmp(a, "-w") && next){ wait_s = atof(next); i++; }
+        else if(!strcmp(a, "--dump")){ dump_only = true; }
+        else if(a[0] == '-'){
+            usage(argv[0]);
+            return 2;
+        }
+        else { targets.push_back(a); }
+    }
+    if(speed <= 0 || (!dump_only && pty == !targets.empty())){
+        usage(argv[0]);
+        return 2;
+    }
+
+    static CaptureReader cap;
+    int rc = cap.open(path);
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", path, rc == -EINVAL ? "not a capture file" : strerror(-rc));
+        return 1;
+    }
+    if(dump_only) return dump(cap);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // --- Outputs ---
+    std::vector<Port_t> ports(cap.channels());
+    for(uint16_t c = 0; c < cap.channels(); c++){
+        Port_t* port = &ports[c];
+        port_init(port, c);
+        if(pty){
+            rc = port_open_pty(port);
+            if(rc < 0){
+                fprintf(stderr, "pty: %s\n", strerror(-rc));
+                return 1;
+            }
+            printf("ch%u (%s): %s\n", (unsigned)c, cap.channel_name(c), port->path);
+        }
+        else if(c < targets.size()){
+            rc = port_open_serial(port, targets[c], 9600);
+            if(rc < 0){
+                fprintf(stderr, "%s: %s\n", targets[c], strerror(-rc));
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "ch%u (%s): no terminal given, skipped\n", (unsigned)c, cap.channel_name(c));
+        }
+    }
+    fflush(stdout);
+
+    if(wait_s < 0) wait_s = pty ? 2 : 0;
+    if(wait_s > 0) sleep_until_us(mono_us() + (uint64_t)(wait_s * 1e6));
+
+    // --- Playback ---
+    CaptureRecord_t rec;
+    uint64_t records = 0, bytes = 0, last_t = 0, max_late_us = 0;
+    uint64_t start = mono_us();
+    while(!stop_requested && cap.next(&rec)){
+        Port_t* port = &ports[rec.channel];
+        if(port->fd < 0) continue;
+
+        if(!afap){
+            uint64_t due = start + (uint64_t)(rec.t_us / speed);
+            uint64_t now = mono_us();
+            if(due > now) sleep_until_us(due);
+            else if(now - due > max_late_us) max_late_us = now - due;
+        }
+        rc = write_all(port->fd, rec.data, rec.len);
+        if(rc < 0){
+            fprintf(stderr, "ch%u: %s\n", (unsigned)rec.channel, strerror(-rc));
+            break;
+        }
+        records++;
+        bytes += rec.len;
+        last_t = rec.t_us;
+    }
+
+    double wall = (mono_us() - start) / 1e6;
+    fprintf(stderr, "%" PRIu64 " records, %" PRIu64 " bytes: %.1f s of capture in %.2f s (%.1fx, %.0f bytes/s)",
+            records, bytes, last_t / 1e6, wall, wall > 0 ? last_t / 1e6 / wall : 0.0, wall > 0 ? bytes / wall : 0.0);
+    if(!afap) fprintf(stderr, ", up to %.1f ms late", max_late_us / 1000.0);
+    fprintf(stderr, "\n");
+    if(cap.truncated()) fprintf(stderr, "%s: ends inside a record (capture was cut short)\n", path);
+
+    // Let a pty reader drain before the master goes away
+    if(pty) sleep_until_us(mono_us() + 500000);
+    for(Port_t& port : ports) port_close(&port);
+    return 0;
+}
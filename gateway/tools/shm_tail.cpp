@@ -0,0 +1,129 @@
+// Follow the gateway's shared-memory ring (tankgw --shm NAME), and the
+// smallest example of a ShmReader client.
+//
+//   ./bin/shm_tail tankgw                 readings as CSV, like tankgw -o
+//   ./bin/shm_tail tankgw -D 3            one device
+//   ./bin/shm_tail tankgw --stats         rate, lag, lost and age every second
+//
+// Waits for the gateway to create the ring and reopens it when the gateway
+// restarts. Idle readers back off from spinning to 50 us sleeps.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "reading.h"
+#include "shm_ring.h"
+
+#define BATCH           256
+#define SPIN_ROUNDS     1000    // Empty polls before sleeping
+#define IDLE_SLEEP_US   50
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s NAME [options]\n"
+        "  -D DEVICE       Only this device id (default: all)\n"
+        "  --oldest        Start from the oldest reading still in the ring\n"
+        "  --stats         Print rate, lag, lost and age every second instead of readings\n",
+        argv0);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 2;
+    }
+    const char* name = argv[1];
+    int32_t device = -1;
+    bool oldest = false, stats = false;
+    for(int i = 2; i < argc; i++){
+        if(!strcmp(argv[i], "-D") && i + 1 < argc) device = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--oldest")) oldest = true;
+        else if(!strcmp(argv[i], "--stats")) stats = true;
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ShmReader ring;
+    Reading_t batch[BATCH];
+    uint32_t idle = 0;
+    uint64_t count = 0, lost_before = 0, max_age_us = 0;
+    uint64_t next_report = mono_ms() + 1000;
+    bool open = false;
+
+    while(!stop_requested){
+        if(!open){
+            // A ring left behind by a gateway that died counts as not there yet
+            int rc = ring.open(name, oldest);
+            if(rc == 0 && ring.stale()){
+                ring.close();
+                rc = -ENOENT;
+            }
+            if(rc < 0){
+                if(rc != -ENOENT && rc != -EAGAIN){
+                    fprintf(stderr, "%s: %s\n", name, strerror(-rc));
+                    return 1;
+                }
+                usleep(100000);
+                continue;
+            }
+            fprintf(stderr, "%s: following from record %" PRIu64 "\n", name, ring.position());
+            open = true;
+            lost_before = 0;
+            oldest = true;      // After a restart, the new ring from its start
+        }
+
+        uint32_t n = ring.read(batch, BATCH);
+        if(n){
+            uint64_t now = now_us();
+            for(uint32_t i = 0; i < n; i++){
+                const Reading_t& r = batch[i];
+                if(device >= 0 && r.device_id != device) continue;
+                count++;
+                if(stats){
+                    uint64_t age = now > r.rx_time_us ? now - r.rx_time_us : 0;
+                    if(age > max_age_us) max_age_us = age;
+                } else {
+                    printf("%" PRIu64 ",%u,%" PRIu32 ",%u,%u,%u,%u\n", r.rx_time_us, (unsigned)r.device_id, r.device_time_ms,
+                           (unsigned)r.percent, (unsigned)r.water_adc, (unsigned)r.status, (unsigned)r.alert);
+                }
+            }
+            idle = 0;
+        } else if(++idle > SPIN_ROUNDS){
+            if(!stats) fflush(stdout);
+            usleep(IDLE_SLEEP_US);
+            if(idle % 1000 == 0 && ring.stale()){      // Every ~50 ms of silence
+                fprintf(stderr, "%s: gateway stopped, waiting\n", name);
+                ring.close();
+                open = false;
+            }
+        }
+
+        if(stats && mono_ms() >= next_report){
+            fprintf(stderr, "%" PRIu64 " readings/s, lag %" PRIu64 ", lost %" PRIu64 ", max age %.3f ms\n",
+                    count, ring.lag(), ring.lost() - lost_before, max_age_us / 1000.0);
+            count = 0;
+            max_age_us = 0;
+            lost_before = ring.lost();
+            next_report += 1000;
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
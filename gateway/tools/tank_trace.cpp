@@ -0,0 +1,123 @@
+// Deterministic sensor traces from the tank model (src/tank_model.h), for
+// validating filters and detectors offline: ground truth next to the echo
+// ticks and ADC codes the controller would capture, and what the firmware
+// makes of them. The same preset and seed always give the same trace.
+//
+//   ./bin/tank_trace -p ibc -s 7 --hours 24 > ibc7.csv
+//   ./bin/tank_trace -p drum --hours 1 --wire > drum.log     # firmware output lines
+//
+// CSV columns: t_ms, level_mm, surface_mm, volume_l, inflow_lpm, outflow_lpm,
+// air_c, water_c, conductivity_us_cm, echo_ticks, echo_kind, water_adc,
+// distance_cm, percent, status (the last three via the firmware's own
+// arithmetic, with the container height set to the sensor height).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "firmware.h"
+#include "tank_model.h"
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -p PRESET       cistern (default), ibc, drum, tower\n"
+        "  -s SEED         Random seed (default 1)\n"
+        "  --hours H       Trace length (default 1)\n"
+        "  --fill F        Starting fill fraction (default: random)\n"
+        "  --leak MM       Add a leak of this diameter at the floor\n"
+        "  --dt MS         Sample period (default 60, the firmware's sensor cycle)\n"
+        "  --wire          Print status packets every 500 ms as the firmware would\n",
+        argv0);
+}
+
+int main(int argc, char** argv){
+    TankConfig_t cfg = TANK_DEFAULTS;
+    uint64_t seed = 1;
+    double hours = 1;
+    uint32_t dt_ms = FW_SENSOR_INTERVAL_MS;
+    bool wire = false;
+
+    for(int i = 1; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-p") && next){
+            const TankConfig_t* preset = tank_preset(next);
+            if(!preset){
+                fprintf(stderr, "unknown preset '%s'\n", next);
+                return 2;
+            }
+            cfg = *preset;
+            i++;
+        }
+        else if(!strcmp(a, "-s") && next){ seed = (uint64_t)atoll(next); i++; }
+        else if(!strcmp(a, "--hours") && next){ hours = atof(next); i++; }
+        else if(!strcmp(a, "--fill") && next){ cfg.initial_fill = atof(next); i++; }
+        else if(!strcmp(a, "--leak") && next){ cfg.geometry.leak_diameter_m = atof(next) / 1000; i++; }
+        else if(!strcmp(a, "--dt") && next){ dt_ms = (uint32_t)atoi(next); i++; }
+        else if(!strcmp(a, "--wire")){ wire = true; }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if(dt_ms == 0 || hours <= 0){
+        usage(argv[0]);
+        return 2;
+    }
+    // The firmware samples every 60 ms and reports every 500
+    if(wire) dt_ms = FW_SENSOR_INTERVAL_MS;
+
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    static TankModel tank;
+    tank.init(cfg, seed);
+    uint16_t height_cm = tank.sensor_height_cm();
+    fprintf(stderr, "%.0f L, sensor %u cm above the floor, %.1f h at %u ms\n",
+            tank.capacity_l(), (unsigned)height_cm, hours, dt_ms);
+
+    if(!wire){
+        printf("t_ms,level_mm,surface_mm,volume_l,inflow_lpm,outflow_lpm,air_c,water_c,conductivity_us_cm,"
+               "echo_ticks,echo_kind,water_adc,distance_cm,percent,status\n");
+    }
+
+    uint64_t end_ms = (uint64_t)(hours * 3600 * 1000);
+    uint64_t next_packet_ms = FW_SEND_INTERVAL_MS;
+    uint32_t distance_cm = 0;
+    uint16_t water_adc = 0;
+    uint16_t percent = 0;
+    Status_t status = STATUS_EMPTY;
+    uint8_t alert = 0;
+    uint64_t echo_ms = 0;
+    TankSample_t s;
+
+    for(uint64_t t_ms = dt_ms; t_ms <= end_ms; t_ms += dt_ms){
+        // Packets go out on the 500 ms tick with the latest reading
+        while(wire && next_packet_ms < t_ms){
+            char line[FW_PACKET_MAX];
+            uint32_t age = next_packet_ms > echo_ms ? (uint32_t)(next_packet_ms - echo_ms) : 0;
+            size_t n = fw_format_status(line, (uint32_t)next_packet_ms, percent, water_adc, status, alert, age);
+            fwrite(line, 1, n, stdout);
+            next_packet_ms += FW_SEND_INTERVAL_MS;
+        }
+
+        tank.step(dt_ms / 1000.0, &s);
+        distance_cm = fw_echo_distance_cm(s.echo_ticks);
+        water_adc = s.water_adc;
+        echo_ms = t_ms + s.echo_ticks / 2000u;
+        percent = fw_level_percent(distance_cm, height_cm);
+        status = fw_status(percent, water_adc, &alert);
+
+        if(!wire){
+            printf("%llu,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%u,%u,%u,%u,%u,%u\n",
+                   (unsigned long long)t_ms, s.level_m * 1000, s.surface_m * 1000, s.volume_l,
+                   s.inflow_lpm, s.outflow_lpm, s.air_c, s.water_c, s.conductivity_us_cm,
+                   (unsigned)s.echo_ticks, (unsigned)s.echo_kind, (unsigned)s.water_adc,
+                   (unsigned)distance_cm, (unsigned)percent, (unsigned)status);
+        }
+    }
+    fflush(stdout);
+    return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Export readings from a column store file (tankgw -d) as CSV or JSON.
+// Output is streamed straight from the mapped blocks, so memory stays flat
+// however large the range; safe to run while the gateway is writing.
+//
+//   ./bin/tsdb_export readings.tsdb > all.csv
+//   ./bin/tsdb_export readings.tsdb -D 3 --last 86400 --json > day.json
+//
+// CSV columns match tankgw -o (rx_time_us,device,T,P,W,S,A). JSON is an
+// array of objects keyed like the client app's sensor_readings export.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "query.h"
+#include "reading.h"
+#include "sinks.h"
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s FILE [options]\n"
+        "  -D DEVICE       Only this device id (default: all)\n"
+        "  -f MS           From receive time, epoch ms (default: start)\n"
+        "  -t MS           To receive time, epoch ms, inclusive (default: end)\n"
+        "  --last SECONDS  Shorthand for -f now-SECONDS\n"
+        "  --json          JSON array instead of CSV\n",
+        argv0);
+}
+
+static void print_json(FILE* out, const Reading_t& r, bool first){
+    char when[40];
+    time_t secs = (time_t)(r.rx_time_us / 1000000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    size_t n = strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(when + n, sizeof(when) - n, ".%03uZ", (unsigned)(r.rx_time_us / 1000 % 1000));
+
+    fprintf(out, "%s\n  {\"timestamp\":\"%s\",\"device\":%u,\"arduinoUptime\":%" PRIu32
+                 ",\"percentage\":%u,\"waterQuality\":%u,\"status\":\"%s\",\"alert\":%u}",
+            first ? "" : ",", when, (unsigned)r.device_id, r.device_time_ms, (unsigned)r.percent,
+            (unsigned)r.water_adc, status_name(r.status), (unsigned)r.alert);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    uint16_t device = QUERY_ALL_DEVICES;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    bool json = false;
+
+    for(int i = 2; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-D") && next){ device = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-f") && next){ from_ms = atoll(next); i++; }
+        else if(!strcmp(a, "-t") && next){ to_ms = atoll(next); i++; }
+        else if(!strcmp(a, "--last") && next){ from_ms = (int64_t)(now_us() / 1000) - atoll(next) * 1000; i++; }
+        else if(!strcmp(a, "--json")){ json = true; }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    static BlockFile file; // Per-device index is too large for the stack
+    int rc = file.open(path);
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(-rc));
+        return 1;
+    }
+
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    RangeCursor cur(file, device, from_ms, to_ms, true);
+    Reading_t r;
+    uint64_t n = 0;
+    if(json) fputs("[", stdout);
+    while(cur.next(&r)){
+        if(json){
+            print_json(stdout, r, n == 0);
+        } else {
+            printf("%" PRIu64 ",%u,%" PRIu32 ",%u,%u,%u,%u\n", r.rx_time_us, (unsigned)r.device_id, r.device_time_ms,
+                   (unsigned)r.percent, (unsigned)r.water_adc, (unsigned)r.status, (unsigned)r.alert);
+        }
+        n++;
+    }
+    if(json) fputs(n ? "\n]\n" : "]\n", stdout);
+    fflush(stdout);
+
+    fprintf(stderr, "%" PRIu64 " readings from %u blocks", n, cur.blocks_decoded());
+    if(cur.blocks_failed()) fprintf(stderr, ", %u unreadable", cur.blocks_failed());
+    fprintf(stderr, "\n");
+    return ferror(stdout) ? 1 : 0;
+}
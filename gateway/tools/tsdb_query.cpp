@@ -0,0 +1,85 @@
+// Range statistics from a column store file (tankgw -d). Safe to run
+// while the gateway is writing it.
+//
+//   ./bin/tsdb_query readings.tsdb                   whole file, all devices
+//   ./bin/tsdb_query readings.tsdb -D 3 --last 3600  device 3, last hour
+//   ./bin/tsdb_query readings.tsdb -f 1700000000000 -t 1700003600000
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "query.h"
+#include "reading.h"
+#include "sinks.h"
+
+static void usage(const char* argv0){
+    fprintf(stderr,
+        "Usage: %s FILE [options]\n"
+        "  -D DEVICE       Only this device id (default: all)\n"
+        "  -f MS           From receive time, epoch ms (default: start)\n"
+        "  -t MS           To receive time, epoch ms, inclusive (default: end)\n"
+        "  --last SECONDS  Shorthand for -f now-SECONDS\n"
+        "  --scan          Decode every block instead of using block headers\n",
+        argv0);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || argv[1][0] == '-'){
+        usage(argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    uint16_t device = QUERY_ALL_DEVICES;
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    bool scan = false;
+
+    for(int i = 2; i < argc; i++){
+        const char* a = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if(!strcmp(a, "-D") && next){ device = (uint16_t)atoi(next); i++; }
+        else if(!strcmp(a, "-f") && next){ from_ms = atoll(next); i++; }
+        else if(!strcmp(a, "-t") && next){ to_ms = atoll(next); i++; }
+        else if(!strcmp(a, "--last") && next){ from_ms = (int64_t)(now_us() / 1000) - atoll(next) * 1000; i++; }
+        else if(!strcmp(a, "--scan")){ scan = true; }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    static BlockFile file; // Per-device index is too large for the stack
+    int rc = file.open(path);
+    if(rc < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(-rc));
+        return 1;
+    }
+
+    RangeStats_t st;
+    uint64_t t0 = now_us();
+    uint32_t failed = scan ? query_range_scan(file, device, from_ms, to_ms, &st)
+                           : query_range(file, device, from_ms, to_ms, &st);
+    uint64_t us = now_us() - t0;
+
+    printf("readings: %" PRIu64 "\n", st.count);
+    if(st.count){
+        printf("span:     %" PRId64 " .. %" PRId64 " ms (%.1f h)\n",
+               st.t_first_ms, st.t_last_ms, (st.t_last_ms - st.t_first_ms) / 3600000.0);
+        printf("level:    min %u%%  max %u%%  avg %.1f%%\n",
+               (unsigned)st.percent_min, (unsigned)st.percent_max, range_avg(st.percent_sum, st.count));
+        printf("water:    min %u  max %u  avg %.1f\n",
+               (unsigned)st.water_min, (unsigned)st.water_max, range_avg(st.water_sum, st.count));
+        for(uint8_t k = 0; k < STATUS_COUNT; k++){
+            printf("  %-12s %" PRIu64 " (%.1f%%)\n", status_name(k), st.status_count[k],
+                   100.0 * st.status_count[k] / st.count);
+        }
+        printf("alerts:   %" PRIu64 "\n", st.alert_count);
+    }
+    printf("cost:     %u blocks from headers, %u decoded, %u skipped, %u unreadable, %.3f ms\n",
+           st.blocks_summarised, st.blocks_decoded, st.blocks_skipped, failed, us / 1000.0);
+    return 0;
+}
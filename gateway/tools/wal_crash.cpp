@@ -0,0 +1,251 @@
+// Crash-injection harness for the column store's write-ahead log.
+//
+// Each round forks a writer that reopens the store (replaying the WAL),
+// resumes every simulated device where the store left off and appends
+// with one group commit per batch. The writer is SIGKILLed at a random
+// moment; half the time the unsynced tails of the live WAL segment and of
+// the store file are also cut at a random length, with garbage appended,
+// like a power cut. Blocks in the middle of the store's unsynced tail may
+// also be zeroed (never reached the disk) or scribbled on, since a power
+// cut doesn't keep write order. A copy of the files is then recovered and checked:
+// every device must read back an exact prefix of its simulated stream, at
+// least as long as the last commit the writer saw acknowledged.
+//
+//   ./bin/wal_crash [rounds=100] [devices=64] [path=/tmp/wal_crash.tsdb]
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../bench/fleet_sim.h"
+#include "column_store.h"
+#include "query.h"
+
+#define MAX_SIM_DEVICES     256
+
+// Published by the writer after each durable commit. Counters only grow,
+// so a writer killed halfway through an update, or inside the next flush,
+// still leaves valid lower bounds. The one thing a stale copy can miss is
+// a checkpoint; the harness notices the newer segment and doesn't tear.
+typedef struct {
+    volatile uint32_t wal_segment;
+    volatile uint64_t wal_synced;
+    volatile uint64_t store_synced;
+    volatile uint32_t acked[MAX_SIM_DEVICES];
+} Progress_t;
+
+static const WalConfig_t CRASH_WAL = { 0, 256 * 1024, 2 };  // Small segments: rotate and checkpoint often
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rnd(uint32_t n){
+    return n ? xorshift(&rng_state) % n : 0;
+}
+
+static void writer(const char* path, uint32_t devices, Progress_t* prog){
+    static ColumnStore store;
+    if(store.open(path, &CRASH_WAL) < 0) _exit(3);
+
+    std::vector<SimDevice_t> sims(devices);
+    for(uint32_t d = 0; d < devices; d++){
+        sim_init(&sims[d], d);
+        for(uint32_t k = 0; k < store.device_readings((uint16_t)d); k++) sim_next(&sims[d], (uint16_t)d);
+    }
+
+    uint64_t rng = (uint64_t)getpid() * 0x9E3779B97F4A7C15ULL;
+    uint32_t d = 0;
+    while(true){
+        uint32_t batch = 1 + xorshift(&rng) % 400;
+        for(uint32_t i = 0; i < batch; i++){
+            store.on_reading(sim_next(&sims[d], (uint16_t)d));
+            d = (d + 1) % devices;
+        }
+
+        store.flush();
+        prog->wal_segment = store.wal()->segment();
+        prog->wal_synced = store.wal()->synced_bytes();
+        prog->store_synced = store.synced_bytes();
+        for(uint32_t k = 0; k < devices; k++) prog->acked[k] = store.device_readings((uint16_t)k);
+    }
+}
+
+// Lose a random part of a file past `keep` and maybe leave some garbage
+static void tear(const char* path, uint64_t keep){
+    struct stat st;
+    if(stat(path, &st) < 0 || (uint64_t)st.st_size <= keep) return;
+
+    uint64_t cut = keep + rnd((uint32_t)((uint64_t)st.st_size - keep + 1));
+    if(truncate(path, (off_t)cut) < 0) return;
+    if(rnd(2)){
+        uint8_t junk[512];
+        for(uint32_t i = 0; i < sizeof(junk); i++) junk[i] = (uint8_t)rnd(256);
+        int fd = open(path, O_WRONLY | O_APPEND);
+        if(fd < 0) return;
+        if(write(fd, junk, 1 + rnd(sizeof(junk))) < 0){}
+        close(fd);
+    }
+}
+
+// Zero or scribble over a few whole blocks past `keep`, leaving the rest
+static uint32_t damage_blocks(const char* path, uint64_t keep){
+    struct stat st;
+    if(stat(path, &st) < 0) return 0;
+    uint32_t first = (uint32_t)((keep + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    uint32_t end = (uint32_t)((uint64_t)st.st_size / BLOCK_SIZE);
+    if(end <= first) return 0;
+
+    int fd = open(path, O_WRONLY);
+    if(fd < 0) return 0;
+    uint32_t damaged = 0, n = 1 + rnd(3);
+    for(uint32_t i = 0; i < n; i++){
+        uint32_t b = first + rnd(end - first - (end - first > 1)); // Keep a later block when there is one
+        uint8_t buf[BLOCK_SIZE];
+        memset(buf, 0, sizeof(buf));
+        off_t at = (off_t)b * BLOCK_SIZE;
+        size_t len = sizeof(buf);
+        if(rnd(2)){
+            // A few bytes of garbage somewhere in the block
+            len = 1 + rnd(64);
+            at += rnd(BLOCK_SIZE - (uint32_t)len);
+            for(size_t k = 0; k < len; k++) buf[k] = (uint8_t)rnd(256);
+        }
+        if(pwrite(fd, buf, len, at) == (ssize_t)len) damaged++;
+    }
+    close(fd);
+    return damaged;
+}
+
+static void wal_segment_path(char* out, size_t len, const char* path, uint32_t segment){
+    snprintf(out, len, "%s.wal/%08u.wal", path, segment);
+}
+
+static uint32_t newest_segment(const char* path){
+    std::string dir = std::string(path) + ".wal";
+    uint32_t newest = 0;
+    DIR* d = opendir(dir.c_str());
+    if(!d) return 0;
+    while(struct dirent* e = readdir(d)){
+        uint32_t n;
+        if(sscanf(e->d_name, "%8u.wal", &n) == 1 && n > newest) newest = n;
+    }
+    closedir(d);
+    return newest;
+}
+
+static bool same(const Reading_t& a, const Reading_t& b){
+    return a.rx_time_us / 1000 == b.rx_time_us / 1000 && a.device_time_ms == b.device_time_ms &&
+           a.percent == b.percent && a.water_adc == b.water_adc && a.status == b.status && a.alert == b.alert;
+}
+
+// Recover a copy of the files and check every device against the simulation
+static bool verify(const char* path, uint32_t devices, const Progress_t* prog, uint64_t* readings, uint64_t* replayed){
+    std::string copy = std::string(path) + ".check";
+    std::string cmd = "rm -rf " + copy + " " + copy + ".wal && cp " + path + " " + copy +
+                      " && cp -r " + path + ".wal " + copy + ".wal";
+    if(system(cmd.c_str()) != 0) return false;
+
+    {
+        static ColumnStore store;
+        if(store.open(copy.c_str(), &CRASH_WAL) < 0) return false;
+        *replayed = store.replayed();
+        store.close();
+    }
+
+    static BlockFile file;
+    if(file.open(copy.c_str()) < 0) return false;
+
+    bool ok = true;
+    *readings = 0;
+    for(uint32_t d = 0; d < devices && ok; d++){
+        SimDevice_t sim;
+        sim_init(&sim, d);
+        uint32_t n = 0;
+        RangeCursor cur(file, (uint16_t)d, INT64_MIN, INT64_MAX);
+        Reading_t got;
+        while(ok && cur.next(&got)){
+            if(!same(got, sim_next(&sim, (uint16_t)d))){
+                printf("  device %u: reading %u differs from the simulation\n", d, n);
+                ok = false;
+            }
+            n++;
+        }
+        if(ok && n < prog->acked[d]){
+            printf("  device %u: %u readings recovered, %u were acknowledged\n", d, n, prog->acked[d]);
+            ok = false;
+        }
+        *readings += n;
+    }
+    file.close();
+    return ok;
+}
+
+int main(int argc, char** argv){
+    uint32_t rounds = (argc > 1) ? (uint32_t)atoi(argv[1]) : 100;
+    uint32_t devices = (argc > 2) ? (uint32_t)atoi(argv[2]) : 64;
+    const char* path = (argc > 3) ? argv[3] : "/tmp/wal_crash.tsdb";
+    if(devices == 0 || devices > MAX_SIM_DEVICES) devices = MAX_SIM_DEVICES;
+
+    std::string clean = std::string("rm -rf ") + path + " " + path + ".wal " + path + ".check " + path + ".check.wal";
+    if(system(clean.c_str()) != 0) return 1;
+
+    Progress_t* prog = (Progress_t*)mmap(NULL, sizeof(Progress_t), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(prog == MAP_FAILED){
+        perror("mmap");
+        return 1;
+    }
+    memset((void*)prog, 0, sizeof(*prog));
+
+    uint32_t torn = 0, damaged = 0, failed = 0;
+    uint64_t readings = 0;
+    for(uint32_t round = 1; round <= rounds; round++){
+        pid_t pid = fork();
+        if(pid < 0){
+            perror("fork");
+            return 1;
+        }
+        if(pid == 0) writer(path, devices, prog);
+
+        usleep(5000 + rnd(60000));
+        kill(pid, SIGKILL);
+        int status;
+        waitpid(pid, &status, 0);
+        if(!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL){
+            printf("round %u: writer died on its own (status 0x%x)\n", round, status);
+            return 1;
+        }
+
+        // Power cut: only data that was never synced may go
+        bool cut = newest_segment(path) == prog->wal_segment && rnd(2);
+        if(cut){
+            char seg[300];
+            wal_segment_path(seg, sizeof(seg), path, prog->wal_segment);
+            tear(seg, prog->wal_synced);
+            tear(path, prog->store_synced);
+            if(rnd(2)) damaged += damage_blocks(path, prog->store_synced);
+            torn++;
+        }
+
+        uint64_t replayed = 0;
+        bool ok = verify(path, devices, prog, &readings, &replayed);
+        printf("round %3u: %-9s %9" PRIu64 " readings, %7" PRIu64 " replayed from the WAL %s\n", round,
+               cut ? "kill+tear" : "kill", readings, replayed, ok ? "ok" : "FAILED");
+        if(!ok) failed++;
+    }
+
+    printf("\n%u rounds (%u with torn files, %u blocks damaged), %u failed\n", rounds, torn, damaged, failed);
+    if(system(clean.c_str()) != 0) return 1;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,365 @@
+#include "telemetry.h"
+
+#include <string.h>
+
+// Eight-digits-at-a-time decoding on 64-bit little-endian hosts; AVR uses the byte loop
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && UINTPTR_MAX > 0xFFFFFFFFUL
+#define TLM_SWAR 1
+#endif
+
+// Field order is fixed by send_status_packet()
+static const uint8_t status_keys[5] = { 'T', 'P', 'W', 'S', 'A' };
+static const uint32_t status_max[5] = { 0xFFFFFFFFUL, TLM_PERCENT_MAX, TLM_ADC_MAX, TLM_STATUS_MAX, 1 };
+
+#ifdef TLM_SWAR
+// Count the leading ASCII digits (0-8) of the 8 bytes at s and return their value
+static inline uint8_t swar_digits(const uint8_t* s, uint32_t* value){
+    uint64_t chunk;
+    memcpy(&chunk, s, 8);
+
+    // Per byte: non-zero unless the byte is '0'..'9'. Carries only run
+    // towards later bytes, so the first non-digit is always found correctly.
+    uint64_t bad = ((chunk & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL)
+                 | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL);
+    bad = (((bad & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | bad) & 0x8080808080808080ULL;
+
+    uint8_t count = bad ? (uint8_t)(__builtin_ctzll(bad) >> 3) : 8;
+    if(count == 0) return 0;
+
+    // Right-align the digits (leading bytes become zeros) and combine pairwise
+    uint64_t v = chunk << ((8 - count) * 8);
+    v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    *value = (uint32_t)(((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+    return count;
+}
+#endif
+
+// Decode "<key>:<digits>" at line[*pos]. `readable` (>= len) is how many
+// bytes from `line` may be loaded, which lets the SWAR path read past the
+// end of the field. Returns 0, or the TlmError_t + 1.
+static uint8_t parse_field(const uint8_t* line, uint8_t len, size_t readable, uint8_t* pos, uint8_t key, uint32_t* value){
+    uint8_t i = *pos;
+    uint32_t v = 0;
+
+    if(i + 1 >= len || line[i] != key || line[i + 1] != ':') return TLM_ERR_SYNTAX + 1;
+    i += 2;
+    if(i >= len || (uint8_t)(line[i] - '0') > 9) return TLM_ERR_SYNTAX + 1;
+
+#ifdef TLM_SWAR
+    if(readable - i >= 8){
+        uint8_t n = swar_digits(line + i, &v);
+        if(n > len - i){
+            // Digits ran past the end of the line (only possible for the
+            // carry buffer, which is never followed by '\n'): rescan bytewise
+            v = 0;
+        } else {
+            i += n;
+            if(n < 8 || i >= len || (uint8_t)(line[i] - '0') > 9){
+                *pos = i;
+                *value = v;
+                return 0;
+            }
+        }
+    }
+#else
+    (void)readable;
+#endif
+
+    while(i < len){
+        uint8_t d = (uint8_t)(line[i] - '0');
+        if(d > 9) break;
+        if(v > 429496729UL || (v == 429496729UL && d > 5)) return TLM_ERR_RANGE + 1; // uint32_t overflow
+        v = v * 10 + d;
+        i++;
+    }
+    *pos = i;
+    *value = v;
+    return 0;
+}
+
+void tlm_parser_init(TlmParser_t* p){
+    memset(p, 0, sizeof(*p));
+}
+
+#ifdef TLM_SWAR
+// Load the 3-byte ",X:" separator (or "T:" + first digit) as an integer
+static inline uint32_t load3(const uint8_t* s){
+    uint32_t v;
+    memcpy(&v, s, 4);
+    return v & 0x00FFFFFFUL;
+}
+
+#define SEP(k)  ((uint32_t)',' | ((uint32_t)(k) << 8) | ((uint32_t)':' << 16))
+
+// Straight-line decoder for a well-formed status packet with at least 48
+// readable bytes (the longest packet plus an 8-byte digit load). Returns 0 on anything unusual; the caller then re-parses
+// with the general path, which also classifies the error.
+static uint8_t parse_status_fast(const uint8_t* line, uint8_t len, TlmStatus_t* st){
+    uint32_t t, p, w, extra;
+    uint8_t pos, n;
+
+    if(line[0] != 'T' || line[1] != ':') return 0;
+    n = swar_digits(line + 2, &t);
+    if(n == 0) return 0;
+    pos = 2 + n;
+    if(n == 8){
+        // 9-10 digit timestamps: finish the tail bytewise with an overflow check
+        while((uint8_t)(line[pos] - '0') <= 9){
+            uint8_t d = (uint8_t)(line[pos] - '0');
+            if(t > 429496729UL || (t == 429496729UL && d > 5)) return 0;
+            t = t * 10 + d;
+            if(++pos > 12) return 0;
+        }
+    }
+
+    if(load3(line + pos) != SEP('P')) return 0;
+    n = swar_digits(line + pos + 3, &p);
+    if(n == 0 || n > 3) return 0;
+    pos += 3 + n;
+
+    if(load3(line + pos) != SEP('W')) return 0;
+    n = swar_digits(line + pos + 3, &w);
+    if(n == 0 || n > 4) return 0;
+    pos += 3 + n;
+
+    if(load3(line + pos) != SEP('S')) return 0;
+    extra = (uint8_t)(line[pos + 3] - '0');
+    pos += 4;
+    if(load3(line + pos) != SEP('A')) return 0;
+    uint8_t alert = (uint8_t)(line[pos + 3] - '0');
+    pos += 4;
+
+    uint32_t age = TLM_AGE_NONE;
+    if(pos != len){
+        if(load3(line + pos) != SEP('C')) return 0;
+        n = swar_digits(line + pos + 3, &age);
+        if(n == 0 || n > 3) return 0;
+        pos += 3 + n;
+    }
+
+    if(pos != len || p > TLM_PERCENT_MAX || w > TLM_ADC_MAX || extra > TLM_STATUS_MAX || alert > 1) return 0;
+
+    st->time_ms = t;
+    st->percent = (uint16_t)p;
+    st->water_adc = (uint16_t)w;
+    st->status = (uint8_t)extra;
+    st->alert = alert;
+    st->capture_age_ms = (uint16_t)age;
+    return 1;
+}
+#endif
+
+static TlmResult_t parse_line_bounded(const uint8_t* line, uint8_t len, size_t readable, TlmLine_t* out){
+    uint8_t pos = 0;
+    uint8_t err;
+    uint32_t v;
+
+    out->length = (uint8_t)(len + 1);
+
+    // Tolerate the '\r' of a CRLF terminal
+    if(len > 0 && line[len - 1] == '\r') len--;
+
+#ifdef TLM_SWAR
+    if(readable >= 48 && parse_status_fast(line, len, &out->status)){
+        out->result = TLM_STATUS;
+        return TLM_STATUS;
+    }
+#endif
+
+    // --- Height acknowledgement: "H:100" ---
+    if(len > 0 && line[0] == 'H'){
+        err = parse_field(line, len, readable, &pos, 'H', &v);
+        if(!err && pos != len) err = TLM_ERR_SYNTAX + 1;
+        if(!err && (v < TLM_HEIGHT_MIN || v > TLM_HEIGHT_MAX)) err = TLM_ERR_RANGE + 1;
+        if(err){
+            out->result = TLM_ERROR;
+            out->error = (TlmError_t)(err - 1);
+            return TLM_ERROR;
+        }
+        out->height_cm = (uint16_t)v;
+        out->result = TLM_HEIGHT_ACK;
+        return TLM_HEIGHT_ACK;
+    }
+
+    // --- Startup: "R:2" ---
+    if(len > 0 && line[0] == 'R'){
+        err = parse_field(line, len, readable, &pos, 'R', &v);
+        if(!err && pos != len) err = TLM_ERR_SYNTAX + 1;
+        if(!err && v > TLM_RESET_MAX) err = TLM_ERR_RANGE + 1;
+        if(err){
+            out->result = TLM_ERROR;
+            out->error = (TlmError_t)(err - 1);
+            return TLM_ERROR;
+        }
+        out->reset_flags = (uint8_t)v;
+        out->result = TLM_RESET;
+        return TLM_RESET;
+    }
+
+    // --- Status packet ---
+    uint32_t fields[5];
+    uint8_t range_error = 0;
+
+    for(uint8_t f = 0; f < 5; f++){
+        if(f > 0){
+            if(pos >= len || line[pos] != ','){
+                out->result = TLM_ERROR;
+                out->error = TLM_ERR_SYNTAX;
+                return TLM_ERROR;
+            }
+            pos++;
+        }
+        err = parse_field(line, len, readable, &pos, status_keys[f], &fields[f]);
+        if(err){
+            out->result = TLM_ERROR;
+            out->error = (TlmError_t)(err - 1);
+            return TLM_ERROR;
+        }
+        if(fields[f] > status_max[f]) range_error = 1;
+    }
+
+    // Optional capture age
+    uint32_t age = TLM_AGE_NONE;
+    if(pos < len && line[pos] == ','){
+        pos++;
+        err = parse_field(line, len, readable, &pos, 'C', &age);
+        if(err){
+            out->result = TLM_ERROR;
+            out->error = (TlmError_t)(err - 1);
+            return TLM_ERROR;
+        }
+        if(age > TLM_AGE_MAX) range_error = 1;
+    }
+
+    // Syntax problems take precedence over range problems
+    if(pos != len || range_error){
+        out->result = TLM_ERROR;
+        out->error = (pos != len) ? TLM_ERR_SYNTAX : TLM_ERR_RANGE;
+        return TLM_ERROR;
+    }
+
+    out->status.time_ms = fields[0];
+    out->status.percent = (uint16_t)fields[1];
+    out->status.water_adc = (uint16_t)fields[2];
+    out->status.status = (uint8_t)fields[3];
+    out->status.alert = (uint8_t)fields[4];
+    out->status.capture_age_ms = (uint16_t)age;
+    out->result = TLM_STATUS;
+    return TLM_STATUS;
+}
+
+TlmResult_t tlm_parse_line(const uint8_t* line, uint8_t len, TlmLine_t* out){
+    return parse_line_bounded(line, len, len, out);
+}
+
+// Decode a complete line and update the parser's counters. Blank lines
+// (e.g. the '\n' of "\r\n\n") are skipped and return TLM_NONE.
+static TlmResult_t count_line(TlmParser_t* p, const uint8_t* line, size_t len, size_t readable, TlmLine_t* out){
+    out->result = TLM_NONE;
+    if(len == 0 || (len == 1 && line[0] == '\r')) return TLM_NONE;
+
+    switch(parse_line_bounded(line, (uint8_t)len, readable, out)){
+        case TLM_STATUS:     p->status_lines++; break;
+        case TLM_HEIGHT_ACK: p->ack_lines++; break;
+        case TLM_RESET:      p->reset_lines++; break;
+        case TLM_ERROR:      p->errors[out->error]++; break;
+        default: break;
+    }
+    return out->result;
+}
+
+size_t tlm_feed(TlmParser_t* p, const uint8_t* data, size_t len, TlmLine_t* out){
+    const uint8_t* nl = (const uint8_t*)memchr(data, '\n', len);
+    out->result = TLM_NONE;
+
+    // --- No line end yet: stash the fragment for the next read ---
+    if(!nl){
+        if(!p->overrun){
+            if(p->carry_len + len <= TLM_LINE_MAX){
+                memcpy(p->carry + p->carry_len, data, len);
+                p->carry_len += (uint8_t)len;
+            } else {
+                p->overrun = 1;
+                p->carry_len = 0;
+            }
+        }
+        return len;
+    }
+
+    size_t seg = (size_t)(nl - data);
+    size_t consumed = seg + 1;
+    const uint8_t* line = data;
+    size_t line_len = seg;
+
+    if(p->overrun || p->carry_len + seg > TLM_LINE_MAX){
+        p->overrun = 0;
+        p->carry_len = 0;
+        p->errors[TLM_ERR_OVERLONG]++;
+        out->result = TLM_ERROR;
+        out->error = TLM_ERR_OVERLONG;
+        return consumed;
+    }
+
+    // Line started in a previous read: complete it in the carry buffer
+    if(p->carry_len > 0){
+        memcpy(p->carry + p->carry_len, data, seg);
+        line = p->carry;
+        line_len = p->carry_len + seg;
+        p->carry_len = 0;
+    }
+
+    // In place: the '\n' (and whatever follows) is readable; carried: only the line
+    count_line(p, line, line_len, (line == data) ? len : line_len, out);
+    return consumed;
+}
+
+size_t tlm_feed_batch(TlmParser_t* p, const uint8_t* data, size_t len, TlmLine_t* lines, size_t max_lines, size_t* n_lines){
+    uint32_t nl[TLM_SCAN_BATCH];
+    size_t pos = 0;
+    size_t n = 0;
+
+    while(pos < len && n < max_lines){
+        size_t want = max_lines - n;
+        if(want > TLM_SCAN_BATCH) want = TLM_SCAN_BATCH;
+
+        size_t base = pos;
+        size_t found = tlm_scan_newlines(data + base, len - base, nl, want);
+        if(found == 0){
+            pos += tlm_feed(p, data + pos, len - pos, &lines[n]); // Stash the trailing fragment
+            break;
+        }
+
+        for(size_t k = 0; k < found; k++){
+            size_t end = base + nl[k];
+
+            // A line that began in an earlier buffer goes through the carry path
+            if(p->carry_len > 0 || p->overrun){
+                pos += tlm_feed(p, data + pos, len - pos, &lines[n]);
+                if(lines[n].result != TLM_NONE) n++;
+                continue;
+            }
+
+            size_t line_len = end - pos;
+            if(line_len > TLM_LINE_MAX){
+                p->errors[TLM_ERR_OVERLONG]++;
+                lines[n].result = TLM_ERROR;
+                lines[n].error = TLM_ERR_OVERLONG;
+                n++;
+            }
+            else if(count_line(p, data + pos, line_len, len - pos, &lines[n]) != TLM_NONE){
+                n++;
+            }
+            pos = end + 1;
+        }
+    }
+
+    *n_lines = n;
+    return pos;
+}
+
+uint32_t tlm_error_total(const TlmParser_t* p){
+    uint32_t total = 0;
+    for(uint8_t i = 0; i < TLM_ERR_COUNT; i++) total += p->errors[i];
+    return total;
+}
@@ -0,0 +1,112 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+// Streaming parser for the firmware's UART1 protocol:
+//   T:12345,P:50,W:123,S:2,A:1,C:42\n (send_status_packet; C is optional,
+//                                    older firmware stops after A)
+//   H:100\n                        (height command acknowledgement)
+//   R:2\n                          (send_reset_packet, once after startup)
+//
+// No heap, no libc number parsing. Complete lines are decoded in place
+// from the caller's buffer; only a line split across two reads is copied
+// into the parser's small carry buffer. Builds for host and AVR.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LIMITS (must match what src/main.cpp can send)
+#define TLM_LINE_MAX        40      // Longest valid line is 39 bytes
+#define TLM_PERCENT_MAX     100
+#define TLM_ADC_MAX         1023
+#define TLM_STATUS_MAX      3       // STATUS_CONTAMINATED
+#define TLM_AGE_MAX         999     // CAPTURE_AGE_MAX_MS
+#define TLM_AGE_NONE        0xFFFF  // No C field in the packet
+#define TLM_UART_BAUD       9600    // The board's UART1, whatever link sits behind it
+#define TLM_RESET_MAX       0x1F    // MCUSR: PORF, EXTRF, BORF, WDRF, JTRF
+#define TLM_HEIGHT_MIN      1
+#define TLM_HEIGHT_MAX      499
+#define TLM_SCAN_BATCH      64      // Newline offsets gathered per scan in tlm_feed_batch
+
+typedef enum {
+    TLM_NONE = 0,       // Input exhausted before the end of a line
+    TLM_STATUS,         // Status packet decoded into TlmLine_t.status
+    TLM_HEIGHT_ACK,     // "H:" acknowledgement decoded into TlmLine_t.height_cm
+    TLM_RESET,          // "R:" startup line decoded into TlmLine_t.reset_flags
+    TLM_ERROR           // Malformed line, reason in TlmLine_t.error
+} TlmResult_t;
+
+typedef enum {
+    TLM_ERR_SYNTAX = 0, // Unexpected byte, missing field, trailing data
+    TLM_ERR_RANGE,      // Well formed but outside the firmware's value range
+    TLM_ERR_OVERLONG,   // No '\n' within TLM_LINE_MAX bytes
+    TLM_ERR_COUNT
+} TlmError_t;
+
+typedef struct {
+    uint32_t time_ms;   // T
+    uint16_t percent;   // P
+    uint16_t water_adc; // W
+    uint8_t  status;    // S
+    uint8_t  alert;     // A
+    uint16_t capture_age_ms; // C = echo capture to T, or TLM_AGE_NONE
+} TlmStatus_t;
+
+typedef struct {
+    TlmResult_t result;
+    TlmError_t  error;
+    TlmStatus_t status;
+    uint16_t    height_cm;
+    uint8_t     reset_flags;
+    uint8_t     length;     // Bytes on the wire, including the '\n'
+} TlmLine_t;
+
+typedef struct {
+    // Partial line carried over between reads
+    uint8_t  carry[TLM_LINE_MAX];
+    uint8_t  carry_len;
+    uint8_t  overrun;   // Discarding until the next '\n'
+
+    // Counters
+    uint32_t status_lines;
+    uint32_t ack_lines;
+    uint32_t reset_lines;
+    uint32_t errors[TLM_ERR_COUNT];
+} TlmParser_t;
+
+void tlm_parser_init(TlmParser_t* p);
+
+// Decode one complete line (without '\n'; a trailing '\r' is accepted).
+// Stateless; does not touch any counters.
+TlmResult_t tlm_parse_line(const uint8_t* line, uint8_t len, TlmLine_t* out);
+
+// Consume bytes until one line completes or the input runs out. Returns
+// the number of bytes consumed; out->result is TLM_NONE if no line
+// completed. Call repeatedly until the whole buffer is consumed:
+//
+//   while(len){ size_t n = tlm_feed(&p, data, len, &line); data += n; len -= n; ... }
+size_t tlm_feed(TlmParser_t* p, const uint8_t* data, size_t len, TlmLine_t* out);
+
+// Whole-buffer variant for hosts ingesting many streams: newlines are
+// located with tlm_scan_newlines() and every complete line is decoded into
+// `lines` (at most `max_lines`; blank lines produce no entry). Returns the
+// number of bytes consumed, which is `len` unless `lines` filled up.
+size_t tlm_feed_batch(TlmParser_t* p, const uint8_t* data, size_t len, TlmLine_t* lines, size_t max_lines, size_t* n_lines);
+
+uint32_t tlm_error_total(const TlmParser_t* p);
+
+// NEWLINE SCANNING (telemetry_scan.cpp)
+typedef enum {
+    TLM_SCAN_SCALAR = 0,
+    TLM_SCAN_SSE2,      // x86 only
+    TLM_SCAN_AVX2       // x86 only, selected at runtime when the CPU has it
+} TlmScanImpl_t;
+
+// Store the offsets of up to `max` '\n' bytes in `offsets`; returns how many
+size_t tlm_scan_newlines(const uint8_t* data, size_t len, uint32_t* offsets, size_t max);
+
+// Same, with an explicit implementation (falls back to scalar if unavailable)
+size_t tlm_scan_newlines_with(TlmScanImpl_t impl, const uint8_t* data, size_t len, uint32_t* offsets, size_t max);
+
+TlmScanImpl_t tlm_scan_best(void);
+
+#endif
@@ -0,0 +1,91 @@
+#include "telemetry.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define TLM_X86 1
+#include <immintrin.h>
+#endif
+
+// SCALAR (AVR, non-x86 hosts, buffer tails)
+static size_t scan_scalar(const uint8_t* data, size_t len, size_t start, uint32_t* offsets, size_t max, size_t n){
+    const uint8_t* p = data + start;
+    const uint8_t* end = data + len;
+
+    while(n < max && p < end){
+        const uint8_t* nl = (const uint8_t*)memchr(p, '\n', (size_t)(end - p));
+        if(!nl) break;
+        offsets[n++] = (uint32_t)(nl - data);
+        p = nl + 1;
+    }
+    return n;
+}
+
+#ifdef TLM_X86
+// Emit one offset per set bit of a compare mask
+#define EMIT_MASK(mask, base)                                   \
+    while(mask){                                                \
+        if(n == max) return n;                                  \
+        offsets[n++] = (uint32_t)((base) + __builtin_ctz(mask));\
+        mask &= mask - 1;                                       \
+    }
+
+static size_t scan_sse2(const uint8_t* data, size_t len, uint32_t* offsets, size_t max){
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    size_t n = 0;
+
+    for(; i + 16 <= len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        EMIT_MASK(mask, i);
+    }
+    return scan_scalar(data, len, i, offsets, max, n);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t* data, size_t len, uint32_t* offsets, size_t max){
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    size_t n = 0;
+
+    // Two vectors per iteration; most 64-byte blocks hold one or two lines
+    for(; i + 64 <= len; i += 64){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 32));
+        uint32_t ma = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+        uint32_t mb = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl));
+        EMIT_MASK(ma, i);
+        EMIT_MASK(mb, i + 32);
+    }
+    for(; i + 32 <= len; i += 32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        uint32_t ma = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+        EMIT_MASK(ma, i);
+    }
+    return scan_scalar(data, len, i, offsets, max, n);
+}
+#endif
+
+TlmScanImpl_t tlm_scan_best(void){
+#ifdef TLM_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");     // Initialised once, thread-safe
+    return avx2 ? TLM_SCAN_AVX2 : TLM_SCAN_SSE2;
+#else
+    return TLM_SCAN_SCALAR;
+#endif
+}
+
+size_t tlm_scan_newlines_with(TlmScanImpl_t impl, const uint8_t* data, size_t len, uint32_t* offsets, size_t max){
+#ifdef TLM_X86
+    if(impl == TLM_SCAN_AVX2 && tlm_scan_best() == TLM_SCAN_AVX2) return scan_avx2(data, len, offsets, max);
+    if(impl != TLM_SCAN_SCALAR) return scan_sse2(data, len, offsets, max);
+#else
+    (void)impl;
+#endif
+    return scan_scalar(data, len, 0, offsets, max, 0);
+}
+
+size_t tlm_scan_newlines(const uint8_t* data, size_t len, uint32_t* offsets, size_t max){
+    return tlm_scan_newlines_with(tlm_scan_best(), data, len, offsets, max);
+}
@@ -22,6 +22,7 @@
 
 #define BT_SEND_INTERVAL_MS         500     // Bluetooth update rate
 #define SENSOR_READ_INTERVAL_MS     60      // Ultrasonic measurement rate
+#define CAPTURE_AGE_MAX_MS          999     // C field saturates here (sensor silent)
 
 //  GLOBAL VARIABLES
 volatile uint16_t container_height_cm = 10;  // Default: 10cm
@@ -30,13 +31,14 @@ volatile uint16_t container_height_cm = 10;  // Default: 10cm
 volatile uint32_t distance_cm = 0;
 volatile uint16_t pulse_start = 0;
 volatile uint8_t edge_count = 0;
+volatile uint32_t echo_time_ms = 0;     // system_time_ms when the last echo ended
 
 // UART RX buffer for height commands
 volatile char rx_buffer[8];
 volatile uint8_t rx_index = 0;
 volatile uint8_t new_command = 0;
 
-// Timestamp counter (milliseconds since startup)
+// Timestamp counter (milliseconds since startup, Timer1 tick)
 volatile uint32_t system_time_ms = 0;
 
 // System status
@@ -50,7 +52,9 @@ typedef enum {
 
 // FUNCTION PROTOTYPES
 void init_adc(void);
+void init_timer1_clock(void);
 void init_timer5_capture(void);
+uint32_t time_now_ms(void);
 void init_uart(void);
 
 void trigger_ultrasonic(void);
@@ -63,10 +67,15 @@ void uart_send_char(char c);
 void uart_send_string(const char* str);
 void uart_send_uint(uint16_t num);
 void uart_send_ulong(uint32_t num);
-void send_status_packet(uint32_t timestamp, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert);
+void send_status_packet(uint32_t timestamp, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert, uint16_t capture_age_ms);
+void send_reset_packet(uint8_t reset_flags);
 
 // MAIN PROGRAM
 int main(void){
+    // Why we (re)started: PORF, EXTRF, BORF, WDRF, JTRF (0 if the bootloader cleared it)
+    uint8_t reset_flags = MCUSR;
+    MCUSR = 0;
+
     // LEDs and Buzzer as outputs (Active-LOW, so set HIGH = OFF)
     DDRE |= (1 << RED_LED) | (1 << YELLOW_LED) | (1 << BUZZER);
     DDRG |= (1 << BLUE_LED);
@@ -84,11 +93,14 @@ int main(void){
     DDRF &= ~(1 << WATER_PIN);
     
     init_adc();
+    init_timer1_clock();
     init_timer5_capture();
     init_uart();
     
     sei(); // Enable interrupts
     _delay_ms(100); // Stabilization
+
+    send_reset_packet(reset_flags);
     
     uint8_t sensor_cycle = 0;
     uint16_t bt_timer = 0;
@@ -180,13 +192,22 @@ int main(void){
         // --- Send Bluetooth update ---
         bt_timer++;
         if(bt_timer >= BT_SEND_INTERVAL_MS){
-            send_status_packet(system_time_ms, level_percent, water_adc, status, alert);
+            // Age of the echo this level came from, for latency tracking
+            // Both read together, so an echo ending in between can't
+            // put echo_time_ms ahead of now
+            uint8_t sreg = SREG;
+            cli();
+            uint32_t now = system_time_ms;
+            uint32_t echo_age = now - echo_time_ms;
+            SREG = sreg;
+            if(echo_age > CAPTURE_AGE_MAX_MS) echo_age = CAPTURE_AGE_MAX_MS;
+
+            send_status_packet(now, level_percent, water_adc, status, alert, (uint16_t)echo_age);
             bt_timer = 0;
         }
         
         // --- Timing ---
         _delay_ms(1); // 1ms loop cycle
-        system_time_ms++; // Increment timestamp
         
         sensor_cycle++;
         if(sensor_cycle >= SENSOR_READ_INTERVAL_MS) sensor_cycle = 0;
@@ -200,6 +221,23 @@ void init_adc(void){
     ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); // Prescaler 128
 }
 
+// 1 kHz tick for system_time_ms, so timestamps keep running while the
+// loop is blocked (a status packet keeps it on the UART for ~30 ms)
+void init_timer1_clock(void){
+    TCCR1A = 0;
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // CTC, prescaler 64
+    OCR1A = 249; // 16MHz / 64 / 250 = 1kHz
+    TIMSK1 = (1 << OCIE1A);
+}
+
+uint32_t time_now_ms(void){
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t t = system_time_ms;
+    SREG = sreg;
+    return t;
+}
+
 void init_timer5_capture(void){
     TCCR5A = 0;
     TCCR5B = (1 << CS51); // Prescaler 8 (0.5us per tick at 16MHz)
@@ -293,9 +331,10 @@ void uart_send_ulong(uint32_t num){
     }
 }
 
-void send_status_packet(uint32_t timestamp, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert){
-    // Format: T:12345,P:50,W:123,S:2,A:1\n
-    // T = timestamp (ms), P = percentage, W = water ADC, S = status code, A = alert
+void send_status_packet(uint32_t timestamp, uint16_t percent, uint16_t water_adc, Status_t status, uint8_t alert, uint16_t capture_age_ms){
+    // Format: T:12345,P:50,W:123,S:2,A:1,C:42\n
+    // T = timestamp (ms), P = percentage, W = water ADC, S = status code, A = alert,
+    // C = ms between the echo capture and T
     uart_send_string("T:");
     uart_send_ulong(timestamp);
     uart_send_string(",P:");
@@ -306,10 +345,23 @@ void send_status_packet(uint32_t timestamp, uint16_t percent, uint16_t water_adc
     uart_send_char('0' + status);
     uart_send_string(",A:");
     uart_send_char('0' + alert);
+    uart_send_string(",C:");
+    uart_send_uint(capture_age_ms);
+    uart_send_char('\n');
+}
+
+void send_reset_packet(uint8_t reset_flags){
+    // Format: R:2\n, once after startup. R = MCUSR reset flags
+    uart_send_string("R:");
+    uart_send_uint(reset_flags);
     uart_send_char('\n');
 }
 
 //  NTERRUPT HANDLERS
+ISR(TIMER1_COMPA_vect){
+    system_time_ms++;
+}
+
 ISR(TIMER5_CAPT_vect){
     if(edge_count == 0){
         pulse_start = ICR5;
@@ -334,6 +386,7 @@ ISR(TIMER5_CAPT_vect){
             distance_cm = 0;
         }
         
+        echo_time_ms = system_time_ms; // Interrupts are off in here
         edge_count = 0;
         TCCR5B |= (1 << ICES5); // Rising edge next
     }